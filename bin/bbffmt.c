@@ -9,7 +9,10 @@ void write_c(ccv_bbf_classifier_cascade_t* cascade)
 		   "	ccv_bbf_classifier_cascade_t* cascade = (ccv_bbf_classifier_cascade_t*)malloc(sizeof(ccv_bbf_classifier_cascade_t));\n"
 		   "	cascade->count = %d;\n"
 		   "	cascade->size = ccv_size(%d, %d);\n"
-		   "	cascade->stage_classifier = (ccv_bbf_stage_classifier_t*)malloc(cascade->count * sizeof(ccv_bbf_stage_classifier_t));\n",
+		   "	cascade->stage_classifier = (ccv_bbf_stage_classifier_t*)malloc(cascade->count * sizeof(ccv_bbf_stage_classifier_t));\n"
+		   "	cascade->map = 0;\n"
+		   "	cascade->map_size = 0;\n"
+		   "	cascade->compiled = 0;\n",
 			cascade->count, cascade->size.width, cascade->size.height);
 	int i, j, k;
 	for (i = 0; i < cascade->count; i++)
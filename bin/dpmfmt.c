@@ -0,0 +1,25 @@
+#include "ccv.h"
+#include <string.h>
+
+int main(int argc, char** argv)
+{
+	assert(argc >= 3);
+	ccv_dpm_mixture_model_t* model = ccv_load_dpm_mixture_model(argv[1]);
+	if (!model)
+	{
+		fprintf(stderr, "cannot load the model %s\n", argv[1]);
+		return -1;
+	}
+	if (strcmp(argv[2], "bin") == 0)
+	{
+		assert(argc >= 4);
+		if (ccv_dpm_mixture_model_write_binary(model, argv[3]) != 0)
+		{
+			fprintf(stderr, "cannot write the binary model to %s\n", argv[3]);
+			ccv_dpm_mixture_model_free(model);
+			return -1;
+		}
+	}
+	ccv_dpm_mixture_model_free(model);
+	return 0;
+}
@@ -16,14 +16,20 @@
 #include <math.h>
 #ifdef HAVE_SSE2
 #include <xmmintrin.h>
+#include <emmintrin.h>
 #endif
 #include <assert.h>
 #include <alloca.h>
 
 #define CCV_PI (3.141592653589793)
-#define ccmalloc malloc
-#define ccrealloc realloc
-#define ccfree free
+/* the memory of ccv goes through these, they are the system allocator, except within ccv_arena_begin / ccv_arena_end
+ * (see ccv_memory.c) of the calling thread */
+void* ccv_malloc(size_t size);
+void* ccv_realloc(void* ptr, size_t size);
+void ccv_free(void* ptr);
+#define ccmalloc ccv_malloc
+#define ccrealloc ccv_realloc
+#define ccfree ccv_free
 
 enum {
 	CCV_8U  = 0x0100,
@@ -60,8 +66,11 @@ enum {
 	CCV_REUSABLE      = 0x40000000, // matrix can be recycled
 	CCV_UNMANAGED     = 0x20000000, // matrix is allocated by user, therefore, cannot be freed by ccv_matrix_free/ccv_matrix_free_immediately
 	CCV_NO_DATA_ALLOC = 0x10000000, // matrix is allocated as header only, but with no data section, therefore, you have to free the data section separately
+	CCV_ALIGNED       = 0x08000000, // the data and every row start at a CCV_ALIGNMENT bytes boundary, thus, aligned loads / stores are safe
 };
 
+#define CCV_ALIGNMENT (64)
+
 typedef union {
 	unsigned char* u8;
 	int* i32;
@@ -143,7 +152,6 @@ typedef union {
 	struct {
 		uint64_t bitmap;
 		uint64_t set;
-		uint64_t age;
 	} branch;
 	struct {
 		uint64_t sign;
@@ -152,6 +160,26 @@ typedef union {
 	} terminal;
 } ccv_cache_index_t;
 
+typedef struct {
+	uint64_t sign;
+	uint32_t age;
+} ccv_cache_recency_t;
+
+#define CCV_CACHE_STATS_BINS (32)
+
+typedef struct {
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t puts;
+	uint64_t evictions;
+	uint64_t evicted_bytes;
+	/* histograms in power of 2 bins, bin i counts [2^i, 2^(i + 1)), the age is counted in puts since the object was
+	 * put into (or last touched in) the cache */
+	uint64_t size[CCV_CACHE_STATS_BINS]; // size of the objects put into the cache
+	uint64_t hit_age[CCV_CACHE_STATS_BINS]; // age of the objects when they are found
+	uint64_t eviction_age[CCV_CACHE_STATS_BINS]; // age of the objects when they are evicted
+} ccv_cache_stats_t;
+
 typedef struct {
 	ccv_cache_index_t origin;
 	uint32_t rnum;
@@ -159,6 +187,12 @@ typedef struct {
 	size_t up;
 	size_t size;
 	ccv_cache_index_free_f ffree[16];
+	ccv_cache_stats_t stats;
+	/* the ring of signatures in the order they are put, the front is the one to evict */
+	ccv_cache_recency_t* recency;
+	uint32_t recency_head;
+	uint32_t recency_count;
+	uint32_t recency_size;
 } ccv_cache_t;
 
 /* I made it as generic as possible */
@@ -198,7 +232,9 @@ typedef struct {
 #define ccv_max(a, b) (((a) > (b)) ? (a) : (b))
 
 /* matrix memory operations ccv_memory.c */
-#define ccv_compute_dense_matrix_size(rows, cols, type) (sizeof(ccv_dense_matrix_t) + (((cols) * CCV_GET_DATA_TYPE_SIZE(type) * CCV_GET_CHANNEL(type) + 3) & -4) * (rows))
+#define ccv_compute_dense_matrix_step(cols, type) (((type) & CCV_ALIGNED) ? (((cols) * CCV_GET_DATA_TYPE_SIZE(type) * CCV_GET_CHANNEL(type) + CCV_ALIGNMENT - 1) & -CCV_ALIGNMENT) : (((cols) * CCV_GET_DATA_TYPE_SIZE(type) * CCV_GET_CHANNEL(type) + 3) & -4))
+/* an aligned matrix has room to move its data up to the next CCV_ALIGNMENT bytes boundary after the header */
+#define ccv_compute_dense_matrix_size(rows, cols, type) (sizeof(ccv_dense_matrix_t) + (((type) & CCV_ALIGNED) ? CCV_ALIGNMENT - 1 : 0) + ccv_compute_dense_matrix_step(cols, type) * (rows))
 ccv_dense_matrix_t* __attribute__((warn_unused_result)) ccv_dense_matrix_renew(ccv_dense_matrix_t* x, int rows, int cols, int types, int prefer_type, uint64_t sig);
 ccv_dense_matrix_t* __attribute__((warn_unused_result)) ccv_dense_matrix_new(int rows, int cols, int type, void* data, uint64_t sig);
 ccv_dense_matrix_t ccv_dense_matrix(int rows, int cols, int type, void* data, uint64_t sig);
@@ -208,7 +244,13 @@ ccv_sparse_matrix_t* __attribute__((warn_unused_result)) ccv_sparse_matrix_new(i
 void ccv_matrix_free_immediately(ccv_matrix_t* mat);
 void ccv_matrix_free(ccv_matrix_t* mat);
 
+enum {
+	CCV_SIGNATURE_SHA1   = 0, // the first 64 bits of SHA-1 (default)
+	CCV_SIGNATURE_XXHASH = 1, // xxHash64, much faster, not cryptographic
+};
+
 uint64_t ccv_cache_generate_signature(const char* msg, int len, uint64_t sig_start, ...);
+void ccv_set_signature_hash(int hash);
 
 #define CCV_DEFAULT_CACHE_SIZE (1024 * 1024 * 64)
 
@@ -216,12 +258,33 @@ void ccv_drain_cache(void);
 void ccv_disable_cache(void);
 void ccv_enable_default_cache(void);
 void ccv_enable_cache(size_t size);
-
+/* the shared cache is process-wide, enable and disable it when no other thread uses ccv, ccv_disable_cache only
+ * disables the cache of the calling thread */
+void ccv_enable_shared_cache(size_t size);
+void ccv_disable_shared_cache(void);
+void ccv_cache_stats(ccv_cache_stats_t* stats, int aggregate);
+/* everything ccmalloc'ed by the calling thread between ccv_arena_begin and ccv_arena_end is released by ccv_arena_end,
+ * including what the calls in between returned (such as the array of the detected objects), thus, copy out what
+ * you need first, and don't let objects that live longer (a ccv_bbf_detector_t, a ccv_pyramid_t) allocate within */
+void ccv_arena_begin(void);
+void ccv_arena_end(void);
+
+/* parallel execution ccv_parallel.c */
+/* the per-pixel kernels (ccv_sobel, ccv_blur, ccv_gradient, ccv_hog, ccv_canny and ccv_color_transform) split
+ * their output rows into bands that a pool of n threads (the calling one included) runs, n <= 0 is the number of
+ * the processors online, 1 (the default) runs everything on the calling thread, the result doesn't depend on n,
+ * the detectors (ccv_bbf_detect_objects, ccv_dpm_detect_objects) and the bbf training scan on the same pool,
+ * ccv_set_num_threads waits for the job on the pool to finish, thus, it cannot be called from within a band
+ * (it asserts, or returns without a change when compiled with NDEBUG) */
+void ccv_set_num_threads(int n);
+int ccv_get_num_threads(void);
+
+/* the rows are step bytes apart, which is more than cols * channels * size for CCV_ALIGNED */
 #define ccv_get_dense_matrix_cell_by(type, x, row, col, ch) \
-	(((type) & CCV_32S) ? (void*)((x)->data.i32 + ((row) * (x)->cols + (col)) * CCV_GET_CHANNEL(type) + (ch)) : \
-	(((type) & CCV_32F) ? (void*)((x)->data.f32+ ((row) * (x)->cols + (col)) * CCV_GET_CHANNEL(type) + (ch)) : \
-	(((type) & CCV_64S) ? (void*)((x)->data.i64+ ((row) * (x)->cols + (col)) * CCV_GET_CHANNEL(type) + (ch)) : \
-	(((type) & CCV_64F) ? (void*)((x)->data.f64 + ((row) * (x)->cols + (col)) * CCV_GET_CHANNEL(type) + (ch)) : \
+	(((type) & CCV_32S) ? (void*)((int*)((x)->data.u8 + (row) * (x)->step) + (col) * CCV_GET_CHANNEL(type) + (ch)) : \
+	(((type) & CCV_32F) ? (void*)((float*)((x)->data.u8 + (row) * (x)->step) + (col) * CCV_GET_CHANNEL(type) + (ch)) : \
+	(((type) & CCV_64S) ? (void*)((int64_t*)((x)->data.u8 + (row) * (x)->step) + (col) * CCV_GET_CHANNEL(type) + (ch)) : \
+	(((type) & CCV_64F) ? (void*)((double*)((x)->data.u8 + (row) * (x)->step) + (col) * CCV_GET_CHANNEL(type) + (ch)) : \
 	(void*)((x)->data.u8 + (row) * (x)->step + (col) * CCV_GET_CHANNEL(type) + (ch))))))
 
 #define ccv_get_dense_matrix_cell(x, row, col, ch) ccv_get_dense_matrix_cell_by((x)->type, x, row, col, ch)
@@ -229,10 +292,10 @@ void ccv_enable_cache(size_t size);
 /* this is for simplicity in code, I am sick of x->data.f64[i * x->cols + j] stuff, this is clearer, and compiler
  * can optimize away the if structures */
 #define ccv_get_dense_matrix_cell_value_by(type, x, row, col, ch) \
-	(((type) & CCV_32S) ? (x)->data.i32[((row) * (x)->cols + (col)) * CCV_GET_CHANNEL(type) + (ch)] : \
-	(((type) & CCV_32F) ? (x)->data.f32[((row) * (x)->cols + (col)) * CCV_GET_CHANNEL(type) + (ch)] : \
-	(((type) & CCV_64S) ? (x)->data.i64[((row) * (x)->cols + (col)) * CCV_GET_CHANNEL(type) + (ch)] : \
-	(((type) & CCV_64F) ? (x)->data.f64[((row) * (x)->cols + (col)) * CCV_GET_CHANNEL(type) + (ch)] : \
+	(((type) & CCV_32S) ? ((int*)((x)->data.u8 + (row) * (x)->step))[(col) * CCV_GET_CHANNEL(type) + (ch)] : \
+	(((type) & CCV_32F) ? ((float*)((x)->data.u8 + (row) * (x)->step))[(col) * CCV_GET_CHANNEL(type) + (ch)] : \
+	(((type) & CCV_64S) ? ((int64_t*)((x)->data.u8 + (row) * (x)->step))[(col) * CCV_GET_CHANNEL(type) + (ch)] : \
+	(((type) & CCV_64F) ? ((double*)((x)->data.u8 + (row) * (x)->step))[(col) * CCV_GET_CHANNEL(type) + (ch)] : \
 	(x)->data.u8[(row) * (x)->step + (col) * CCV_GET_CHANNEL(type) + (ch)]))))
 
 #define ccv_get_dense_matrix_cell_value(x, row, col, ch) ccv_get_dense_matrix_cell_value_by((x)->type, x, row, col, ch)
@@ -426,6 +489,10 @@ ccv_array_t* __attribute__((warn_unused_result)) ccv_array_new(int rsize, int rn
 void ccv_array_push(ccv_array_t* array, void* r);
 typedef int(*ccv_array_group_f)(const void*, const void*, void*);
 int ccv_array_group(ccv_array_t* array, ccv_array_t** index, ccv_array_group_f gfunc, void* data);
+/* ccv_array_group for the arrays of elements that begin with a ccv_rect_t (ccv_comp_t, ccv_root_comp_t), where gfunc(a, b, data)
+ * can only be true if the origin of b is at most (int)(a->rect.width * reach + 0.5) away from the one of a along x and y. Only these
+ * pairs are tested (found in bands of rows sorted by x), thus, it takes near-linear time and makes the same groups */
+int ccv_array_group_rect(ccv_array_t* array, ccv_array_t** index, ccv_array_group_f gfunc, void* data, double reach);
 void ccv_make_array_immutable(ccv_array_t* array);
 void ccv_make_array_mutable(ccv_array_t* array);
 void ccv_array_zero(ccv_array_t* array);
@@ -483,6 +550,9 @@ typedef struct {
 typedef int(*ccv_minimize_f)(const ccv_dense_matrix_t* x, double* f, ccv_dense_matrix_t* df, void*);
 void ccv_minimize(ccv_dense_matrix_t* x, int length, double red, ccv_minimize_f func, ccv_minimize_param_t params, void* data);
 
+/* d(y, x) = sum b(i, j) * a(y + i - (b->rows - 1) / 2, x + j - (b->cols - 1) / 2), d is of the size of a, and the pixels of a
+ * out of the image are 0 (CCV_NO_PADDING, CCV_PADDING_ZERO), the nearest edge pixel (CCV_PADDING_EXTEND) or the reflection
+ * with the edge repeated (CCV_PADDING_MIRROR), it is the same whichever of the direct, separable or fft way is taken */
 void ccv_filter(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_dense_matrix_t** d, int type, int padding_pattern);
 typedef double(*ccv_filter_kernel_f)(double x, double y, void*);
 void ccv_filter_kernel(ccv_dense_matrix_t* x, ccv_filter_kernel_f func, void* data);
@@ -505,6 +575,7 @@ enum {
 
 void ccv_flip(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int btype, int type);
 void ccv_blur(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, double sigma);
+void ccv_blur_iir(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, double sigma);
 
 enum {
 	CCV_RGB_TO_YUV = 0x01,
@@ -523,8 +594,26 @@ enum {
 
 void ccv_resample(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int btype, int rows, int cols, int type);
 void ccv_sample_down(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int src_x, int src_y);
+/* b[src_x + src_y * 2] = ccv_sample_down(a, .., src_x, src_y) for the 4 phases in 0 and 1, in one pass over a */
+void ccv_sample_down_phases(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type);
 void ccv_sample_up(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int src_x, int src_y);
 
+/* an image pyramid whose levels are computed on demand: level i is the image scaled down by 2^(i / (interval + 1)),
+ * the first interval + 1 levels are resampled from the image with CCV_INTER_AREA, and the rest are sampled down
+ * from the level one octave above (with the given src_x, src_y phase). The same pyramid can be handed to several
+ * detectors (ccv_bbf_detect_objects_on_pyramid, ccv_dpm_detect_objects_on_pyramid) so that the levels are only
+ * computed once per image. It doesn't own the image, and it is not safe to query from several threads at once. */
+typedef struct {
+	int interval;
+	int count;
+	ccv_dense_matrix_t* a;
+	ccv_dense_matrix_t** level; // count * 4, for phase (0, 0), (1, 0), (0, 1), (1, 1)
+} ccv_pyramid_t;
+
+ccv_pyramid_t* ccv_pyramid_new(ccv_dense_matrix_t* a, int interval);
+ccv_dense_matrix_t* ccv_pyramid_level(ccv_pyramid_t* pyramid, int i, int src_x, int src_y);
+void ccv_pyramid_free(ccv_pyramid_t* pyramid);
+
 /* classic computer vision algorithms ccv_classic.c */
 
 void ccv_hog(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int b_type, int sbin, int size);
@@ -687,11 +776,15 @@ typedef struct {
 	ccv_dpm_part_classifier_t root;
 	ccv_dpm_part_classifier_t* part;
 	float alpha[3], beta;
+	float cascade[CCV_DPM_PART_MAX + 1]; // thresholds of the star-cascade on the score after the root, and after each part, -FLT_MAX if not estimated
 } ccv_dpm_root_classifier_t;
 
 typedef struct {
 	int count;
 	ccv_dpm_root_classifier_t* root;
+	void* map; // the binary model file mapped into memory, the filters point into it, 0 for the text model file
+	size_t map_size;
+	void* spectrum; // the filters in the frequency domain for the detection (see ccv_dpm.c), computed by the first detection, thus, the filters shouldn't change after that
 } ccv_dpm_mixture_model_t;
 
 typedef struct {
@@ -725,13 +818,17 @@ typedef struct {
 
 enum {
 	CCV_DPM_NO_NESTED = 0x10000000,
+	CCV_DPM_CASCADE   = 0x20000000,
 };
 
 extern ccv_dpm_param_t ccv_dpm_default_params;
 
 void ccv_dpm_mixture_model_new(char** posfiles, ccv_rect_t* bboxes, int posnum, char** bgfiles, int bgnum, int negnum, const char* dir, ccv_dpm_new_param_t params);
 ccv_array_t* __attribute__((warn_unused_result)) ccv_dpm_detect_objects(ccv_dense_matrix_t* a, ccv_dpm_mixture_model_t** model, int count, ccv_dpm_param_t params);
+ccv_array_t* __attribute__((warn_unused_result)) ccv_dpm_detect_objects_on_pyramid(ccv_pyramid_t* pyramid, ccv_dpm_mixture_model_t** model, int count, ccv_dpm_param_t params);
 ccv_dpm_mixture_model_t* __attribute__((warn_unused_result)) ccv_load_dpm_mixture_model(const char* directory);
+int ccv_dpm_mixture_model_write_binary(ccv_dpm_mixture_model_t* model, const char* filename);
+void ccv_dpm_mixture_model_estimate_cascade(ccv_dpm_mixture_model_t* model, ccv_dense_matrix_t** images, ccv_rect_t* bboxes, int count, double overlap, ccv_dpm_param_t params);
 void ccv_dpm_mixture_model_free(ccv_dpm_mixture_model_t* model);
 
 /* this is open source implementation of object detection algorithm: brightness binary feature
@@ -763,6 +860,9 @@ typedef struct {
 	int count;
 	ccv_size_t size;
 	ccv_bbf_stage_classifier_t* stage_classifier;
+	void* map; // the binary cascade file mapped into memory, the features point into it, 0 otherwise
+	size_t map_size;
+	void* compiled; // the stages compiled for the detection (see ccv_bbf.c), one per configuration of pyramid steps, kept from the first detection that needs it, thus, the stages shouldn't change after that
 } ccv_bbf_classifier_cascade_t;
 
 enum {
@@ -796,11 +896,34 @@ extern ccv_bbf_param_t ccv_bbf_default_params;
 
 void ccv_bbf_classifier_cascade_new(ccv_dense_matrix_t** posimg, int posnum, char** bgfiles, int bgnum, int negnum, ccv_size_t size, const char* dir, ccv_bbf_new_param_t params);
 ccv_array_t* __attribute__((warn_unused_result)) ccv_bbf_detect_objects(ccv_dense_matrix_t* a, ccv_bbf_classifier_cascade_t** cascade, int count, ccv_bbf_param_t params);
+ccv_array_t* __attribute__((warn_unused_result)) ccv_bbf_detect_objects_on_pyramid(ccv_pyramid_t* pyramid, ccv_bbf_classifier_cascade_t** cascade, int count, ccv_bbf_param_t params);
 ccv_bbf_classifier_cascade_t* __attribute__((warn_unused_result)) ccv_load_bbf_classifier_cascade(const char* directory);
 ccv_bbf_classifier_cascade_t* __attribute__((warn_unused_result)) ccv_bbf_classifier_cascade_read_binary(char* s);
+ccv_bbf_classifier_cascade_t* __attribute__((warn_unused_result)) ccv_bbf_classifier_cascade_map(const char* filename);
 int ccv_bbf_classifier_cascade_write_binary(ccv_bbf_classifier_cascade_t* cascade, char* s, int slen);
 void ccv_bbf_classifier_cascade_free(ccv_bbf_classifier_cascade_t* cascade);
 
+/* the detector keeps the image pyramid, the compiled cascades and the result arrays between calls, it is bound to
+ * one image size and one set of parameters, thus, good for detecting objects on frames of a video stream.
+ * the array returned by ccv_bbf_detector_detect_objects belongs to the detector, and it is overwritten by the next call */
+typedef struct {
+	int rows;
+	int cols;
+	int count;
+	int scale_upto;
+	ccv_bbf_param_t params;
+	ccv_bbf_classifier_cascade_t** cascade;
+	ccv_dense_matrix_t** pyr;
+	struct ccv_bbf_compiled_cascade_t** compiled;
+	ccv_array_t* seq;
+	ccv_array_t* seq2;
+	ccv_array_t* result_seq;
+} ccv_bbf_detector_t;
+
+ccv_bbf_detector_t* __attribute__((warn_unused_result)) ccv_bbf_detector_new(ccv_bbf_classifier_cascade_t** cascade, int count, int rows, int cols, ccv_bbf_param_t params);
+ccv_array_t* ccv_bbf_detector_detect_objects(ccv_bbf_detector_t* detector, ccv_dense_matrix_t* a);
+void ccv_bbf_detector_free(ccv_bbf_detector_t* detector);
+
 /* TLD: Track-Learn-Detection is a long-term object tracking framework, which achieved very high
  * tracking accuracy, this is the tracking algorithm of choice ccv implements */
 
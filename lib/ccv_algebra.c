@@ -233,16 +233,25 @@ void ccv_gemm(ccv_matrix_t* a, ccv_matrix_t* b, double alpha, ccv_matrix_t* c, d
 	ccv_object_return_if_cached(, dd);
 
 	if (dd != dc && dc != 0)
-		memcpy(dd->data.u8, dc->data.u8, dc->step * dc->rows);
+	{
+		if (dd->step == dc->step)
+			memcpy(dd->data.u8, dc->data.u8, dc->step * dc->rows);
+		else { // one of them is CCV_ALIGNED
+			int i;
+			for (i = 0; i < dc->rows; i++)
+				memcpy(dd->data.u8 + i * dd->step, dc->data.u8 + i * dc->step, ccv_min(dc->step, dd->step));
+		}
+	}
 
 #ifdef HAVE_CBLAS
+	/* the leading dimensions are the steps in elements, the rows of a CCV_ALIGNED matrix are padded */
 	switch (CCV_GET_DATA_TYPE(dd->type))
 	{
 		case CCV_32F:
-			cblas_sgemm(CblasRowMajor, (transpose & CCV_A_TRANSPOSE) ? CblasTrans : CblasNoTrans, (transpose & CCV_B_TRANSPOSE) ? CblasTrans : CblasNoTrans, dd->rows, dd->cols, da->cols, alpha, da->data.f32, da->cols, db->data.f32, db->cols, beta, dd->data.f32, dd->cols);
+			cblas_sgemm(CblasRowMajor, (transpose & CCV_A_TRANSPOSE) ? CblasTrans : CblasNoTrans, (transpose & CCV_B_TRANSPOSE) ? CblasTrans : CblasNoTrans, dd->rows, dd->cols, (transpose & CCV_A_TRANSPOSE) ? da->rows : da->cols, alpha, da->data.f32, da->step / CCV_GET_DATA_TYPE_SIZE(da->type), db->data.f32, db->step / CCV_GET_DATA_TYPE_SIZE(db->type), beta, dd->data.f32, dd->step / CCV_GET_DATA_TYPE_SIZE(dd->type));
 			break;
 		case CCV_64F:
-			cblas_dgemm(CblasRowMajor, (transpose & CCV_A_TRANSPOSE) ? CblasTrans : CblasNoTrans, (transpose & CCV_B_TRANSPOSE) ? CblasTrans : CblasNoTrans, dd->rows, dd->cols, (transpose & CCV_A_TRANSPOSE) ? da->rows : da->cols, alpha, da->data.f64, da->cols, db->data.f64, db->cols, beta, dd->data.f64, dd->cols);
+			cblas_dgemm(CblasRowMajor, (transpose & CCV_A_TRANSPOSE) ? CblasTrans : CblasNoTrans, (transpose & CCV_B_TRANSPOSE) ? CblasTrans : CblasNoTrans, dd->rows, dd->cols, (transpose & CCV_A_TRANSPOSE) ? da->rows : da->cols, alpha, da->data.f64, da->step / CCV_GET_DATA_TYPE_SIZE(da->type), db->data.f64, db->step / CCV_GET_DATA_TYPE_SIZE(db->type), beta, dd->data.f64, dd->step / CCV_GET_DATA_TYPE_SIZE(dd->type));
 			break;
 	}
 #endif
@@ -1,13 +1,15 @@
 #include "ccv.h"
 #include "ccv_internal.h"
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #ifdef HAVE_GSL
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
 #endif
-#ifdef USE_OPENMP
-#include <omp.h>
-#endif
 
 ccv_bbf_param_t ccv_bbf_default_params = {
 	.interval = 5,
@@ -59,6 +61,212 @@ static inline int _ccv_run_bbf_feature(ccv_bbf_feature_t* feature, int* step, un
 	return 1;
 }
 
+/* the compiled cascade is the read-only form the detector scans with: for one configuration of pyramid steps,
+ * every feature point is resolved to its level (z) and byte offset, the unused points are dropped, and all
+ * stages are packed back to back into a few flat arrays, thus, the working set is much smaller and there
+ * is no py * step[pz] to compute for each window */
+typedef struct ccv_bbf_compiled_cascade_t {
+	int step[3]; // the configuration it is compiled for
+	struct ccv_bbf_compiled_cascade_t* next; // the one compiled for another configuration
+	int count;
+	ccv_size_t size;
+	int* feature; // features of the i-th stage are [feature[i], feature[i + 1])
+	int* point; // points of the i-th stage are [point[i], point[i + 1])
+	float* threshold;
+	float* alpha; // 2 per feature
+	int32_t* off; // the P points followed by the N points of every feature
+	int8_t* z;
+	uint8_t* pnum;
+	uint8_t* nnum;
+} ccv_bbf_compiled_cascade_t;
+
+static ccv_bbf_compiled_cascade_t* _ccv_bbf_compile_cascade(ccv_bbf_classifier_cascade_t* cascade, int* step)
+{
+	int i, j, k, fnum = 0, pnum = 0;
+	for (i = 0; i < cascade->count; i++)
+	{
+		ccv_bbf_stage_classifier_t* classifier = cascade->stage_classifier + i;
+		fnum += classifier->count;
+		for (j = 0; j < classifier->count; j++)
+			for (k = 0; k < classifier->feature[j].size; k++)
+				pnum += (k == 0 || classifier->feature[j].pz[k] >= 0) + (k == 0 || classifier->feature[j].nz[k] >= 0);
+	}
+	/* one memory region, from the widest type to the narrowest, with malloc rather than ccmalloc, because it is
+	 * kept on the cascade, and the detection that compiles it may be within an arena scope */
+	ccv_bbf_compiled_cascade_t* compiled = (ccv_bbf_compiled_cascade_t*)malloc(sizeof(ccv_bbf_compiled_cascade_t) + (cascade->count + 1) * 2 * sizeof(int) + cascade->count * sizeof(float) + fnum * 2 * sizeof(float) + pnum * (sizeof(int32_t) + sizeof(int8_t)) + fnum * 2 * sizeof(uint8_t));
+	memcpy(compiled->step, step, sizeof(compiled->step));
+	compiled->next = 0;
+	compiled->count = cascade->count;
+	compiled->size = cascade->size;
+	compiled->feature = (int*)(compiled + 1);
+	compiled->point = compiled->feature + cascade->count + 1;
+	compiled->threshold = (float*)(compiled->point + cascade->count + 1);
+	compiled->alpha = compiled->threshold + cascade->count;
+	compiled->off = (int32_t*)(compiled->alpha + fnum * 2);
+	compiled->z = (int8_t*)(compiled->off + pnum);
+	compiled->pnum = (uint8_t*)(compiled->z + pnum);
+	compiled->nnum = compiled->pnum + fnum;
+	int f = 0, p = 0;
+	for (i = 0; i < cascade->count; i++)
+	{
+		ccv_bbf_stage_classifier_t* classifier = cascade->stage_classifier + i;
+		compiled->feature[i] = f;
+		compiled->point[i] = p;
+		compiled->threshold[i] = classifier->threshold;
+		memcpy(compiled->alpha + f * 2, classifier->alpha, classifier->count * 2 * sizeof(float));
+		for (j = 0; j < classifier->count; j++, f++)
+		{
+			ccv_bbf_feature_t* feature = classifier->feature + j;
+			compiled->pnum[f] = compiled->nnum[f] = 0;
+			for (k = 0; k < feature->size; k++)
+				if (k == 0 || feature->pz[k] >= 0)
+				{
+					compiled->z[p] = feature->pz[k];
+					compiled->off[p] = feature->px[k] + feature->py[k] * step[feature->pz[k]];
+					++compiled->pnum[f];
+					++p;
+				}
+			for (k = 0; k < feature->size; k++)
+				if (k == 0 || feature->nz[k] >= 0)
+				{
+					compiled->z[p] = feature->nz[k];
+					compiled->off[p] = feature->nx[k] + feature->ny[k] * step[feature->nz[k]];
+					++compiled->nnum[f];
+					++p;
+				}
+		}
+	}
+	compiled->feature[cascade->count] = f;
+	compiled->point[cascade->count] = p;
+	return compiled;
+}
+
+/* the lock only guards the lists of the compiled cascades, a compiled cascade never changes once it is in one */
+static pthread_mutex_t ccv_bbf_compiled_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the compiled cascade for the steps, it is compiled by the first detection that needs it, and then kept on the
+ * cascade for the later ones until ccv_bbf_classifier_cascade_free */
+static ccv_bbf_compiled_cascade_t* _ccv_bbf_compiled_cascade(ccv_bbf_classifier_cascade_t* cascade, int* step)
+{
+	pthread_mutex_lock(&ccv_bbf_compiled_mutex);
+	ccv_bbf_compiled_cascade_t* compiled;
+	for (compiled = (ccv_bbf_compiled_cascade_t*)cascade->compiled; compiled; compiled = compiled->next)
+		if (memcmp(compiled->step, step, sizeof(compiled->step)) == 0)
+			break;
+	if (!compiled)
+	{
+		compiled = _ccv_bbf_compile_cascade(cascade, step);
+		compiled->next = (ccv_bbf_compiled_cascade_t*)cascade->compiled;
+		cascade->compiled = compiled;
+	}
+	pthread_mutex_unlock(&ccv_bbf_compiled_mutex);
+	return compiled;
+}
+
+/* free the compiled cascades, when the cascade is freed, or its stages are changed */
+static void _ccv_bbf_compiled_cascade_drain(ccv_bbf_classifier_cascade_t* cascade)
+{
+	ccv_bbf_compiled_cascade_t* compiled = (ccv_bbf_compiled_cascade_t*)cascade->compiled;
+	while (compiled)
+	{
+		ccv_bbf_compiled_cascade_t* next = compiled->next;
+		free(compiled);
+		compiled = next;
+	}
+	cascade->compiled = 0;
+}
+
+/* the same test as _ccv_run_bbf_feature on the compiled points: every point in P > every point in N */
+static inline int _ccv_run_bbf_compiled_feature(const int8_t* z, const int32_t* off, int pnum, int nnum, unsigned char** u8)
+{
+	unsigned char pmin = u8[z[0]][off[0]], nmax = u8[z[pnum]][off[pnum]];
+	if (pmin <= nmax)
+		return 0;
+	int i;
+	for (i = 1; i < pnum; i++)
+	{
+		int p = u8[z[i]][off[i]];
+		if (p < pmin)
+		{
+			if (p <= nmax)
+				return 0;
+			pmin = p;
+		}
+	}
+	for (i = pnum + 1; i < pnum + nnum; i++)
+	{
+		int n = u8[z[i]][off[i]];
+		if (n > nmax)
+		{
+			if (pmin <= n)
+				return 0;
+			nmax = n;
+		}
+	}
+	return 1;
+}
+
+/* run the stages from stage onwards on one window, sum is the response of the last stage evaluated */
+static inline int _ccv_run_bbf_compiled_stages(ccv_bbf_compiled_cascade_t* cascade, int stage, unsigned char** u8, float* sum)
+{
+	int i, j;
+	const int32_t* off = cascade->off + cascade->point[stage];
+	const int8_t* z = cascade->z + cascade->point[stage];
+	for (i = stage; i < cascade->count; i++)
+	{
+		*sum = 0;
+		for (j = cascade->feature[i]; j < cascade->feature[i + 1]; j++)
+		{
+			*sum += cascade->alpha[j * 2 + _ccv_run_bbf_compiled_feature(z, off, cascade->pnum[j], cascade->nnum[j], u8)];
+			off += cascade->pnum[j] + cascade->nnum[j];
+			z += cascade->pnum[j] + cascade->nnum[j];
+		}
+		if (*sum < cascade->threshold[i])
+			return 0;
+	}
+	return 1;
+}
+
+#ifdef HAVE_SSE2
+/* load the pixel at the same feature point for 16 adjacent windows, adjacent windows are 4, 2, 1 pixels apart
+ * on the 3 levels (z = 0, 1, 2) of the pyramid */
+static inline __m128i _ccv_bbf_load_16u8(unsigned char* ptr, int z)
+{
+	switch (z)
+	{
+		case 0:
+		{
+			__m128i mask = _mm_set1_epi32(0xff);
+			__m128i lo = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128((__m128i*)ptr), mask), _mm_and_si128(_mm_loadu_si128((__m128i*)(ptr + 16)), mask));
+			__m128i hi = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128((__m128i*)(ptr + 32)), mask), _mm_and_si128(_mm_loadu_si128((__m128i*)(ptr + 48)), mask));
+			return _mm_packus_epi16(lo, hi);
+		}
+		case 1:
+		{
+			__m128i mask = _mm_set1_epi16(0xff);
+			return _mm_packus_epi16(_mm_and_si128(_mm_loadu_si128((__m128i*)ptr), mask), _mm_and_si128(_mm_loadu_si128((__m128i*)(ptr + 16)), mask));
+		}
+		default:
+			return _mm_loadu_si128((__m128i*)ptr);
+	}
+}
+
+/* the compiled feature test for 16 adjacent windows, lanes where every point in P > every point in N are 0xff */
+static inline __m128i _ccv_run_bbf_compiled_feature_sse2(const int8_t* z, const int32_t* off, int pnum, int nnum, unsigned char** u8)
+{
+	__m128i pmin = _ccv_bbf_load_16u8(u8[z[0]] + off[0], z[0]), nmax = _ccv_bbf_load_16u8(u8[z[pnum]] + off[pnum], z[pnum]);
+	/* pmin <= nmax iff max(pmin, nmax) == nmax, take a shortcut if it is true for all windows */
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(pmin, nmax), nmax)) == 0xffff)
+		return _mm_setzero_si128();
+	int i;
+	for (i = 1; i < pnum; i++)
+		pmin = _mm_min_epu8(pmin, _ccv_bbf_load_16u8(u8[z[i]] + off[i], z[i]));
+	for (i = pnum + 1; i < pnum + nnum; i++)
+		nmax = _mm_max_epu8(nmax, _ccv_bbf_load_16u8(u8[z[i]] + off[i], z[i]));
+	return _mm_xor_si128(_mm_cmpeq_epi8(_mm_max_epu8(pmin, nmax), nmax), _mm_set1_epi8(-1));
+}
+#endif
+
 static int _ccv_read_bbf_stage_classifier(const char* file, ccv_bbf_stage_classifier_t* classifier)
 {
 	FILE* r = fopen(file, "r");
@@ -403,6 +611,41 @@ static inline double _ccv_bbf_error_rate(ccv_bbf_feature_t* feature, unsigned ch
 	return error;
 }
 
+typedef struct {
+	ccv_bbf_gene_t* gene;
+	unsigned char** posdata;
+	int posnum;
+	unsigned char** negdata;
+	int negnum;
+	ccv_size_t size;
+	double* pw;
+	double* nw;
+} ccv_bbf_error_rate_band_t;
+
+static void _ccv_bbf_error_rate_band(void* context, int start, int end)
+{
+	ccv_bbf_error_rate_band_t* band = (ccv_bbf_error_rate_band_t*)context;
+	int i;
+	for (i = start; i < end; i++)
+		band->gene[i].error = _ccv_bbf_error_rate(&band->gene[i].feature, band->posdata, band->posnum, band->negdata, band->negnum, band->size, band->pw, band->nw);
+}
+
+/* the error rates of the genes [0, pnum), every gene is independent of the others */
+static void _ccv_bbf_error_rates(ccv_bbf_gene_t* gene, int pnum, unsigned char** posdata, int posnum, unsigned char** negdata, int negnum, ccv_size_t size, double* pw, double* nw)
+{
+	ccv_bbf_error_rate_band_t band = {
+		.gene = gene,
+		.posdata = posdata,
+		.posnum = posnum,
+		.negdata = negdata,
+		.negnum = negnum,
+		.size = size,
+		.pw = pw,
+		.nw = nw,
+	};
+	ccv_parallel_for(pnum, 1, _ccv_bbf_error_rate_band, &band);
+}
+
 #define less_than(fit1, fit2, aux) ((fit1).fitness >= (fit2).fitness)
 static CCV_IMPLEMENT_QSORT(_ccv_bbf_genetic_qsort, ccv_bbf_gene_t, less_than)
 #undef less_than
@@ -424,11 +667,7 @@ static ccv_bbf_feature_t _ccv_bbf_genetic_optimize(unsigned char** posdata, int
 	for (i = 0; i < pnum; i++)
 		_ccv_bbf_randomize_gene(rng, &gene[i], rows, cols);
 	unsigned int timer = _ccv_bbf_time_measure();
-#ifdef USE_OPENMP
-#pragma omp parallel for private(i) schedule(dynamic)
-#endif
-	for (i = 0; i < pnum; i++)
-		gene[i].error = _ccv_bbf_error_rate(&gene[i].feature, posdata, posnum, negdata, negnum, size, pw, nw);
+	_ccv_bbf_error_rates(gene, pnum, posdata, posnum, negdata, negnum, size, pw, nw);
 	timer = _ccv_bbf_time_measure() - timer;
 	for (i = 0; i < pnum; i++)
 		_ccv_bbf_genetic_fitness(&gene[i]);
@@ -563,11 +802,7 @@ static ccv_bbf_feature_t _ccv_bbf_genetic_optimize(unsigned char** posdata, int
 		for (i = ftnum + mnum + hnum; i < ftnum + mnum + hnum + rnum; i++)
 			_ccv_bbf_randomize_gene(rng, &gene[i], rows, cols);
 		timer = _ccv_bbf_time_measure();
-#ifdef USE_OPENMP
-#pragma omp parallel for private(i) schedule(dynamic)
-#endif
-		for (i = 0; i < pnum; i++)
-			gene[i].error = _ccv_bbf_error_rate(&gene[i].feature, posdata, posnum, negdata, negnum, size, pw, nw);
+		_ccv_bbf_error_rates(gene, pnum, posdata, posnum, negdata, negnum, size, pw, nw);
 		timer = _ccv_bbf_time_measure() - timer;
 		for (i = 0; i < pnum; i++)
 			_ccv_bbf_genetic_fitness(&gene[i]);
@@ -585,11 +820,7 @@ static ccv_bbf_gene_t _ccv_bbf_best_gene(ccv_bbf_gene_t* gene, int pnum, int poi
 {
 	int i;
 	unsigned int timer = _ccv_bbf_time_measure();
-#ifdef USE_OPENMP
-#pragma omp parallel for private(i) schedule(dynamic)
-#endif
-	for (i = 0; i < pnum; i++)
-		gene[i].error = _ccv_bbf_error_rate(&gene[i].feature, posdata, posnum, negdata, negnum, size, pw, nw);
+	_ccv_bbf_error_rates(gene, pnum, posdata, posnum, negdata, negnum, size, pw, nw);
 	timer = _ccv_bbf_time_measure() - timer;
 	_ccv_bbf_best_qsort(gene, pnum, 0);
 	int min_id = 0;
@@ -947,6 +1178,9 @@ void ccv_bbf_classifier_cascade_new(ccv_dense_matrix_t** posimg, int posnum, cha
 	cascade->count = 0;
 	cascade->size = size;
 	cascade->stage_classifier = (ccv_bbf_stage_classifier_t*)ccmalloc(sizeof(ccv_bbf_stage_classifier_t));
+	cascade->map = 0;
+	cascade->map_size = 0;
+	cascade->compiled = 0;
 	unsigned char** posdata = (unsigned char**)ccmalloc(posnum * sizeof(unsigned char*));
 	unsigned char** negdata = (unsigned char**)ccmalloc(negnum * sizeof(unsigned char*));
 	double* pw = (double*)ccmalloc(posnum * sizeof(double));
@@ -1135,6 +1369,8 @@ void ccv_bbf_classifier_cascade_new(ccv_dense_matrix_t** posimg, int posnum, cha
 		ccfree(cascade->stage_classifier);
 		stage_classifier[i] = classifier;
 		cascade->stage_classifier = stage_classifier;
+		/* the negative data of the next stage is detected with the new stage too */
+		_ccv_bbf_compiled_cascade_drain(cascade);
 		k = 0;
 		bg = 0;
 		for (j = 0; j < rpos; j++)
@@ -1149,6 +1385,7 @@ void ccv_bbf_classifier_cascade_new(ccv_dense_matrix_t** posimg, int posnum, cha
 	ccfree(pw);
 	ccfree(negdata);
 	ccfree(posdata);
+	_ccv_bbf_compiled_cascade_drain(cascade);
 	ccfree(cascade);
 }
 #else
@@ -1158,6 +1395,15 @@ void ccv_bbf_classifier_cascade_new(ccv_dense_matrix_t** posimg, int posnum, cha
 }
 #endif
 
+typedef struct {
+	int x;
+	int i;
+} ccv_bbf_comp_origin_t;
+
+#define less_than(o1, o2, aux) ((o1).x < (o2).x)
+static CCV_IMPLEMENT_QSORT(_ccv_bbf_comp_origin_qsort, ccv_bbf_comp_origin_t, less_than)
+#undef less_than
+
 static int _ccv_is_equal(const void* _r1, const void* _r2, void* data)
 {
 	const ccv_comp_t* r1 = (const ccv_comp_t*)_r1;
@@ -1187,35 +1433,209 @@ static int _ccv_is_equal_same_class(const void* _r1, const void* _r2, void* data
 		   (int)(r2->rect.width * 1.5 + 0.5) >= r1->rect.width;
 }
 
-ccv_array_t* ccv_bbf_detect_objects(ccv_dense_matrix_t* a, ccv_bbf_classifier_cascade_t** _cascade, int count, ccv_bbf_param_t params)
+#define CCV_BBF_SCAN_BAND (16)
+
+/* scan rows [y_start, y_end) of the i-th scale with phase q, push every window that passes all stages to seq */
+static void _ccv_bbf_scan_rows(ccv_bbf_compiled_cascade_t* cascade, ccv_dense_matrix_t** pyr, int i, int next, int q, int y_start, int y_end, float scale_x, float scale_y, int t, ccv_array_t* seq)
+{
+	int dx[] = {0, 1, 0, 1};
+	int dy[] = {0, 0, 1, 1};
+	int x, y;
+	int steps[] = { pyr[i * 4]->step, pyr[i * 4 + next * 4]->step, pyr[i * 4 + next * 8]->step };
+	int i_cols = pyr[i * 4 + next * 8]->cols - (cascade->size.width >> 2);
+	int paddings[] = { pyr[i * 4]->step * 4 - i_cols * 4,
+					   pyr[i * 4 + next * 4]->step * 2 - i_cols * 2,
+					   pyr[i * 4 + next * 8]->step - i_cols };
+	unsigned char* u8[] = { pyr[i * 4]->data.u8 + dx[q] * 2 + dy[q] * pyr[i * 4]->step * 2 + y_start * steps[0] * 4,
+							pyr[i * 4 + next * 4]->data.u8 + dx[q] + dy[q] * pyr[i * 4 + next * 4]->step + y_start * steps[1] * 2,
+							pyr[i * 4 + next * 8 + q]->data.u8 + y_start * steps[2] };
+	for (y = y_start; y < y_end; y++)
+	{
+		x = 0;
+#ifdef HAVE_SSE2
+		/* evaluate 16 adjacent windows at a time, the last window of a row is always left to the scalar path,
+		 * thus, the strided loads never read past the end of a row */
+		for (; x + 16 < i_cols; x += 16)
+		{
+			int j, k, live = 0xffff;
+			float sums[16];
+			const int32_t* off = cascade->off;
+			const int8_t* z = cascade->z;
+			for (j = 0; j < cascade->count; j++)
+			{
+				__m128 sum[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+				for (k = cascade->feature[j]; k < cascade->feature[j + 1]; k++)
+				{
+					__m128i mask = _ccv_run_bbf_compiled_feature_sse2(z, off, cascade->pnum[k], cascade->nnum[k], u8);
+					off += cascade->pnum[k] + cascade->nnum[k];
+					z += cascade->pnum[k] + cascade->nnum[k];
+					__m128 alpha0 = _mm_set1_ps(cascade->alpha[k * 2]), alpha1 = _mm_set1_ps(cascade->alpha[k * 2 + 1]);
+					__m128i mask_lo = _mm_unpacklo_epi8(mask, mask), mask_hi = _mm_unpackhi_epi8(mask, mask);
+					__m128 maskf[4] = { _mm_castsi128_ps(_mm_unpacklo_epi16(mask_lo, mask_lo)),
+										_mm_castsi128_ps(_mm_unpackhi_epi16(mask_lo, mask_lo)),
+										_mm_castsi128_ps(_mm_unpacklo_epi16(mask_hi, mask_hi)),
+										_mm_castsi128_ps(_mm_unpackhi_epi16(mask_hi, mask_hi)) };
+					int l;
+					for (l = 0; l < 4; l++)
+						sum[l] = _mm_add_ps(sum[l], _mm_or_ps(_mm_and_ps(maskf[l], alpha1), _mm_andnot_ps(maskf[l], alpha0)));
+				}
+				__m128 threshold = _mm_set1_ps(cascade->threshold[j]);
+				live &= ~(_mm_movemask_ps(_mm_cmplt_ps(sum[0], threshold)) |
+						  (_mm_movemask_ps(_mm_cmplt_ps(sum[1], threshold)) << 4) |
+						  (_mm_movemask_ps(_mm_cmplt_ps(sum[2], threshold)) << 8) |
+						  (_mm_movemask_ps(_mm_cmplt_ps(sum[3], threshold)) << 12));
+				_mm_storeu_ps(sums, sum[0]);
+				_mm_storeu_ps(sums + 4, sum[1]);
+				_mm_storeu_ps(sums + 8, sum[2]);
+				_mm_storeu_ps(sums + 12, sum[3]);
+				/* once only a few windows are alive, it is cheaper to finish them one by one */
+				if (__builtin_popcount(live) <= 2)
+					break;
+			}
+			if (live)
+			{
+				int l;
+				for (l = 0; l < 16; l++)
+					if (live & (1 << l))
+					{
+						unsigned char* u8l[] = { u8[0] + l * 4, u8[1] + l * 2, u8[2] + l };
+						if (j >= cascade->count - 1 || _ccv_run_bbf_compiled_stages(cascade, j + 1, u8l, sums + l))
+						{
+							ccv_comp_t comp;
+							comp.rect = ccv_rect((int)(((x + l) * 4 + dx[q] * 2) * scale_x + 0.5), (int)((y * 4 + dy[q] * 2) * scale_y + 0.5), (int)(cascade->size.width * scale_x + 0.5), (int)(cascade->size.height * scale_y + 0.5));
+							comp.id = t;
+							comp.neighbors = 1;
+							comp.confidence = sums[l];
+							ccv_array_push(seq, &comp);
+						}
+					}
+			}
+			u8[0] += 64;
+			u8[1] += 32;
+			u8[2] += 16;
+		}
+#endif
+		for (; x < i_cols; x++)
+		{
+			float sum = 0;
+			if (_ccv_run_bbf_compiled_stages(cascade, 0, u8, &sum))
+			{
+				ccv_comp_t comp;
+				comp.rect = ccv_rect((int)((x * 4 + dx[q] * 2) * scale_x + 0.5), (int)((y * 4 + dy[q] * 2) * scale_y + 0.5), (int)(cascade->size.width * scale_x + 0.5), (int)(cascade->size.height * scale_y + 0.5));
+				comp.id = t;
+				comp.neighbors = 1;
+				comp.confidence = sum;
+				ccv_array_push(seq, &comp);
+			}
+			u8[0] += 4;
+			u8[1] += 2;
+			u8[2] += 1;
+		}
+		u8[0] += paddings[0];
+		u8[1] += paddings[1];
+		u8[2] += paddings[2];
+	}
+}
+
+typedef struct {
+	ccv_bbf_compiled_cascade_t** compiled; // one per scale
+	ccv_dense_matrix_t** pyr;
+	int next;
+	int height; // of the cascade
+	float* scale_xs;
+	float* scale_ys;
+	int t;
+	int* units; // (scale, phase, first row) of a unit
+	ccv_array_t** useq; // one array per unit
+} ccv_bbf_scan_band_t;
+
+/* the units [start, end), a unit scans CCV_BBF_SCAN_BAND rows of a scale in a phase */
+static void _ccv_bbf_scan_band(void* context, int start, int end)
+{
+	ccv_bbf_scan_band_t* band = (ccv_bbf_scan_band_t*)context;
+	int k, next = band->next;
+	for (k = start; k < end; k++)
+	{
+		int i = band->units[k * 3], q = band->units[k * 3 + 1], y = band->units[k * 3 + 2];
+		int i_rows = band->pyr[i * 4 + next * 8]->rows - (band->height >> 2);
+		band->useq[k] = ccv_array_new(sizeof(ccv_comp_t), 4, 0);
+		_ccv_bbf_scan_rows(band->compiled[i], band->pyr, i, next, q, y, ccv_min(y + CCV_BBF_SCAN_BAND, i_rows), band->scale_xs[i], band->scale_ys[i], band->t, band->useq[k]);
+	}
+}
+
+static int _ccv_bbf_scale_upto(int rows, int cols, ccv_bbf_param_t params)
+{
+	int hr = rows / params.size.height;
+	int wr = cols / params.size.width;
+	double scale = pow(2., 1. / (params.interval + 1.));
+	return (int)(log((double)ccv_min(hr, wr)) / log(scale));
+}
+
+/* pyr holds (scale_upto + next * 2) * 4 matrices, the ones that are not 0 are reused (and have to be of the right size) */
+static void _ccv_bbf_build_pyramid(ccv_dense_matrix_t* a, ccv_dense_matrix_t** pyr, ccv_size_t size, int scale_upto, ccv_bbf_param_t params)
 {
-	int hr = a->rows / params.size.height;
-	int wr = a->cols / params.size.width;
 	double scale = pow(2., 1. / (params.interval + 1.));
 	int next = params.interval + 1;
-	int scale_upto = (int)(log((double)ccv_min(hr, wr)) / log(scale));
-	ccv_dense_matrix_t** pyr = (ccv_dense_matrix_t**)alloca((scale_upto + next * 2) * 4 * sizeof(ccv_dense_matrix_t*));
-	memset(pyr, 0, (scale_upto + next * 2) * 4 * sizeof(ccv_dense_matrix_t*));
-	if (params.size.height != _cascade[0]->size.height || params.size.width != _cascade[0]->size.width)
-		ccv_resample(a, &pyr[0], 0, a->rows * _cascade[0]->size.height / params.size.height, a->cols * _cascade[0]->size.width / params.size.width, CCV_INTER_AREA);
+	if (params.size.height != size.height || params.size.width != size.width)
+		ccv_resample(a, &pyr[0], 0, a->rows * size.height / params.size.height, a->cols * size.width / params.size.width, CCV_INTER_AREA);
 	else
 		pyr[0] = a;
-	int i, j, k, t, x, y, q;
+	int i;
 	for (i = 1; i <= params.interval; i++)
 		ccv_resample(pyr[0], &pyr[i * 4], 0, (int)(pyr[0]->rows / pow(scale, i)), (int)(pyr[0]->cols / pow(scale, i)), CCV_INTER_AREA);
 	for (i = next; i < scale_upto + next * 2; i++)
-		ccv_sample_down(pyr[i * 4 - next * 4], &pyr[i * 4], 0, 0, 0);
+		if (params.accurate && i >= next * 2)
+			ccv_sample_down_phases(pyr[i * 4 - next * 4], pyr + i * 4, 0);
+		else
+			ccv_sample_down(pyr[i * 4 - next * 4], &pyr[i * 4], 0, 0, 0);
+}
+
+static void _ccv_bbf_free_pyramid(ccv_dense_matrix_t** pyr, ccv_size_t size, int scale_upto, ccv_bbf_param_t params)
+{
+	int next = params.interval + 1;
+	int i;
+	for (i = 1; i < scale_upto + next * 2; i++)
+		ccv_matrix_free(pyr[i * 4]);
 	if (params.accurate)
 		for (i = next * 2; i < scale_upto + next * 2; i++)
 		{
-			ccv_sample_down(pyr[i * 4 - next * 4], &pyr[i * 4 + 1], 0, 1, 0);
-			ccv_sample_down(pyr[i * 4 - next * 4], &pyr[i * 4 + 2], 0, 0, 1);
-			ccv_sample_down(pyr[i * 4 - next * 4], &pyr[i * 4 + 3], 0, 1, 1);
+			ccv_matrix_free(pyr[i * 4 + 1]);
+			ccv_matrix_free(pyr[i * 4 + 2]);
+			ccv_matrix_free(pyr[i * 4 + 3]);
 		}
+	if (params.size.height != size.height || params.size.width != size.width)
+		ccv_matrix_free(pyr[0]);
+}
+
+/* scan the pyramid with every cascade and group the windows into result_seq, _compiled holds count * scale_upto compiled
+ * cascades (they belong to the cascades), the ones that are 0 will be looked up, seq and seq2 are scratch arrays */
+static void _ccv_bbf_detect(ccv_dense_matrix_t** pyr, ccv_bbf_classifier_cascade_t** _cascade, ccv_bbf_compiled_cascade_t** _compiled, int count, int scale_upto, ccv_bbf_param_t params, ccv_array_t* seq, ccv_array_t* seq2, ccv_array_t* result_seq)
+{
+	double scale = pow(2., 1. / (params.interval + 1.));
+	int next = params.interval + 1;
+	int i, j, t, q;
 	ccv_array_t* idx_seq;
-	ccv_array_t* seq = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
-	ccv_array_t* seq2 = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
-	ccv_array_t* result_seq = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
+	ccv_array_clear(result_seq);
+	/* every (scale, phase, band of rows) is an independent unit of work that only reads the pyramid
+	 * and the cascade, each unit collects into its own array, and these are merged in the serial
+	 * order afterwards, thus, the grouping sees exactly the same sequence as the single-threaded scan,
+	 * the units of the cascade with the most of them size the buffers shared by every cascade */
+	int k, y, unum, umax = 0;
+	for (t = 0; t < count; t++)
+	{
+		unum = 0;
+		for (i = 0; i < scale_upto; i++)
+		{
+			int i_rows = pyr[i * 4 + next * 8]->rows - (_cascade[t]->size.height >> 2);
+			if (i_rows > 0)
+				unum += (params.accurate ? 4 : 1) * ((i_rows + CCV_BBF_SCAN_BAND - 1) / CCV_BBF_SCAN_BAND);
+		}
+		umax = ccv_max(umax, unum);
+	}
+	ccv_array_t** useq = (ccv_array_t**)ccmalloc(umax * sizeof(ccv_array_t*) + umax * 3 * sizeof(int) + scale_upto * 2 * sizeof(float));
+	int* units = (int*)(useq + umax);
+	float* scale_xs = (float*)(units + umax * 3);
+	float* scale_ys = scale_xs + scale_upto;
 	/* detect in multi scale */
 	for (t = 0; t < count; t++)
 	{
@@ -1223,60 +1643,50 @@ ccv_array_t* ccv_bbf_detect_objects(ccv_dense_matrix_t* a, ccv_bbf_classifier_ca
 		float scale_x = (float) params.size.width / (float) cascade->size.width;
 		float scale_y = (float) params.size.height / (float) cascade->size.height;
 		ccv_array_clear(seq);
+		ccv_bbf_compiled_cascade_t** compiled = _compiled + t * scale_upto;
 		for (i = 0; i < scale_upto; i++)
 		{
-			int dx[] = {0, 1, 0, 1};
-			int dy[] = {0, 0, 1, 1};
-			int i_rows = pyr[i * 4 + next * 8]->rows - (cascade->size.height >> 2);
-			int steps[] = { pyr[i * 4]->step, pyr[i * 4 + next * 4]->step, pyr[i * 4 + next * 8]->step };
-			int i_cols = pyr[i * 4 + next * 8]->cols - (cascade->size.width >> 2);
-			int paddings[] = { pyr[i * 4]->step * 4 - i_cols * 4,
-							   pyr[i * 4 + next * 4]->step * 2 - i_cols * 2,
-							   pyr[i * 4 + next * 8]->step - i_cols };
-			for (q = 0; q < (params.accurate ? 4 : 1); q++)
+			if (!compiled[i])
 			{
-				unsigned char* u8[] = { pyr[i * 4]->data.u8 + dx[q] * 2 + dy[q] * pyr[i * 4]->step * 2, pyr[i * 4 + next * 4]->data.u8 + dx[q] + dy[q] * pyr[i * 4 + next * 4]->step, pyr[i * 4 + next * 8 + q]->data.u8 };
-				for (y = 0; y < i_rows; y++)
-				{
-					for (x = 0; x < i_cols; x++)
-					{
-						float sum;
-						int flag = 1;
-						ccv_bbf_stage_classifier_t* classifier = cascade->stage_classifier;
-						for (j = 0; j < cascade->count; ++j, ++classifier)
-						{
-							sum = 0;
-							float* alpha = classifier->alpha;
-							ccv_bbf_feature_t* feature = classifier->feature;
-							for (k = 0; k < classifier->count; ++k, alpha += 2, ++feature)
-								sum += alpha[_ccv_run_bbf_feature(feature, steps, u8)];
-							if (sum < classifier->threshold)
-							{
-								flag = 0;
-								break;
-							}
-						}
-						if (flag)
-						{
-							ccv_comp_t comp;
-							comp.rect = ccv_rect((int)((x * 4 + dx[q] * 2) * scale_x + 0.5), (int)((y * 4 + dy[q] * 2) * scale_y + 0.5), (int)(cascade->size.width * scale_x + 0.5), (int)(cascade->size.height * scale_y + 0.5));
-							comp.id = t;
-							comp.neighbors = 1;
-							comp.confidence = sum;
-							ccv_array_push(seq, &comp);
-						}
-						u8[0] += 4;
-						u8[1] += 2;
-						u8[2] += 1;
-					}
-					u8[0] += paddings[0];
-					u8[1] += paddings[1];
-					u8[2] += paddings[2];
-				}
+				int steps[] = { pyr[i * 4]->step, pyr[i * 4 + next * 4]->step, pyr[i * 4 + next * 8]->step };
+				compiled[i] = _ccv_bbf_compiled_cascade(cascade, steps);
 			}
+			scale_xs[i] = scale_x;
+			scale_ys[i] = scale_y;
 			scale_x *= scale;
 			scale_y *= scale;
 		}
+		k = 0;
+		for (i = 0; i < scale_upto; i++)
+		{
+			int i_rows = pyr[i * 4 + next * 8]->rows - (cascade->size.height >> 2);
+			for (q = 0; q < (params.accurate ? 4 : 1); q++)
+				for (y = 0; y < i_rows; y += CCV_BBF_SCAN_BAND, k++)
+				{
+					units[k * 3] = i;
+					units[k * 3 + 1] = q;
+					units[k * 3 + 2] = y;
+				}
+		}
+		unum = k;
+		ccv_bbf_scan_band_t band = {
+			.compiled = compiled,
+			.pyr = pyr,
+			.next = next,
+			.height = cascade->size.height,
+			.scale_xs = scale_xs,
+			.scale_ys = scale_ys,
+			.t = t,
+			.units = units,
+			.useq = useq,
+		};
+		ccv_parallel_for(unum, 1, _ccv_bbf_scan_band, &band);
+		for (k = 0; k < unum; k++)
+		{
+			for (i = 0; i < useq[k]->rnum; i++)
+				ccv_array_push(seq, ccv_array_get(useq[k], i));
+			ccv_array_free(useq[k]);
+		}
 
 		/* the following code from OpenCV's haar feature implementation */
 		if(params.min_neighbors == 0)
@@ -1290,7 +1700,7 @@ ccv_array_t* ccv_bbf_detect_objects(ccv_dense_matrix_t* a, ccv_bbf_classifier_ca
 			idx_seq = 0;
 			ccv_array_clear(seq2);
 			// group retrieved rectangles in order to filter out noise
-			int ncomp = ccv_array_group(seq, &idx_seq, _ccv_is_equal_same_class, 0);
+			int ncomp = ccv_array_group_rect(seq, &idx_seq, _ccv_is_equal_same_class, 0, 0.25);
 			ccv_comp_t* comps = (ccv_comp_t*)ccmalloc((ncomp + 1) * sizeof(ccv_comp_t));
 			memset(comps, 0, (ncomp + 1) * sizeof(ccv_comp_t));
 
@@ -1331,14 +1741,37 @@ ccv_array_t* ccv_bbf_detect_objects(ccv_dense_matrix_t* a, ccv_bbf_classifier_ca
 				}
 			}
 
-			// filter out small face rectangles inside large face rectangles
+			// filter out small face rectangles inside large face rectangles, the ones can contain r1 begin within
+			// [r1.rect.x + r1.rect.width - extent, r1.rect.x + reach] along x, these are looked up in seq2 sorted by x
+			ccv_bbf_comp_origin_t* origin = (ccv_bbf_comp_origin_t*)ccmalloc((seq2->rnum + 1) * sizeof(ccv_bbf_comp_origin_t));
+			int k, reach = 0, extent = 0;
+			for(i = 0; i < seq2->rnum; i++)
+			{
+				ccv_comp_t* r2 = (ccv_comp_t*)ccv_array_get(seq2, i);
+				int distance = (int)(r2->rect.width * 0.25 + 0.5);
+				reach = ccv_max(reach, distance);
+				extent = ccv_max(extent, r2->rect.width + distance);
+				origin[i].x = r2->rect.x;
+				origin[i].i = i;
+			}
+			_ccv_bbf_comp_origin_qsort(origin, seq2->rnum, 0);
 			for(i = 0; i < seq2->rnum; i++)
 			{
 				ccv_comp_t r1 = *(ccv_comp_t*)ccv_array_get(seq2, i);
 				int flag = 1;
+				int lo = 0, hi = seq2->rnum;
+				while (lo < hi)
+				{
+					int mid = (lo + hi) / 2;
+					if (origin[mid].x < r1.rect.x + r1.rect.width - extent)
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
 
-				for(j = 0; j < seq2->rnum; j++)
+				for(k = lo; k < seq2->rnum && origin[k].x <= r1.rect.x + reach; k++)
 				{
+					j = origin[k].i;
 					ccv_comp_t r2 = *(ccv_comp_t*)ccv_array_get(seq2, j);
 					int distance = (int)(r2.rect.width * 0.25 + 0.5);
 
@@ -1358,22 +1791,20 @@ ccv_array_t* ccv_bbf_detect_objects(ccv_dense_matrix_t* a, ccv_bbf_classifier_ca
 				if(flag)
 					ccv_array_push(result_seq, &r1);
 			}
+			ccfree(origin);
 			ccv_array_free(idx_seq);
 			ccfree(comps);
 		}
 	}
+	ccfree(useq);
 
-	ccv_array_free(seq);
-	ccv_array_free(seq2);
-
-	ccv_array_t* result_seq2;
 	/* the following code from OpenCV's haar feature implementation */
 	if (params.flags & CCV_BBF_NO_NESTED)
 	{
-		result_seq2 = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
+		ccv_array_clear(seq);
 		idx_seq = 0;
 		// group retrieved rectangles in order to filter out noise
-		int ncomp = ccv_array_group(result_seq, &idx_seq, _ccv_is_equal, 0);
+		int ncomp = ccv_array_group_rect(result_seq, &idx_seq, _ccv_is_equal, 0, 0.25);
 		ccv_comp_t* comps = (ccv_comp_t*)ccmalloc((ncomp + 1) * sizeof(ccv_comp_t));
 		memset(comps, 0, (ncomp + 1) * sizeof(ccv_comp_t));
 
@@ -1395,27 +1826,103 @@ ccv_array_t* ccv_bbf_detect_objects(ccv_dense_matrix_t* a, ccv_bbf_classifier_ca
 		// calculate average bounding box
 		for(i = 0; i < ncomp; i++)
 			if(comps[i].neighbors)
-				ccv_array_push(result_seq2, &comps[i]);
+				ccv_array_push(seq, &comps[i]);
 
-		ccv_array_free(result_seq);
+		ccv_array_clear(result_seq);
+		for (i = 0; i < seq->rnum; i++)
+			ccv_array_push(result_seq, ccv_array_get(seq, i));
+		ccv_array_free(idx_seq);
 		ccfree(comps);
-	} else {
-		result_seq2 = result_seq;
 	}
+}
 
-	for (i = 1; i < scale_upto + next * 2; i++)
-		ccv_matrix_free(pyr[i * 4]);
+static ccv_array_t* _ccv_bbf_detect_objects(ccv_dense_matrix_t** pyr, ccv_bbf_classifier_cascade_t** _cascade, int count, int scale_upto, ccv_bbf_param_t params)
+{
+	ccv_bbf_compiled_cascade_t** compiled = (ccv_bbf_compiled_cascade_t**)alloca(count * scale_upto * sizeof(ccv_bbf_compiled_cascade_t*));
+	memset(compiled, 0, count * scale_upto * sizeof(ccv_bbf_compiled_cascade_t*));
+	ccv_array_t* seq = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
+	ccv_array_t* seq2 = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
+	ccv_array_t* result_seq = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
+	_ccv_bbf_detect(pyr, _cascade, compiled, count, scale_upto, params, seq, seq2, result_seq);
+	ccv_array_free(seq);
+	ccv_array_free(seq2);
+	return result_seq;
+}
+
+ccv_array_t* ccv_bbf_detect_objects(ccv_dense_matrix_t* a, ccv_bbf_classifier_cascade_t** _cascade, int count, ccv_bbf_param_t params)
+{
+	int next = params.interval + 1;
+	int scale_upto = _ccv_bbf_scale_upto(a->rows, a->cols, params);
+	ccv_dense_matrix_t** pyr = (ccv_dense_matrix_t**)alloca((scale_upto + next * 2) * 4 * sizeof(ccv_dense_matrix_t*));
+	memset(pyr, 0, (scale_upto + next * 2) * 4 * sizeof(ccv_dense_matrix_t*));
+	_ccv_bbf_build_pyramid(a, pyr, _cascade[0]->size, scale_upto, params);
+	ccv_array_t* result_seq = _ccv_bbf_detect_objects(pyr, _cascade, count, scale_upto, params);
+	_ccv_bbf_free_pyramid(pyr, _cascade[0]->size, scale_upto, params);
+	return result_seq;
+}
+
+ccv_array_t* ccv_bbf_detect_objects_on_pyramid(ccv_pyramid_t* pyramid, ccv_bbf_classifier_cascade_t** _cascade, int count, ccv_bbf_param_t params)
+{
+	/* the levels are taken as they are, thus, the image cannot be rescaled to params.size first */
+	assert(pyramid->interval == params.interval);
+	assert(params.size.height == _cascade[0]->size.height && params.size.width == _cascade[0]->size.width);
+	int next = params.interval + 1;
+	int scale_upto = _ccv_bbf_scale_upto(pyramid->a->rows, pyramid->a->cols, params);
+	ccv_dense_matrix_t** pyr = (ccv_dense_matrix_t**)alloca((scale_upto + next * 2) * 4 * sizeof(ccv_dense_matrix_t*));
+	memset(pyr, 0, (scale_upto + next * 2) * 4 * sizeof(ccv_dense_matrix_t*));
+	int i;
+	for (i = 0; i < scale_upto + next * 2; i++)
+		pyr[i * 4] = ccv_pyramid_level(pyramid, i, 0, 0);
 	if (params.accurate)
 		for (i = next * 2; i < scale_upto + next * 2; i++)
 		{
-			ccv_matrix_free(pyr[i * 4 + 1]);
-			ccv_matrix_free(pyr[i * 4 + 2]);
-			ccv_matrix_free(pyr[i * 4 + 3]);
+			pyr[i * 4 + 1] = ccv_pyramid_level(pyramid, i, 1, 0);
+			pyr[i * 4 + 2] = ccv_pyramid_level(pyramid, i, 0, 1);
+			pyr[i * 4 + 3] = ccv_pyramid_level(pyramid, i, 1, 1);
 		}
-	if (params.size.height != _cascade[0]->size.height || params.size.width != _cascade[0]->size.width)
-		ccv_matrix_free(pyr[0]);
+	/* the levels belong to the pyramid */
+	return _ccv_bbf_detect_objects(pyr, _cascade, count, scale_upto, params);
+}
 
-	return result_seq2;
+ccv_bbf_detector_t* ccv_bbf_detector_new(ccv_bbf_classifier_cascade_t** cascade, int count, int rows, int cols, ccv_bbf_param_t params)
+{
+	int next = params.interval + 1;
+	int scale_upto = _ccv_bbf_scale_upto(rows, cols, params);
+	ccv_bbf_detector_t* detector = (ccv_bbf_detector_t*)ccmalloc(sizeof(ccv_bbf_detector_t) + count * sizeof(ccv_bbf_classifier_cascade_t*) + (scale_upto + next * 2) * 4 * sizeof(ccv_dense_matrix_t*) + count * scale_upto * sizeof(ccv_bbf_compiled_cascade_t*));
+	detector->rows = rows;
+	detector->cols = cols;
+	detector->count = count;
+	detector->scale_upto = scale_upto;
+	detector->params = params;
+	detector->cascade = (ccv_bbf_classifier_cascade_t**)(detector + 1);
+	memcpy(detector->cascade, cascade, count * sizeof(ccv_bbf_classifier_cascade_t*));
+	detector->pyr = (ccv_dense_matrix_t**)(detector->cascade + count);
+	memset(detector->pyr, 0, (scale_upto + next * 2) * 4 * sizeof(ccv_dense_matrix_t*));
+	detector->compiled = (ccv_bbf_compiled_cascade_t**)(detector->pyr + (scale_upto + next * 2) * 4);
+	memset(detector->compiled, 0, count * scale_upto * sizeof(ccv_bbf_compiled_cascade_t*));
+	detector->seq = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
+	detector->seq2 = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
+	detector->result_seq = ccv_array_new(sizeof(ccv_comp_t), 64, 0);
+	return detector;
+}
+
+ccv_array_t* ccv_bbf_detector_detect_objects(ccv_bbf_detector_t* detector, ccv_dense_matrix_t* a)
+{
+	assert(a->rows == detector->rows && a->cols == detector->cols);
+	/* the pyramid is allocated by the first frame, and every later frame is computed in place */
+	_ccv_bbf_build_pyramid(a, detector->pyr, detector->cascade[0]->size, detector->scale_upto, detector->params);
+	_ccv_bbf_detect(detector->pyr, detector->cascade, detector->compiled, detector->count, detector->scale_upto, detector->params, detector->seq, detector->seq2, detector->result_seq);
+	return detector->result_seq;
+}
+
+void ccv_bbf_detector_free(ccv_bbf_detector_t* detector)
+{
+	if (detector->pyr[4]) // the pyramid is built
+		_ccv_bbf_free_pyramid(detector->pyr, detector->cascade[0]->size, detector->scale_upto, detector->params);
+	ccv_array_free(detector->seq);
+	ccv_array_free(detector->seq2);
+	ccv_array_free(detector->result_seq);
+	ccfree(detector);
 }
 
 ccv_bbf_classifier_cascade_t* ccv_load_bbf_classifier_cascade(const char* directory)
@@ -1428,6 +1935,9 @@ ccv_bbf_classifier_cascade_t* ccv_load_bbf_classifier_cascade(const char* direct
 		return 0;
 	ccv_bbf_classifier_cascade_t* cascade = (ccv_bbf_classifier_cascade_t*)ccmalloc(sizeof(ccv_bbf_classifier_cascade_t));
 	s = fscanf(r, "%d %d %d", &cascade->count, &cascade->size.width, &cascade->size.height);
+	cascade->map = 0;
+	cascade->map_size = 0;
+	cascade->compiled = 0;
 	cascade->stage_classifier = (ccv_bbf_stage_classifier_t*)ccmalloc(cascade->count * sizeof(ccv_bbf_stage_classifier_t));
 	for (i = 0; i < cascade->count; i++)
 	{
@@ -1449,6 +1959,9 @@ ccv_bbf_classifier_cascade_t* ccv_bbf_classifier_cascade_read_binary(char* s)
 	memcpy(&cascade->count, s, sizeof(cascade->count)); s += sizeof(cascade->count);
 	memcpy(&cascade->size.width, s, sizeof(cascade->size.width)); s += sizeof(cascade->size.width);
 	memcpy(&cascade->size.height, s, sizeof(cascade->size.height)); s += sizeof(cascade->size.height);
+	cascade->map = 0;
+	cascade->map_size = 0;
+	cascade->compiled = 0;
 	ccv_bbf_stage_classifier_t* classifier = cascade->stage_classifier = (ccv_bbf_stage_classifier_t*)ccmalloc(cascade->count * sizeof(ccv_bbf_stage_classifier_t));
 	for (i = 0; i < cascade->count; i++, classifier++)
 	{
@@ -1463,6 +1976,65 @@ ccv_bbf_classifier_cascade_t* ccv_bbf_classifier_cascade_read_binary(char* s)
 
 }
 
+ccv_bbf_classifier_cascade_t* ccv_bbf_classifier_cascade_map(const char* filename)
+{
+	/* every field of the binary format is a 4-byte int or float, thus, with the 12-byte header, the features and
+	 * the alphas of every stage stay 4-byte aligned in a page-aligned mapping, and can be used in place. The mapping
+	 * is read-only and shared, so forked processes share one physical copy of it */
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(int) * 3)
+	{
+		close(fd);
+		return 0;
+	}
+	char* map = (char*)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+	char* s = map;
+	char* end = map + st.st_size;
+	int count = ((int*)s)[0];
+	if (count < 0 || count > (st.st_size - sizeof(int) * 3) / (sizeof(int) + sizeof(float)))
+	{
+		munmap(map, st.st_size);
+		return 0;
+	}
+	ccv_bbf_classifier_cascade_t* cascade = (ccv_bbf_classifier_cascade_t*)ccmalloc(sizeof(ccv_bbf_classifier_cascade_t) + count * sizeof(ccv_bbf_stage_classifier_t));
+	cascade->count = count;
+	cascade->size.width = ((int*)s)[1];
+	cascade->size.height = ((int*)s)[2];
+	s += sizeof(int) * 3;
+	cascade->stage_classifier = (ccv_bbf_stage_classifier_t*)(cascade + 1);
+	cascade->map = map;
+	cascade->map_size = st.st_size;
+	cascade->compiled = 0;
+	int i;
+	ccv_bbf_stage_classifier_t* classifier = cascade->stage_classifier;
+	for (i = 0; i < count; i++, classifier++)
+	{
+		if (end - s < sizeof(int) + sizeof(float))
+			break;
+		classifier->count = ((int*)s)[0];
+		classifier->threshold = ((float*)s)[1];
+		s += sizeof(int) + sizeof(float);
+		if (classifier->count < 0 || (end - s) / (sizeof(ccv_bbf_feature_t) + 2 * sizeof(float)) < classifier->count)
+			break;
+		classifier->feature = (ccv_bbf_feature_t*)s;
+		s += classifier->count * sizeof(ccv_bbf_feature_t);
+		classifier->alpha = (float*)s;
+		s += classifier->count * 2 * sizeof(float);
+	}
+	if (i < count)
+	{
+		ccv_bbf_classifier_cascade_free(cascade);
+		return 0;
+	}
+	return cascade;
+}
+
 int ccv_bbf_classifier_cascade_write_binary(ccv_bbf_classifier_cascade_t* cascade, char* s, int slen)
 {
 	int i;
@@ -1490,6 +2062,14 @@ int ccv_bbf_classifier_cascade_write_binary(ccv_bbf_classifier_cascade_t* cascad
 void ccv_bbf_classifier_cascade_free(ccv_bbf_classifier_cascade_t* cascade)
 {
 	int i;
+	_ccv_bbf_compiled_cascade_drain(cascade);
+	if (cascade->map)
+	{
+		/* the stages are allocated together with the cascade */
+		munmap(cascade->map, cascade->map_size);
+		ccfree(cascade);
+		return;
+	}
 	for (i = 0; i < cascade->count; ++i)
 	{
 		ccfree(cascade->stage_classifier[i].feature);
@@ -1,27 +1,12 @@
 #include "ccv.h"
 #include "ccv_internal.h"
 
+/* the index and the ring outlive any arena scope (ccv_arena_begin), thus, they use the system allocator directly */
+
 #define CCV_GET_CACHE_TYPE(x) ((x) >> 60)
 #define CCV_GET_TERMINAL_AGE(x) (((x) >> 32) & 0x0FFFFFFF)
 #define CCV_GET_TERMINAL_SIZE(x) ((x) & 0xFFFFFFFF)
-#define CCV_SET_TERMINAL_TYPE(x, y, z) (((uint64_t)(x) << 60) | ((uint64_t)(y) << 32) | (z))
-
-void ccv_cache_init(ccv_cache_t* cache, size_t up, int cache_types, ccv_cache_index_free_f ffree, ...)
-{
-	assert(cache_types > 0 && cache_types <= 16);
-	cache->rnum = 0;
-	cache->age = 0;
-	cache->up = up;
-	cache->size = 0;
-	va_list arguments;
-	va_start(arguments, ffree);
-	int i;
-	cache->ffree[0] = ffree;
-	for (i = 1; i < cache_types; i++)
-		cache->ffree[i] = va_arg(arguments, ccv_cache_index_free_f);
-	va_end(arguments);
-	memset(&cache->origin, 0, sizeof(ccv_cache_index_t));
-}
+#define CCV_SET_TERMINAL_TYPE(x, y, z) (((uint64_t)(x) << 60) | ((uint64_t)((y) & 0x0FFFFFFF) << 32) | (z))
 
 static int bits_in_16bits[0x1u << 16];
 static int bits_in_16bits_init = 0;
@@ -47,60 +32,35 @@ static uint32_t compute_bits(uint64_t m) {
 			bits_in_16bits[(m >> 32) & 0xffff] + bits_in_16bits[(m >> 48) & 0xffff]);
 }
 
-/* udate age along a path in the radix tree */
-static void _ccv_cache_aging(ccv_cache_index_t* branch, uint64_t sign)
+void ccv_cache_init(ccv_cache_t* cache, size_t up, int cache_types, ccv_cache_index_free_f ffree, ...)
 {
+	/* initialize the table here as well, thus, the caches that are initialized before use by many threads don't race on it */
 	if (!bits_in_16bits_init)
 		precomputed_16bits();
+	assert(cache_types > 0 && cache_types <= 16);
+	cache->rnum = 0;
+	cache->age = 0;
+	cache->up = up;
+	cache->size = 0;
+	va_list arguments;
+	va_start(arguments, ffree);
 	int i;
-	uint64_t j = 63;
-	ccv_cache_index_t* breadcrumb[10];
-	for (i = 0; i < 10; i++)
-	{
-		breadcrumb[i] = branch;
-		int leaf = branch->terminal.off & 0x1;
-		int full = branch->terminal.off & 0x2;
-		if (leaf)
-		{
-			break;
-		} else {
-			ccv_cache_index_t* set = (ccv_cache_index_t*)(branch->branch.set - (branch->branch.set & 0x3));
-			int dice = (sign & j) >> (i * 6);
-			if (full)
-			{
-				branch = set + dice;
-			} else {
-				uint64_t k = 1;
-				k = k << dice;
-				if (k & branch->branch.bitmap) {
-					uint64_t m = (k - 1) & branch->branch.bitmap;
-					branch = set + compute_bits(m);
-				} else {
-					break;
-				}
-			}
-			j <<= 6;
-		}
-	}
-	assert(i < 10);
-	for (; i >= 0; i--)
-	{
-		branch = breadcrumb[i];
-		int leaf = branch->terminal.off & 0x1;
-		if (!leaf)
-		{
-			ccv_cache_index_t* set = (ccv_cache_index_t*)(branch->branch.set - (branch->branch.set & 0x3));
-			uint32_t total = compute_bits(branch->branch.bitmap);
-			uint32_t min_age = (set[0].terminal.off & 0x1) ? CCV_GET_TERMINAL_AGE(set[0].terminal.type) : set[0].branch.age;
-			for (j = 1; j < total; j++)
-			{
-				uint32_t age = (set[j].terminal.off & 0x1) ? CCV_GET_TERMINAL_AGE(set[j].terminal.type) : set[j].branch.age;
-				if (age < min_age)
-					min_age = age;
-			}
-			branch->branch.age = min_age;
-		}
-	}
+	cache->ffree[0] = ffree;
+	for (i = 1; i < cache_types; i++)
+		cache->ffree[i] = va_arg(arguments, ccv_cache_index_free_f);
+	va_end(arguments);
+	memset(&cache->origin, 0, sizeof(ccv_cache_index_t));
+	memset(&cache->stats, 0, sizeof(ccv_cache_stats_t));
+	cache->recency = 0;
+	cache->recency_head = cache->recency_count = cache->recency_size = 0;
+}
+
+static inline int _ccv_cache_stats_bin(uint64_t x)
+{
+	int i;
+	for (i = 0; x > 1 && i < CCV_CACHE_STATS_BINS - 1; i++)
+		x >>= 1;
+	return i;
 }
 
 static ccv_cache_index_t* _ccv_cache_seek(ccv_cache_index_t* branch, uint64_t sign, int* depth)
@@ -144,6 +104,7 @@ static ccv_cache_index_t* _ccv_cache_seek(ccv_cache_index_t* branch, uint64_t si
 
 void* ccv_cache_get(ccv_cache_t* cache, uint64_t sign, uint8_t* type)
 {
+	++cache->stats.lookups;
 	if (cache->rnum == 0)
 		return 0;
 	ccv_cache_index_t* branch = _ccv_cache_seek(&cache->origin, sign, 0);
@@ -156,54 +117,69 @@ void* ccv_cache_get(ccv_cache_t* cache, uint64_t sign, uint8_t* type)
 		return 0;
 	if (type)
 		*type = CCV_GET_CACHE_TYPE(branch->terminal.type);
+	++cache->stats.hits;
+	++cache->stats.hit_age[_ccv_cache_stats_bin((cache->age - CCV_GET_TERMINAL_AGE(branch->terminal.type)) & 0x0FFFFFFF)];
 	return (void*)(branch->terminal.off - (branch->terminal.off & 0x3));
 }
 
-// only call this function when the cache space is delpeted
-static void _ccv_cache_lru(ccv_cache_t* cache)
+/* whether the recency entry still refers to the object in the cache, it is stale if the object is out or is put
+ * again since then (thus, its age changed) */
+static int _ccv_cache_recency_is_current(ccv_cache_t* cache, ccv_cache_recency_t* recency)
 {
-	ccv_cache_index_t* branch = &cache->origin;
-	int leaf = branch->terminal.off & 0x1;
-	if (leaf)
+	ccv_cache_index_t* branch = _ccv_cache_seek(&cache->origin, recency->sign, 0);
+	return branch && (branch->terminal.off & 0x1) && branch->terminal.sign == recency->sign && CCV_GET_TERMINAL_AGE(branch->terminal.type) == recency->age;
+}
+
+static void _ccv_cache_recency_push(ccv_cache_t* cache, uint64_t sign, uint32_t age)
+{
+	if (cache->recency_count == cache->recency_size)
 	{
-		void* result = (void*)(branch->terminal.off - (branch->terminal.off & 0x3));
-		uint8_t type = CCV_GET_CACHE_TYPE(branch->terminal.type);
-		if (result != 0)
+		/* the ring is full, drop the stale entries into a new one that is twice the size of what's left, thus, the
+		 * rebuild happens at most once every recency_size / 2 puts, and costs O(1) per put amortized */
+		uint32_t i, j = 0;
+		for (i = 0; i < cache->recency_count; i++)
 		{
-			assert(type >= 0 && type < 16);
-			cache->ffree[type](result);
+			ccv_cache_recency_t* recency = cache->recency + (cache->recency_head + i) % cache->recency_size;
+			if (_ccv_cache_recency_is_current(cache, recency))
+				cache->recency[(cache->recency_head + j++) % cache->recency_size] = *recency;
 		}
-		cache->rnum = 0;
-		cache->size = 0;
-		return;
+		uint32_t size = ccv_max(64, j * 2);
+		ccv_cache_recency_t* ring = (ccv_cache_recency_t*)malloc(sizeof(ccv_cache_recency_t) * size);
+		for (i = 0; i < j; i++)
+			ring[i] = cache->recency[(cache->recency_head + i) % cache->recency_size];
+		free(cache->recency);
+		cache->recency = ring;
+		cache->recency_head = 0;
+		cache->recency_count = j;
+		cache->recency_size = size;
 	}
-	uint32_t min_age = branch->branch.age;
-	int i, j;
-	for (i = 0; i < 10; i++)
+	ccv_cache_recency_t* recency = cache->recency + (cache->recency_head + cache->recency_count) % cache->recency_size;
+	recency->sign = sign;
+	recency->age = age & 0x0FFFFFFF;
+	++cache->recency_count;
+}
+
+// only call this function when the cache space is delpeted
+static void _ccv_cache_lru(ccv_cache_t* cache)
+{
+	/* objects are taken out when found, thus, the least recently used one is the oldest put that is still in the
+	 * cache, skip the stale entries from the front of the ring until there is one */
+	while (cache->recency_count > 0)
 	{
-		ccv_cache_index_t* old_branch = branch;
-		int leaf = branch->terminal.off & 0x1;
-		if (leaf)
+		ccv_cache_recency_t recency = cache->recency[cache->recency_head];
+		cache->recency_head = (cache->recency_head + 1) % cache->recency_size;
+		--cache->recency_count;
+		if (_ccv_cache_recency_is_current(cache, &recency))
 		{
-			ccv_cache_delete(cache, branch->terminal.sign);
-			break;
-		} else {
-			ccv_cache_index_t* set = (ccv_cache_index_t*)(branch->branch.set - (branch->branch.set & 0x3));
-			uint32_t total = compute_bits(branch->branch.bitmap);
-			for (j = 0; j < total; j++)
-			{
-				uint32_t age = (set[j].terminal.off & 0x1) ? CCV_GET_TERMINAL_AGE(set[j].terminal.type) : set[j].branch.age;
-				assert(age >= min_age);
-				if (age == min_age)
-				{
-					branch = set + j;
-					break;
-				}
-			}
-			assert(old_branch != branch);
+			ccv_cache_index_t* branch = _ccv_cache_seek(&cache->origin, recency.sign, 0);
+			++cache->stats.evictions;
+			cache->stats.evicted_bytes += CCV_GET_TERMINAL_SIZE(branch->terminal.type);
+			++cache->stats.eviction_age[_ccv_cache_stats_bin((cache->age - CCV_GET_TERMINAL_AGE(branch->terminal.type)) & 0x0FFFFFFF)];
+			ccv_cache_delete(cache, recency.sign);
+			return;
 		}
 	}
-	assert(i < 10);
+	assert(0 && "every object in the cache should have a recency entry");
 }
 
 static void _ccv_cache_depleted(ccv_cache_t* cache, size_t size)
@@ -219,6 +195,8 @@ int ccv_cache_put(ccv_cache_t* cache, uint64_t sign, void* x, uint32_t size, uin
 		return -1;
 	if (size + cache->size > cache->up)
 		_ccv_cache_depleted(cache, cache->up - size);
+	++cache->stats.puts;
+	++cache->stats.size[_ccv_cache_stats_bin(size)];
 	if (cache->rnum == 0)
 	{
 		cache->age = 1;
@@ -227,6 +205,7 @@ int ccv_cache_put(ccv_cache_t* cache, uint64_t sign, void* x, uint32_t size, uin
 		cache->origin.terminal.type = CCV_SET_TERMINAL_TYPE(type, cache->age, size);
 		cache->size = size;
 		cache->rnum = 1;
+		_ccv_cache_recency_push(cache, sign, cache->age);
 		return 0;
 	}
 	++cache->age;
@@ -246,11 +225,10 @@ int ccv_cache_put(ccv_cache_t* cache, uint64_t sign, void* x, uint32_t size, uin
 			uint32_t old_size = CCV_GET_TERMINAL_SIZE(branch->terminal.type);
 			cache->size = cache->size + size - old_size;
 			branch->terminal.type = CCV_SET_TERMINAL_TYPE(type, cache->age, size);
-			_ccv_cache_aging(&cache->origin, sign);
+			_ccv_cache_recency_push(cache, sign, cache->age);
 			return 1;
 		} else {
 			ccv_cache_index_t t = *branch;
-			uint32_t age = CCV_GET_TERMINAL_AGE(branch->terminal.type);
 			uint64_t j = 63;
 			j = j << (depth * 6);
 			int dice, udice;
@@ -262,10 +240,9 @@ int ccv_cache_put(ccv_cache_t* cache, uint64_t sign, void* x, uint32_t size, uin
 				if (dice == udice)
 				{
 					branch->branch.bitmap = on << dice;
-					ccv_cache_index_t* set = (ccv_cache_index_t*)ccmalloc(sizeof(ccv_cache_index_t));
+					ccv_cache_index_t* set = (ccv_cache_index_t*)malloc(sizeof(ccv_cache_index_t));
 					assert(((uint64_t)set & 0x3) == 0);
 					branch->branch.set = (uint64_t)set;
-					branch->branch.age = age;
 					branch = set;
 				} else {
 					break;
@@ -273,10 +250,9 @@ int ccv_cache_put(ccv_cache_t* cache, uint64_t sign, void* x, uint32_t size, uin
 				j <<= 6;
 			}
 			branch->branch.bitmap = (on << dice) | (on << udice);
-			ccv_cache_index_t* set = (ccv_cache_index_t*)ccmalloc(sizeof(ccv_cache_index_t) * 2);
+			ccv_cache_index_t* set = (ccv_cache_index_t*)malloc(sizeof(ccv_cache_index_t) * 2);
 			assert(((uint64_t)set & 0x3) == 0);
 			branch->branch.set = (uint64_t)set;
-			branch->branch.age = age;
 			int u = dice < udice;
 			set[u].terminal.sign = sign;
 			set[u].terminal.off = (uint64_t)x | 0x1;
@@ -290,7 +266,7 @@ int ccv_cache_put(ccv_cache_t* cache, uint64_t sign, void* x, uint32_t size, uin
 		uint32_t start = compute_bits(m);
 		uint32_t total = compute_bits(branch->branch.bitmap);
 		ccv_cache_index_t* set = (ccv_cache_index_t*)(branch->branch.set - (branch->branch.set & 0x3));
-		set = (ccv_cache_index_t*)ccrealloc(set, sizeof(ccv_cache_index_t) * (total + 1));
+		set = (ccv_cache_index_t*)realloc(set, sizeof(ccv_cache_index_t) * (total + 1));
 		assert(((uint64_t)set & 0x3) == 0);
 		for (i = total; i > start; i--)
 			set[i] = set[i - 1];
@@ -304,6 +280,7 @@ int ccv_cache_put(ccv_cache_t* cache, uint64_t sign, void* x, uint32_t size, uin
 	}
 	cache->rnum++;
 	cache->size += size;
+	_ccv_cache_recency_push(cache, sign, cache->age);
 	return 0;
 }
 
@@ -320,7 +297,7 @@ static void _ccv_cache_cleanup(ccv_cache_index_t* branch)
 			if (!(set[i].terminal.off & 0x1))
 				_ccv_cache_cleanup(set + i);
 		}
-		ccfree(set);
+		free(set);
 	}
 }
 
@@ -334,14 +311,14 @@ static void _ccv_cache_cleanup_and_free(ccv_cache_index_t* branch, ccv_cache_ind
 		ccv_cache_index_t* set = (ccv_cache_index_t*)(branch->branch.set - (branch->branch.set & 0x3));
 		for (i = 0; i < total; i++)
 			_ccv_cache_cleanup_and_free(set + i, ffree);
-		ccfree(set);
+		free(set);
 	} else {
 		assert(CCV_GET_CACHE_TYPE(branch->terminal.type) >= 0 && CCV_GET_CACHE_TYPE(branch->terminal.type) < 16);
 		ffree[CCV_GET_CACHE_TYPE(branch->terminal.type)]((void*)(branch->terminal.off - (branch->terminal.off & 0x3)));
 	}
 }
 
-void* ccv_cache_out(ccv_cache_t* cache, uint64_t sign, uint8_t* type)
+static void* _ccv_cache_out(ccv_cache_t* cache, uint64_t sign, uint8_t* type, uint32_t* age)
 {
 	if (!bits_in_16bits_init)
 		precomputed_16bits();
@@ -393,6 +370,8 @@ void* ccv_cache_out(ccv_cache_t* cache, uint64_t sign, uint8_t* type)
 	void* result = (void*)(branch->terminal.off - (branch->terminal.off & 0x3));
 	if (type)
 		*type = CCV_GET_CACHE_TYPE(branch->terminal.type);
+	if (age)
+		*age = (cache->age - CCV_GET_TERMINAL_AGE(branch->terminal.type)) & 0x0FFFFFFF;
 	uint32_t size = CCV_GET_TERMINAL_SIZE(branch->terminal.type);
 	if (branch != &cache->origin)
 	{
@@ -409,27 +388,40 @@ void* ccv_cache_out(ccv_cache_t* cache, uint64_t sign, uint8_t* type)
 			parent->branch.bitmap &= ~k;
 			for (i = start + 1; i < total; i++)
 				set[i - 1] = set[i];
-			set = (ccv_cache_index_t*)ccrealloc(set, sizeof(ccv_cache_index_t) * (total - 1));
+			set = (ccv_cache_index_t*)realloc(set, sizeof(ccv_cache_index_t) * (total - 1));
 			parent->branch.set = (uint64_t)set;
 		} else {
 			ccv_cache_index_t t = set[1 - start];
 			_ccv_cache_cleanup(uncle);
 			*uncle = t;
 		}
-		_ccv_cache_aging(&cache->origin, sign);
 	} else {
-		// if I only have one item, reset age to 1
+		// if I only have one item, reset age to 1, and all the recency entries are stale now
 		cache->age = 1;
+		cache->recency_head = cache->recency_count = 0;
 	}
 	cache->rnum--;
 	cache->size -= size;
 	return result;
 }
 
+void* ccv_cache_out(ccv_cache_t* cache, uint64_t sign, uint8_t* type)
+{
+	++cache->stats.lookups;
+	uint32_t age;
+	void* result = _ccv_cache_out(cache, sign, type, &age);
+	if (result)
+	{
+		++cache->stats.hits;
+		++cache->stats.hit_age[_ccv_cache_stats_bin(age)];
+	}
+	return result;
+}
+
 int ccv_cache_delete(ccv_cache_t* cache, uint64_t sign)
 {
 	uint8_t type = 0;
-	void* result = ccv_cache_out(cache, sign, &type);
+	void* result = _ccv_cache_out(cache, sign, &type, 0);
 	if (result != 0)
 	{
 		assert(type >= 0 && type < 16);
@@ -448,6 +440,7 @@ void ccv_cache_cleanup(ccv_cache_t* cache)
 		cache->age = 0;
 		cache->rnum = 0;
 		memset(&cache->origin, 0, sizeof(ccv_cache_index_t));
+		cache->recency_head = cache->recency_count = 0;
 	}
 }
 
@@ -456,4 +449,7 @@ void ccv_cache_close(ccv_cache_t* cache)
 	// for radix-tree based cache, close/cleanup are the same (it is not the same for cuckoo based one,
 	// because for cuckoo based one, it will free up space in close whereas only cleanup space in cleanup
 	ccv_cache_cleanup(cache);
+	free(cache->recency);
+	cache->recency = 0;
+	cache->recency_size = 0;
 }
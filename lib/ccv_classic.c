@@ -1,46 +1,296 @@
 #include "ccv.h"
 #include "ccv_internal.h"
 
-void ccv_hog(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int b_type, int sbin, int size)
+typedef struct {
+	ccv_dense_matrix_t* a;
+	ccv_dense_matrix_t* ag;
+	ccv_dense_matrix_t* mg;
+	ccv_dense_matrix_t* cn;
+	ccv_dense_matrix_t* ca;
+	ccv_dense_matrix_t* b;
+	int sbin;
+	int size;
+} ccv_hog_band_t;
+
+#ifdef HAVE_SSE2
+/* the fused path of 9 bins on 8-bit images (what the dpm pyramid computes), the gradient, the orientation and the votes
+ * of a pixel row are computed in one go from the image rather than from the full-size matrices of ccv_gradient */
+
+/* the 1x3 and 3x1 sobel of ccv_gradient(a, .., 1, 1) on the pixel row i */
+static void _ccv_hog_gradient_8u(ccv_dense_matrix_t* a, int i, float* dx, float* dy)
 {
-	assert(a->rows >= size && a->cols >= size && (4 + sbin * 3) <= CCV_MAX_CHANNEL);
-	int rows = a->rows / size;
-	int cols = a->cols / size;
-	b_type = (CCV_GET_DATA_TYPE(b_type) == CCV_64F) ? CCV_64F | (4 + sbin * 3) : CCV_32F | (4 + sbin * 3);
-	ccv_declare_derived_signature(sig, a->sig != 0, ccv_sign_with_format(64, "ccv_hog(%d,%d)", sbin, size), a->sig, 0);
-	ccv_dense_matrix_t* db = *b = ccv_dense_matrix_renew(*b, rows, cols, CCV_64F | CCV_32F | (4 + sbin * 3), b_type, sig);
-	ccv_object_return_if_cached(, db);
-	ccv_dense_matrix_t* ag = 0;
-	ccv_dense_matrix_t* mg = 0;
-	ccv_gradient(a, &ag, 0, &mg, 0, 1, 1);
-	float* agp = ag->data.f32;
-	float* mgp = mg->data.f32;
-	int i, j, k, ch = CCV_GET_CHANNEL(a->type);
-	ccv_dense_matrix_t* cn = ccv_dense_matrix_new(rows, cols, CCV_GET_DATA_TYPE(db->type) | (sbin * 2), 0, 0);
-	ccv_dense_matrix_t* ca = ccv_dense_matrix_new(rows, cols, CCV_GET_DATA_TYPE(db->type) | CCV_C1, 0, 0);
-	ccv_zero(cn);
-	// normalize sbin direction-sensitive and sbin * 2 insensitive over 4 normalization factor
-	// accumulating them over sbin * 2 + sbin + 4 channels
-	// TNA - truncation - normalization - accumulation
-#define TNA(_for_type, idx, a, b, c, d) \
-	{ \
-		_for_type norm = 1.0 / sqrt(cap[a] + cap[b] + cap[c] + cap[d] + 1e-4); \
-		for (k = 0; k < sbin * 2; k++) \
-		{ \
-			_for_type v = 0.5 * ccv_min(cnp[k] * norm, 0.2); \
-			dbp[4 + sbin + k] += v; \
-			dbp[idx] += v; \
-		} \
-		dbp[idx] *= 0.2357; \
-		for (k = 0; k < sbin; k++) \
-		{ \
-			_for_type v = 0.5 * ccv_min((cnp[k] + cnp[k + sbin]) * norm, 0.2); \
-			dbp[4 + k] += v; \
-		} \
+	int ch = CCV_GET_CHANNEL(a->type);
+	int len = a->cols * ch;
+	int j;
+	unsigned char* a_ptr = a->data.u8 + i * a->step;
+	unsigned char* up = (i > 0) ? a_ptr - a->step : a_ptr;
+	unsigned char* down = (i < a->rows - 1) ? a_ptr + a->step : a_ptr;
+	float scale = (i > 0 && i < a->rows - 1) ? 2 : 1;
+	__m128i z = _mm_setzero_si128();
+	__m128 scale4 = _mm_set1_ps(scale);
+	__m128 two4 = _mm_set1_ps(2);
+	for (j = 0; j <= len - 8; j += 8)
+	{
+		__m128i d = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(down + j)), z), _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(up + j)), z));
+		_mm_storeu_ps(dy + j, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16)), scale4));
+		_mm_storeu_ps(dy + j + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16)), scale4));
+	}
+	for (; j < len; j++)
+		dy[j] = scale * (down[j] - up[j]);
+	for (j = 0; j < ch; j++)
+	{
+		dx[j] = a_ptr[ch + j] - a_ptr[j];
+		dx[len - ch + j] = a_ptr[len - ch + j] - a_ptr[len - ch * 2 + j];
+	}
+	for (j = ch; j <= len - ch - 8; j += 8)
+	{
+		__m128i d = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(a_ptr + j + ch)), z), _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(a_ptr + j - ch)), z));
+		_mm_storeu_ps(dx + j, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16)), two4));
+		_mm_storeu_ps(dx + j + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16)), two4));
+	}
+	for (; j < len - ch; j++)
+		dx[j] = 2 * (a_ptr[j + ch] - a_ptr[j - ch]);
+}
+
+static void _ccv_hog_histogram_8u_9(void* context, int start, int end)
+{
+	ccv_hog_band_t* band = (ccv_hog_band_t*)context;
+	ccv_dense_matrix_t* a = band->a;
+	ccv_dense_matrix_t* cn = band->cn;
+	ccv_dense_matrix_t* ca = band->ca;
+	int size = band->size;
+	int rows = cn->rows;
+	int cols = cn->cols;
+	int ch = CCV_GET_CHANNEL(a->type);
+	int len = a->cols * ch;
+	int w = cols * size;
+	int i, j, k;
+	float* dx = (float*)ccmalloc(sizeof(float) * (len * 2 + w * 8 + 18 * (cols + 2)));
+	float* dy = dx + len;
+	float* sx = dy + len;
+	float* sy = sx + w;
+	float* ag = sy + w;
+	float* mg = ag + w;
+	float* w0 = mg + w;
+	float* w1 = w0 + w;
+	float* vx0 = w1 + w;
+	float* vx1 = vx0 + w;
+	/* the votes of a pixel row, with a cell of padding on both sides for the pixels on the left / right border */
+	float* h = vx1 + w;
+	int* ag0 = (int*)ccmalloc(sizeof(int) * w * 3);
+	int* ag1 = ag0 + w;
+	int* cx = ag1 + w;
+	for (j = 0; j < w; j++)
+	{
+		float xp = ((float)j + 0.5) / (float)size - 0.5;
+		int ixp = (int)floor(xp);
+		vx0[j] = xp - ixp;
+		vx1[j] = 1.0 - vx0[j];
+		cx[j] = (ixp + 1) * 18;
+	}
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1);
+	__m128 max = _mm_set1_ps(359.99f);
+	__m128 bin = _mm_set1_ps(18.0f / 360.0f);
+	__m128 norm = _mm_set1_ps(1.0f / 255.0f);
+	__m128i _1 = _mm_set1_epi32(1);
+	__m128i _18 = _mm_set1_epi32(18);
+	int first = ccv_max(start - 1, 0) * size;
+	int last = ccv_min(end + 1, rows) * size;
+	for (i = first; i < last; i++)
+	{
+		float yp = ((float)i + 0.5) / (float)size - 0.5;
+		int iyp = (int)floor(yp);
+		float vy0 = yp - iyp;
+		float vy1 = 1.0 - vy0;
+		int top = (iyp >= start && iyp < end);
+		int bottom = (iyp + 1 >= start && iyp + 1 < end);
+		if (!top && !bottom)
+			continue;
+		_ccv_hog_gradient_8u(a, i, dx, dy);
+		float* gx = dx;
+		float* gy = dy;
+		if (ch > 1)
+		{
+			/* the channel of the largest magnitude, x * x + y * y of integers is exact, thus, it picks the same one as
+			 * the comparison on the magnitudes */
+			for (j = 0; j < w; j++)
+			{
+				float x = dx[j * ch], y = dy[j * ch];
+				float m = x * x + y * y;
+				for (k = 1; k < ch; k++)
+				{
+					float xk = dx[j * ch + k], yk = dy[j * ch + k];
+					float mk = xk * xk + yk * yk;
+					if (mk > m)
+						m = mk, x = xk, y = yk;
+				}
+				sx[j] = x;
+				sy[j] = y;
+			}
+			gx = sx;
+			gy = sy;
+		}
+		_ccv_atan2(gx, gy, ag, mg, w);
+		for (j = 0; j <= w - 4; j += 4)
+		{
+			__m128 r = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(ag + j), zero), max), bin);
+			__m128i b0 = _mm_cvttps_epi32(r);
+			__m128i b1 = _mm_add_epi32(b0, _1);
+			b1 = _mm_andnot_si128(_mm_cmpeq_epi32(b1, _18), b1);
+			r = _mm_sub_ps(r, _mm_cvtepi32_ps(b0));
+			__m128 m = _mm_mul_ps(_mm_loadu_ps(mg + j), norm);
+			_mm_storeu_ps(w0 + j, _mm_mul_ps(_mm_sub_ps(one, r), m));
+			_mm_storeu_ps(w1 + j, _mm_mul_ps(r, m));
+			_mm_storeu_si128((__m128i*)(ag0 + j), b0);
+			_mm_storeu_si128((__m128i*)(ag1 + j), b1);
+		}
+		for (; j < w; j++)
+		{
+			float r = ccv_clamp(ag[j], 0, 359.99f) * (18.0f / 360.0f);
+			ag0[j] = (int)r;
+			ag1[j] = (ag0[j] + 1 < 18) ? ag0[j] + 1 : 0;
+			r = r - ag0[j];
+			float m = mg[j] * (1.0f / 255.0f);
+			w0[j] = (1.0f - r) * m;
+			w1[j] = r * m;
+		}
+		memset(h, 0, sizeof(float) * 18 * (cols + 2));
+		for (j = 0; j < w; j++)
+		{
+			float* hp = h + cx[j];
+			hp[ag0[j]] += w0[j] * vx1[j];
+			hp[ag1[j]] += w1[j] * vx1[j];
+			hp[18 + ag0[j]] += w0[j] * vx0[j];
+			hp[18 + ag1[j]] += w1[j] * vx0[j];
+		}
+		/* the row votes into the cell row above it and the one below it */
+		for (k = 0; k < 2; k++)
+		{
+			if (!(k ? bottom : top))
+				continue;
+			float* cnp = (float*)ccv_get_dense_matrix_cell(cn, iyp + k, 0, 0);
+			float* hp = h + 18;
+			__m128 vy = _mm_set1_ps(k ? vy0 : vy1);
+			for (j = 0; j <= cols * 18 - 4; j += 4)
+				_mm_storeu_ps(cnp + j, _mm_add_ps(_mm_loadu_ps(cnp + j), _mm_mul_ps(_mm_loadu_ps(hp + j), vy)));
+			for (; j < cols * 18; j++)
+				cnp[j] += hp[j] * (k ? vy0 : vy1);
+		}
 	}
+	for (i = start; i < end; i++)
+	{
+		float* cnp = (float*)ccv_get_dense_matrix_cell(cn, i, 0, 0);
+		float* cap = (float*)ccv_get_dense_matrix_cell(ca, i, 0, 0);
+		for (j = 0; j < cols; j++)
+		{
+			cap[j] = 0;
+			for (k = 0; k < 9; k++)
+				cap[j] += (cnp[k] + cnp[k + 9]) * (cnp[k] + cnp[k + 9]);
+			cnp += 18;
+		}
+	}
+	ccfree(ag0);
+	ccfree(dx);
+}
+
+/* the 31 features of a cell, 4 texture features, 9 contrast-insensitive and 18 contrast-sensitive ones, normalized
+ * by the 4 blocks of 2x2 cells around it (the same as TNA below), the border cells take themselves as the neighbors
+ * outside */
+static void _ccv_hog_normalize_9(void* context, int start, int end)
+{
+	ccv_hog_band_t* band = (ccv_hog_band_t*)context;
+	ccv_dense_matrix_t* cn = band->cn;
+	ccv_dense_matrix_t* ca = band->ca;
+	ccv_dense_matrix_t* db = band->b;
+	int rows = cn->rows;
+	int cols = cn->cols;
+	int i, j, k;
+	__m128 eps = _mm_set1_ps(1e-4f);
+	__m128 one = _mm_set1_ps(1);
+	__m128 truncation = _mm_set1_ps(0.2f);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 texture = _mm_set1_ps(0.5f * 0.2357f);
+	for (i = start; i < end; i++)
+	{
+		float* cap = (float*)ccv_get_dense_matrix_cell(ca, i, 0, 0);
+		float* capu = (float*)ccv_get_dense_matrix_cell(ca, ccv_max(i - 1, 0), 0, 0);
+		float* capd = (float*)ccv_get_dense_matrix_cell(ca, ccv_min(i + 1, rows - 1), 0, 0);
+		float* cnp = (float*)ccv_get_dense_matrix_cell(cn, i, 0, 0);
+		float* dbp = (float*)ccv_get_dense_matrix_cell(db, i, 0, 0);
+		for (j = 0; j < cols; j++)
+		{
+			int l = ccv_max(j - 1, 0);
+			int r = ccv_min(j + 1, cols - 1);
+			/* the block on the bottom right, top right, bottom left and top left */
+			float n4[4];
+			_mm_storeu_ps(n4, _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_set_ps(cap[l] + capu[l] + capu[j] + cap[j], cap[l] + capd[l] + capd[j] + cap[j], cap[r] + capu[r] + capu[j] + cap[j], cap[r] + capd[r] + capd[j] + cap[j]), eps))));
+			__m128 c0 = _mm_loadu_ps(cnp);
+			__m128 c1 = _mm_loadu_ps(cnp + 4);
+			__m128 c2 = _mm_loadu_ps(cnp + 8);
+			__m128 c3 = _mm_loadu_ps(cnp + 12);
+			__m128 c4 = _mm_loadl_pi(_mm_setzero_ps(), (__m64*)(cnp + 16));
+			__m128 u0 = _mm_add_ps(c0, _mm_loadu_ps(cnp + 9));
+			__m128 u1 = _mm_add_ps(c1, _mm_loadu_ps(cnp + 13));
+			__m128 u2 = _mm_add_ss(_mm_load_ss(cnp + 8), _mm_load_ss(cnp + 17));
+			__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps(), s4 = _mm_setzero_ps();
+			__m128 i0 = _mm_setzero_ps(), i1 = _mm_setzero_ps(), i2 = _mm_setzero_ps();
+			__m128 t[4];
+			for (k = 0; k < 4; k++)
+			{
+				__m128 n = _mm_set1_ps(n4[k]);
+				__m128 v0 = _mm_min_ps(_mm_mul_ps(c0, n), truncation);
+				__m128 v1 = _mm_min_ps(_mm_mul_ps(c1, n), truncation);
+				__m128 v2 = _mm_min_ps(_mm_mul_ps(c2, n), truncation);
+				__m128 v3 = _mm_min_ps(_mm_mul_ps(c3, n), truncation);
+				__m128 v4 = _mm_min_ps(_mm_mul_ps(c4, n), truncation);
+				s0 = _mm_add_ps(s0, v0);
+				s1 = _mm_add_ps(s1, v1);
+				s2 = _mm_add_ps(s2, v2);
+				s3 = _mm_add_ps(s3, v3);
+				s4 = _mm_add_ps(s4, v4);
+				t[k] = _mm_add_ps(_mm_add_ps(_mm_add_ps(v0, v1), _mm_add_ps(v2, v3)), v4);
+				i0 = _mm_add_ps(i0, _mm_min_ps(_mm_mul_ps(u0, n), truncation));
+				i1 = _mm_add_ps(i1, _mm_min_ps(_mm_mul_ps(u1, n), truncation));
+				i2 = _mm_add_ps(i2, _mm_min_ps(_mm_mul_ps(u2, n), truncation));
+			}
+			_MM_TRANSPOSE4_PS(t[0], t[1], t[2], t[3]);
+			_mm_storeu_ps(dbp, _mm_mul_ps(_mm_add_ps(_mm_add_ps(t[0], t[1]), _mm_add_ps(t[2], t[3])), texture));
+			_mm_storeu_ps(dbp + 4, _mm_mul_ps(i0, half));
+			_mm_storeu_ps(dbp + 8, _mm_mul_ps(i1, half));
+			_mm_store_ss(dbp + 12, _mm_mul_ss(i2, half));
+			_mm_storeu_ps(dbp + 13, _mm_mul_ps(s0, half));
+			_mm_storeu_ps(dbp + 17, _mm_mul_ps(s1, half));
+			_mm_storeu_ps(dbp + 21, _mm_mul_ps(s2, half));
+			_mm_storeu_ps(dbp + 25, _mm_mul_ps(s3, half));
+			_mm_storel_pi((__m64*)(dbp + 29), _mm_mul_ps(s4, half));
+			cnp += 18;
+			dbp += 31;
+		}
+	}
+}
+#endif
+
+/* the histograms of the cell rows [start, end), a pixel row votes into the cell row above and the one below it,
+ * thus, a band goes through the pixel rows of the cells on its border too, but only counts the votes into its own */
+static void _ccv_hog_histogram(void* context, int start, int end)
+{
+	ccv_hog_band_t* band = (ccv_hog_band_t*)context;
+	ccv_dense_matrix_t* cn = band->cn;
+	ccv_dense_matrix_t* ca = band->ca;
+	int sbin = band->sbin;
+	int size = band->size;
+	int rows = cn->rows;
+	int cols = cn->cols;
+	int ch = CCV_GET_CHANNEL(band->ag->type);
+	int i, j, k;
+	int first = ccv_max(start - 1, 0) * size;
+	int last = ccv_min(end + 1, rows) * size;
+	float* agp = band->ag->data.f32 + first * band->ag->cols * ch;
+	float* mgp = band->mg->data.f32 + first * band->mg->cols * ch;
 #define for_block(_, _for_type) \
 	_for_type* cnp = (_for_type*)ccv_get_dense_matrix_cell(cn, 0, 0, 0); \
-	for (i = 0; i < rows * size; i++) \
+	for (i = first; i < last; i++) \
 	{ \
 		for (j = 0; j < cols * size; j++) \
 		{ \
@@ -68,35 +318,33 @@ void ccv_hog(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int b_type, int sbin
 			_for_type vx0 = xp - ixp; \
 			_for_type vy1 = 1.0 - vy0; \
 			_for_type vx1 = 1.0 - vx0; \
-			if (ixp >= 0 && iyp >= 0) \
+			if (ixp >= 0 && iyp >= start && iyp < end) \
 			{ \
-				cnp[iyp * cn->cols * sbin * 2 + ixp * sbin * 2 + ag0] += agr1 * vx1 * vy1 * mgv; \
-				cnp[iyp * cn->cols * sbin * 2 + ixp * sbin * 2 + ag1] += agr0 * vx1 * vy1 * mgv; \
+				cnp[iyp * cols * sbin * 2 + ixp * sbin * 2 + ag0] += agr1 * vx1 * vy1 * mgv; \
+				cnp[iyp * cols * sbin * 2 + ixp * sbin * 2 + ag1] += agr0 * vx1 * vy1 * mgv; \
 			} \
-			if (ixp + 1 < cn->cols && iyp >= 0) \
+			if (ixp + 1 < cols && iyp >= start && iyp < end) \
 			{ \
-				cnp[iyp * cn->cols * sbin * 2 + (ixp + 1) * sbin * 2 + ag0] += agr1 * vx0 * vy1 * mgv; \
-				cnp[iyp * cn->cols * sbin * 2 + (ixp + 1) * sbin * 2 + ag1] += agr0 * vx0 * vy1 * mgv; \
+				cnp[iyp * cols * sbin * 2 + (ixp + 1) * sbin * 2 + ag0] += agr1 * vx0 * vy1 * mgv; \
+				cnp[iyp * cols * sbin * 2 + (ixp + 1) * sbin * 2 + ag1] += agr0 * vx0 * vy1 * mgv; \
 			} \
-			if (ixp >= 0 && iyp + 1 < cn->rows) \
+			if (ixp >= 0 && iyp + 1 >= start && iyp + 1 < end) \
 			{ \
-				cnp[(iyp + 1) * cn->cols * sbin * 2 + ixp * sbin * 2 + ag0] += agr1 * vx1 * vy0 * mgv; \
-				cnp[(iyp + 1) * cn->cols * sbin * 2 + ixp * sbin * 2 + ag1] += agr0 * vx1 * vy0 * mgv; \
+				cnp[(iyp + 1) * cols * sbin * 2 + ixp * sbin * 2 + ag0] += agr1 * vx1 * vy0 * mgv; \
+				cnp[(iyp + 1) * cols * sbin * 2 + ixp * sbin * 2 + ag1] += agr0 * vx1 * vy0 * mgv; \
 			} \
-			if (ixp + 1 < cn->cols && iyp + 1 < cn->rows) \
+			if (ixp + 1 < cols && iyp + 1 >= start && iyp + 1 < end) \
 			{ \
-				cnp[(iyp + 1) * cn->cols * sbin * 2 + (ixp + 1) * sbin * 2 + ag0] += agr1 * vx0 * vy0 * mgv; \
-				cnp[(iyp + 1) * cn->cols * sbin * 2 + (ixp + 1) * sbin * 2 + ag1] += agr0 * vx0 * vy0 * mgv; \
+				cnp[(iyp + 1) * cols * sbin * 2 + (ixp + 1) * sbin * 2 + ag0] += agr1 * vx0 * vy0 * mgv; \
+				cnp[(iyp + 1) * cols * sbin * 2 + (ixp + 1) * sbin * 2 + ag1] += agr0 * vx0 * vy0 * mgv; \
 			} \
 		} \
-		agp += a->cols * ch; \
-		mgp += a->cols * ch; \
+		agp += band->ag->cols * ch; \
+		mgp += band->mg->cols * ch; \
 	} \
-	ccv_matrix_free(ag); \
-	ccv_matrix_free(mg); \
-	cnp = (_for_type*)ccv_get_dense_matrix_cell(cn, 0, 0, 0); \
-	_for_type* cap = (_for_type*)ccv_get_dense_matrix_cell(ca, 0, 0, 0); \
-	for (i = 0; i < rows; i++) \
+	cnp = (_for_type*)ccv_get_dense_matrix_cell(cn, start, 0, 0); \
+	_for_type* cap = (_for_type*)ccv_get_dense_matrix_cell(ca, start, 0, 0); \
+	for (i = start; i < end; i++) \
 	{ \
 		for (j = 0; j < cols; j++) \
 		{ \
@@ -106,90 +354,316 @@ void ccv_hog(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int b_type, int sbin
 			cnp += 2 * sbin; \
 			cap++; \
 		} \
-	} \
-	cnp = (_for_type*)ccv_get_dense_matrix_cell(cn, 0, 0, 0); \
-	cap = (_for_type*)ccv_get_dense_matrix_cell(ca, 0, 0, 0); \
-	ccv_zero(db); \
-	_for_type* dbp = (_for_type*)ccv_get_dense_matrix_cell(db, 0, 0, 0); \
-	TNA(_for_type, 0, 1, cols + 1, cols, 0); \
-	TNA(_for_type, 1, 1, 1, 0, 0); \
-	TNA(_for_type, 2, 0, cols, cols, 0); \
-	TNA(_for_type, 3, 0, 0, 0, 0); \
-	cnp += 2 * sbin; \
-	dbp += 3 * sbin + 4; \
-	cap++; \
-	for (j = 1; j < cols - 1; j++) \
-	{ \
-		TNA(_for_type, 0, 1, cols + 1, cols, 0); \
-		TNA(_for_type, 1, 1, 1, 0, 0); \
-		TNA(_for_type, 2, -1, cols - 1, cols, 0); \
-		TNA(_for_type, 3, -1, -1, 0, 0); \
-		cnp += 2 * sbin; \
-		dbp += 3 * sbin + 4; \
-		cap++; \
-	} \
-	TNA(_for_type, 0, 0, cols, cols, 0); \
-	TNA(_for_type, 1, 0, 0, 0, 0); \
-	TNA(_for_type, 2, -1, cols - 1, cols, 0); \
-	TNA(_for_type, 3, -1, -1, 0, 0); \
-	cnp += 2 * sbin; \
-	dbp += 3 * sbin + 4; \
-	cap++; \
-	for (i = 1; i < rows - 1; i++) \
+	}
+	ccv_matrix_typeof(cn->type, for_block);
+#undef for_block
+}
+
+// normalize sbin direction-sensitive and sbin * 2 insensitive over 4 normalization factor
+// accumulating them over sbin * 2 + sbin + 4 channels
+// TNA - truncation - normalization - accumulation
+#define TNA(_for_type, idx, a, b, c, d) \
 	{ \
-		TNA(_for_type, 0, 1, cols + 1, cols, 0); \
-		TNA(_for_type, 1, 1, -cols + 1, -cols, 0); \
-		TNA(_for_type, 2, 0, cols, cols, 0); \
-		TNA(_for_type, 3, 0, -cols, -cols, 0); \
-		cnp += 2 * sbin; \
-		dbp += 3 * sbin + 4; \
-		cap++; \
-		for (j = 1; j < cols - 1; j++) \
+		_for_type norm = 1.0 / sqrt(cap[a] + cap[b] + cap[c] + cap[d] + 1e-4); \
+		for (k = 0; k < sbin * 2; k++) \
+		{ \
+			_for_type v = 0.5 * ccv_min(cnp[k] * norm, 0.2); \
+			dbp[4 + sbin + k] += v; \
+			dbp[idx] += v; \
+		} \
+		dbp[idx] *= 0.2357; \
+		for (k = 0; k < sbin; k++) \
+		{ \
+			_for_type v = 0.5 * ccv_min((cnp[k] + cnp[k + sbin]) * norm, 0.2); \
+			dbp[4 + k] += v; \
+		} \
+	}
+
+/* the features of the cell rows [start, end), normalized with the cells around them */
+static void _ccv_hog_normalize(void* context, int start, int end)
+{
+	ccv_hog_band_t* band = (ccv_hog_band_t*)context;
+	ccv_dense_matrix_t* cn = band->cn;
+	ccv_dense_matrix_t* ca = band->ca;
+	ccv_dense_matrix_t* db = band->b;
+	int sbin = band->sbin;
+	int rows = cn->rows;
+	int cols = cn->cols;
+	int i, j, k;
+#define for_block(_, _for_type) \
+	_for_type* cnp = (_for_type*)ccv_get_dense_matrix_cell(cn, start, 0, 0); \
+	_for_type* cap = (_for_type*)ccv_get_dense_matrix_cell(ca, start, 0, 0); \
+	_for_type* dbp = (_for_type*)ccv_get_dense_matrix_cell(db, start, 0, 0); \
+	for (i = start; i < end; i++) \
+		if (i == 0) \
 		{ \
 			TNA(_for_type, 0, 1, cols + 1, cols, 0); \
+			TNA(_for_type, 1, 1, 1, 0, 0); \
+			TNA(_for_type, 2, 0, cols, cols, 0); \
+			TNA(_for_type, 3, 0, 0, 0, 0); \
+			cnp += 2 * sbin; \
+			dbp += 3 * sbin + 4; \
+			cap++; \
+			for (j = 1; j < cols - 1; j++) \
+			{ \
+				TNA(_for_type, 0, 1, cols + 1, cols, 0); \
+				TNA(_for_type, 1, 1, 1, 0, 0); \
+				TNA(_for_type, 2, -1, cols - 1, cols, 0); \
+				TNA(_for_type, 3, -1, -1, 0, 0); \
+				cnp += 2 * sbin; \
+				dbp += 3 * sbin + 4; \
+				cap++; \
+			} \
+			TNA(_for_type, 0, 0, cols, cols, 0); \
+			TNA(_for_type, 1, 0, 0, 0, 0); \
+			TNA(_for_type, 2, -1, cols - 1, cols, 0); \
+			TNA(_for_type, 3, -1, -1, 0, 0); \
+			cnp += 2 * sbin; \
+			dbp += 3 * sbin + 4; \
+			cap++; \
+		} else if (i == rows - 1) { \
+			TNA(_for_type, 0, 1, 1, 0, 0); \
 			TNA(_for_type, 1, 1, -cols + 1, -cols, 0); \
+			TNA(_for_type, 2, 0, 0, 0, 0); \
+			TNA(_for_type, 3, 0, -cols, -cols, 0); \
+			cnp += 2 * sbin; \
+			dbp += 3 * sbin + 4; \
+			cap++; \
+			for (j = 1; j < cols - 1; j++) \
+			{ \
+				TNA(_for_type, 0, 1, 1, 0, 0); \
+				TNA(_for_type, 1, 1, -cols + 1, -cols, 0); \
+				TNA(_for_type, 2, -1, -1, 0, 0); \
+				TNA(_for_type, 3, -1, -cols - 1, -cols, 0); \
+				cnp += 2 * sbin; \
+				dbp += 3 * sbin + 4; \
+				cap++; \
+			} \
+			TNA(_for_type, 0, 0, 0, 0, 0); \
+			TNA(_for_type, 1, 0, -cols, -cols, 0); \
+			TNA(_for_type, 2, -1, -1, 0, 0); \
+			TNA(_for_type, 3, -1, -cols - 1, -cols, 0); \
+			cnp += 2 * sbin; \
+			dbp += 3 * sbin + 4; \
+			cap++; \
+		} else { \
+			TNA(_for_type, 0, 1, cols + 1, cols, 0); \
+			TNA(_for_type, 1, 1, -cols + 1, -cols, 0); \
+			TNA(_for_type, 2, 0, cols, cols, 0); \
+			TNA(_for_type, 3, 0, -cols, -cols, 0); \
+			cnp += 2 * sbin; \
+			dbp += 3 * sbin + 4; \
+			cap++; \
+			for (j = 1; j < cols - 1; j++) \
+			{ \
+				TNA(_for_type, 0, 1, cols + 1, cols, 0); \
+				TNA(_for_type, 1, 1, -cols + 1, -cols, 0); \
+				TNA(_for_type, 2, -1, cols - 1, cols, 0); \
+				TNA(_for_type, 3, -1, -cols - 1, -cols, 0); \
+				cnp += 2 * sbin; \
+				dbp += 3 * sbin + 4; \
+				cap++; \
+			} \
+			TNA(_for_type, 0, 0, cols, cols, 0); \
+			TNA(_for_type, 1, 0, -cols, -cols, 0); \
 			TNA(_for_type, 2, -1, cols - 1, cols, 0); \
 			TNA(_for_type, 3, -1, -cols - 1, -cols, 0); \
 			cnp += 2 * sbin; \
 			dbp += 3 * sbin + 4; \
 			cap++; \
-		} \
-		TNA(_for_type, 0, 0, cols, cols, 0); \
-		TNA(_for_type, 1, 0, -cols, -cols, 0); \
-		TNA(_for_type, 2, -1, cols - 1, cols, 0); \
-		TNA(_for_type, 3, -1, -cols - 1, -cols, 0); \
-		cnp += 2 * sbin; \
-		dbp += 3 * sbin + 4; \
-		cap++; \
-	} \
-	TNA(_for_type, 0, 1, 1, 0, 0); \
-	TNA(_for_type, 1, 1, -cols + 1, -cols, 0); \
-	TNA(_for_type, 2, 0, 0, 0, 0); \
-	TNA(_for_type, 3, 0, -cols, -cols, 0); \
-	cnp += 2 * sbin; \
-	dbp += 3 * sbin + 4; \
-	cap++; \
-	for (j = 1; j < cols - 1; j++) \
-	{ \
-		TNA(_for_type, 0, 1, 1, 0, 0); \
-		TNA(_for_type, 1, 1, -cols + 1, -cols, 0); \
-		TNA(_for_type, 2, -1, -1, 0, 0); \
-		TNA(_for_type, 3, -1, -cols - 1, -cols, 0); \
-		cnp += 2 * sbin; \
-		dbp += 3 * sbin + 4; \
-		cap++; \
-	} \
-	TNA(_for_type, 0, 0, 0, 0, 0); \
-	TNA(_for_type, 1, 0, -cols, -cols, 0); \
-	TNA(_for_type, 2, -1, -1, 0, 0); \
-	TNA(_for_type, 3, -1, -cols - 1, -cols, 0);
+		}
 	ccv_matrix_typeof(db->type, for_block);
 #undef for_block
 #undef TNA
+}
+
+void ccv_hog(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int b_type, int sbin, int size)
+{
+	assert(a->rows >= size && a->cols >= size && (4 + sbin * 3) <= CCV_MAX_CHANNEL);
+	int rows = a->rows / size;
+	int cols = a->cols / size;
+	b_type = (CCV_GET_DATA_TYPE(b_type) == CCV_64F) ? CCV_64F | (4 + sbin * 3) : CCV_32F | (4 + sbin * 3);
+	ccv_declare_derived_signature(sig, a->sig != 0, ccv_sign_with_format(64, "ccv_hog(%d,%d)", sbin, size), a->sig, 0);
+	ccv_dense_matrix_t* db = *b = ccv_dense_matrix_renew(*b, rows, cols, CCV_64F | CCV_32F | (4 + sbin * 3), b_type, sig);
+	ccv_object_return_if_cached(, db);
+	ccv_dense_matrix_t* cn = ccv_dense_matrix_new(rows, cols, CCV_GET_DATA_TYPE(db->type) | (sbin * 2), 0, 0);
+	ccv_dense_matrix_t* ca = ccv_dense_matrix_new(rows, cols, CCV_GET_DATA_TYPE(db->type) | CCV_C1, 0, 0);
+	ccv_zero(cn);
+	ccv_hog_band_t band = {
+		.a = a,
+		.cn = cn,
+		.ca = ca,
+		.b = db,
+		.sbin = sbin,
+		.size = size,
+	};
+#ifdef HAVE_SSE2
+	if (sbin == 9 && CCV_GET_DATA_TYPE(a->type) == CCV_8U && CCV_GET_DATA_TYPE(db->type) == CCV_32F && a->rows > 1 && a->cols > 1)
+	{
+		ccv_parallel_for(rows, 4, _ccv_hog_histogram_8u_9, &band);
+		ccv_parallel_for(rows, 4, _ccv_hog_normalize_9, &band);
+		ccv_matrix_free(cn);
+		ccv_matrix_free(ca);
+		return;
+	}
+#endif
+	ccv_gradient(a, &band.ag, 0, &band.mg, 0, 1, 1);
+	ccv_parallel_for(rows, 4, _ccv_hog_histogram, &band);
+	ccv_matrix_free(band.ag);
+	ccv_matrix_free(band.mg);
+	ccv_zero(db);
+	ccv_parallel_for(rows, 4, _ccv_hog_normalize, &band);
 	ccv_matrix_free(cn);
 	ccv_matrix_free(ca);
 }
 
+typedef struct {
+	ccv_dense_matrix_t* a;
+	ccv_dense_matrix_t* dx;
+	ccv_dense_matrix_t* dy;
+	ccv_dense_matrix_t* b;
+	int low;
+	int high;
+	int* map;
+	int** stack;
+	int* count;
+} ccv_canny_band_t;
+
+/* the non-maximum suppression of the rows [start, end), the strong edge pixels of row i go on the stack
+ * from i * cols on, count[i] of them */
+static void _ccv_canny_nms(void* context, int start, int end)
+{
+	ccv_canny_band_t* band = (ccv_canny_band_t*)context;
+	ccv_dense_matrix_t* a = band->a;
+	int low = band->low;
+	int high = band->high;
+	int* dxi = band->dx->data.i32 + start * a->cols;
+	int* dyi = band->dy->data.i32 + start * a->cols;
+	int i, j;
+	int* mbuf = (int*)alloca(4 * (a->cols + 2) * sizeof(int));
+	memset(mbuf, 0, 4 * (a->cols + 2) * sizeof(int));
+	int* rows[3];
+	rows[0] = mbuf + 1;
+	rows[1] = mbuf + (a->cols + 2) + 1;
+	rows[2] = mbuf + 2 * (a->cols + 2) + 1;
+	int* zero = mbuf + 3 * (a->cols + 2) + 1;
+	if (start > 0)
+		for (j = 0; j < a->cols; j++)
+			rows[0][j] = abs(dxi[j - a->cols]) + abs(dyi[j - a->cols]);
+	for (j = 0; j < a->cols; j++)
+		rows[1][j] = abs(dxi[j]) + abs(dyi[j]);
+	dxi += a->cols;
+	dyi += a->cols;
+	int map_cols = a->cols + 2;
+	int* map_ptr = band->map + (start + 1) * map_cols + 1;
+	for (i = start + 1; i <= end; i++)
+	{
+		/* the if clause should be unswitched automatically, no need to manually do so */
+		if (i == a->rows)
+			memset(rows[2], 0, sizeof(int) * a->cols);
+		else
+			for (j = 0; j < a->cols; j++)
+				rows[2][j] = abs(dxi[j]) + abs(dyi[j]);
+		/* the first row of a band doesn't look at the one above, which is another band's, it only decides whether
+		 * a strong edge pixel is a seed or not, and the hysteresis below reaches it through its neighbor either way */
+		int* up = (i == start + 1) ? zero : map_ptr - map_cols;
+		int** stack_bottom = band->stack + (i - 1) * a->cols;
+		int** stack_top = stack_bottom;
+		int* _dx = dxi - a->cols;
+		int* _dy = dyi - a->cols;
+		map_ptr[-1] = 0;
+		int suppress = 0;
+		for (j = 0; j < a->cols; j++)
+		{
+			int f = rows[1][j];
+			if (f > low)
+			{
+				int x = abs(_dx[j]);
+				int y = abs(_dy[j]);
+				int s = _dx[j] ^ _dy[j];
+				/* x * tan(22.5) */
+				int tg22x = x * (int)(0.4142135623730950488016887242097 * (1 << 15) + 0.5);
+				/* x * tan(67.5) == 2 * x + x * tan(22.5) */
+				int tg67x = tg22x + ((x + x) << 15);
+				y <<= 15;
+				/* it is a little different from the Canny original paper because we adopted the coordinate system of
+				 * top-left corner as origin. Thus, the derivative of y convolved with matrix:
+				 * |-1 -2 -1|
+				 * | 0  0  0|
+				 * | 1  2  1|
+				 * actually is the reverse of real y. Thus, the computed angle will be mirrored around x-axis.
+				 * In this case, when angle is -45 (135), we compare with north-east and south-west, and for 45,
+				 * we compare with north-west and south-east (in traditional coordinate system sense, the same if we
+				 * adopt top-left corner as origin for "north", "south", "east", "west" accordingly) */
+#define high_block \
+				{ \
+					if (f > high && !suppress && up[j] != 2) \
+					{ \
+						map_ptr[j] = 2; \
+						suppress = 1; \
+						*(stack_top++) = map_ptr + j; \
+					} else { \
+						map_ptr[j] = 1; \
+					} \
+					continue; \
+				}
+				/* sometimes, we end up with same f in integer domain, for that case, we will take the first occurrence
+				 * suppressing the second with flag */
+				if (y < tg22x)
+				{
+					if (f > rows[1][j - 1] && f >= rows[1][j + 1])
+						high_block;
+				} else if (y > tg67x) {
+					if (f > rows[0][j] && f >= rows[2][j])
+						high_block;
+				} else {
+					s = s < 0 ? -1 : 1;
+					if (f > rows[0][j - s] && f > rows[2][j + s])
+						high_block;
+				}
+#undef high_block
+			}
+			map_ptr[j] = 0;
+			suppress = 0;
+		}
+		map_ptr[a->cols] = 0;
+		band->count[i - 1] = stack_top - stack_bottom;
+		map_ptr += map_cols;
+		dxi += a->cols;
+		dyi += a->cols;
+		int* row = rows[0];
+		rows[0] = rows[1];
+		rows[1] = rows[2];
+		rows[2] = row;
+	}
+}
+
+typedef struct {
+	ccv_dense_matrix_t* a;
+	ccv_dense_matrix_t* b;
+	int* map;
+} ccv_canny_output_band_t;
+
+static void _ccv_canny_output(void* context, int start, int end)
+{
+	ccv_canny_output_band_t* band = (ccv_canny_output_band_t*)context;
+	ccv_dense_matrix_t* a = band->a;
+	ccv_dense_matrix_t* db = band->b;
+	int i, j, map_cols = a->cols + 2;
+	int* map_ptr = band->map + (start + 1) * map_cols + 1;
+	unsigned char* b_ptr = db->data.u8 + start * db->step;
+#define for_block(_, _for_set) \
+	for (i = start; i < end; i++) \
+	{ \
+		for (j = 0; j < a->cols; j++) \
+			_for_set(b_ptr, j, (map_ptr[j] == 2), 0); \
+		map_ptr += map_cols; \
+		b_ptr += db->step; \
+	}
+	ccv_matrix_setter(db->type, for_block);
+#undef for_block
+}
+
 /* it is a supposely cleaner and faster implementation than original OpenCV (ccv_canny_deprecated,
  * removed, since the newer implementation achieve bit accuracy with OpenCV's), after a lot
  * profiling, the current implementation still uses integer to speed up */
@@ -209,101 +683,35 @@ void ccv_canny(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int size
 		/* special case, all integer */
 		int low = (int)(low_thresh + 0.5);
 		int high = (int)(high_thresh + 0.5);
-		int* dxi = dx->data.i32;
-		int* dyi = dy->data.i32;
-		int i, j;
-		int* mbuf = (int*)alloca(3 * (a->cols + 2) * sizeof(int));
-		memset(mbuf, 0, 3 * (a->cols + 2) * sizeof(int));
-		int* rows[3];
-		rows[0] = mbuf + 1;
-		rows[1] = mbuf + (a->cols + 2) + 1;
-		rows[2] = mbuf + 2 * (a->cols + 2) + 1;
-		for (j = 0; j < a->cols; j++)
-			rows[1][j] = abs(dxi[j]) + abs(dyi[j]);
-		dxi += a->cols;
-		dyi += a->cols;
+		int i;
+		int map_cols = a->cols + 2;
 		int* map = (int*)ccmalloc(sizeof(int) * (a->rows + 2) * (a->cols + 2));
 		memset(map, 0, sizeof(int) * (a->cols + 2));
-		int* map_ptr = map + a->cols + 2 + 1;
-		int map_cols = a->cols + 2;
+		memset(map + (a->rows + 1) * map_cols, 0, sizeof(int) * (a->cols + 2));
 		int** stack = (int**)ccmalloc(sizeof(int*) * a->rows * a->cols);
+		int* count = (int*)ccmalloc(sizeof(int) * a->rows);
+		ccv_canny_band_t band = {
+			.a = a,
+			.dx = dx,
+			.dy = dy,
+			.b = db,
+			.low = low,
+			.high = high,
+			.map = map,
+			.stack = stack,
+			.count = count,
+		};
+		ccv_parallel_for(a->rows, 16, _ccv_canny_nms, &band);
+		memset(map + a->rows * map_cols, 0, sizeof(int) * (a->cols + 2));
+		/* gather the seeds of all rows at the bottom of the stack */
 		int** stack_top = stack;
-		int** stack_bottom = stack;
-		for (i = 1; i <= a->rows; i++)
+		for (i = 0; i < a->rows; i++)
 		{
-			/* the if clause should be unswitched automatically, no need to manually do so */
-			if (i == a->rows)
-				memset(rows[2], 0, sizeof(int) * a->cols);
-			else
-				for (j = 0; j < a->cols; j++)
-					rows[2][j] = abs(dxi[j]) + abs(dyi[j]);
-			int* _dx = dxi - a->cols;
-			int* _dy = dyi - a->cols;
-			map_ptr[-1] = 0;
-			int suppress = 0;
-			for (j = 0; j < a->cols; j++)
-			{
-				int f = rows[1][j];
-				if (f > low)
-				{
-					int x = abs(_dx[j]);
-					int y = abs(_dy[j]);
-					int s = _dx[j] ^ _dy[j];
-					/* x * tan(22.5) */
-					int tg22x = x * (int)(0.4142135623730950488016887242097 * (1 << 15) + 0.5);
-					/* x * tan(67.5) == 2 * x + x * tan(22.5) */
-					int tg67x = tg22x + ((x + x) << 15);
-					y <<= 15;
-					/* it is a little different from the Canny original paper because we adopted the coordinate system of
-					 * top-left corner as origin. Thus, the derivative of y convolved with matrix:
-					 * |-1 -2 -1|
-					 * | 0  0  0|
-					 * | 1  2  1|
-					 * actually is the reverse of real y. Thus, the computed angle will be mirrored around x-axis.
-					 * In this case, when angle is -45 (135), we compare with north-east and south-west, and for 45,
-					 * we compare with north-west and south-east (in traditional coordinate system sense, the same if we
-					 * adopt top-left corner as origin for "north", "south", "east", "west" accordingly) */
-#define high_block \
-					{ \
-						if (f > high && !suppress && map_ptr[j - map_cols] != 2) \
-						{ \
-							map_ptr[j] = 2; \
-							suppress = 1; \
-							*(stack_top++) = map_ptr + j; \
-						} else { \
-							map_ptr[j] = 1; \
-						} \
-						continue; \
-					}
-					/* sometimes, we end up with same f in integer domain, for that case, we will take the first occurrence
-					 * suppressing the second with flag */
-					if (y < tg22x)
-					{
-						if (f > rows[1][j - 1] && f >= rows[1][j + 1])
-							high_block;
-					} else if (y > tg67x) {
-						if (f > rows[0][j] && f >= rows[2][j])
-							high_block;
-					} else {
-						s = s < 0 ? -1 : 1;
-						if (f > rows[0][j - s] && f > rows[2][j + s])
-							high_block;
-					}
-#undef high_block
-				}
-				map_ptr[j] = 0;
-				suppress = 0;
-			}
-			map_ptr[a->cols] = 0;
-			map_ptr += map_cols;
-			dxi += a->cols;
-			dyi += a->cols;
-			int* row = rows[0];
-			rows[0] = rows[1];
-			rows[1] = rows[2];
-			rows[2] = row;
+			memmove(stack_top, stack + i * a->cols, sizeof(int*) * count[i]);
+			stack_top += count[i];
 		}
-		memset(map_ptr - map_cols - 1, 0, sizeof(int) * (a->cols + 2));
+		int** stack_bottom = stack;
+		int* map_ptr;
 		int dr[] = {-1, 1, -map_cols - 1, -map_cols, -map_cols + 1, map_cols - 1, map_cols, map_cols + 1};
 		while (stack_top > stack_bottom)
 		{
@@ -315,18 +723,13 @@ void ccv_canny(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int size
 					*(stack_top++) = map_ptr + dr[i];
 				}
 		}
-		map_ptr = map + map_cols + 1;
-		unsigned char* b_ptr = db->data.u8;
-#define for_block(_, _for_set) \
-		for (i = 0; i < a->rows; i++) \
-		{ \
-			for (j = 0; j < a->cols; j++) \
-				_for_set(b_ptr, j, (map_ptr[j] == 2), 0); \
-			map_ptr += map_cols; \
-			b_ptr += db->step; \
-		}
-		ccv_matrix_setter(db->type, for_block);
-#undef for_block
+		ccv_canny_output_band_t output = {
+			.a = a,
+			.b = db,
+			.map = map,
+		};
+		ccv_parallel_for(a->rows, 16, _ccv_canny_output, &output);
+		ccfree(count);
 		ccfree(stack);
 		ccfree(map);
 		ccv_matrix_free(dx);
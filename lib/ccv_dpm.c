@@ -1,14 +1,17 @@
 #include "ccv.h"
 #include "ccv_internal.h"
+#include "3rdparty/kissfft/kissf_fftndr.h"
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #ifdef HAVE_GSL
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_multifit.h>
 #include <gsl/gsl_randist.h>
 #endif
-#ifdef USE_OPENMP
-#include <omp.h>
-#endif
 #ifdef HAVE_LIBLINEAR
 #include <linear.h>
 #endif
@@ -21,6 +24,7 @@ ccv_dpm_param_t ccv_dpm_default_params = {
 };
 
 #define CCV_DPM_WINDOW_SIZE (8)
+#define CCV_DPM_CASCADE_DISPLACEMENT (4)
 
 static int _ccv_dpm_scale_upto(ccv_dense_matrix_t* a, ccv_dpm_mixture_model_t** _model, int count, int interval)
 {
@@ -42,59 +46,409 @@ static int _ccv_dpm_scale_upto(ccv_dense_matrix_t* a, ccv_dpm_mixture_model_t**
 	return (int)(log((double)ccv_min(hr, wr)) / log(scale)) - next;
 }
 
-static void _ccv_dpm_feature_pyramid(ccv_dense_matrix_t* a, ccv_dense_matrix_t** pyr, int scale_upto, int interval)
+/* pyr holds scale_upto + next * 2 hog matrices, the first next ones are computed with half the window size on the top octave of the image pyramid */
+static void _ccv_dpm_hog_pyramid(ccv_pyramid_t* pyramid, ccv_dense_matrix_t** pyr, int scale_upto)
 {
-	int next = interval + 1;
-	double scale = pow(2.0, 1.0 / (interval + 1.0));
-	memset(pyr, 0, (scale_upto + next * 2) * sizeof(ccv_dense_matrix_t*));
-	pyr[next] = a;
+	int next = pyramid->interval + 1;
 	int i;
-	for (i = 1; i <= interval; i++)
-		ccv_resample(pyr[next], &pyr[next + i], 0, (int)(pyr[next]->rows / pow(scale, i)), (int)(pyr[next]->cols / pow(scale, i)), CCV_INTER_AREA);
-	for (i = next; i < scale_upto + next; i++)
-		ccv_sample_down(pyr[i], &pyr[i + next], 0, 0, 0);
-	ccv_dense_matrix_t* hog;
 	/* a more efficient way to generate up-scaled hog (using smaller size) */
 	for (i = 0; i < next; i++)
 	{
-		hog = 0;
-		ccv_hog(pyr[i + next], &hog, 0, 9, CCV_DPM_WINDOW_SIZE / 2 /* this is */);
-		pyr[i] = hog;
+		pyr[i] = 0;
+		ccv_hog(ccv_pyramid_level(pyramid, i, 0, 0), &pyr[i], 0, 9, CCV_DPM_WINDOW_SIZE / 2 /* this is */);
 	}
-	hog = 0;
-	ccv_hog(pyr[next], &hog, 0, 9, CCV_DPM_WINDOW_SIZE);
-	pyr[next] = hog;
-	for (i = next + 1; i < scale_upto + next * 2; i++)
+	for (i = next; i < scale_upto + next * 2; i++)
 	{
-		hog = 0;
-		ccv_hog(pyr[i], &hog, 0, 9, CCV_DPM_WINDOW_SIZE);
-		ccv_matrix_free(pyr[i]);
-		pyr[i] = hog;
+		pyr[i] = 0;
+		ccv_hog(ccv_pyramid_level(pyramid, i - next, 0, 0), &pyr[i], 0, 9, CCV_DPM_WINDOW_SIZE);
 	}
 }
 
-static void _ccv_dpm_compute_score(ccv_dpm_root_classifier_t* root_classifier, ccv_dense_matrix_t* hog, ccv_dense_matrix_t* hog2x, ccv_dense_matrix_t** _response, ccv_dense_matrix_t** part_feature, ccv_dense_matrix_t** dx, ccv_dense_matrix_t** dy)
+static void _ccv_dpm_feature_pyramid(ccv_dense_matrix_t* a, ccv_dense_matrix_t** pyr, int scale_upto, int interval)
 {
-	ccv_dense_matrix_t* response = 0;
-	ccv_filter(hog, root_classifier->root.w, &response, 0, CCV_NO_PADDING);
-	ccv_dense_matrix_t* root_feature = 0;
-	ccv_flatten(response, (ccv_matrix_t**)&root_feature, 0, 0);
-	ccv_matrix_free(response);
+	ccv_pyramid_t* pyramid = ccv_pyramid_new(a, interval);
+	_ccv_dpm_hog_pyramid(pyramid, pyr, scale_upto);
+	ccv_pyramid_free(pyramid);
+}
+
+static inline float _ccv_dpm_dot(float* a, float* b, int n)
+{
+	int i = 0;
+	float sum = 0;
+#ifdef HAVE_SSE2
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	for (; i < n - 7; i += 8)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	float sums[4];
+	_mm_storeu_ps(sums, _mm_add_ps(sum0, sum1));
+	sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+#endif
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+/* the response of the filter w at (y, x) of the hog, summed over all channels, the response is centred at
+ * ((w->rows - 1) / 2, (w->cols - 1) / 2) of the filter, and the part of the filter that falls outside of the hog
+ * contributes nothing */
+static inline float _ccv_dpm_filter_at(ccv_dense_matrix_t* a, ccv_dense_matrix_t* w, int y, int x)
+{
+	int ch = CCV_GET_CHANNEL(a->type);
+	int wh = (w->rows - 1) / 2, ww = (w->cols - 1) / 2;
+	int i0 = ccv_max(0, wh - y), i1 = ccv_min(w->rows, a->rows - y + wh);
+	int j0 = ccv_max(0, ww - x), j1 = ccv_min(w->cols, a->cols - x + ww);
+	int i;
+	float sum = 0;
+	for (i = i0; i < i1; i++)
+		sum += _ccv_dpm_dot((float*)ccv_get_dense_matrix_cell_by(CCV_32F | ch, a, y - wh + i, x - ww + j0, 0), (float*)ccv_get_dense_matrix_cell_by(CCV_32F | ch, w, i, j0, 0), (j1 - j0) * ch);
+	return sum;
+}
+
+/* correlate the hog with the filter and sum up its channels in one pass (what ccv_filter followed by ccv_flatten
+ * computes, without the 31-channel response in between) */
+static void _ccv_dpm_filter(ccv_dense_matrix_t* a, ccv_dense_matrix_t* w, ccv_dense_matrix_t** b)
+{
+	assert(CCV_GET_DATA_TYPE(a->type) == CCV_32F && CCV_GET_DATA_TYPE(w->type) == CCV_32F);
+	assert(CCV_GET_CHANNEL(a->type) == CCV_GET_CHANNEL(w->type));
+	ccv_dense_matrix_t* db = *b = ccv_dense_matrix_renew(*b, a->rows, a->cols, CCV_32F | CCV_C1, CCV_32F | CCV_C1, 0);
+	int x, y;
+	float* b_ptr = db->data.f32;
+	for (y = 0; y < a->rows; y++)
+	{
+		for (x = 0; x < a->cols; x++)
+			b_ptr[x] = _ccv_dpm_filter_at(a, w, y, x);
+		b_ptr += db->cols;
+	}
+}
+
+/* the filters of a model in the frequency domain (computed by the first detection), the hog is correlated with them in tiles of
+ * size x size cells (overlap-save), the spectra of a tile are computed once and shared by all the filters, thus, it
+ * takes a forward transform per channel of a tile and an inverse one per filter rather than a ccv_filter per filter.
+ * The spectra are kept for 2 sizes of the tile, the smaller one is for the smaller levels of the pyramid */
+#define CCV_DPM_SPECTRUM_SIZES (2)
+
+/* the plans of the transforms at every size of the tile and the buffers of a tile, kiss_fftndr keeps its scratch in
+ * the plan, thus, a plan is only used by one band at a time */
+typedef struct ccv_dpm_spectrum_plan_s {
+	struct ccv_dpm_spectrum_plan_s* next;
+	kissf_fftndr_cfg p[CCV_DPM_SPECTRUM_SIZES];
+	kissf_fftndr_cfg pinv[CCV_DPM_SPECTRUM_SIZES];
+	float* plane; // 31 channels of a tile of the largest size
+	kissf_fft_cpx* x; // the spectra of the 31 channels of a tile, and then their product with the ones of a filter
+} ccv_dpm_spectrum_plan_t;
+
+typedef struct {
+	int rows; // the largest filter
+	int cols;
+	int count; // the roots first, then the parts of the roots in order
+	ccv_dense_matrix_t** w;
+	int size[CCV_DPM_SPECTRUM_SIZES]; // the larger one first
+	kissf_fft_cpx* data[CCV_DPM_SPECTRUM_SIZES]; // 31 channels of size * (size / 2 + 1) per filter, conjugated and scaled by 1 / (size * size)
+	pthread_mutex_t mutex;
+	ccv_dpm_spectrum_plan_t* plan; // the ones not in use, they are kept for the next detection
+} ccv_dpm_spectrum_t;
+
+static ccv_dpm_spectrum_plan_t* _ccv_dpm_spectrum_plan_get(ccv_dpm_spectrum_t* spectrum)
+{
+	pthread_mutex_lock(&spectrum->mutex);
+	ccv_dpm_spectrum_plan_t* plan = spectrum->plan;
+	if (plan)
+		spectrum->plan = plan->next;
+	pthread_mutex_unlock(&spectrum->mutex);
+	if (plan)
+		return plan;
+	plan = (ccv_dpm_spectrum_plan_t*)malloc(sizeof(ccv_dpm_spectrum_plan_t));
+	int t;
+	for (t = 0; t < CCV_DPM_SPECTRUM_SIZES; t++)
+	{
+		/* the buffers are sized for size[0], thus, it has to be the largest */
+		assert(spectrum->size[t] <= spectrum->size[0]);
+		int dims[2] = {spectrum->size[t], spectrum->size[t]};
+		plan->p[t] = kissf_fftndr_alloc(dims, 2, 0, 0, 0);
+		plan->pinv[t] = kissf_fftndr_alloc(dims, 2, 1, 0, 0);
+	}
+	int size = spectrum->size[0];
+	plan->plane = (float*)malloc(sizeof(float) * size * size * 31);
+	plan->x = (kissf_fft_cpx*)malloc(sizeof(kissf_fft_cpx) * size * (size / 2 + 1) * 32);
+	return plan;
+}
+
+static void _ccv_dpm_spectrum_plan_put(ccv_dpm_spectrum_t* spectrum, ccv_dpm_spectrum_plan_t* plan)
+{
+	pthread_mutex_lock(&spectrum->mutex);
+	plan->next = spectrum->plan;
+	spectrum->plan = plan;
+	pthread_mutex_unlock(&spectrum->mutex);
+}
+
+static ccv_dpm_spectrum_t* _ccv_dpm_spectrum_new(ccv_dpm_mixture_model_t* model)
+{
+	int i, j, k, c, t, count = model->count;
+	for (i = 0; i < model->count; i++)
+		count += model->root[i].count;
+	/* with malloc rather than ccmalloc, because it is kept on the model, and the detection that computes it may be
+	 * within an arena scope */
+	ccv_dpm_spectrum_t* spectrum = (ccv_dpm_spectrum_t*)malloc(sizeof(ccv_dpm_spectrum_t) + sizeof(ccv_dense_matrix_t*) * count);
+	spectrum->count = count;
+	spectrum->w = (ccv_dense_matrix_t**)(spectrum + 1);
+	spectrum->rows = spectrum->cols = 0;
+	for (i = 0, k = model->count; i < model->count; i++)
+	{
+		spectrum->w[i] = model->root[i].root.w;
+		for (j = 0; j < model->root[i].count; j++, k++)
+			spectrum->w[k] = model->root[i].part[j].w;
+	}
+	for (i = 0; i < count; i++)
+	{
+		spectrum->rows = ccv_max(spectrum->rows, spectrum->w[i]->rows);
+		spectrum->cols = ccv_max(spectrum->cols, spectrum->w[i]->cols);
+	}
+	/* a tile covers (size - rows + 1) x (size - cols + 1) cells of the response, it is a trade-off between the
+	 * cells lost on its border and the cost of the transforms */
+	int size = 32;
+	while (size < ccv_max(spectrum->rows, spectrum->cols) * 4)
+		size *= 2;
+	for (t = 0; t < CCV_DPM_SPECTRUM_SIZES; t++, size /= 2)
+		spectrum->size[t] = size;
+	pthread_mutex_init(&spectrum->mutex, 0);
+	spectrum->plan = 0;
+	/* the plan of the forward transforms here is the first one the detection takes */
+	ccv_dpm_spectrum_plan_t* plan = _ccv_dpm_spectrum_plan_get(spectrum);
+	float* plane = plan->plane;
+	for (t = 0; t < CCV_DPM_SPECTRUM_SIZES; t++)
+	{
+		size = spectrum->size[t];
+		int len = size * (size / 2 + 1);
+		spectrum->data[t] = (kissf_fft_cpx*)malloc(sizeof(kissf_fft_cpx) * len * 31 * count);
+		float scale = 1.0 / (size * size);
+		for (i = 0; i < count; i++)
+		{
+			ccv_dense_matrix_t* w = spectrum->w[i];
+			for (c = 0; c < 31; c++)
+			{
+				memset(plane, 0, sizeof(float) * size * size);
+				for (j = 0; j < w->rows; j++)
+					for (k = 0; k < w->cols; k++)
+						plane[j * size + k] = w->data.f32[(j * w->cols + k) * 31 + c];
+				kissf_fft_cpx* d = spectrum->data[t] + (i * 31 + c) * len;
+				kissf_fftndr(plan->p[t], plane, d);
+				for (j = 0; j < len; j++)
+				{
+					d[j].r = d[j].r * scale;
+					d[j].i = -d[j].i * scale;
+				}
+			}
+		}
+	}
+	_ccv_dpm_spectrum_plan_put(spectrum, plan);
+	return spectrum;
+}
+
+static void _ccv_dpm_spectrum_free(ccv_dpm_spectrum_t* spectrum)
+{
+	int t;
+	while (spectrum->plan)
+	{
+		ccv_dpm_spectrum_plan_t* plan = spectrum->plan;
+		spectrum->plan = plan->next;
+		for (t = 0; t < CCV_DPM_SPECTRUM_SIZES; t++)
+		{
+			kissf_fft_free(plan->p[t]);
+			kissf_fft_free(plan->pinv[t]);
+		}
+		free(plan->plane);
+		free(plan->x);
+		free(plan);
+	}
+	pthread_mutex_destroy(&spectrum->mutex);
+	for (t = 0; t < CCV_DPM_SPECTRUM_SIZES; t++)
+		free(spectrum->data[t]);
+	free(spectrum);
+}
+
+/* the lock only guards the computation of the spectra of the models, they never change once they are computed */
+static pthread_mutex_t ccv_dpm_spectrum_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the spectra of the filters of the model, computed by the first detection that needs them rather than on load, thus,
+ * a model that is only loaded (a binary one is mapped and nothing is copied) pays nothing for them */
+static ccv_dpm_spectrum_t* _ccv_dpm_spectrum_get(ccv_dpm_mixture_model_t* model)
+{
+	pthread_mutex_lock(&ccv_dpm_spectrum_mutex);
+	if (!model->spectrum)
+		model->spectrum = _ccv_dpm_spectrum_new(model);
+	pthread_mutex_unlock(&ccv_dpm_spectrum_mutex);
+	return (ccv_dpm_spectrum_t*)model->spectrum;
+}
+
+/* d = sum of x * w over the 31 channels */
+static void _ccv_dpm_spectrum_product(kissf_fft_cpx* x, kissf_fft_cpx* w, kissf_fft_cpx* d, int len)
+{
+	int c, k;
+	memset(d, 0, sizeof(kissf_fft_cpx) * len);
+	for (c = 0; c < 31; c++)
+	{
+		float* x_ptr = (float*)(x + c * len);
+		float* w_ptr = (float*)(w + c * len);
+		float* d_ptr = (float*)d;
+		k = 0;
+#ifdef HAVE_SSE2
+		__m128 sign = _mm_set_ps(1, -1, 1, -1);
+		for (; k < len * 2 - 3; k += 4)
+		{
+			__m128 x4 = _mm_loadu_ps(x_ptr + k);
+			__m128 w4 = _mm_loadu_ps(w_ptr + k);
+			/* (xr * wr - xi * wi, xi * wr + xr * wi) of the 2 complex numbers */
+			__m128 wr = _mm_shuffle_ps(w4, w4, _MM_SHUFFLE(2, 2, 0, 0));
+			__m128 wi = _mm_mul_ps(_mm_shuffle_ps(w4, w4, _MM_SHUFFLE(3, 3, 1, 1)), sign);
+			__m128 xs = _mm_shuffle_ps(x4, x4, _MM_SHUFFLE(2, 3, 0, 1));
+			_mm_storeu_ps(d_ptr + k, _mm_add_ps(_mm_loadu_ps(d_ptr + k), _mm_add_ps(_mm_mul_ps(x4, wr), _mm_mul_ps(xs, wi))));
+		}
+#endif
+		for (; k < len * 2; k += 2)
+		{
+			d_ptr[k] += x_ptr[k] * w_ptr[k] - x_ptr[k + 1] * w_ptr[k + 1];
+			d_ptr[k + 1] += x_ptr[k + 1] * w_ptr[k] + x_ptr[k] * w_ptr[k + 1];
+		}
+	}
+}
+
+/* the size of the tile with the least work for the transforms on a rows x cols level, n * n * log(n) for each tile */
+static int _ccv_dpm_spectrum_best(ccv_dpm_spectrum_t* spectrum, int rows, int cols)
+{
+	int t, best = 0;
+	double cost = DBL_MAX;
+	for (t = 0; t < CCV_DPM_SPECTRUM_SIZES; t++)
+	{
+		int n = spectrum->size[t];
+		int srows = n - spectrum->rows + 1, scols = n - spectrum->cols + 1;
+		double tcost = (double)((rows + srows - 1) / srows) * ((cols + scols - 1) / scols) * n * n * log(n);
+		if (tcost < cost)
+			best = t, cost = tcost;
+	}
+	return best;
+}
+
+typedef struct {
+	ccv_dpm_spectrum_t* spectrum;
+	ccv_dense_matrix_t** pyr;
+	ccv_dense_matrix_t** response; // spectrum->count per level, the ones not needed are 0
+	int roots; // the levels [roots, levels) need the responses of the roots
+	int parts; // the levels [0, parts) need the responses of the parts
+	int count; // of the roots
+} ccv_dpm_response_band_t;
+
+/* the responses of the filters on the levels [start, end), the same as _ccv_dpm_filter */
+static void _ccv_dpm_response(void* context, int start, int end)
+{
+	ccv_dpm_response_band_t* band = (ccv_dpm_response_band_t*)context;
+	ccv_dpm_spectrum_t* spectrum = band->spectrum;
+	ccv_dpm_spectrum_plan_t* plan = _ccv_dpm_spectrum_plan_get(spectrum);
+	float* plane = plan->plane;
+	kissf_fft_cpx* x = plan->x;
+	int i, j, c, f, l, tx, ty;
+	int hrows = (spectrum->rows - 1) / 2, hcols = (spectrum->cols - 1) / 2;
+	for (l = start; l < end; l++)
+	{
+		ccv_dense_matrix_t* a = band->pyr[l];
+		int first = (l >= band->roots) ? 0 : band->count;
+		int last = (l < band->parts) ? spectrum->count : band->count;
+		if (first >= last)
+			continue;
+		ccv_dense_matrix_t** response = band->response + l * spectrum->count;
+		for (f = first; f < last; f++)
+			response[f] = ccv_dense_matrix_new(a->rows, a->cols, CCV_32F | CCV_C1, 0, 0);
+		int best = _ccv_dpm_spectrum_best(spectrum, a->rows, a->cols);
+		int size = spectrum->size[best];
+		int len = size * (size / 2 + 1);
+		kissf_fft_cpx* d = x + len * 31;
+		/* the tile at (ty, tx) of the response reads the cells from (ty - hrows, tx - hcols) of the hog, a filter
+		 * starts (hrows - wh, hcols - ww) into the result of the inverse transform */
+		int srows = size - spectrum->rows + 1, scols = size - spectrum->cols + 1;
+		for (ty = 0; ty < a->rows; ty += srows)
+			for (tx = 0; tx < a->cols; tx += scols)
+			{
+				int py = ty - hrows, px = tx - hcols;
+				int i0 = ccv_max(0, -py), i1 = ccv_min(size, a->rows - py);
+				int j0 = ccv_max(0, -px), j1 = ccv_min(size, a->cols - px);
+				memset(plane, 0, sizeof(float) * size * size * 31);
+				for (i = i0; i < i1; i++)
+				{
+					float* a_ptr = (float*)(a->data.u8 + (py + i) * a->step) + px * 31;
+					for (j = j0; j < j1; j++)
+						for (c = 0; c < 31; c++)
+							plane[c * size * size + i * size + j] = a_ptr[j * 31 + c];
+				}
+				for (c = 0; c < 31; c++)
+					kissf_fftndr(plan->p[best], plane + c * size * size, x + c * len);
+				int rows = ccv_min(srows, a->rows - ty), cols = ccv_min(scols, a->cols - tx);
+				for (f = first; f < last; f++)
+				{
+					ccv_dense_matrix_t* w = spectrum->w[f];
+					_ccv_dpm_spectrum_product(x, spectrum->data[best] + f * 31 * len, d, len);
+					kissf_fftndri(plan->pinv[best], d, plane);
+					float* r_ptr = plane + (hrows - (w->rows - 1) / 2) * size + hcols - (w->cols - 1) / 2;
+					float* b_ptr = response[f]->data.f32 + ty * a->cols + tx;
+					for (i = 0; i < rows; i++)
+						memcpy(b_ptr + i * a->cols, r_ptr + i * size, sizeof(float) * cols);
+				}
+			}
+	}
+	_ccv_dpm_spectrum_plan_put(spectrum, plan);
+}
+
+/* the responses of the filters of the model on the levels of the pyramid in the frequency domain, the response of
+ * the root j on the level i is response[i * spectrum->count + j], the ones of its parts (on the level i - next) follow
+ * the roots (see ccv_dpm_spectrum_t) */
+static ccv_dense_matrix_t** _ccv_dpm_responses(ccv_dpm_mixture_model_t* model, ccv_dense_matrix_t** pyr, int scale_upto, int next, int parts)
+{
+	ccv_dpm_spectrum_t* spectrum = (ccv_dpm_spectrum_t*)model->spectrum;
+	int levels = scale_upto + next * 2;
+	ccv_dense_matrix_t** response = (ccv_dense_matrix_t**)ccmalloc(sizeof(ccv_dense_matrix_t*) * levels * spectrum->count);
+	memset(response, 0, sizeof(ccv_dense_matrix_t*) * levels * spectrum->count);
+	ccv_dpm_response_band_t band = {
+		.spectrum = spectrum,
+		.pyr = pyr,
+		.response = response,
+		.roots = next,
+		.parts = parts ? scale_upto + next : 0,
+		.count = model->count,
+	};
+	ccv_parallel_for(levels, 1, _ccv_dpm_response, &band);
+	return response;
+}
+
+/* where the parts of the root j start in the filters of ccv_dpm_spectrum_t */
+static inline int _ccv_dpm_part_index(ccv_dpm_mixture_model_t* model, int j)
+{
+	int i, index = model->count;
+	for (i = 0; i < j; i++)
+		index += model->root[i].count;
+	return index;
+}
+
+/* root_response and part_response are the responses of the filters if these are computed already (_ccv_dpm_responses),
+ * these are taken over and freed along with the others */
+static void _ccv_dpm_compute_score(ccv_dpm_root_classifier_t* root_classifier, ccv_dense_matrix_t* hog, ccv_dense_matrix_t* hog2x, ccv_dense_matrix_t* root_response, ccv_dense_matrix_t** part_response, ccv_dense_matrix_t** _response, ccv_dense_matrix_t** part_feature, ccv_dense_matrix_t** dx, ccv_dense_matrix_t** dy)
+{
+	ccv_dense_matrix_t* root_feature = root_response;
+	if (!root_feature)
+		_ccv_dpm_filter(hog, root_classifier->root.w, &root_feature);
 	*_response = root_feature;
 	if (hog2x == 0)
 		return;
-	ccv_make_matrix_mutable(root_feature);
 	int rwh = (root_classifier->root.w->rows - 1) / 2, rww = (root_classifier->root.w->cols - 1) / 2;
 	int rwh_1 = root_classifier->root.w->rows / 2, rww_1 = root_classifier->root.w->cols / 2;
 	int i, x, y;
 	for (i = 0; i < root_classifier->count; i++)
 	{
 		ccv_dpm_part_classifier_t* part = root_classifier->part + i;
-		ccv_dense_matrix_t* response = 0;
-		ccv_filter(hog2x, part->w, &response, 0, CCV_NO_PADDING);
-		ccv_dense_matrix_t* feature = 0;
-		ccv_flatten(response, (ccv_matrix_t**)&feature, 0, 0);
-		ccv_matrix_free(response);
+		ccv_dense_matrix_t* feature = part_response ? part_response[i] : 0;
+		if (!feature)
+			_ccv_dpm_filter(hog2x, part->w, &feature);
 		part_feature[i] = dx[i] = dy[i] = 0;
 		ccv_distance_transform(feature, &part_feature[i], 0, &dx[i], 0, &dy[i], 0, part->dx, part->dy, part->dxx, part->dyy, CCV_NEGATIVE | CCV_GSEDT);
 		ccv_matrix_free(feature);
@@ -117,6 +471,239 @@ static void _ccv_dpm_compute_score(ccv_dpm_root_classifier_t* root_classifier, c
 	}
 }
 
+/* the anchor of the part at (x, y) of the root response, on the hog with twice the resolution */
+static inline void _ccv_dpm_part_anchor(ccv_dpm_root_classifier_t* root, ccv_dpm_part_classifier_t* part, ccv_dense_matrix_t* hog2x, int x, int y, int* ix, int* iy)
+{
+	int rwh = (root->root.w->rows - 1) / 2, rww = (root->root.w->cols - 1) / 2;
+	int pwh = (part->w->rows - 1) / 2, pww = (part->w->cols - 1) / 2;
+	*iy = ccv_clamp(y * 2 + part->y + pwh - rwh * 2, pwh, hog2x->rows - part->w->rows + pwh);
+	*ix = ccv_clamp(x * 2 + part->x + pww - rww * 2, pww, hog2x->cols - part->w->cols + pww);
+}
+
+/* push the window at (x, y) of the root response, the parts are displaced by (rx, ry) from their anchors (ix, iy) */
+static void _ccv_dpm_push_root_comp(ccv_dpm_root_classifier_t* root, int c, int x, int y, float confidence, int* ix, int* iy, int* rx, int* ry, float* part_confidence, double scale_x, double scale_y, ccv_array_t* seq)
+{
+	int k;
+	int rwh = (root->root.w->rows - 1) / 2, rww = (root->root.w->cols - 1) / 2;
+	ccv_root_comp_t comp;
+	comp.id = c;
+	comp.neighbors = 1;
+	comp.confidence = confidence;
+	comp.pnum = root->count;
+	float drift_x = root->alpha[0],
+		  drift_y = root->alpha[1],
+		  drift_scale = root->alpha[2];
+	for (k = 0; k < root->count; k++)
+	{
+		ccv_dpm_part_classifier_t* part = root->part + k;
+		comp.part[k].id = c;
+		comp.part[k].neighbors = 1;
+		int pww = (part->w->cols - 1) / 2, pwh = (part->w->rows - 1) / 2;
+		drift_x += part->alpha[0] * rx[k] + part->alpha[1] * ry[k];
+		drift_y += part->alpha[2] * rx[k] + part->alpha[3] * ry[k];
+		drift_scale += part->alpha[4] * rx[k] + part->alpha[5] * ry[k];
+		int py = iy[k] - ry[k];
+		int px = ix[k] - rx[k];
+		comp.part[k].rect = ccv_rect((int)((px - pww) * CCV_DPM_WINDOW_SIZE / 2 * scale_x + 0.5), (int)((py - pwh) * CCV_DPM_WINDOW_SIZE / 2 * scale_y + 0.5), (int)(part->w->cols * CCV_DPM_WINDOW_SIZE / 2 * scale_x + 0.5), (int)(part->w->rows * CCV_DPM_WINDOW_SIZE / 2 * scale_y + 0.5));
+		comp.part[k].confidence = part_confidence[k];
+	}
+	comp.rect = ccv_rect((int)((x + drift_x) * CCV_DPM_WINDOW_SIZE * scale_x - rww * CCV_DPM_WINDOW_SIZE * scale_x * (1.0 + drift_scale) + 0.5), (int)((y + drift_y) * CCV_DPM_WINDOW_SIZE * scale_y - rwh * CCV_DPM_WINDOW_SIZE * scale_y * (1.0 + drift_scale) + 0.5), (int)(root->root.w->cols * CCV_DPM_WINDOW_SIZE * scale_x * (1.0 + drift_scale) + 0.5), (int)(root->root.w->rows * CCV_DPM_WINDOW_SIZE * scale_y * (1.0 + drift_scale) + 0.5));
+	ccv_array_push(seq, &comp);
+}
+
+/* scan the responses of one root classifier (and its parts) on one level of the hog pyramid, collect the windows
+ * above the threshold into seq */
+static void _ccv_dpm_scan_root(ccv_dpm_root_classifier_t* root, int c, ccv_dense_matrix_t* hog, ccv_dense_matrix_t* hog2x, ccv_dense_matrix_t* root_response, ccv_dense_matrix_t** part_response, double scale_x, double scale_y, float threshold, ccv_array_t* seq)
+{
+	int k, x, y;
+	ccv_dense_matrix_t* root_feature = 0;
+	ccv_dense_matrix_t* part_feature[CCV_DPM_PART_MAX];
+	ccv_dense_matrix_t* dx[CCV_DPM_PART_MAX];
+	ccv_dense_matrix_t* dy[CCV_DPM_PART_MAX];
+	_ccv_dpm_compute_score(root, hog, hog2x, root_response, part_response, &root_feature, part_feature, dx, dy);
+	int rwh = (root->root.w->rows - 1) / 2, rww = (root->root.w->cols - 1) / 2;
+	int rwh_1 = root->root.w->rows / 2, rww_1 = root->root.w->cols / 2;
+	int ix[CCV_DPM_PART_MAX], iy[CCV_DPM_PART_MAX], rx[CCV_DPM_PART_MAX], ry[CCV_DPM_PART_MAX];
+	float part_confidence[CCV_DPM_PART_MAX];
+	/* these values are designed to make sure works with odd/even number of rows/cols
+	 * of the root classifier:
+	 * suppose the image is 6x6, and the root classifier is 6x6, the scan area should starts
+	 * at (2,2) and end at (2,2), thus, it is capped by (rwh, rww) to (6 - rwh_1 - 1, 6 - rww_1 - 1)
+	 * this computation works for odd root classifier too (i.e. 5x5) */
+	float* f_ptr = (float*)ccv_get_dense_matrix_cell_by(CCV_32F | CCV_C1, root_feature, rwh, 0, 0);
+	for (y = rwh; y < root_feature->rows - rwh_1; y++)
+	{
+		for (x = rww; x < root_feature->cols - rww_1; x++)
+			if (f_ptr[x] + root->beta > threshold)
+			{
+				for (k = 0; k < root->count; k++)
+				{
+					_ccv_dpm_part_anchor(root, root->part + k, hog2x, x, y, ix + k, iy + k);
+					ry[k] = ccv_get_dense_matrix_cell_value_by(CCV_32S | CCV_C1, dy[k], iy[k], ix[k], 0);
+					rx[k] = ccv_get_dense_matrix_cell_value_by(CCV_32S | CCV_C1, dx[k], iy[k], ix[k], 0);
+					part_confidence[k] = -ccv_get_dense_matrix_cell_value_by(CCV_32F | CCV_C1, part_feature[k], iy[k], ix[k], 0);
+				}
+				_ccv_dpm_push_root_comp(root, c, x, y, f_ptr[x] + root->beta, ix, iy, rx, ry, part_confidence, scale_x, scale_y, seq);
+			}
+		f_ptr += root_feature->cols;
+	}
+	for (k = 0; k < root->count; k++)
+	{
+		ccv_matrix_free(part_feature[k]);
+		ccv_matrix_free(dx[k]);
+		ccv_matrix_free(dy[k]);
+	}
+	ccv_matrix_free(root_feature);
+}
+
+/* the star-cascade version of _ccv_dpm_scan_root: the root response is computed first, then the parts are added one
+ * by one, and the window is dropped as soon as the partial score falls below the threshold of that stage. Thus, the
+ * part responses are only computed around the windows that survive, and the best displacement of a part is searched
+ * in a window of CCV_DPM_CASCADE_DISPLACEMENT cells around its anchor rather than with the distance transform.
+ * If partial is given, the partial scores of every collected window are pushed into it as well */
+static void _ccv_dpm_scan_root_cascade(ccv_dpm_root_classifier_t* root, int c, ccv_dense_matrix_t* hog, ccv_dense_matrix_t* hog2x, ccv_dense_matrix_t* root_response, double scale_x, double scale_y, float threshold, const float* cascade, ccv_array_t* seq, ccv_array_t* partial)
+{
+	int i, k, x, y, u, v;
+	ccv_dense_matrix_t* root_feature = root_response;
+	if (!root_feature)
+		_ccv_dpm_filter(hog, root->root.w, &root_feature);
+	/* FLT_MAX marks the part responses that are not computed yet */
+	int size = hog2x->rows * hog2x->cols;
+	float* response = (float*)ccmalloc(sizeof(float) * size * ccv_max(root->count, 1));
+	for (i = 0; i < size * root->count; i++)
+		response[i] = FLT_MAX;
+	int rwh = (root->root.w->rows - 1) / 2, rww = (root->root.w->cols - 1) / 2;
+	int rwh_1 = root->root.w->rows / 2, rww_1 = root->root.w->cols / 2;
+	int ix[CCV_DPM_PART_MAX], iy[CCV_DPM_PART_MAX], rx[CCV_DPM_PART_MAX], ry[CCV_DPM_PART_MAX];
+	float part_confidence[CCV_DPM_PART_MAX];
+	float score[CCV_DPM_PART_MAX + 1];
+	float* f_ptr = (float*)ccv_get_dense_matrix_cell_by(CCV_32F | CCV_C1, root_feature, rwh, 0, 0);
+	for (y = rwh; y < root_feature->rows - rwh_1; y++)
+	{
+		for (x = rww; x < root_feature->cols - rww_1; x++)
+		{
+			score[0] = f_ptr[x] + root->beta;
+			if (score[0] < cascade[0])
+				continue;
+			for (k = 0; k < root->count; k++)
+			{
+				ccv_dpm_part_classifier_t* part = root->part + k;
+				_ccv_dpm_part_anchor(root, part, hog2x, x, y, ix + k, iy + k);
+				float best = -FLT_MAX;
+				int miny = ccv_max(iy[k] - CCV_DPM_CASCADE_DISPLACEMENT, 0), maxy = ccv_min(iy[k] + CCV_DPM_CASCADE_DISPLACEMENT, hog2x->rows - 1);
+				int minx = ccv_max(ix[k] - CCV_DPM_CASCADE_DISPLACEMENT, 0), maxx = ccv_min(ix[k] + CCV_DPM_CASCADE_DISPLACEMENT, hog2x->cols - 1);
+				for (v = miny; v <= maxy; v++)
+				{
+					float* r_ptr = response + size * k + v * hog2x->cols;
+					int dy = iy[k] - v;
+					float cy = part->dy * dy + part->dyy * dy * dy;
+					for (u = minx; u <= maxx; u++)
+					{
+						if (r_ptr[u] == FLT_MAX)
+							r_ptr[u] = _ccv_dpm_filter_at(hog2x, part->w, v, u);
+						int dx = ix[k] - u;
+						/* the same cost as the distance transform, the displacement is from the part to its anchor */
+						float s = r_ptr[u] - (part->dx * dx + part->dxx * dx * dx + cy);
+						if (s > best)
+						{
+							best = s;
+							rx[k] = dx;
+							ry[k] = dy;
+						}
+					}
+				}
+				part_confidence[k] = best;
+				score[k + 1] = score[k] + best;
+				if (score[k + 1] < cascade[k + 1])
+					break;
+			}
+			if (k < root->count || score[root->count] <= threshold)
+				continue;
+			_ccv_dpm_push_root_comp(root, c, x, y, score[root->count], ix, iy, rx, ry, part_confidence, scale_x, scale_y, seq);
+			if (partial)
+				ccv_array_push(partial, score);
+		}
+		f_ptr += root_feature->cols;
+	}
+	ccfree(response);
+	ccv_matrix_free(root_feature);
+}
+
+/* find the window that overlaps bbox best with the star-cascade (no pruning), and lower the thresholds to its partial scores */
+static void _ccv_dpm_estimate_cascade_on_image(ccv_dpm_mixture_model_t* model, ccv_dense_matrix_t* image, ccv_rect_t bbox, double overlap, ccv_dpm_param_t params, float* cascade, int* found)
+{
+	int i, j, k;
+	double scale = pow(2.0, 1.0 / (params.interval + 1.0));
+	int next = params.interval + 1;
+	int scale_upto = _ccv_dpm_scale_upto(image, &model, 1, params.interval);
+	if (scale_upto < 0)
+		return;
+	ccv_dense_matrix_t** pyr = (ccv_dense_matrix_t**)alloca((scale_upto + next * 2) * sizeof(ccv_dense_matrix_t*));
+	_ccv_dpm_feature_pyramid(image, pyr, scale_upto, params.interval);
+	float none[CCV_DPM_PART_MAX + 1];
+	for (i = 0; i < CCV_DPM_PART_MAX + 1; i++)
+		none[i] = -FLT_MAX;
+	float best[CCV_DPM_PART_MAX + 1];
+	float confidence = -FLT_MAX;
+	int id = -1;
+	ccv_array_t* seq = ccv_array_new(sizeof(ccv_root_comp_t), 64, 0);
+	ccv_array_t* partial = ccv_array_new(sizeof(float) * (CCV_DPM_PART_MAX + 1), 64, 0);
+	double scale_x = 1.0;
+	for (i = next; i < scale_upto + next * 2; i++)
+	{
+		for (j = 0; j < model->count; j++)
+		{
+			ccv_array_clear(seq);
+			ccv_array_clear(partial);
+			_ccv_dpm_scan_root_cascade(model->root + j, 0, pyr[i], pyr[i - next], 0, scale_x, scale_x, params.threshold, none, seq, partial);
+			for (k = 0; k < seq->rnum; k++)
+			{
+				ccv_root_comp_t* comp = (ccv_root_comp_t*)ccv_array_get(seq, k);
+				ccv_rect_t rect = comp->rect;
+				if ((double)(ccv_max(0, ccv_min(rect.x + rect.width, bbox.x + bbox.width) - ccv_max(rect.x, bbox.x)) *
+							 ccv_max(0, ccv_min(rect.y + rect.height, bbox.y + bbox.height) - ccv_max(rect.y, bbox.y))) /
+					(double)ccv_max(rect.width * rect.height, bbox.width * bbox.height) >= overlap && comp->confidence > confidence)
+				{
+					confidence = comp->confidence;
+					id = j;
+					memcpy(best, ccv_array_get(partial, k), sizeof(float) * (CCV_DPM_PART_MAX + 1));
+				}
+			}
+		}
+		scale_x *= scale;
+	}
+	ccv_array_free(seq);
+	ccv_array_free(partial);
+	for (i = 0; i < scale_upto + next * 2; i++)
+		ccv_matrix_free(pyr[i]);
+	if (id < 0)
+		return;
+	for (k = 0; k <= model->root[id].count; k++)
+		cascade[id * (CCV_DPM_PART_MAX + 1) + k] = ccv_min(cascade[id * (CCV_DPM_PART_MAX + 1) + k], best[k]);
+	++found[id];
+}
+
+static void _ccv_dpm_set_cascade(ccv_dpm_mixture_model_t* model, float* cascade, int* found)
+{
+	int i, k;
+	for (i = 0; i < model->count; i++)
+		for (k = 0; k < CCV_DPM_PART_MAX + 1; k++)
+			model->root[i].cascade[k] = (found[i] > 0 && k <= model->root[i].count) ? cascade[i * (CCV_DPM_PART_MAX + 1) + k] : -FLT_MAX;
+}
+
+/* the star-cascade thresholds follow all the root classifiers in the text format, and are read back by position, thus,
+ * every root has its row, the ones without a cascade (-FLT_MAX) too */
+static inline void _ccv_dpm_write_cascade(ccv_dpm_mixture_model_t* model, FILE* w)
+{
+	int i, j;
+	for (i = 0; i < model->count; i++)
+	{
+		for (j = 0; j <= model->root[i].count; j++)
+			fprintf(w, "%a ", model->root[i].cascade[j]);
+		fprintf(w, "\n");
+	}
+}
+
 #ifdef HAVE_LIBLINEAR
 #ifdef HAVE_GSL
 
@@ -143,6 +730,7 @@ static ccv_dpm_mixture_model_t* _ccv_dpm_model_copy(ccv_dpm_mixture_model_t* _mo
 {
 	ccv_dpm_mixture_model_t* model = (ccv_dpm_mixture_model_t*)ccmalloc(sizeof(ccv_dpm_mixture_model_t));
 	model->count = _model->count;
+	model->spectrum = 0;
 	model->root = (ccv_dpm_root_classifier_t*)ccmalloc(sizeof(ccv_dpm_root_classifier_t) * model->count);
 	int i, j;
 	memcpy(model->root, _model->root, sizeof(ccv_dpm_root_classifier_t) * model->count);
@@ -217,6 +805,8 @@ static void _ccv_dpm_write_checkpoint(ccv_dpm_mixture_model_t* model, int done,
 			}
 		}
 	}
+	if (done)
+		_ccv_dpm_write_cascade(model, w);
 	fclose(w);
 	rename(swpfile, dir);
 }
@@ -237,6 +827,8 @@ static void _ccv_dpm_read_checkpoint(ccv_dpm_mixture_model_t* model, const char*
 	for (i = 0; i < count; i++)
 	{
 		int rows, cols;
+		for (j = 0; j < CCV_DPM_PART_MAX + 1; j++)
+			root_classifier[i].cascade[j] = -FLT_MAX;
 		fscanf(r, "%d %d", &rows, &cols);
 		fscanf(r, "%f %f %f %f", &root_classifier[i].beta, &root_classifier[i].alpha[0], &root_classifier[i].alpha[1], &root_classifier[i].alpha[2]);
 		root_classifier[i].root.w = ccv_dense_matrix_new(rows, cols, CCV_32F | 31, 0, 0);
@@ -871,7 +1463,7 @@ static ccv_dpm_feature_vector_t* _ccv_dpm_collect_best(ccv_dense_matrix_t* image
 			ccv_dense_matrix_t* part_feature[CCV_DPM_PART_MAX];
 			ccv_dense_matrix_t* dx[CCV_DPM_PART_MAX];
 			ccv_dense_matrix_t* dy[CCV_DPM_PART_MAX];
-			_ccv_dpm_compute_score(root_classifier, pyr[j], pyr[j - next], &root_feature, part_feature, dx, dy);
+			_ccv_dpm_compute_score(root_classifier, pyr[j], pyr[j - next], 0, 0, &root_feature, part_feature, dx, dy);
 			int rwh = (root_classifier->root.w->rows - 1) / 2, rww = (root_classifier->root.w->cols - 1) / 2;
 			int rwh_1 = root_classifier->root.w->rows / 2, rww_1 = root_classifier->root.w->cols / 2;
 			float* f_ptr = (float*)ccv_get_dense_matrix_cell_by(CCV_32F | CCV_C1, root_feature, rwh, 0, 0);
@@ -947,7 +1539,7 @@ static ccv_array_t* _ccv_dpm_collect_all(gsl_rng* rng, ccv_dense_matrix_t* image
 			ccv_dense_matrix_t* part_feature[CCV_DPM_PART_MAX];
 			ccv_dense_matrix_t* dx[CCV_DPM_PART_MAX];
 			ccv_dense_matrix_t* dy[CCV_DPM_PART_MAX];
-			_ccv_dpm_compute_score(root_classifier, pyr[j], pyr[j - next], &root_feature, part_feature, dx, dy);
+			_ccv_dpm_compute_score(root_classifier, pyr[j], pyr[j - next], 0, 0, &root_feature, part_feature, dx, dy);
 			int rwh = (root_classifier->root.w->rows - 1) / 2, rww = (root_classifier->root.w->cols - 1) / 2;
 			int rwh_1 = root_classifier->root.w->rows / 2, rww_1 = root_classifier->root.w->cols / 2;
 			float* f_ptr = (float*)ccv_get_dense_matrix_cell_by(CCV_32F | CCV_C1, root_feature, rwh, 0, 0);
@@ -1651,6 +2243,9 @@ void ccv_dpm_mixture_model_new(char** posfiles, ccv_rect_t* bboxes, int posnum,
 		model->count = params.components;
 		model->root = (ccv_dpm_root_classifier_t*)ccmalloc(sizeof(ccv_dpm_root_classifier_t) * model->count);
 		memset(model->root, 0, sizeof(ccv_dpm_root_classifier_t) * model->count);
+		for (i = 0; i < model->count; i++)
+			for (j = 0; j < CCV_DPM_PART_MAX + 1; j++)
+				model->root[i].cascade[j] = -FLT_MAX;
 	}
 	printf("computing root mixture model dimensions: ");
 	fflush(stdout);
@@ -1989,6 +2584,24 @@ void ccv_dpm_mixture_model_new(char** posfiles, ccv_rect_t* bboxes, int posnum,
 	ccfree(posv);
 	printf("root rectangle prediction with linear regression\n");
 	_ccv_dpm_initialize_root_rectangle_estimator(model, posfiles, bboxes, posnum, params);
+	printf("star-cascade thresholds from positive examples\n");
+	float* cascade = (float*)ccmalloc(sizeof(float) * (CCV_DPM_PART_MAX + 1) * model->count);
+	int* found = (int*)ccmalloc(sizeof(int) * model->count);
+	for (i = 0; i < (CCV_DPM_PART_MAX + 1) * model->count; i++)
+		cascade[i] = FLT_MAX;
+	memset(found, 0, sizeof(int) * model->count);
+	for (i = 0; i < posnum; i++)
+	{
+		FLUSH(" - collecting partial scores from positive examples : %d%%", i * 100 / posnum);
+		ccv_dense_matrix_t* image = 0;
+		ccv_read(posfiles[i], &image, (params.grayscale ? CCV_IO_GRAY : 0) | CCV_IO_ANY_FILE);
+		_ccv_dpm_estimate_cascade_on_image(model, image, bboxes[i], params.include_overlap, params.detector, cascade, found);
+		ccv_matrix_free(image);
+	}
+	printf("\n");
+	_ccv_dpm_set_cascade(model, cascade, found);
+	ccfree(found);
+	ccfree(cascade);
 	_ccv_dpm_write_checkpoint(model, 1, checkpoint);
 	printf("done\n");
 	remove(gradient_progress_checkpoint);
@@ -2009,6 +2622,15 @@ void ccv_dpm_mixture_model_new(char** posfiles, ccv_rect_t* bboxes, int posnum,
 }
 #endif
 
+typedef struct {
+	int x;
+	int i;
+} ccv_dpm_comp_origin_t;
+
+#define less_than(o1, o2, aux) ((o1).x < (o2).x)
+static CCV_IMPLEMENT_QSORT(_ccv_dpm_comp_origin_qsort, ccv_dpm_comp_origin_t, less_than)
+#undef less_than
+
 static int _ccv_is_equal(const void* _r1, const void* _r2, void* data)
 {
 	const ccv_root_comp_t* r1 = (const ccv_root_comp_t*)_r1;
@@ -2042,92 +2664,90 @@ static int _ccv_is_equal_same_class(const void* _r1, const void* _r2, void* data
 		(int)(r2->rect.height * 1.5 + 0.5) >= r1->rect.height;
 }
 
-ccv_array_t* ccv_dpm_detect_objects(ccv_dense_matrix_t* a, ccv_dpm_mixture_model_t** _model, int count, ccv_dpm_param_t params)
+static int ccv_dpm_spectrum_enabled = 1;
+
+void ccv_dpm_set_spectrum(int enable)
+{
+	ccv_dpm_spectrum_enabled = enable;
+}
+
+typedef struct {
+	ccv_dpm_mixture_model_t* model;
+	int c;
+	ccv_dense_matrix_t** pyr;
+	ccv_dense_matrix_t** response; // the responses of the filters, 0 if these are computed on the way
+	int fcount;
+	int next;
+	double* scales;
+	ccv_dpm_param_t params;
+	ccv_array_t** useq; // one array per unit
+} ccv_dpm_scan_band_t;
+
+/* the units [start, end), the unit k is the root classifier k % model->count on the level next + k / model->count */
+static void _ccv_dpm_scan_band(void* context, int start, int end)
 {
-	int c, i, j, k, x, y;
+	ccv_dpm_scan_band_t* band = (ccv_dpm_scan_band_t*)context;
+	ccv_dpm_mixture_model_t* model = band->model;
+	int k, next = band->next;
+	for (k = start; k < end; k++)
+	{
+		int i = next + k / model->count, j = k % model->count;
+		ccv_array_t* seq = band->useq[k] = ccv_array_new(sizeof(ccv_root_comp_t), 4, 0);
+		ccv_dense_matrix_t* root_response = band->response ? band->response[i * band->fcount + j] : 0;
+		ccv_dense_matrix_t** part_response = band->response ? band->response + (i - next) * band->fcount + _ccv_dpm_part_index(model, j) : 0;
+		if (band->params.flags & CCV_DPM_CASCADE)
+			_ccv_dpm_scan_root_cascade(model->root + j, band->c, band->pyr[i], band->pyr[i - next], root_response, band->scales[i - next], band->scales[i - next], band->params.threshold, model->root[j].cascade, seq, 0);
+		else
+			_ccv_dpm_scan_root(model->root + j, band->c, band->pyr[i], band->pyr[i - next], root_response, part_response, band->scales[i - next], band->scales[i - next], band->params.threshold, seq);
+	}
+}
+
+/* scan the hog pyramid with every model, the hog pyramid is freed afterwards */
+static ccv_array_t* _ccv_dpm_detect_objects(ccv_dense_matrix_t** pyr, ccv_dpm_mixture_model_t** _model, int count, int scale_upto, ccv_dpm_param_t params)
+{
+	int c, i, j;
 	double scale = pow(2.0, 1.0 / (params.interval + 1.0));
 	int next = params.interval + 1;
-	int scale_upto = _ccv_dpm_scale_upto(a, _model, count, params.interval);
-	if (scale_upto < 0) // image is too small to be interesting
-		return 0;
-	ccv_dense_matrix_t** pyr = (ccv_dense_matrix_t**)alloca((scale_upto + next * 2) * sizeof(ccv_dense_matrix_t*));
-	_ccv_dpm_feature_pyramid(a, pyr, scale_upto, params.interval);
 	ccv_array_t* idx_seq;
 	ccv_array_t* seq = ccv_array_new(sizeof(ccv_root_comp_t), 64, 0);
 	ccv_array_t* seq2 = ccv_array_new(sizeof(ccv_root_comp_t), 64, 0);
 	ccv_array_t* result_seq = ccv_array_new(sizeof(ccv_root_comp_t), 64, 0);
+	double* scales = (double*)alloca((scale_upto + next) * sizeof(double));
+	scales[0] = 1.0;
+	for (i = 1; i < scale_upto + next; i++)
+		scales[i] = scales[i - 1] * scale;
 	for (c = 0; c < count; c++)
 	{
 		ccv_dpm_mixture_model_t* model = _model[c];
-		double scale_x = 1.0;
-		double scale_y = 1.0;
-		for (i = next; i < scale_upto + next * 2; i++)
+		/* the responses of the filters in the frequency domain, the cascade computes the ones of the parts lazily */
+		ccv_dpm_spectrum_t* spectrum = ccv_dpm_spectrum_enabled ? _ccv_dpm_spectrum_get(model) : 0;
+		ccv_dense_matrix_t** response = spectrum ? _ccv_dpm_responses(model, pyr, scale_upto, next, !(params.flags & CCV_DPM_CASCADE)) : 0;
+		int fcount = spectrum ? spectrum->count : 0;
+		/* every (level, root classifier) is an independent unit of work, each unit collects into its own array,
+		 * and these are merged in the serial order afterwards, thus, the grouping sees the same sequence */
+		int k, unum = (scale_upto + next) * model->count;
+		ccv_array_t** useq = (ccv_array_t**)ccmalloc(unum * sizeof(ccv_array_t*));
+		ccv_dpm_scan_band_t band = {
+			.model = model,
+			.c = c,
+			.pyr = pyr,
+			.response = response,
+			.fcount = fcount,
+			.next = next,
+			.scales = scales,
+			.params = params,
+			.useq = useq,
+		};
+		ccv_parallel_for(unum, 1, _ccv_dpm_scan_band, &band);
+		for (k = 0; k < unum; k++)
 		{
-			for (j = 0; j < model->count; j++)
-			{
-				ccv_dpm_root_classifier_t* root = model->root + j;
-				ccv_dense_matrix_t* root_feature = 0;
-				ccv_dense_matrix_t* part_feature[CCV_DPM_PART_MAX];
-				ccv_dense_matrix_t* dx[CCV_DPM_PART_MAX];
-				ccv_dense_matrix_t* dy[CCV_DPM_PART_MAX];
-				_ccv_dpm_compute_score(root, pyr[i], pyr[i - next], &root_feature, part_feature, dx, dy);
-				int rwh = (root->root.w->rows - 1) / 2, rww = (root->root.w->cols - 1) / 2;
-				int rwh_1 = root->root.w->rows / 2, rww_1 = root->root.w->cols / 2;
-				/* these values are designed to make sure works with odd/even number of rows/cols
-				 * of the root classifier:
-				 * suppose the image is 6x6, and the root classifier is 6x6, the scan area should starts
-				 * at (2,2) and end at (2,2), thus, it is capped by (rwh, rww) to (6 - rwh_1 - 1, 6 - rww_1 - 1)
-				 * this computation works for odd root classifier too (i.e. 5x5) */
-				float* f_ptr = (float*)ccv_get_dense_matrix_cell_by(CCV_32F | CCV_C1, root_feature, rwh, 0, 0);
-				for (y = rwh; y < root_feature->rows - rwh_1; y++)
-				{
-					for (x = rww; x < root_feature->cols - rww_1; x++)
-						if (f_ptr[x] + root->beta > params.threshold)
-						{
-							ccv_root_comp_t comp;
-							comp.id = c;
-							comp.neighbors = 1;
-							comp.confidence = f_ptr[x] + root->beta;
-							comp.pnum = root->count;
-							float drift_x = root->alpha[0],
-								  drift_y = root->alpha[1],
-								  drift_scale = root->alpha[2];
-							for (k = 0; k < root->count; k++)
-							{
-								ccv_dpm_part_classifier_t* part = root->part + k;
-								comp.part[k].id = c;
-								comp.part[k].neighbors = 1;
-								int pww = (part->w->cols - 1) / 2, pwh = (part->w->rows - 1) / 2;
-								int offy = part->y + pwh - rwh * 2;
-								int offx = part->x + pww - rww * 2;
-								int iy = ccv_clamp(y * 2 + offy, pwh, part_feature[k]->rows - part->w->rows + pwh);
-								int ix = ccv_clamp(x * 2 + offx, pww, part_feature[k]->cols - part->w->cols + pww);
-								int ry = ccv_get_dense_matrix_cell_value_by(CCV_32S | CCV_C1, dy[k], iy, ix, 0);
-								int rx = ccv_get_dense_matrix_cell_value_by(CCV_32S | CCV_C1, dx[k], iy, ix, 0);
-								drift_x += part->alpha[0] * rx + part->alpha[1] * ry;
-								drift_y += part->alpha[2] * rx + part->alpha[3] * ry;
-								drift_scale += part->alpha[4] * rx + part->alpha[5] * ry;
-								ry = iy - ry;
-								rx = ix - rx;
-								comp.part[k].rect = ccv_rect((int)((rx - pww) * CCV_DPM_WINDOW_SIZE / 2 * scale_x + 0.5), (int)((ry - pwh) * CCV_DPM_WINDOW_SIZE / 2 * scale_y + 0.5), (int)(part->w->cols * CCV_DPM_WINDOW_SIZE / 2 * scale_x + 0.5), (int)(part->w->rows * CCV_DPM_WINDOW_SIZE / 2 * scale_y + 0.5));
-								comp.part[k].confidence = -ccv_get_dense_matrix_cell_value_by(CCV_32F | CCV_C1, part_feature[k], iy, ix, 0);
-							}
-							comp.rect = ccv_rect((int)((x + drift_x) * CCV_DPM_WINDOW_SIZE * scale_x - rww * CCV_DPM_WINDOW_SIZE * scale_x * (1.0 + drift_scale) + 0.5), (int)((y + drift_y) * CCV_DPM_WINDOW_SIZE * scale_y - rwh * CCV_DPM_WINDOW_SIZE * scale_y * (1.0 + drift_scale) + 0.5), (int)(root->root.w->cols * CCV_DPM_WINDOW_SIZE * scale_x * (1.0 + drift_scale) + 0.5), (int)(root->root.w->rows * CCV_DPM_WINDOW_SIZE * scale_y * (1.0 + drift_scale) + 0.5));
-							ccv_array_push(seq, &comp);
-						}
-					f_ptr += root_feature->cols;
-				}
-				for (k = 0; k < root->count; k++)
-				{
-					ccv_matrix_free(part_feature[k]);
-					ccv_matrix_free(dx[k]);
-					ccv_matrix_free(dy[k]);
-				}
-				ccv_matrix_free(root_feature);
-			}
-			scale_x *= scale;
-			scale_y *= scale;
+			for (i = 0; i < useq[k]->rnum; i++)
+				ccv_array_push(seq, ccv_array_get(useq[k], i));
+			ccv_array_free(useq[k]);
 		}
+		ccfree(useq);
+		if (response)
+			ccfree(response);
 		/* the following code from OpenCV's haar feature implementation */
 		if (params.min_neighbors == 0)
 		{
@@ -2140,7 +2760,7 @@ ccv_array_t* ccv_dpm_detect_objects(ccv_dense_matrix_t* a, ccv_dpm_mixture_model
 			idx_seq = 0;
 			ccv_array_clear(seq2);
 			// group retrieved rectangles in order to filter out noise
-			int ncomp = ccv_array_group(seq, &idx_seq, _ccv_is_equal_same_class, 0);
+			int ncomp = ccv_array_group_rect(seq, &idx_seq, _ccv_is_equal_same_class, 0, 0.25);
 			ccv_root_comp_t* comps = (ccv_root_comp_t*)ccmalloc((ncomp + 1) * sizeof(ccv_root_comp_t));
 			memset(comps, 0, (ncomp + 1) * sizeof(ccv_root_comp_t));
 
@@ -2170,14 +2790,37 @@ ccv_array_t* ccv_dpm_detect_objects(ccv_dense_matrix_t* a, ccv_dpm_mixture_model
 					ccv_array_push(seq2, comps + i);
 			}
 
-			// filter out small object rectangles inside large object rectangles
+			// filter out small object rectangles inside large object rectangles, the ones can contain r1 begin within
+			// [r1.rect.x + r1.rect.width - extent, r1.rect.x + reach] along x, these are looked up in seq2 sorted by x
+			ccv_dpm_comp_origin_t* origin = (ccv_dpm_comp_origin_t*)ccmalloc((seq2->rnum + 1) * sizeof(ccv_dpm_comp_origin_t));
+			int k, reach = 0, extent = 0;
+			for(i = 0; i < seq2->rnum; i++)
+			{
+				ccv_root_comp_t* r2 = (ccv_root_comp_t*)ccv_array_get(seq2, i);
+				int distance = (int)(ccv_min(r2->rect.width, r2->rect.height) * 0.25 + 0.5);
+				reach = ccv_max(reach, distance);
+				extent = ccv_max(extent, r2->rect.width + distance);
+				origin[i].x = r2->rect.x;
+				origin[i].i = i;
+			}
+			_ccv_dpm_comp_origin_qsort(origin, seq2->rnum, 0);
 			for(i = 0; i < seq2->rnum; i++)
 			{
 				ccv_root_comp_t r1 = *(ccv_root_comp_t*)ccv_array_get(seq2, i);
 				int flag = 1;
+				int lo = 0, hi = seq2->rnum;
+				while (lo < hi)
+				{
+					int mid = (lo + hi) / 2;
+					if (origin[mid].x < r1.rect.x + r1.rect.width - extent)
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
 
-				for(j = 0; j < seq2->rnum; j++)
+				for(k = lo; k < seq2->rnum && origin[k].x <= r1.rect.x + reach; k++)
 				{
+					j = origin[k].i;
 					ccv_root_comp_t r2 = *(ccv_root_comp_t*)ccv_array_get(seq2, j);
 					int distance = (int)(ccv_min(r2.rect.width, r2.rect.height) * 0.25 + 0.5);
 
@@ -2197,6 +2840,7 @@ ccv_array_t* ccv_dpm_detect_objects(ccv_dense_matrix_t* a, ccv_dpm_mixture_model
 				if(flag)
 					ccv_array_push(result_seq, &r1);
 			}
+			ccfree(origin);
 			ccv_array_free(idx_seq);
 			ccfree(comps);
 		}
@@ -2215,7 +2859,7 @@ ccv_array_t* ccv_dpm_detect_objects(ccv_dense_matrix_t* a, ccv_dpm_mixture_model
 		result_seq2 = ccv_array_new(sizeof(ccv_root_comp_t), 64, 0);
 		idx_seq = 0;
 		// group retrieved rectangles in order to filter out noise
-		int ncomp = ccv_array_group(result_seq, &idx_seq, _ccv_is_equal, 0);
+		int ncomp = ccv_array_group_rect(result_seq, &idx_seq, _ccv_is_equal, 0, 0.25);
 		ccv_root_comp_t* comps = (ccv_root_comp_t*)ccmalloc((ncomp + 1) * sizeof(ccv_root_comp_t));
 		memset(comps, 0, (ncomp + 1) * sizeof(ccv_root_comp_t));
 
@@ -2250,11 +2894,268 @@ ccv_array_t* ccv_dpm_detect_objects(ccv_dense_matrix_t* a, ccv_dpm_mixture_model
 	return result_seq2;
 }
 
+ccv_array_t* ccv_dpm_detect_objects(ccv_dense_matrix_t* a, ccv_dpm_mixture_model_t** _model, int count, ccv_dpm_param_t params)
+{
+	int next = params.interval + 1;
+	int scale_upto = _ccv_dpm_scale_upto(a, _model, count, params.interval);
+	if (scale_upto < 0) // image is too small to be interesting
+		return 0;
+	ccv_dense_matrix_t** pyr = (ccv_dense_matrix_t**)alloca((scale_upto + next * 2) * sizeof(ccv_dense_matrix_t*));
+	_ccv_dpm_feature_pyramid(a, pyr, scale_upto, params.interval);
+	return _ccv_dpm_detect_objects(pyr, _model, count, scale_upto, params);
+}
+
+ccv_array_t* ccv_dpm_detect_objects_on_pyramid(ccv_pyramid_t* pyramid, ccv_dpm_mixture_model_t** _model, int count, ccv_dpm_param_t params)
+{
+	assert(pyramid->interval == params.interval);
+	int next = params.interval + 1;
+	int scale_upto = _ccv_dpm_scale_upto(pyramid->a, _model, count, params.interval);
+	if (scale_upto < 0) // image is too small to be interesting
+		return 0;
+	ccv_dense_matrix_t** pyr = (ccv_dense_matrix_t**)alloca((scale_upto + next * 2) * sizeof(ccv_dense_matrix_t*));
+	_ccv_dpm_hog_pyramid(pyramid, pyr, scale_upto);
+	return _ccv_dpm_detect_objects(pyr, _model, count, scale_upto, params);
+}
+
+void ccv_dpm_mixture_model_estimate_cascade(ccv_dpm_mixture_model_t* model, ccv_dense_matrix_t** images, ccv_rect_t* bboxes, int count, double overlap, ccv_dpm_param_t params)
+{
+	/* the thresholds are the lowest partial scores of the positive examples that are detected, thus, on the
+	 * training data, the cascade doesn't drop any window that the full model would find for these */
+	int i;
+	float* cascade = (float*)ccmalloc(sizeof(float) * (CCV_DPM_PART_MAX + 1) * model->count);
+	int* found = (int*)ccmalloc(sizeof(int) * model->count);
+	for (i = 0; i < (CCV_DPM_PART_MAX + 1) * model->count; i++)
+		cascade[i] = FLT_MAX;
+	memset(found, 0, sizeof(int) * model->count);
+	for (i = 0; i < count; i++)
+		_ccv_dpm_estimate_cascade_on_image(model, images[i], bboxes[i], overlap, params, cascade, found);
+	_ccv_dpm_set_cascade(model, cascade, found);
+	ccfree(found);
+	ccfree(cascade);
+}
+
+/* the binary model file is laid out as: a header, the root classifiers, the part classifiers of all roots (in order),
+ * and then the filters, every one of them starts at an offset aligned to CCV_DPM_BINARY_ALIGN. Thus, the file can be
+ * mapped into memory and the filters used in place, nothing other than the small records needs to be read */
+#define CCV_DPM_BINARY_MAGIC "CCVDPMB"
+#define CCV_DPM_BINARY_VERSION (1)
+#define CCV_DPM_BINARY_ALIGN (64)
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint32_t part_max;
+	uint32_t reserved;
+	uint64_t size;
+} ccv_dpm_binary_header_t;
+
+typedef struct {
+	uint64_t offset;
+	uint64_t sig;
+	int32_t rows, cols;
+} ccv_dpm_binary_filter_t;
+
+typedef struct {
+	ccv_dpm_binary_filter_t w;
+	int32_t count;
+	float alpha[3], beta;
+	float cascade[CCV_DPM_PART_MAX + 1];
+} ccv_dpm_binary_root_t;
+
+typedef struct {
+	ccv_dpm_binary_filter_t w;
+	double dx, dy, dxx, dyy;
+	int32_t x, y, z;
+	int32_t counterpart;
+	float alpha[6];
+} ccv_dpm_binary_part_t;
+
+static void _ccv_dpm_write_binary_filter(ccv_dpm_binary_filter_t* filter, ccv_dense_matrix_t* w, uint64_t* offset)
+{
+	filter->offset = *offset;
+	filter->sig = w->sig;
+	filter->rows = w->rows;
+	filter->cols = w->cols;
+	*offset = (*offset + sizeof(float) * w->rows * w->cols * 31 + CCV_DPM_BINARY_ALIGN - 1) & -(uint64_t)CCV_DPM_BINARY_ALIGN;
+}
+
+int ccv_dpm_mixture_model_write_binary(ccv_dpm_mixture_model_t* model, const char* filename)
+{
+	int i, j, k, parts = 0;
+	for (i = 0; i < model->count; i++)
+		parts += model->root[i].count;
+	size_t size = sizeof(ccv_dpm_binary_header_t) + sizeof(ccv_dpm_binary_root_t) * model->count + sizeof(ccv_dpm_binary_part_t) * parts;
+	unsigned char* m = (unsigned char*)ccmalloc(size);
+	/* zero out the paddings too, thus, the same model always gives the same file */
+	memset(m, 0, size);
+	ccv_dpm_binary_header_t* header = (ccv_dpm_binary_header_t*)m;
+	ccv_dpm_binary_root_t* broot = (ccv_dpm_binary_root_t*)(header + 1);
+	ccv_dpm_binary_part_t* bpart = (ccv_dpm_binary_part_t*)(broot + model->count);
+	uint64_t offset = (size + CCV_DPM_BINARY_ALIGN - 1) & -(uint64_t)CCV_DPM_BINARY_ALIGN;
+	memcpy(header->magic, CCV_DPM_BINARY_MAGIC, sizeof(header->magic));
+	header->version = CCV_DPM_BINARY_VERSION;
+	header->count = model->count;
+	header->part_max = CCV_DPM_PART_MAX;
+	for (i = 0, k = 0; i < model->count; i++)
+	{
+		ccv_dpm_root_classifier_t* root = model->root + i;
+		_ccv_dpm_write_binary_filter(&broot[i].w, root->root.w, &offset);
+		broot[i].count = root->count;
+		memcpy(broot[i].alpha, root->alpha, sizeof(broot[i].alpha));
+		broot[i].beta = root->beta;
+		memcpy(broot[i].cascade, root->cascade, sizeof(broot[i].cascade));
+		for (j = 0; j < root->count; j++, k++)
+		{
+			ccv_dpm_part_classifier_t* part = root->part + j;
+			_ccv_dpm_write_binary_filter(&bpart[k].w, part->w, &offset);
+			bpart[k].dx = part->dx;
+			bpart[k].dy = part->dy;
+			bpart[k].dxx = part->dxx;
+			bpart[k].dyy = part->dyy;
+			bpart[k].x = part->x;
+			bpart[k].y = part->y;
+			bpart[k].z = part->z;
+			bpart[k].counterpart = part->counterpart;
+			memcpy(bpart[k].alpha, part->alpha, sizeof(bpart[k].alpha));
+		}
+	}
+	header->size = offset;
+	FILE* w = fopen(filename, "wb");
+	if (w == 0)
+	{
+		ccfree(m);
+		return -1;
+	}
+	static const unsigned char zeros[CCV_DPM_BINARY_ALIGN] = {0};
+	int ok = (fwrite(m, 1, size, w) == size);
+	offset = size;
+	for (i = 0, k = 0; ok && i < model->count; i++)
+		for (j = -1; ok && j < model->root[i].count; j++)
+		{
+			/* the root filter first, and then its parts */
+			ccv_dpm_binary_filter_t* filter = (j < 0) ? &broot[i].w : &bpart[k++].w;
+			ccv_dense_matrix_t* mat = (j < 0) ? model->root[i].root.w : model->root[i].part[j].w;
+			size_t len = sizeof(float) * mat->rows * mat->cols * 31;
+			ok = (fwrite(zeros, 1, filter->offset - offset, w) == filter->offset - offset) && (fwrite(mat->data.f32, 1, len, w) == len);
+			offset = filter->offset + len;
+		}
+	if (ok && offset < header->size)
+		ok = (fwrite(zeros, 1, header->size - offset, w) == header->size - offset);
+	ok = (fclose(w) == 0) && ok;
+	ccfree(m);
+	return ok ? 0 : -1;
+}
+
+static int _ccv_dpm_read_binary_filter(ccv_dense_matrix_t* mat, ccv_dpm_binary_filter_t* filter, unsigned char* map, uint64_t size)
+{
+	if (filter->rows <= 0 || filter->cols <= 0 || filter->offset % CCV_DPM_BINARY_ALIGN != 0 ||
+		filter->offset + sizeof(float) * filter->rows * filter->cols * 31 > size)
+		return -1;
+	*mat = ccv_dense_matrix(filter->rows, filter->cols, CCV_32F | 31, map + filter->offset, filter->sig);
+	return 0;
+}
+
+static ccv_dpm_mixture_model_t* _ccv_dpm_read_binary(const char* filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(ccv_dpm_binary_header_t))
+	{
+		close(fd);
+		return 0;
+	}
+	unsigned char* map = (unsigned char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+	ccv_dpm_binary_header_t* header = (ccv_dpm_binary_header_t*)map;
+	ccv_dpm_binary_root_t* broot = (ccv_dpm_binary_root_t*)(header + 1);
+	int i, j, k, parts = 0;
+	if (memcmp(header->magic, CCV_DPM_BINARY_MAGIC, sizeof(header->magic)) != 0 || header->version != CCV_DPM_BINARY_VERSION ||
+		header->part_max != CCV_DPM_PART_MAX || header->size != st.st_size || (int)header->count < 0 ||
+		sizeof(ccv_dpm_binary_header_t) + sizeof(ccv_dpm_binary_root_t) * (uint64_t)header->count > header->size)
+	{
+		munmap(map, st.st_size);
+		return 0;
+	}
+	/* the counts are checked before they are summed up, thus, a corrupted one can neither overflow parts nor
+	 * point the parts out of the file */
+	for (i = 0; i < header->count; i++)
+	{
+		if (broot[i].count < 0 || broot[i].count > CCV_DPM_PART_MAX)
+			break;
+		parts += broot[i].count;
+	}
+	ccv_dpm_binary_part_t* bpart = (ccv_dpm_binary_part_t*)(broot + header->count);
+	if (i < header->count || sizeof(ccv_dpm_binary_part_t) * (uint64_t)parts > header->size - ((unsigned char*)bpart - map))
+	{
+		munmap(map, st.st_size);
+		return 0;
+	}
+	/* only the records are copied, the filters stay in the mapped file */
+	size_t size = sizeof(ccv_dpm_mixture_model_t) + sizeof(ccv_dpm_root_classifier_t) * header->count + sizeof(ccv_dpm_part_classifier_t) * parts + sizeof(ccv_dense_matrix_t) * (header->count + parts);
+	unsigned char* m = (unsigned char*)ccmalloc(size);
+	ccv_dpm_mixture_model_t* model = (ccv_dpm_mixture_model_t*)m;
+	model->count = header->count;
+	model->root = (ccv_dpm_root_classifier_t*)(model + 1);
+	model->map = map;
+	model->map_size = st.st_size;
+	model->spectrum = 0;
+	ccv_dpm_part_classifier_t* part = (ccv_dpm_part_classifier_t*)(model->root + model->count);
+	ccv_dense_matrix_t* mat = (ccv_dense_matrix_t*)(part + parts);
+	for (i = 0, k = 0; i < model->count; i++)
+	{
+		ccv_dpm_root_classifier_t* root = model->root + i;
+		root->root.w = mat++;
+		if (_ccv_dpm_read_binary_filter(root->root.w, &broot[i].w, map, header->size) != 0)
+			break;
+		root->count = broot[i].count;
+		root->part = part;
+		memcpy(root->alpha, broot[i].alpha, sizeof(root->alpha));
+		root->beta = broot[i].beta;
+		memcpy(root->cascade, broot[i].cascade, sizeof(root->cascade));
+		for (j = 0; j < root->count; j++, k++, part++)
+		{
+			part->w = mat++;
+			if (_ccv_dpm_read_binary_filter(part->w, &bpart[k].w, map, header->size) != 0)
+				break;
+			part->dx = bpart[k].dx;
+			part->dy = bpart[k].dy;
+			part->dxx = bpart[k].dxx;
+			part->dyy = bpart[k].dyy;
+			part->x = bpart[k].x;
+			part->y = bpart[k].y;
+			part->z = bpart[k].z;
+			part->counterpart = bpart[k].counterpart;
+			memcpy(part->alpha, bpart[k].alpha, sizeof(part->alpha));
+		}
+		if (j < root->count)
+			break;
+	}
+	if (i < model->count)
+	{
+		ccv_dpm_mixture_model_free(model);
+		return 0;
+	}
+	model->spectrum = 0;
+	return model;
+}
+
 ccv_dpm_mixture_model_t* ccv_load_dpm_mixture_model(const char* directory)
 {
 	FILE* r = fopen(directory, "r");
 	if (r == 0)
 		return 0;
+	char magic[8];
+	if (fread(magic, 1, sizeof(magic), r) == sizeof(magic) && memcmp(magic, CCV_DPM_BINARY_MAGIC, sizeof(magic)) == 0)
+	{
+		fclose(r);
+		return _ccv_dpm_read_binary(directory);
+	}
+	rewind(r);
 	int count;
 	char flag;
 	fscanf(r, "%c", &flag);
@@ -2292,11 +3193,21 @@ ccv_dpm_mixture_model_t* ccv_load_dpm_mixture_model(const char* directory)
 		}
 		root_classifier[i].part = part_classifier;
 	}
+	/* the star-cascade thresholds are optional, and follow all the root classifiers */
+	for (i = 0; i < count; i++)
+		for (j = 0; j < CCV_DPM_PART_MAX + 1; j++)
+			root_classifier[i].cascade[j] = -FLT_MAX;
+	for (i = 0; i < count; i++)
+		for (j = 0; j <= root_classifier[i].count; j++)
+			if (fscanf(r, "%f", &root_classifier[i].cascade[j]) != 1)
+				break;
 	fclose(r);
 	unsigned char* m = (unsigned char*)ccmalloc(size);
 	ccv_dpm_mixture_model_t* model = (ccv_dpm_mixture_model_t*)m;
 	m += sizeof(ccv_dpm_mixture_model_t);
 	model->count = count;
+	model->map = 0;
+	model->map_size = 0;
 	model->root = (ccv_dpm_root_classifier_t*)m;
 	m += sizeof(ccv_dpm_root_classifier_t) * model->count;
 	memcpy(model->root, root_classifier, sizeof(ccv_dpm_root_classifier_t) * model->count);
@@ -2327,10 +3238,15 @@ ccv_dpm_mixture_model_t* ccv_load_dpm_mixture_model(const char* directory)
 			ccfree(w);
 		}
 	}
+	model->spectrum = 0;
 	return model;
 }
 
 void ccv_dpm_mixture_model_free(ccv_dpm_mixture_model_t* model)
 {
+	if (model->map)
+		munmap(model->map, model->map_size);
+	if (model->spectrum)
+		_ccv_dpm_spectrum_free((ccv_dpm_spectrum_t*)model->spectrum);
 	ccfree(model);
 }
@@ -323,6 +323,17 @@ static int _CCV_PRINT_LOOP __attribute__ ((unused)) = 0;
 	case CCV_64F: { block(__VA_ARGS__, double, _ccv_set_64f_value, _ccv_get_64f_value); break; } \
 	default: { block(__VA_ARGS__, unsigned char, _ccv_set_8u_value, _ccv_get_8u_value); } } }
 
+/* runs func(context, start, end) over the bands of [0, n) on the pool of ccv_set_num_threads, a band has at least
+ * grain of them (rows, typically), the calls run concurrently thus the bands must write to disjoint memory */
+typedef void (*ccv_parallel_f)(void* context, int start, int end);
+void ccv_parallel_for(int n, int grain, ccv_parallel_f func, void* context);
+
+/* the angle (in degrees) and the magnitude of (x, y), element-wise, what ccv_gradient computes (ccv_basic.c) */
+void _ccv_atan2(float* x, float* y, float* angle, float* mag, int len);
+
+/* frees the plans of the transforms that ccv_filter keeps for the next calls (ccv_numeric.c), ccv_drain_cache calls it */
+void _ccv_fft_drain(void);
+
 /****************************************************************************************\
 
   Generic implementation of QuickSort algorithm.
@@ -554,4 +565,8 @@ void func_name(T *array, size_t total, user_data_type aux)
 #define CCV_IMPLEMENT_QSORT(func_name, T, cmp)  \
     CCV_IMPLEMENT_QSORT_EX(func_name, T, cmp, _ccv_qsort_default_swap, int)
 
+/* the dpm detection correlates the filters with the hog in the frequency domain (see ccv_dpm.c), 0 turns that off and
+ * the filters are correlated directly, it is for the tests to compare the two, not to be changed during a detection */
+void ccv_dpm_set_spectrum(int enable);
+
 #endif
@@ -1,9 +1,34 @@
 #include "ccv.h"
 #include "ccv_internal.h"
 #include "3rdparty/sha1/sha1.h"
+#include <pthread.h>
 
 static __thread ccv_cache_t ccv_cache;
 
+/* the process-wide cache is split into shards by the top bits of the signature (the radix tree only uses the lower
+ * 60 bits), every shard has its own lock and gets an equal share of the memory bound */
+#define CCV_SHARED_CACHE_SHARDS (16)
+
+static struct {
+	pthread_mutex_t mutex;
+	ccv_cache_t cache;
+} ccv_shared_cache[CCV_SHARED_CACHE_SHARDS];
+
+/* the caches of the threads that enabled one are linked, thus, ccv_cache_stats can add them up */
+typedef struct ccv_cache_node_s {
+	ccv_cache_t* cache;
+	struct ccv_cache_node_s* prev;
+	struct ccv_cache_node_s* next;
+} ccv_cache_node_t;
+
+static __thread ccv_cache_node_t ccv_cache_node;
+static ccv_cache_node_t ccv_cache_nodes = { 0, &ccv_cache_nodes, &ccv_cache_nodes };
+static pthread_mutex_t ccv_cache_nodes_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* the statistics of the caches that are closed, or belong to the threads that exited */
+static ccv_cache_stats_t ccv_cache_retired_stats;
+static pthread_once_t ccv_cache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ccv_cache_key;
+
 /**
  * For new typed cache object:
  * ccv_dense_matrix_t: type 0
@@ -12,17 +37,381 @@ static __thread ccv_cache_t ccv_cache;
 
 /* option to enable/disable cache */
 static __thread int ccv_cache_opt = 0;
+/* option to use the process-wide cache instead of the one of the current thread, it is only set by
+ * ccv_enable_shared_cache / ccv_disable_shared_cache, and always read atomically */
+static int ccv_shared_cache_opt = 0;
+
+static inline int _ccv_shared_cache_enabled(void)
+{
+	return __atomic_load_n(&ccv_shared_cache_opt, __ATOMIC_ACQUIRE);
+}
+
+static void* _ccv_cache_out(uint64_t sig, uint8_t* type)
+{
+	if (!_ccv_shared_cache_enabled())
+		return ccv_cache_out(&ccv_cache, sig, type);
+	int i = sig >> 60;
+	pthread_mutex_lock(&ccv_shared_cache[i].mutex);
+	void* x = ccv_cache_out(&ccv_shared_cache[i].cache, sig, type);
+	pthread_mutex_unlock(&ccv_shared_cache[i].mutex);
+	return x;
+}
+
+static void _ccv_cache_stats_add(ccv_cache_stats_t* stats, ccv_cache_stats_t* x)
+{
+	stats->lookups += x->lookups;
+	stats->hits += x->hits;
+	stats->puts += x->puts;
+	stats->evictions += x->evictions;
+	stats->evicted_bytes += x->evicted_bytes;
+	int i;
+	for (i = 0; i < CCV_CACHE_STATS_BINS; i++)
+	{
+		stats->size[i] += x->size[i];
+		stats->hit_age[i] += x->hit_age[i];
+		stats->eviction_age[i] += x->eviction_age[i];
+	}
+}
+
+/* called when the cache is disabled, or the thread exits */
+static void _ccv_cache_node_remove(void* data)
+{
+	ccv_cache_node_t* node = (ccv_cache_node_t*)data;
+	pthread_mutex_lock(&ccv_cache_nodes_mutex);
+	if (node->cache)
+	{
+		_ccv_cache_stats_add(&ccv_cache_retired_stats, &node->cache->stats);
+		node->prev->next = node->next;
+		node->next->prev = node->prev;
+		node->cache = 0;
+	}
+	pthread_mutex_unlock(&ccv_cache_nodes_mutex);
+}
+
+static void _ccv_cache_key_create(void)
+{
+	pthread_key_create(&ccv_cache_key, _ccv_cache_node_remove);
+}
+
+static void _ccv_cache_node_insert(void)
+{
+	pthread_once(&ccv_cache_key_once, _ccv_cache_key_create);
+	pthread_mutex_lock(&ccv_cache_nodes_mutex);
+	if (!ccv_cache_node.cache)
+	{
+		ccv_cache_node.cache = &ccv_cache;
+		ccv_cache_node.prev = &ccv_cache_nodes;
+		ccv_cache_node.next = ccv_cache_nodes.next;
+		ccv_cache_nodes.next->prev = &ccv_cache_node;
+		ccv_cache_nodes.next = &ccv_cache_node;
+	}
+	pthread_mutex_unlock(&ccv_cache_nodes_mutex);
+	pthread_setspecific(ccv_cache_key, &ccv_cache_node);
+}
+
+static int _ccv_cache_put(uint64_t sig, void* x, uint32_t size, uint8_t type)
+{
+	if (!_ccv_shared_cache_enabled())
+		return ccv_cache_put(&ccv_cache, sig, x, size, type);
+	int i = sig >> 60;
+	pthread_mutex_lock(&ccv_shared_cache[i].mutex);
+	int result = ccv_cache_put(&ccv_shared_cache[i].cache, sig, x, size, type);
+	pthread_mutex_unlock(&ccv_shared_cache[i].mutex);
+	return result;
+}
+
+/* within ccv_arena_begin / ccv_arena_end, the thread allocates from chunks of CCV_ARENA_CHUNK_SIZE bytes: a block is
+ * rounded up to a power of 2 size class, ccfree puts it to the free list of its class for the next ccmalloc, and
+ * ccv_arena_end releases the chunks all at once. The blocks larger than half a chunk get a region of their own.
+ * The chunks and regions are aligned to CCV_ARENA_CHUNK_SIZE, and a pointer is from an arena if and only if its
+ * chunk is registered, that is how ccfree tells them apart from the memory of the system allocator (it looks into
+ * the chunks of its own thread and the bounds of all regions first, and only locks the registry for the rest).
+ * The released regions are kept (up to CCV_ARENA_SPARE_SIZE per thread) for the next scope, until ccv_drain_cache */
+#define CCV_ARENA_CHUNK_SHIFT (20)
+#define CCV_ARENA_CHUNK_SIZE (1 << CCV_ARENA_CHUNK_SHIFT)
+#define CCV_ARENA_MIN_CLASS (5)
+#define CCV_ARENA_MAX_CLASS (CCV_ARENA_CHUNK_SHIFT - 1)
+#define CCV_ARENA_HEADER (16) // keeps the blocks 16-byte aligned as malloc does
+#define CCV_ARENA_BUCKETS (256)
+#define CCV_ARENA_SPARE_SIZE (1024 * 1024 * 64)
+
+typedef struct ccv_arena_region_s {
+	struct ccv_arena_region_s* next; // in the registry
+	struct ccv_arena_region_s* link; // in the table of its arena, or in the spare list
+	struct ccv_arena_s* arena;
+	unsigned char* base;
+	size_t size;
+} ccv_arena_region_t;
+
+typedef struct ccv_arena_s {
+	int depth;
+	ccv_arena_region_t* table[CCV_ARENA_BUCKETS];
+	ccv_arena_region_t* spare;
+	size_t spare_size;
+	unsigned char* top;
+	unsigned char* end;
+	void* free[CCV_ARENA_MAX_CLASS + 1];
+} ccv_arena_t;
+
+static __thread ccv_arena_t ccv_arena;
+/* the regions of all arenas, thus, a block can be freed by another thread */
+static ccv_arena_region_t* ccv_arena_registry[CCV_ARENA_BUCKETS];
+// ccfree only reads it, thus, the frees on many threads don't wait for each other
+static pthread_rwlock_t ccv_arena_registry_lock = PTHREAD_RWLOCK_INITIALIZER;
+// the lowest and the highest address of the regions ever registered, a pointer out of these is from no arena
+static uintptr_t ccv_arena_lo = UINTPTR_MAX;
+static uintptr_t ccv_arena_hi = 0;
+/* the number of threads within an arena scope, when it is 0, ccfree is free */
+static int ccv_arena_live = 0;
+static pthread_once_t ccv_arena_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ccv_arena_key;
+
+#define ccv_arena_bucket(base) ((((uintptr_t)(base)) >> CCV_ARENA_CHUNK_SHIFT) & (CCV_ARENA_BUCKETS - 1))
+
+static void _ccv_arena_drain(void* data)
+{
+	ccv_arena_t* arena = (ccv_arena_t*)data;
+	while (arena->spare)
+	{
+		ccv_arena_region_t* region = arena->spare;
+		arena->spare = region->link;
+		free(region->base);
+		free(region);
+	}
+	arena->spare_size = 0;
+}
+
+static void _ccv_arena_key_create(void)
+{
+	pthread_key_create(&ccv_arena_key, _ccv_arena_drain);
+}
+
+static ccv_arena_region_t* _ccv_arena_region_new(ccv_arena_t* arena, size_t size)
+{
+	size = (size + CCV_ARENA_CHUNK_SIZE - 1) & ~(size_t)(CCV_ARENA_CHUNK_SIZE - 1);
+	// the smallest spare one that fits, if it is not too large (a chunk has to be exactly one, the blocks
+	// in it are found by their chunk)
+	size_t upto = size > CCV_ARENA_CHUNK_SIZE ? size * 2 : size;
+	ccv_arena_region_t** prev = 0;
+	ccv_arena_region_t** iter;
+	for (iter = &arena->spare; *iter; iter = &(*iter)->link)
+		if ((*iter)->size >= size && (*iter)->size <= upto && (!prev || (*iter)->size < (*prev)->size))
+			prev = iter;
+	ccv_arena_region_t* region;
+	if (prev)
+	{
+		region = *prev;
+		*prev = region->link;
+		arena->spare_size -= region->size;
+	} else {
+		void* base = 0;
+		if (posix_memalign(&base, CCV_ARENA_CHUNK_SIZE, size) != 0)
+			return 0;
+		region = (ccv_arena_region_t*)malloc(sizeof(ccv_arena_region_t));
+		region->arena = arena;
+		region->base = (unsigned char*)base;
+		region->size = size;
+	}
+	int i = ccv_arena_bucket(region->base);
+	region->link = arena->table[i];
+	arena->table[i] = region;
+	pthread_rwlock_wrlock(&ccv_arena_registry_lock);
+	region->next = ccv_arena_registry[i];
+	ccv_arena_registry[i] = region;
+	// the block is handed to another thread after this, which sees the new bounds then
+	if ((uintptr_t)region->base < ccv_arena_lo)
+		__atomic_store_n(&ccv_arena_lo, (uintptr_t)region->base, __ATOMIC_RELEASE);
+	if ((uintptr_t)region->base + region->size > ccv_arena_hi)
+		__atomic_store_n(&ccv_arena_hi, (uintptr_t)region->base + region->size, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&ccv_arena_registry_lock);
+	return region;
+}
+
+/* the caller holds the registry lock for writing */
+static void _ccv_arena_region_unregister(ccv_arena_region_t* region)
+{
+	ccv_arena_region_t** prev = ccv_arena_registry + ccv_arena_bucket(region->base);
+	while (*prev != region)
+		prev = &(*prev)->next;
+	*prev = region->next;
+}
+
+static void _ccv_arena_region_spare(ccv_arena_t* arena, ccv_arena_region_t* region)
+{
+	if (arena->spare_size + region->size <= CCV_ARENA_SPARE_SIZE)
+	{
+		region->link = arena->spare;
+		arena->spare = region;
+		arena->spare_size += region->size;
+	} else {
+		free(region->base);
+		free(region);
+	}
+}
+
+static ccv_arena_region_t* _ccv_arena_find(void* ptr)
+{
+	int live = __atomic_load_n(&ccv_arena_live, __ATOMIC_ACQUIRE);
+	if (!live)
+		return 0;
+	unsigned char* base = (unsigned char*)((uintptr_t)ptr & ~(uintptr_t)(CCV_ARENA_CHUNK_SIZE - 1));
+	ccv_arena_region_t* region;
+	ccv_arena_t* arena = &ccv_arena;
+	if (arena->depth)
+	{
+		// look into the arena of this thread first, it doesn't need the lock
+		for (region = arena->table[ccv_arena_bucket(base)]; region; region = region->link)
+			if (region->base == base)
+				return region;
+		if (live == 1) // and it is the only one
+			return 0;
+	}
+	// the memory of the system allocator is mostly out of the bounds of the regions, it doesn't need the lock either
+	if ((uintptr_t)ptr < __atomic_load_n(&ccv_arena_lo, __ATOMIC_ACQUIRE) || (uintptr_t)ptr >= __atomic_load_n(&ccv_arena_hi, __ATOMIC_ACQUIRE))
+		return 0;
+	pthread_rwlock_rdlock(&ccv_arena_registry_lock);
+	for (region = ccv_arena_registry[ccv_arena_bucket(base)]; region; region = region->next)
+		if (region->base == base)
+			break;
+	pthread_rwlock_unlock(&ccv_arena_registry_lock);
+	return region;
+}
+
+void* ccv_malloc(size_t size)
+{
+	ccv_arena_t* arena = &ccv_arena;
+	if (!arena->depth)
+		return malloc(size);
+	unsigned char* block;
+	int c = ccv_max(CCV_ARENA_MIN_CLASS, 64 - __builtin_clzll(size + CCV_ARENA_HEADER - 1));
+	if (c > CCV_ARENA_MAX_CLASS)
+	{
+		ccv_arena_region_t* region = _ccv_arena_region_new(arena, size + CCV_ARENA_HEADER);
+		if (!region)
+			return 0;
+		block = region->base;
+		c = 0;
+	} else if (arena->free[c]) {
+		block = (unsigned char*)arena->free[c];
+		arena->free[c] = *(void**)(block + CCV_ARENA_HEADER);
+	} else {
+		if (arena->top + (1 << c) > arena->end)
+		{
+			ccv_arena_region_t* region = _ccv_arena_region_new(arena, CCV_ARENA_CHUNK_SIZE);
+			if (!region)
+				return 0;
+			arena->top = region->base;
+			arena->end = region->base + region->size;
+		}
+		block = arena->top;
+		arena->top += 1 << c;
+	}
+	*(int*)block = c;
+	return block + CCV_ARENA_HEADER;
+}
+
+void ccv_free(void* ptr)
+{
+	if (!ptr)
+		return;
+	ccv_arena_region_t* region = _ccv_arena_find(ptr);
+	if (!region)
+	{
+		free(ptr);
+		return;
+	}
+	ccv_arena_t* arena = &ccv_arena;
+	// the block of another thread's arena, it will be released with that arena
+	if (region->arena != arena)
+		return;
+	unsigned char* block = (unsigned char*)ptr - CCV_ARENA_HEADER;
+	int c = *(int*)block;
+	if (c > 0)
+	{
+		*(void**)ptr = arena->free[c];
+		arena->free[c] = block;
+	} else {
+		// a region of its own, it can be reused right away rather than at the end of the scope
+		ccv_arena_region_t** prev = arena->table + ccv_arena_bucket(region->base);
+		while (*prev != region)
+			prev = &(*prev)->link;
+		*prev = region->link;
+		pthread_rwlock_wrlock(&ccv_arena_registry_lock);
+		_ccv_arena_region_unregister(region);
+		pthread_rwlock_unlock(&ccv_arena_registry_lock);
+		_ccv_arena_region_spare(arena, region);
+	}
+}
+
+void* ccv_realloc(void* ptr, size_t size)
+{
+	if (!ptr)
+		return ccv_malloc(size);
+	ccv_arena_region_t* region = _ccv_arena_find(ptr);
+	if (!region)
+		return realloc(ptr, size);
+	int c = *(int*)((unsigned char*)ptr - CCV_ARENA_HEADER);
+	size_t capacity = (c > 0 ? (size_t)1 << c : region->size) - CCV_ARENA_HEADER;
+	if (size <= capacity)
+		return ptr;
+	void* x = ccv_malloc(size);
+	if (!x)
+		return 0;
+	memcpy(x, ptr, capacity);
+	ccv_free(ptr);
+	return x;
+}
+
+void ccv_arena_begin(void)
+{
+	if (ccv_arena.depth++ == 0)
+	{
+		pthread_once(&ccv_arena_key_once, _ccv_arena_key_create);
+		pthread_setspecific(ccv_arena_key, &ccv_arena);
+		__atomic_add_fetch(&ccv_arena_live, 1, __ATOMIC_RELEASE);
+	}
+}
+
+void ccv_arena_end(void)
+{
+	ccv_arena_t* arena = &ccv_arena;
+	assert(arena->depth > 0);
+	if (--arena->depth > 0) // only the outermost scope releases
+		return;
+	int i;
+	ccv_arena_region_t* region;
+	pthread_rwlock_wrlock(&ccv_arena_registry_lock);
+	for (i = 0; i < CCV_ARENA_BUCKETS; i++)
+		for (region = arena->table[i]; region; region = region->link)
+			_ccv_arena_region_unregister(region);
+	pthread_rwlock_unlock(&ccv_arena_registry_lock);
+	__atomic_sub_fetch(&ccv_arena_live, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < CCV_ARENA_BUCKETS; i++)
+		while (arena->table[i])
+		{
+			region = arena->table[i];
+			arena->table[i] = region->link;
+			_ccv_arena_region_spare(arena, region);
+		}
+	arena->top = arena->end = 0;
+	memset(arena->free, 0, sizeof(arena->free));
+}
 
 ccv_dense_matrix_t* ccv_dense_matrix_new(int rows, int cols, int type, void* data, uint64_t sig)
 {
 	ccv_dense_matrix_t* mat;
-	if (ccv_cache_opt && sig != 0 && !data && !(type & CCV_NO_DATA_ALLOC))
+	if ((ccv_cache_opt || _ccv_shared_cache_enabled()) && sig != 0 && !data && !(type & CCV_NO_DATA_ALLOC))
 	{
-		uint8_t type;
-		mat = (ccv_dense_matrix_t*)ccv_cache_out(&ccv_cache, sig, &type);
+		uint8_t ctype;
+		mat = (ccv_dense_matrix_t*)_ccv_cache_out(sig, &ctype);
+		if (mat && (type & CCV_ALIGNED) && !(mat->type & CCV_ALIGNED)) // the same result, but it won't do
+		{
+			ccv_matrix_free_immediately(mat);
+			mat = 0;
+		}
 		if (mat)
 		{
-			assert(type == 0);
+			assert(ctype == 0);
 			mat->type |= CCV_GARBAGE; // set the flag so the upper level function knows this is from recycle-bin
 			mat->refcount = 1;
 			return mat;
@@ -30,19 +419,22 @@ ccv_dense_matrix_t* ccv_dense_matrix_new(int rows, int cols, int type, void* dat
 	}
 	if (type & CCV_NO_DATA_ALLOC)
 	{
+		assert(!(type & CCV_ALIGNED) || !((uintptr_t)data & (CCV_ALIGNMENT - 1)));
 		mat = (ccv_dense_matrix_t*)ccmalloc(sizeof(ccv_dense_matrix_t));
-		mat->type = (CCV_GET_CHANNEL(type) | CCV_GET_DATA_TYPE(type) | CCV_MATRIX_DENSE | CCV_NO_DATA_ALLOC) & ~CCV_GARBAGE;
+		mat->type = (CCV_GET_CHANNEL(type) | CCV_GET_DATA_TYPE(type) | CCV_MATRIX_DENSE | CCV_NO_DATA_ALLOC | (type & CCV_ALIGNED)) & ~CCV_GARBAGE;
 		mat->data.u8 = data;
 	} else {
 		mat = (ccv_dense_matrix_t*)(data ? data : ccmalloc(ccv_compute_dense_matrix_size(rows, cols, type)));
-		mat->type = (CCV_GET_CHANNEL(type) | CCV_GET_DATA_TYPE(type) | CCV_MATRIX_DENSE) & ~CCV_GARBAGE;
+		mat->type = (CCV_GET_CHANNEL(type) | CCV_GET_DATA_TYPE(type) | CCV_MATRIX_DENSE | (type & CCV_ALIGNED)) & ~CCV_GARBAGE;
 		mat->type |= data ? CCV_UNMANAGED : CCV_REUSABLE; // it still could be reusable because the signature could be derived one.
 		mat->data.u8 = (unsigned char*)(mat + 1);
+		if (type & CCV_ALIGNED)
+			mat->data.u8 = (unsigned char*)(((uintptr_t)mat->data.u8 + CCV_ALIGNMENT - 1) & ~(uintptr_t)(CCV_ALIGNMENT - 1));
 	}
 	mat->sig = sig;
 	mat->rows = rows;
 	mat->cols = cols;
-	mat->step = (cols * CCV_GET_DATA_TYPE_SIZE(type) * CCV_GET_CHANNEL(type) + 3) & -4;
+	mat->step = ccv_compute_dense_matrix_step(cols, type);
 	mat->refcount = 1;
 	return mat;
 }
@@ -55,7 +447,11 @@ ccv_dense_matrix_t* ccv_dense_matrix_renew(ccv_dense_matrix_t* x, int rows, int
 		prefer_type = CCV_GET_DATA_TYPE(x->type) | CCV_GET_CHANNEL(x->type);
 	}
 	if (sig != 0)
-		sig = ccv_cache_generate_signature((const char*)&prefer_type, sizeof(int), sig, 0);
+	{
+		// the alignment doesn't change the result, an aligned one found in the cache does for either
+		int sign_type = prefer_type & ~CCV_ALIGNED;
+		sig = ccv_cache_generate_signature((const char*)&sign_type, sizeof(int), sig, 0);
+	}
 	if (x == 0)
 	{
 		x = ccv_dense_matrix_new(rows, cols, prefer_type, 0, sig);
@@ -86,7 +482,18 @@ void ccv_make_matrix_immutable(ccv_matrix_t* mat)
 		/* immutable matrix made this way is not reusable (collected), because its signature
 		 * only depends on the content, not the operation to generate it */
 		dmt->type &= ~CCV_REUSABLE;
-		dmt->sig = ccv_cache_generate_signature((char*)dmt->data.u8, dmt->rows * dmt->step, (uint64_t)dmt->type, 0);
+		int step = ccv_compute_dense_matrix_step(dmt->cols, dmt->type & ~CCV_ALIGNED);
+		if (step == dmt->step)
+			dmt->sig = ccv_cache_generate_signature((char*)dmt->data.u8, dmt->rows * dmt->step, (uint64_t)dmt->type, 0);
+		else {
+			/* the padding of the aligned rows is not part of the content, the signature is the one of the unaligned copy */
+			int i;
+			unsigned char* data = (unsigned char*)ccmalloc(step * dmt->rows);
+			for (i = 0; i < dmt->rows; i++)
+				memcpy(data + i * step, dmt->data.u8 + i * dmt->step, step);
+			dmt->sig = ccv_cache_generate_signature((char*)data, dmt->rows * step, (uint64_t)(dmt->type & ~CCV_ALIGNED), 0);
+			ccfree(data);
+		}
 	}
 }
 
@@ -94,10 +501,11 @@ ccv_dense_matrix_t ccv_dense_matrix(int rows, int cols, int type, void* data, ui
 {
 	ccv_dense_matrix_t mat;
 	mat.sig = sig;
-	mat.type = (CCV_GET_CHANNEL(type) | CCV_GET_DATA_TYPE(type) | CCV_MATRIX_DENSE | CCV_UNMANAGED) & ~CCV_GARBAGE;
+	assert(!(type & CCV_ALIGNED) || !((uintptr_t)data & (CCV_ALIGNMENT - 1)));
+	mat.type = (CCV_GET_CHANNEL(type) | CCV_GET_DATA_TYPE(type) | CCV_MATRIX_DENSE | CCV_UNMANAGED | (type & CCV_ALIGNED)) & ~CCV_GARBAGE;
 	mat.rows = rows;
 	mat.cols = cols;
-	mat.step = (cols * CCV_GET_DATA_TYPE_SIZE(type) * CCV_GET_CHANNEL(type) + 3) & -4;
+	mat.step = ccv_compute_dense_matrix_step(cols, type);
 	mat.refcount = 1;
 	mat.data.u8 = (unsigned char*)data;
 	return mat;
@@ -168,10 +576,11 @@ void ccv_matrix_free(ccv_matrix_t* mat)
 	{
 		ccv_dense_matrix_t* dmt = (ccv_dense_matrix_t*)mat;
 		dmt->refcount = 0;
-		if (!ccv_cache_opt || // e don't enable cache
+		if (!(ccv_cache_opt || _ccv_shared_cache_enabled()) || // e don't enable cache
 			!(dmt->type & CCV_REUSABLE) || // or this is not a reusable piece
 			dmt->sig == 0 || // or this doesn't have valid signature
-			(dmt->type & CCV_NO_DATA_ALLOC)) // or this matrix is allocated as header-only, therefore we cannot cache it
+			(dmt->type & CCV_NO_DATA_ALLOC) || // or this matrix is allocated as header-only, therefore we cannot cache it
+			_ccv_arena_find(dmt)) // or this matrix will be gone with its arena
 			ccfree(dmt);
 		else {
 			assert(CCV_GET_DATA_TYPE(dmt->type) == CCV_8U ||
@@ -180,7 +589,9 @@ void ccv_matrix_free(ccv_matrix_t* mat)
 				   CCV_GET_DATA_TYPE(dmt->type) == CCV_64S ||
 				   CCV_GET_DATA_TYPE(dmt->type) == CCV_64F);
 			size_t size = ccv_compute_dense_matrix_size(dmt->rows, dmt->cols, dmt->type);
-			ccv_cache_put(&ccv_cache, dmt->sig, dmt, size, 0 /* type 0 */);
+			// the matrix is larger than the cache (or the shard), free it then
+			if (_ccv_cache_put(dmt->sig, dmt, size, 0 /* type 0 */) < 0)
+				ccfree(dmt);
 		}
 	} else if (type & CCV_MATRIX_SPARSE) {
 		ccv_sparse_matrix_t* smt = (ccv_sparse_matrix_t*)mat;
@@ -211,10 +622,10 @@ void ccv_matrix_free(ccv_matrix_t* mat)
 ccv_array_t* ccv_array_new(int rsize, int rnum, uint64_t sig)
 {
 	ccv_array_t* array;
-	if (ccv_cache_opt && sig != 0)
+	if ((ccv_cache_opt || _ccv_shared_cache_enabled()) && sig != 0)
 	{
 		uint8_t type;
-		array = (ccv_array_t*)ccv_cache_out(&ccv_cache, sig, &type);
+		array = (ccv_array_t*)_ccv_cache_out(sig, &type);
 		if (array)
 		{
 			assert(type == 1);
@@ -256,33 +667,51 @@ void ccv_array_free_immediately(ccv_array_t* array)
 
 void ccv_array_free(ccv_array_t* array)
 {
-	if (!ccv_cache_opt || !(array->type & CCV_REUSABLE) || array->sig == 0)
+	if (!(ccv_cache_opt || _ccv_shared_cache_enabled()) || !(array->type & CCV_REUSABLE) || array->sig == 0 ||
+		_ccv_arena_find(array) || _ccv_arena_find(array->data))
 	{
 		array->refcount = 0;
 		ccfree(array->data);
 		ccfree(array);
 	} else {
 		size_t size = sizeof(ccv_array_t) + array->size * array->rsize;
-		ccv_cache_put(&ccv_cache, array->sig, array, size, 1 /* type 1 */);
+		if (_ccv_cache_put(array->sig, array, size, 1 /* type 1 */) < 0)
+			ccv_array_free_immediately(array);
 	}
 }
 
 void ccv_drain_cache(void)
 {
+	_ccv_arena_drain(&ccv_arena);
+	_ccv_fft_drain();
 	if (ccv_cache.rnum > 0)
 		ccv_cache_cleanup(&ccv_cache);
+	if (_ccv_shared_cache_enabled())
+	{
+		int i;
+		for (i = 0; i < CCV_SHARED_CACHE_SHARDS; i++)
+		{
+			pthread_mutex_lock(&ccv_shared_cache[i].mutex);
+			ccv_cache_cleanup(&ccv_shared_cache[i].cache);
+			pthread_mutex_unlock(&ccv_shared_cache[i].mutex);
+		}
+	}
 }
 
 void ccv_disable_cache(void)
 {
 	ccv_cache_opt = 0;
+	_ccv_cache_node_remove(&ccv_cache_node);
 	ccv_cache_close(&ccv_cache);
 }
 
 void ccv_enable_cache(size_t size)
 {
 	ccv_cache_opt = 1;
+	/* keep the statistics collected so far if the cache is enabled again */
+	_ccv_cache_node_remove(&ccv_cache_node);
 	ccv_cache_init(&ccv_cache, size, 2, ccv_matrix_free_immediately, ccv_array_free_immediately);
+	_ccv_cache_node_insert();
 }
 
 void ccv_enable_default_cache(void)
@@ -290,13 +719,176 @@ void ccv_enable_default_cache(void)
 	ccv_enable_cache(CCV_DEFAULT_CACHE_SIZE);
 }
 
+void ccv_enable_shared_cache(size_t size)
+{
+	/* call it before other threads start to use ccv, the matrix taken out from the cache belongs to the caller
+	 * as usual, thus, only the cache itself needs to be locked */
+	assert(!ccv_shared_cache_opt);
+	int i;
+	for (i = 0; i < CCV_SHARED_CACHE_SHARDS; i++)
+	{
+		pthread_mutex_init(&ccv_shared_cache[i].mutex, 0);
+		ccv_cache_init(&ccv_shared_cache[i].cache, size / CCV_SHARED_CACHE_SHARDS, 2, ccv_matrix_free_immediately, ccv_array_free_immediately);
+	}
+	__atomic_store_n(&ccv_shared_cache_opt, 1, __ATOMIC_RELEASE);
+}
+
+void ccv_disable_shared_cache(void)
+{
+	/* as ccv_enable_shared_cache, call it when no other thread uses ccv, because the shards and their locks are
+	 * torn down, the threads go back to their own caches afterwards */
+	assert(ccv_shared_cache_opt);
+	__atomic_store_n(&ccv_shared_cache_opt, 0, __ATOMIC_RELEASE);
+	int i;
+	for (i = 0; i < CCV_SHARED_CACHE_SHARDS; i++)
+	{
+		pthread_mutex_lock(&ccv_cache_nodes_mutex);
+		_ccv_cache_stats_add(&ccv_cache_retired_stats, &ccv_shared_cache[i].cache.stats);
+		pthread_mutex_unlock(&ccv_cache_nodes_mutex);
+		ccv_cache_close(&ccv_shared_cache[i].cache);
+		pthread_mutex_destroy(&ccv_shared_cache[i].mutex);
+	}
+}
+
+void ccv_cache_stats(ccv_cache_stats_t* stats, int aggregate)
+{
+	if (!aggregate)
+	{
+		*stats = ccv_cache.stats;
+		return;
+	}
+	/* the counters of the other threads are read while they keep running, thus, they are only approximately
+	 * consistent with each other */
+	memset(stats, 0, sizeof(ccv_cache_stats_t));
+	pthread_mutex_lock(&ccv_cache_nodes_mutex);
+	_ccv_cache_stats_add(stats, &ccv_cache_retired_stats);
+	ccv_cache_node_t* node;
+	for (node = ccv_cache_nodes.next; node != &ccv_cache_nodes; node = node->next)
+		_ccv_cache_stats_add(stats, &node->cache->stats);
+	pthread_mutex_unlock(&ccv_cache_nodes_mutex);
+	if (_ccv_shared_cache_enabled())
+	{
+		int i;
+		for (i = 0; i < CCV_SHARED_CACHE_SHARDS; i++)
+		{
+			pthread_mutex_lock(&ccv_shared_cache[i].mutex);
+			_ccv_cache_stats_add(stats, &ccv_shared_cache[i].cache.stats);
+			pthread_mutex_unlock(&ccv_shared_cache[i].mutex);
+		}
+	}
+}
+
+/* the hash used to generate signatures, it is process-wide because the signatures must agree across threads */
+static int ccv_signature_hash = CCV_SIGNATURE_SHA1;
+
+void ccv_set_signature_hash(int hash)
+{
+	assert(hash == CCV_SIGNATURE_SHA1 || hash == CCV_SIGNATURE_XXHASH);
+	ccv_signature_hash = hash;
+}
+
+/* xxHash64 by Yann Collet, it is not cryptographic, but has good distribution and runs at memory speed */
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define xxh_rotl64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t _ccv_xxh64_read64(const unsigned char* p)
+{
+	uint64_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static inline uint32_t _ccv_xxh64_read32(const unsigned char* p)
+{
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static inline uint64_t _ccv_xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = xxh_rotl64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t _ccv_xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= _ccv_xxh64_round(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static uint64_t _ccv_xxh64(const unsigned char* p, size_t len, uint64_t seed)
+{
+	const unsigned char* end = p + len;
+	uint64_t h;
+	if (len >= 32)
+	{
+		const unsigned char* limit = end - 32;
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+		do {
+			v1 = _ccv_xxh64_round(v1, _ccv_xxh64_read64(p));
+			v2 = _ccv_xxh64_round(v2, _ccv_xxh64_read64(p + 8));
+			v3 = _ccv_xxh64_round(v3, _ccv_xxh64_read64(p + 16));
+			v4 = _ccv_xxh64_round(v4, _ccv_xxh64_read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+		h = _ccv_xxh64_merge_round(h, v1);
+		h = _ccv_xxh64_merge_round(h, v2);
+		h = _ccv_xxh64_merge_round(h, v3);
+		h = _ccv_xxh64_merge_round(h, v4);
+	} else
+		h = seed + XXH_PRIME64_5;
+	h += len;
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= _ccv_xxh64_round(0, _ccv_xxh64_read64(p));
+		h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= (uint64_t)_ccv_xxh64_read32(p) * XXH_PRIME64_1;
+		h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++)
+	{
+		h ^= (*p) * XXH_PRIME64_5;
+		h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+	}
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
 uint64_t ccv_cache_generate_signature(const char* msg, int len, uint64_t sig_start, ...)
 {
-	blk_SHA_CTX ctx;
-	blk_SHA1_Init(&ctx);
 	uint64_t sigi;
 	va_list arguments;
 	va_start(arguments, sig_start);
+	if (ccv_signature_hash == CCV_SIGNATURE_XXHASH)
+	{
+		/* the signatures this one derived from are chained into the seed, each through a full xxHash64 round */
+		uint64_t seed = 0;
+		for (sigi = sig_start; sigi != 0; sigi = va_arg(arguments, uint64_t))
+			seed = _ccv_xxh64((const unsigned char*)&sigi, 8, seed);
+		va_end(arguments);
+		uint64_t sig = _ccv_xxh64((const unsigned char*)msg, len, seed);
+		return sig ? sig : 1; // 0 means no signature
+	}
+	blk_SHA_CTX ctx;
+	blk_SHA1_Init(&ctx);
 	for (sigi = sig_start; sigi != 0; sigi = va_arg(arguments, uint64_t))
 		blk_SHA1_Update(&ctx, &sigi, 8);
 	va_end(arguments);
@@ -1,6 +1,7 @@
 #include "ccv.h"
 #include "ccv_internal.h"
 #include <complex.h>
+#include <pthread.h>
 #ifdef HAVE_FFTW3
 #include <fftw3.h>
 #else
@@ -274,6 +275,86 @@ void ccv_minimize(ccv_dense_matrix_t* x, int length, double red, ccv_minimize_f
 	ccv_matrix_free(df3);
 }
 
+/* the index in [0, n) of the pixel that the i-th one (which can be out of [0, n)) takes as the padding_pattern says,
+ * -1 for 0: |00|abcd|00| for CCV_NO_PADDING and CCV_PADDING_ZERO, |aa|abcd|dd| for CCV_PADDING_EXTEND, and
+ * |ba|abcd|dc| for CCV_PADDING_MIRROR */
+static inline int _ccv_filter_border(int i, int n, int padding_pattern)
+{
+	if (i >= 0 && i < n)
+		return i;
+	if (padding_pattern & CCV_PADDING_EXTEND)
+		return ccv_clamp(i, 0, n - 1);
+	if (padding_pattern & CCV_PADDING_MIRROR)
+	{
+		i = i % (n * 2);
+		if (i < 0)
+			i += n * 2;
+		return (i < n) ? i : n * 2 - 1 - i;
+	}
+	return -1;
+}
+
+/* a copy of a with top rows above it and left columns to the left of it, rows x cols in all, the pixels out of a are
+ * filled as the padding_pattern says (see _ccv_filter_border) */
+static ccv_dense_matrix_t* _ccv_filter_pad(ccv_dense_matrix_t* a, int top, int left, int rows, int cols, int padding_pattern)
+{
+	ccv_dense_matrix_t* pa = ccv_dense_matrix_new(rows, cols, CCV_GET_DATA_TYPE(a->type) | CCV_GET_CHANNEL(a->type), 0, 0);
+	size_t size = CCV_GET_DATA_TYPE_SIZE(a->type) * CCV_GET_CHANNEL(a->type);
+	int i, j;
+	for (i = 0; i < rows; i++)
+	{
+		int y = _ccv_filter_border(i - top, a->rows, padding_pattern);
+		unsigned char* p_ptr = pa->data.u8 + i * pa->step;
+		if (y < 0)
+		{
+			memset(p_ptr, 0, size * cols);
+			continue;
+		}
+		unsigned char* a_ptr = a->data.u8 + y * a->step;
+		memcpy(p_ptr + left * size, a_ptr, a->cols * size);
+		for (j = 0; j < cols; j++)
+		{
+			if (j == left) // these are of a, copied already
+			{
+				j = left + a->cols - 1;
+				continue;
+			}
+			int x = _ccv_filter_border(j - left, a->cols, padding_pattern);
+			if (x < 0)
+				memset(p_ptr + j * size, 0, size);
+			else
+				memcpy(p_ptr + j * size, a_ptr + x * size, size);
+		}
+	}
+	return pa;
+}
+
+#ifdef HAVE_FFTW3
+static int _ccv_get_optimal_fft_size(int size);
+#endif
+
+/* the size of the tiles of FFT along an axis of n pixels for a filter of m taps, a tile gives size - m + 1 pixels of
+ * the result, it takes the size with the least work from 3 times the filter up to the one that covers n at once */
+static int _ccv_filter_fft_tile_size(int n, int m)
+{
+	int k, best = 0;
+	double cost = DBL_MAX;
+	for (k = 3; ; k++)
+	{
+#ifdef HAVE_FFTW3
+		int size = _ccv_get_optimal_fft_size(ccv_min(m * k, n + m - 1));
+#else
+		int size = ((kiss_fftr_next_fast_size_real(ccv_min(m * k, n + m - 1)) + 1) >> 1) << 1;
+#endif
+		double tcost = (double)((n + size - m) / (size - m + 1)) * size * log(size);
+		if (tcost < cost)
+			best = size, cost = tcost;
+		if (m * k >= n + m - 1)
+			break;
+	}
+	return best;
+}
+
 #ifdef HAVE_FFTW3
 /* optimal FFT size table is adopted from OpenCV */
 static const int _ccv_optimal_fft_size[] = {
@@ -477,8 +558,8 @@ static void _ccv_filter_fftw(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_d
 {
 	int ch = CCV_GET_CHANNEL(a->type);
 	int fft_type = (CCV_GET_DATA_TYPE(d->type) == CCV_8U || CCV_GET_DATA_TYPE(d->type) == CCV_32F) ? CCV_32F : CCV_64F;
-	int rows = ccv_min(a->rows + b->rows - 1, _ccv_get_optimal_fft_size(b->rows * 3));
-	int cols = ccv_min(a->cols + b->cols - 1, _ccv_get_optimal_fft_size(b->cols * 3));
+	int rows = _ccv_filter_fft_tile_size(a->rows, b->rows);
+	int cols = _ccv_filter_fft_tile_size(a->cols, b->cols);
 	int cols_2c = 2 * (cols / 2 + 1);
 	void* fftw_a;
 	void* fftw_b;
@@ -534,14 +615,13 @@ static void _ccv_filter_fftw(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_d
 		fftwf_execute_dft_r2c(pf, (float*)fftw_b, (fftwf_complex*)fftw_b);
 	else
 		fftw_execute_dft_r2c(p, (double*)fftw_b, (fftw_complex*)fftw_b);
-	/* why a->cols + cols - 2 * (b->cols & ~1) ?
-	 * what we really want is ceiling((a->cols - (b->cols & ~1)) / (cols - (b->cols & ~1)))
-	 * in this case, we strip out paddings on the left/right, and compute how many tiles
-	 * we need. It then be interpreted in the above integer division form */
-	int tile_x = ccv_max(1, (a->cols + cols - 2 * (b->cols & ~1)) / (cols - (b->cols & ~1)));
-	int tile_y = ccv_max(1, (a->rows + rows - 2 * (b->rows & ~1)) / (rows - (b->rows & ~1)));
-	int brows2 = b->rows / 2;
-	int bcols2 = b->cols / 2;
+	/* the tile at (i, j) reads rows x cols pixels of a from (i * srows - top, j * scols - left), the ones out of a are
+	 * filled as the padding_pattern says, and its last srows x scols pixels don't wrap around, these are the ones of d
+	 * from (i * srows, j * scols) */
+	int srows = rows - b->rows + 1, scols = cols - b->cols + 1;
+	int tile_x = (a->cols + scols - 1) / scols;
+	int tile_y = (a->rows + srows - 1) / srows;
+	int top = (b->rows - 1) / 2, left = (b->cols - 1) / 2;
 #define for_block(_for_type, _cpx_type, _for_set, _for_get) \
 	_for_type scale = 1.0 / (rows * cols); \
 	for (i = 0; i < tile_y; i++) \
@@ -549,18 +629,19 @@ static void _ccv_filter_fftw(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_d
 		{ \
 			int x, y; \
 			memset(fftw_a, 0, rows * cols_2c * ch * sizeof(_for_type)); \
-			int iy = ccv_min(i * (rows - (b->rows & ~1)), ccv_max(a->rows - rows, 0)); \
-			int ix = ccv_min(j * (cols - (b->cols & ~1)), ccv_max(a->cols - cols, 0)); \
 			_for_type* fftw_ptr = (_for_type*)fftw_a; \
-			int end_y = ccv_min(rows, a->rows - iy); \
-			int end_x = ccv_min(cols, a->cols - ix); \
-			m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(a, iy, ix, 0); \
-			for (y = 0; y < end_y; y++) \
+			for (y = 0; y < rows; y++) \
 			{ \
-				for (x = 0; x < end_x * ch; x++) \
-					fftw_ptr[x] = _for_get(m_ptr, x, 0); \
+				int ay = _ccv_filter_border(i * srows - top + y, a->rows, padding_pattern); \
+				m_ptr = a->data.u8 + ccv_max(ay, 0) * a->step; \
+				for (x = 0; ay >= 0 && x < cols; x++) \
+				{ \
+					int ax = _ccv_filter_border(j * scols - left + x, a->cols, padding_pattern); \
+					if (ax >= 0) \
+						for (k = 0; k < ch; k++) \
+							fftw_ptr[x * ch + k] = _for_get(m_ptr, ax * ch + k, 0); \
+				} \
 				fftw_ptr += cols_2c * ch; \
-				m_ptr += a->step; \
 			} \
 			_cpx_type* fftw_ac = (_cpx_type*)fftw_a; \
 			_cpx_type* fftw_bc = (_cpx_type*)fftw_b; \
@@ -569,12 +650,10 @@ static void _ccv_filter_fftw(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_d
 			for (x = 0; x < rows * ch * (cols / 2 + 1); x++) \
 				fftw_dc[x] = (fftw_ac[x] * fftw_bc[x]) * scale; \
 			fft_execute_dft_c2r((_cpx_type*)fftw_dc, (_for_type*)fftw_d); \
-			fftw_ptr = (_for_type*)fftw_d + ((1 + (i > 0)) * brows2 * cols_2c + (1 + (j > 0)) * bcols2) * ch; \
-			end_y = ccv_min(d->rows - (iy + (i > 0) * brows2), \
-							(rows - (b->rows & ~1)) + (i == 0) * brows2); \
-			end_x = ccv_min(d->cols - (ix + (j > 0) * bcols2), \
-							(cols - (b->cols & ~1)) + (j == 0) * bcols2); \
-			m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, iy + (i > 0) * brows2, ix + (j > 0) * bcols2, 0); \
+			fftw_ptr = (_for_type*)fftw_d + ((b->rows - 1) * cols_2c + b->cols - 1) * ch; \
+			int end_y = ccv_min(srows, d->rows - i * srows); \
+			int end_x = ccv_min(scols, d->cols - j * scols); \
+			m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, i * srows, j * scols, 0); \
 			for (y = 0; y < end_y; y++) \
 			{ \
 				for (x = 0; x < end_x * ch; x++) \
@@ -582,47 +661,6 @@ static void _ccv_filter_fftw(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_d
 				m_ptr += d->step; \
 				fftw_ptr += cols_2c * ch; \
 			} \
-			int end_tile_y, end_tile_x; \
-			/* handle edge cases: */ \
-			if (i + 1 == tile_y && end_y + iy + (i > 0) * brows2 < d->rows) \
-			{ \
-				end_tile_y = ccv_min(brows2, d->rows - (iy + (i > 0) * brows2 + end_y)); \
-				fftw_ptr = (_for_type*)fftw_d + (1 + (j > 0)) * bcols2 * ch; \
-				m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, iy + (i > 0) * brows2 + end_y, ix + (j > 0) * bcols2, 0); \
-				for (y = 0; y < end_tile_y; y++) \
-				{ \
-					for (x = 0; x < end_x * ch; x++) \
-						_for_set(m_ptr, x, fftw_ptr[x], 0); \
-					m_ptr += d->step; \
-					fftw_ptr += cols_2c * ch; \
-				} \
-			} \
-			if (j + 1 == tile_x && end_x + ix + (j > 0) * bcols2 < d->cols) \
-			{ \
-				end_tile_x = ccv_min(bcols2, d->cols - (ix + (j > 0) * bcols2 + end_x)); \
-				fftw_ptr = (_for_type*)fftw_d + (1 + (i > 0)) * brows2 * cols_2c * ch; \
-				m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, iy + (i > 0) * brows2, ix + (j > 0) * bcols2 + end_x, 0); \
-				for (y = 0; y < end_y; y++) \
-				{ \
-					for (x = 0; x < end_tile_x * ch; x++) \
-						_for_set(m_ptr, x, fftw_ptr[x], 0); \
-					m_ptr += d->step; \
-					fftw_ptr += cols_2c * ch; \
-				} \
-			} \
-			if (i + 1 == tile_y && end_y + iy + (i > 0) * brows2 < d->rows && \
-				j + 1 == tile_x && end_x + ix + (j > 0) * bcols2 < d->cols) \
-			{ \
-				fftw_ptr = (_for_type*)fftw_d; \
-				m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, iy + (i > 0) * brows2 + end_y, ix + (j > 0) * bcols2 + end_x, 0); \
-				for (y = 0; y < end_tile_y; y++) \
-				{ \
-					for (x = 0; x < end_tile_x * ch; x++) \
-						_for_set(m_ptr, x, fftw_ptr[x], 0); \
-					m_ptr += d->step; \
-					fftw_ptr += cols_2c * ch; \
-				} \
-			} \
 		}
 	if (fft_type == CCV_32F)
 	{
@@ -650,101 +688,173 @@ static void _ccv_filter_fftw(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_d
 	}
 #undef for_block
 }
+
+void _ccv_fft_drain(void)
+{
+	/* fftw keeps the plans it made (its wisdom) itself */
+}
 #else
-static void _ccv_filter_kissfft(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_dense_matrix_t* d, int padding_pattern)
+/* the plans of the transforms that ccv_filter used, along with their scratch buffers, keyed by the size and the type
+ * of the transform. A plan is taken out of the cache while it is in use (kiss_fftndr keeps its scratch in the plan,
+ * thus, it cannot be shared between threads), and put back after. The cache outlives any arena scope
+ * (ccv_arena_begin), thus, it uses the system allocator directly */
+#define CCV_FFT_PLAN_CACHE_SIZE (16)
+
+typedef struct {
+	int rows;
+	int cols;
+	int type; // CCV_32F or CCV_64F
+	void* p; // kissf_fftndr_cfg for CCV_32F, kiss_fftndr_cfg for CCV_64F
+	void* pinv;
+	size_t size;
+	void* data; // the scratch buffer
+} ccv_fft_plan_t;
+
+/* the least recently used first */
+static ccv_fft_plan_t* ccv_fft_plan_cache[CCV_FFT_PLAN_CACHE_SIZE];
+static int ccv_fft_plan_cache_count = 0;
+static pthread_mutex_t ccv_fft_plan_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void _ccv_fft_plan_free(ccv_fft_plan_t* plan)
 {
-	int ch = CCV_GET_CHANNEL(a->type);
-	int fft_type = (CCV_GET_DATA_TYPE(d->type) == CCV_8U || CCV_GET_DATA_TYPE(d->type) == CCV_32F) ? CCV_32F : CCV_64F;
-	int rows = ((ccv_min(a->rows + b->rows - 1, kiss_fftr_next_fast_size_real(b->rows * 3)) + 1) >> 1) << 1;
-	int cols = ((ccv_min(a->cols + b->cols - 1, kiss_fftr_next_fast_size_real(b->cols * 3)) + 1) >> 1) << 1;
-	int ndim[] = {rows, cols};
-	void* kiss_a;
-	void* kiss_b;
-	void* kiss_d;
-	void* kiss_ac;
-	void* kiss_bc;
-	void* kiss_dc;
-	kiss_fftndr_cfg p;
-	kiss_fftndr_cfg pinv;
-	kissf_fftndr_cfg pf;
-	kissf_fftndr_cfg pinvf;
-	if (fft_type == CCV_32F)
+	free(plan->p);
+	free(plan->pinv);
+	free(plan->data);
+	free(plan);
+}
+
+/* a plan of rows x cols with at least size bytes of scratch, from the cache if there is one */
+static ccv_fft_plan_t* _ccv_fft_plan_get(int rows, int cols, int type, size_t size)
+{
+	int i;
+	ccv_fft_plan_t* plan = 0;
+	pthread_mutex_lock(&ccv_fft_plan_cache_mutex);
+	for (i = ccv_fft_plan_cache_count - 1; i >= 0; i--)
+		if (ccv_fft_plan_cache[i]->rows == rows && ccv_fft_plan_cache[i]->cols == cols && ccv_fft_plan_cache[i]->type == type)
+		{
+			plan = ccv_fft_plan_cache[i];
+			memmove(ccv_fft_plan_cache + i, ccv_fft_plan_cache + i + 1, sizeof(ccv_fft_plan_t*) * (ccv_fft_plan_cache_count - i - 1));
+			--ccv_fft_plan_cache_count;
+			break;
+		}
+	pthread_mutex_unlock(&ccv_fft_plan_cache_mutex);
+	if (!plan)
 	{
-		pf = kissf_fftndr_alloc(ndim, 2, 0, 0, 0);
-		pinvf = kissf_fftndr_alloc(ndim, 2, 1, 0, 0);
-		kiss_a = ccmalloc(rows * cols * ch * sizeof(kissf_fft_scalar));
-		kiss_b = ccmalloc(rows * cols * ch * sizeof(kissf_fft_scalar));
-		kiss_d = ccmalloc(rows * cols * ch * sizeof(kissf_fft_scalar));
-		kiss_ac = ccmalloc(rows * (cols / 2 + 1) * ch * sizeof(kissf_fft_cpx));
-		kiss_bc = ccmalloc(rows * (cols / 2 + 1) * ch * sizeof(kissf_fft_cpx));
-		kiss_dc = ccmalloc(rows * (cols / 2 + 1) * ch * sizeof(kissf_fft_cpx));
-		memset(kiss_b, 0, rows * cols * ch * sizeof(kissf_fft_scalar));
-	} else {
-		p = kiss_fftndr_alloc(ndim, 2, 0, 0, 0);
-		pinv = kiss_fftndr_alloc(ndim, 2, 1, 0, 0);
-		kiss_a = ccmalloc(rows * cols * ch * sizeof(kiss_fft_scalar));
-		kiss_b = ccmalloc(rows * cols * ch * sizeof(kiss_fft_scalar));
-		kiss_d = ccmalloc(rows * cols * ch * sizeof(kiss_fft_scalar));
-		kiss_ac = ccmalloc(rows * (cols / 2 + 1) * ch * sizeof(kiss_fft_cpx));
-		kiss_bc = ccmalloc(rows * (cols / 2 + 1) * ch * sizeof(kiss_fft_cpx));
-		kiss_dc = ccmalloc(rows * (cols / 2 + 1) * ch * sizeof(kiss_fft_cpx));
-		memset(kiss_b, 0, rows * cols * ch * sizeof(kiss_fft_scalar));
+		int ndim[] = {rows, cols};
+		plan = (ccv_fft_plan_t*)malloc(sizeof(ccv_fft_plan_t));
+		plan->rows = rows;
+		plan->cols = cols;
+		plan->type = type;
+		if (type == CCV_32F)
+		{
+			plan->p = kissf_fftndr_alloc(ndim, 2, 0, 0, 0);
+			plan->pinv = kissf_fftndr_alloc(ndim, 2, 1, 0, 0);
+		} else {
+			plan->p = kiss_fftndr_alloc(ndim, 2, 0, 0, 0);
+			plan->pinv = kiss_fftndr_alloc(ndim, 2, 1, 0, 0);
+		}
+		plan->size = 0;
+		plan->data = 0;
 	}
+	if (plan->size < size)
+	{
+		free(plan->data);
+		plan->data = malloc(size);
+		plan->size = size;
+	}
+	return plan;
+}
+
+static void _ccv_fft_plan_put(ccv_fft_plan_t* plan)
+{
+	ccv_fft_plan_t* evicted = 0;
+	pthread_mutex_lock(&ccv_fft_plan_cache_mutex);
+	if (ccv_fft_plan_cache_count == CCV_FFT_PLAN_CACHE_SIZE)
+	{
+		evicted = ccv_fft_plan_cache[0];
+		memmove(ccv_fft_plan_cache, ccv_fft_plan_cache + 1, sizeof(ccv_fft_plan_t*) * (CCV_FFT_PLAN_CACHE_SIZE - 1));
+		--ccv_fft_plan_cache_count;
+	}
+	ccv_fft_plan_cache[ccv_fft_plan_cache_count++] = plan;
+	pthread_mutex_unlock(&ccv_fft_plan_cache_mutex);
+	if (evicted)
+		_ccv_fft_plan_free(evicted);
+}
+
+void _ccv_fft_drain(void)
+{
+	int i;
+	pthread_mutex_lock(&ccv_fft_plan_cache_mutex);
+	for (i = 0; i < ccv_fft_plan_cache_count; i++)
+		_ccv_fft_plan_free(ccv_fft_plan_cache[i]);
+	ccv_fft_plan_cache_count = 0;
+	pthread_mutex_unlock(&ccv_fft_plan_cache_mutex);
+}
+
+typedef struct {
+	ccv_dense_matrix_t* a;
+	ccv_dense_matrix_t* b;
+	ccv_dense_matrix_t* d;
+	int rows; // of a tile
+	int cols;
+	int fft_type;
+	void* kiss_bc; // the spectrum of the flipped b, ch planes of rows x (cols / 2 + 1)
+	int tile_x;
+	int tile_y;
+	int padding_pattern;
+} ccv_filter_kissfft_band_t;
+
+/* the tile rows [start, end) of the overlap-save, the tile at (i, j) reads rows x cols pixels of a from
+ * (i * srows - top, j * scols - left), the ones out of a are filled as the padding_pattern says. It is transformed,
+ * multiplied with the spectrum of b, and transformed back, and its last srows x scols pixels don't wrap around, these
+ * are the ones of d from (i * srows, j * scols), thus, every pixel of d is written by one tile only */
+static void _ccv_filter_kissfft_tile(void* context, int start, int end)
+{
+	ccv_filter_kissfft_band_t* band = (ccv_filter_kissfft_band_t*)context;
+	ccv_dense_matrix_t* a = band->a;
+	ccv_dense_matrix_t* b = band->b;
+	ccv_dense_matrix_t* d = band->d;
+	int ch = CCV_GET_CHANNEL(a->type);
+	int rows = band->rows, cols = band->cols;
+	int srows = rows - b->rows + 1, scols = cols - b->cols + 1;
+	int top = (b->rows - 1) / 2, left = (b->cols - 1) / 2;
+	int tile_x = band->tile_x;
+	int padding_pattern = band->padding_pattern;
 	int nch = rows * cols, nchc = rows * (cols / 2 + 1);
+	size_t scalar_size = band->fft_type == CCV_32F ? sizeof(kissf_fft_scalar) : sizeof(kiss_fft_scalar);
+	size_t cpx_size = band->fft_type == CCV_32F ? sizeof(kissf_fft_cpx) : sizeof(kiss_fft_cpx);
+	ccv_fft_plan_t* plan = _ccv_fft_plan_get(rows, cols, band->fft_type, (nchc * cpx_size + nch * scalar_size) * ch * 2);
+	void* kiss_ac = plan->data;
+	void* kiss_dc = (unsigned char*)kiss_ac + nchc * ch * cpx_size;
+	void* kiss_a = (unsigned char*)kiss_dc + nchc * ch * cpx_size;
+	void* kiss_d = (unsigned char*)kiss_a + nch * ch * scalar_size;
 	int i, j, k;
-	unsigned char* m_ptr = b->data.u8;
-	// to flip matrix b is crucial, this problem only shows when I changed to a more sophisticated test case
-#define for_block(_for_type, _for_get) \
-	_for_type* kiss_ptr = (_for_type*)kiss_b + (b->rows - 1) * cols; \
-	for (i = 0; i < b->rows; i++) \
-	{ \
-		for (j = 0; j < b->cols; j++) \
-			for (k = 0; k < ch; k++) \
-				kiss_ptr[k * nch + b->cols - 1 - j] = _for_get(m_ptr, j * ch + k, 0); \
-		kiss_ptr -= cols; \
-		m_ptr += b->step; \
-	}
-	ccv_matrix_typeof(fft_type, ccv_matrix_getter, b->type, for_block);
-#undef for_block
-	if (fft_type == CCV_32F)
-		for (k = 0; k < ch; k++)
-			kissf_fftndr(pf, (kissf_fft_scalar*)kiss_b + nch * k, (kissf_fft_cpx*)kiss_bc + nchc * k);
-	else
-		for (k = 0; k < ch; k++)
-			kiss_fftndr(p, (kiss_fft_scalar*)kiss_b + nch * k, (kiss_fft_cpx*)kiss_bc + nchc * k);
-	/* why a->cols + cols - 2 * (b->cols & ~1) ?
-	 * what we really want is ceiling((a->cols - (b->cols & ~1)) / (cols - (b->cols & ~1)))
-	 * in this case, we strip out paddings on the left/right, and compute how many tiles
-	 * we need. It then be interpreted in the above integer division form */
-	int tile_x = ccv_max(1, (a->cols + cols - 2 * (b->cols & ~1)) / (cols - (b->cols & ~1)));
-	int tile_y = ccv_max(1, (a->rows + rows - 2 * (b->rows & ~1)) / (rows - (b->rows & ~1)));
-	int brows2 = b->rows / 2;
-	int bcols2 = b->cols / 2;
+	unsigned char* m_ptr;
 #define for_block(_for_type, _cpx_type, _for_set, _for_get) \
 	_for_type scale = 1.0 / (rows * cols); \
-	for (i = 0; i < tile_y; i++) \
+	for (i = start; i < end; i++) \
 		for (j = 0; j < tile_x; j++) \
 		{ \
 			int x, y; \
 			memset(kiss_a, 0, rows * cols * ch * sizeof(_for_type)); \
-			int iy = ccv_min(i * (rows - (b->rows & ~1)), ccv_max(a->rows - rows, 0)); \
-			int ix = ccv_min(j * (cols - (b->cols & ~1)), ccv_max(a->cols - cols, 0)); \
 			_for_type* kiss_ptr = (_for_type*)kiss_a; \
-			int end_y = ccv_min(rows, a->rows - iy); \
-			int end_x = ccv_min(cols, a->cols - ix); \
-			m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(a, iy, ix, 0); \
-			for (y = 0; y < end_y; y++) \
+			for (y = 0; y < rows; y++) \
 			{ \
-				for (x = 0; x < end_x; x++) \
-					for (k = 0; k < ch; k++) \
-						kiss_ptr[k * nch + x] = _for_get(m_ptr, x * ch + k, 0); \
+				int ay = _ccv_filter_border(i * srows - top + y, a->rows, padding_pattern); \
+				m_ptr = a->data.u8 + ccv_max(ay, 0) * a->step; \
+				for (x = 0; ay >= 0 && x < cols; x++) \
+				{ \
+					int ax = _ccv_filter_border(j * scols - left + x, a->cols, padding_pattern); \
+					if (ax >= 0) \
+						for (k = 0; k < ch; k++) \
+							kiss_ptr[k * nch + x] = _for_get(m_ptr, ax * ch + k, 0); \
+				} \
 				kiss_ptr += cols; \
-				m_ptr += a->step; \
 			} \
 			for (k = 0; k < ch; k++) \
 				fft_ndr((_for_type*)kiss_a + nch * k, (_cpx_type*)kiss_ac + nchc * k); \
 			_cpx_type* fft_ac = (_cpx_type*)kiss_ac; \
-			_cpx_type* fft_bc = (_cpx_type*)kiss_bc; \
+			_cpx_type* fft_bc = (_cpx_type*)band->kiss_bc; \
 			_cpx_type* fft_dc = (_cpx_type*)kiss_dc; \
 			for (x = 0; x < rows * ch * (cols / 2 + 1); x++) \
 			{ \
@@ -753,12 +863,10 @@ static void _ccv_filter_kissfft(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, cc
 			} \
 			for (k = 0; k < ch; k++) \
 				fft_ndri((_cpx_type*)kiss_dc + nchc * k, (_for_type*)kiss_d + nch * k); \
-			kiss_ptr = (_for_type*)kiss_d + (1 + (i > 0)) * brows2 * cols + (1 + (j > 0)) * bcols2; \
-			end_y = ccv_min(d->rows - (iy + (i > 0) * brows2), \
-							(rows - (b->rows & ~1)) + (i == 0) * brows2); \
-			end_x = ccv_min(d->cols - (ix + (j > 0) * bcols2), \
-							(cols - (b->cols & ~1)) + (j == 0) * bcols2); \
-			m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, iy + (i > 0) * brows2, ix + (j > 0) * bcols2, 0); \
+			kiss_ptr = (_for_type*)kiss_d + (b->rows - 1) * cols + b->cols - 1; \
+			int end_y = ccv_min(srows, d->rows - i * srows); \
+			int end_x = ccv_min(scols, d->cols - j * scols); \
+			m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, i * srows, j * scols, 0); \
 			for (y = 0; y < end_y; y++) \
 			{ \
 				for (x = 0; x < end_x; x++) \
@@ -767,76 +875,76 @@ static void _ccv_filter_kissfft(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, cc
 				m_ptr += d->step; \
 				kiss_ptr += cols; \
 			} \
-			int end_tile_y, end_tile_x; \
-			/* handle edge cases: */ \
-			if (i + 1 == tile_y && end_y + iy + (i > 0) * brows2 < d->rows) \
-			{ \
-				end_tile_y = ccv_min(brows2, d->rows - (iy + (i > 0) * brows2 + end_y)); \
-				kiss_ptr = (_for_type*)kiss_d + (1 + (j > 0)) * bcols2; \
-				m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, iy + (i > 0) * brows2 + end_y, ix + (j > 0) * bcols2, 0); \
-				for (y = 0; y < end_tile_y; y++) \
-				{ \
-					for (x = 0; x < end_x; x++) \
-						for (k = 0; k < ch; k++) \
-							_for_set(m_ptr, x * ch + k, kiss_ptr[k * nch + x], 0); \
-					m_ptr += d->step; \
-					kiss_ptr += cols; \
-				} \
-			} \
-			if (j + 1 == tile_x && end_x + ix + (j > 0) * bcols2 < d->cols) \
-			{ \
-				end_tile_x = ccv_min(bcols2, d->cols - (ix + (j > 0) * bcols2 + end_x)); \
-				kiss_ptr = (_for_type*)kiss_d + (1 + (i > 0)) * brows2 * cols; \
-				m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, iy + (i > 0) * brows2, ix + (j > 0) * bcols2 + end_x, 0); \
-				for (y = 0; y < end_y; y++) \
-				{ \
-					for (x = 0; x < end_tile_x; x++) \
-						for (k = 0; k < ch; k++) \
-							_for_set(m_ptr, x * ch + k, kiss_ptr[k * nch + x], 0); \
-					m_ptr += d->step; \
-					kiss_ptr += cols; \
-				} \
-			} \
-			if (i + 1 == tile_y && end_y + iy + (i > 0) * brows2 < d->rows && \
-				j + 1 == tile_x && end_x + ix + (j > 0) * bcols2 < d->cols) \
-			{ \
-				kiss_ptr = (_for_type*)kiss_d; \
-				m_ptr = (unsigned char*)ccv_get_dense_matrix_cell(d, iy + (i > 0) * brows2 + end_y, ix + (j > 0) * bcols2 + end_x, 0); \
-				for (y = 0; y < end_tile_y; y++) \
-				{ \
-					for (x = 0; x < end_tile_x; x++) \
-						for (k = 0; k < ch; k++) \
-							_for_set(m_ptr, x * ch + k, kiss_ptr[k * nch + x], 0); \
-					m_ptr += d->step; \
-					kiss_ptr += cols; \
-				} \
-			} \
 		}
-	if (fft_type == CCV_32F)
+	if (band->fft_type == CCV_32F)
 	{
-#define fft_ndr(r, c) kissf_fftndr(pf, r, c)
-#define fft_ndri(c, r) kissf_fftndri(pinvf, c, r)
+#define fft_ndr(r, c) kissf_fftndr((kissf_fftndr_cfg)plan->p, r, c)
+#define fft_ndri(c, r) kissf_fftndri((kissf_fftndr_cfg)plan->pinv, c, r)
 		ccv_matrix_setter(d->type, ccv_matrix_getter, a->type, for_block, kissf_fft_scalar, kissf_fft_cpx);
 #undef fft_ndr
 #undef fft_ndri
-		kissf_fft_free(pf);
-		kissf_fft_free(pinvf);
 	} else {
-#define fft_ndr(r, c) kiss_fftndr(p, r, c)
-#define fft_ndri(c, r) kiss_fftndri(pinv, c, r)
+#define fft_ndr(r, c) kiss_fftndr((kiss_fftndr_cfg)plan->p, r, c)
+#define fft_ndri(c, r) kiss_fftndri((kiss_fftndr_cfg)plan->pinv, c, r)
 		ccv_matrix_setter(d->type, ccv_matrix_getter, a->type, for_block, kiss_fft_scalar, kiss_fft_cpx);
 #undef fft_ndr
 #undef fft_ndri
-		kiss_fft_free(p);
-		kiss_fft_free(pinv);
 	}
 #undef for_block
-	ccfree(kiss_dc);
+	_ccv_fft_plan_put(plan);
+}
+
+static void _ccv_filter_kissfft(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_dense_matrix_t* d, int padding_pattern)
+{
+	int ch = CCV_GET_CHANNEL(a->type);
+	int fft_type = (CCV_GET_DATA_TYPE(d->type) == CCV_8U || CCV_GET_DATA_TYPE(d->type) == CCV_32F) ? CCV_32F : CCV_64F;
+	int rows = _ccv_filter_fft_tile_size(a->rows, b->rows);
+	int cols = _ccv_filter_fft_tile_size(a->cols, b->cols);
+	int nch = rows * cols, nchc = rows * (cols / 2 + 1);
+	size_t scalar_size = fft_type == CCV_32F ? sizeof(kissf_fft_scalar) : sizeof(kiss_fft_scalar);
+	size_t cpx_size = fft_type == CCV_32F ? sizeof(kissf_fft_cpx) : sizeof(kiss_fft_cpx);
+	/* the spectrum of b is shared by all the tiles, the flipped b is put in the scratch of the plan */
+	ccv_fft_plan_t* plan = _ccv_fft_plan_get(rows, cols, fft_type, nch * ch * scalar_size);
+	void* kiss_b = plan->data;
+	void* kiss_bc = ccmalloc(nchc * ch * cpx_size);
+	memset(kiss_b, 0, nch * ch * scalar_size);
+	int i, j, k;
+	unsigned char* m_ptr = b->data.u8;
+	// to flip matrix b is crucial, this problem only shows when I changed to a more sophisticated test case
+#define for_block(_for_type, _for_get) \
+	_for_type* kiss_ptr = (_for_type*)kiss_b + (b->rows - 1) * cols; \
+	for (i = 0; i < b->rows; i++) \
+	{ \
+		for (j = 0; j < b->cols; j++) \
+			for (k = 0; k < ch; k++) \
+				kiss_ptr[k * nch + b->cols - 1 - j] = _for_get(m_ptr, j * ch + k, 0); \
+		kiss_ptr -= cols; \
+		m_ptr += b->step; \
+	}
+	ccv_matrix_typeof(fft_type, ccv_matrix_getter, b->type, for_block);
+#undef for_block
+	if (fft_type == CCV_32F)
+		for (k = 0; k < ch; k++)
+			kissf_fftndr((kissf_fftndr_cfg)plan->p, (kissf_fft_scalar*)kiss_b + nch * k, (kissf_fft_cpx*)kiss_bc + nchc * k);
+	else
+		for (k = 0; k < ch; k++)
+			kiss_fftndr((kiss_fftndr_cfg)plan->p, (kiss_fft_scalar*)kiss_b + nch * k, (kiss_fft_cpx*)kiss_bc + nchc * k);
+	_ccv_fft_plan_put(plan);
+	/* a tile gives (rows - b->rows + 1) x (cols - b->cols + 1) pixels of d (see _ccv_filter_kissfft_tile) */
+	ccv_filter_kissfft_band_t band = {
+		.a = a,
+		.b = b,
+		.d = d,
+		.rows = rows,
+		.cols = cols,
+		.fft_type = fft_type,
+		.kiss_bc = kiss_bc,
+		.tile_x = (a->cols + cols - b->cols) / (cols - b->cols + 1),
+		.tile_y = (a->rows + rows - b->rows) / (rows - b->rows + 1),
+		.padding_pattern = padding_pattern,
+	};
+	ccv_parallel_for(band.tile_y, 1, _ccv_filter_kissfft_tile, &band);
 	ccfree(kiss_bc);
-	ccfree(kiss_ac);
-	ccfree(kiss_d);
-	ccfree(kiss_b);
-	ccfree(kiss_a);
 }
 #endif
 
@@ -859,19 +967,74 @@ void _ccv_filter_direct_8u(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_den
 			cx[nz] = j;
 			nz++;
 		}
-	ccv_dense_matrix_t* pa = ccv_dense_matrix_new(a->rows + b->rows / 2 * 2, a->cols + b->cols / 2 * 2, CCV_8U | CCV_C1, 0, 0);
-	/* the padding pattern is different from FFT: |aa{BORDER}|abcd|{BORDER}dd| */
-	for (i = 0; i < pa->rows; i++)
-		for (j = 0; j < pa->cols; j++)
-			pa->data.u8[i * pa->step + j] = a->data.u8[ccv_clamp(i - b->rows / 2, 0, a->rows - 1) * a->step + ccv_clamp(j - b->cols / 2, 0, a->cols - 1)];
+	/* the filter is centred at ((b->rows - 1) / 2, (b->cols - 1) / 2) as the other ways */
+	ccv_dense_matrix_t* pa = _ccv_filter_pad(a, (b->rows - 1) / 2, (b->cols - 1) / 2, a->rows + b->rows - 1, a->cols + b->cols - 1, padding_pattern);
 	unsigned char* m_ptr = d->data.u8;
 	unsigned char* a_ptr = pa->data.u8;
+	/* the columns [0, vcols) are done with SSE2, the loops below do the rest */
+	int vcols = 0;
+#ifdef HAVE_SSE2
+	/* 8 pixels and 2 taps at a time with _mm_madd_epi16, the sums are the same as the ones of the loops below as long
+	 * as the coefficients fit in 16 bits (the filters with weights in (-2, 2)) */
+	int bcols_2 = (b->cols + 1) / 2;
+	__m128i* cpair = (__m128i*)ccmalloc(sizeof(__m128i) * b->rows * bcols_2);
+	int fit = 1;
+	for (i = 0; i < b->rows; i++)
+		for (j = 0; j < b->cols; j += 2)
+		{
+			int c0 = (int)(ccv_get_dense_matrix_cell_value(b, i, j, 0) * scale + 0.5);
+			int c1 = (j + 1 < b->cols) ? (int)(ccv_get_dense_matrix_cell_value(b, i, j + 1, 0) * scale + 0.5) : 0;
+			fit = fit && c0 >= -32768 && c0 <= 32767 && c1 >= -32768 && c1 <= 32767;
+			cpair[i * bcols_2 + j / 2] = _mm_set1_epi32((int)(((unsigned int)c1 << 16) | ((unsigned int)c0 & 0xffff)));
+		}
+	if (fit)
+	{
+		vcols = d->cols & ~7;
+		__m128i zero = _mm_setzero_si128();
+		for (i = 0; i < d->rows; i++)
+		{
+			for (j = 0; j < vcols; j += 8)
+			{
+				__m128i z0 = _mm_setzero_si128();
+				__m128i z1 = _mm_setzero_si128();
+				__m128i* c_ptr = cpair;
+				for (y = 0; y < b->rows; y++)
+				{
+					unsigned char* p_ptr = a_ptr + y * pa->step + j;
+					for (x = 0; x < b->cols - 1; x += 2, c_ptr++)
+					{
+						__m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(p_ptr + x)), zero);
+						__m128i a1 = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(p_ptr + x + 1)), zero);
+						z0 = _mm_add_epi32(z0, _mm_madd_epi16(_mm_unpacklo_epi16(a0, a1), *c_ptr));
+						z1 = _mm_add_epi32(z1, _mm_madd_epi16(_mm_unpackhi_epi16(a0, a1), *c_ptr));
+					}
+					if (x < b->cols)
+					{
+						__m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(p_ptr + x)), zero);
+						z0 = _mm_add_epi32(z0, _mm_madd_epi16(_mm_unpacklo_epi16(a0, zero), *c_ptr));
+						z1 = _mm_add_epi32(z1, _mm_madd_epi16(_mm_unpackhi_epi16(a0, zero), *c_ptr));
+						c_ptr++;
+					}
+				}
+				/* the saturation of the packs is the ccv_clamp(z >> 14, 0, 255) */
+				z0 = _mm_srai_epi32(z0, 14);
+				z1 = _mm_srai_epi32(z1, 14);
+				_mm_storel_epi64((__m128i*)(m_ptr + j), _mm_packus_epi16(_mm_packs_epi32(z0, z1), zero));
+			}
+			m_ptr += d->step;
+			a_ptr += pa->step;
+		}
+		m_ptr = d->data.u8;
+		a_ptr = pa->data.u8;
+	}
+	ccfree(cpair);
+#endif
 	/* 0.5 denote the overhead for indexing x and y */
 	if (nz < b->rows * b->cols * 0.75)
 	{
 		for (i = 0; i < d->rows; i++)
 		{
-			for (j = 0; j < d->cols; j++)
+			for (j = vcols; j < d->cols; j++)
 			{
 				int z = 0;
 				for (k = 0; k < nz; k++)
@@ -891,7 +1054,7 @@ void _ccv_filter_direct_8u(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_den
 			}
 		for (i = 0; i < d->rows; i++)
 		{
-			for (j = 0; j < d->cols; j++)
+			for (j = vcols; j < d->cols; j++)
 			{
 				int* c_ptr = coeff;
 				int z = 0;
@@ -916,6 +1079,207 @@ void _ccv_filter_direct_8u(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_den
 	ccfree(cy);
 }
 
+/* acc[e] += src[e] * pattern[e % (4 * ch)] for e in [0, n), the pattern is the coefficient of every channel of a tap
+ * repeated over 4 * ch floats, thus, with the channels interleaved (e = x * ch + k), every 4 of them load at once */
+static void _ccv_filter_tap_32f(float* acc, float* src, float* pattern, int ch, int n)
+{
+	int e = 0;
+	float* p = pattern;
+	float* p_end = pattern + 4 * ch;
+#ifdef HAVE_SSE2
+	for (; e < n - 3; e += 4)
+	{
+		_mm_storeu_ps(acc + e, _mm_add_ps(_mm_loadu_ps(acc + e), _mm_mul_ps(_mm_loadu_ps(src + e), _mm_loadu_ps(p))));
+		p += 4;
+		if (p == p_end)
+			p = pattern;
+	}
+#endif
+	for (; e < n; e++)
+	{
+		acc[e] += src[e] * p[0];
+		if (++p == p_end)
+			p = pattern;
+	}
+}
+
+/* the patterns (see _ccv_filter_tap_32f) of the rows x cols taps of b, the coefficient of a tap on the channel k is
+ * b(i, j, k), or the product u[i * ch + k] * v[j * ch + k] of the separable parts of b if it is given in u and v
+ * (one of these can be 0, then it takes the other only) */
+static float* _ccv_filter_patterns(ccv_dense_matrix_t* b, float* u, float* v, int rows, int cols)
+{
+	int ch = CCV_GET_CHANNEL(b->type);
+	float* pattern = (float*)ccmalloc(sizeof(float) * rows * cols * ch * 4);
+	int i, j, k;
+	float* p_ptr = pattern;
+	for (i = 0; i < rows; i++)
+		for (j = 0; j < cols; j++, p_ptr += ch * 4)
+			for (k = 0; k < ch * 4; k++)
+				p_ptr[k] = (u || v) ? (u ? u[i * ch + k % ch] : 1) * (v ? v[j * ch + k % ch] : 1) : ccv_get_dense_matrix_cell_value(b, i, j, k % ch);
+	return pattern;
+}
+
+/* b(i, j, k) = u[i * ch + k] * v[j * ch + k] if b is separable (every channel of it is an outer product, up to a
+ * relative error of 1e-5), that is how it takes rows + cols taps rather than rows * cols ones */
+static int _ccv_filter_separate(ccv_dense_matrix_t* b, float* u, float* v)
+{
+	int ch = CCV_GET_CHANNEL(b->type);
+	int i, j, k;
+	for (k = 0; k < ch; k++)
+	{
+		/* the row and the column of the largest coefficient are the parts */
+		int pi = 0, pj = 0;
+		double pivot = 0;
+		for (i = 0; i < b->rows; i++)
+			for (j = 0; j < b->cols; j++)
+				if (fabs(ccv_get_dense_matrix_cell_value(b, i, j, k)) > fabs(pivot))
+					pivot = ccv_get_dense_matrix_cell_value(b, pi = i, pj = j, k);
+		if (pivot == 0)
+			return 0;
+		for (i = 0; i < b->rows; i++)
+			u[i * ch + k] = ccv_get_dense_matrix_cell_value(b, i, pj, k);
+		for (j = 0; j < b->cols; j++)
+			v[j * ch + k] = ccv_get_dense_matrix_cell_value(b, pi, j, k) / pivot;
+		for (i = 0; i < b->rows; i++)
+			for (j = 0; j < b->cols; j++)
+				if (fabs(ccv_get_dense_matrix_cell_value(b, i, j, k) - (double)u[i * ch + k] * v[j * ch + k]) > fabs(pivot) * 1e-5)
+					return 0;
+	}
+	return 1;
+}
+
+typedef struct {
+	float* src;
+	int step; // of src, in floats
+	int rows; // of the taps
+	int cols;
+	int ch;
+	float* pattern; // of the taps (see _ccv_filter_patterns)
+	int n; // the floats in a row of the result
+	float* dst; // the result, n floats a row, or
+	ccv_dense_matrix_t* d; // the result in d (if dst is 0)
+} ccv_filter_taps_band_t;
+
+/* the rows [start, end) of the result, the row y takes the rows [y, y + rows) of src */
+static void _ccv_filter_taps(void* context, int start, int end)
+{
+	ccv_filter_taps_band_t* band = (ccv_filter_taps_band_t*)context;
+	int i, j, x, y, ch = band->ch, n = band->n;
+	float* acc = band->dst ? 0 : (float*)ccmalloc(sizeof(float) * n);
+	for (y = start; y < end; y++)
+	{
+		float* row = band->dst ? band->dst + y * n : acc;
+		memset(row, 0, sizeof(float) * n);
+		float* pattern = band->pattern;
+		for (i = 0; i < band->rows; i++)
+			for (j = 0; j < band->cols; j++, pattern += ch * 4)
+				_ccv_filter_tap_32f(row, band->src + (y + i) * band->step + j * ch, pattern, ch, n);
+		if (!band->dst)
+		{
+			unsigned char* m_ptr = band->d->data.u8 + y * band->d->step;
+#define for_block(_, _for_set) \
+			for (x = 0; x < n; x++) \
+				_for_set(m_ptr, x, acc[x], 0);
+			ccv_matrix_setter(band->d->type, for_block);
+#undef for_block
+		}
+	}
+	if (acc)
+		ccfree(acc);
+}
+
+/* the direct correlation of a with b in floats, the filter is centred at ((b->rows - 1) / 2, (b->cols - 1) / 2) as the
+ * FFT does, and the pixels out of a are filled as the padding_pattern says. It takes b->rows + b->cols taps if the
+ * separable parts of b are given in u and v (see _ccv_filter_separate), b->rows * b->cols ones otherwise */
+static void _ccv_filter_direct_32f(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_dense_matrix_t* d, float* u, float* v, int padding_pattern)
+{
+	int ch = CCV_GET_CHANNEL(a->type);
+	int i, j;
+	int n = a->cols * ch;
+	int prows = a->rows + b->rows - 1, pstep = (a->cols + b->cols - 1) * ch;
+	ccv_dense_matrix_t* da = _ccv_filter_pad(a, (b->rows - 1) / 2, (b->cols - 1) / 2, prows, a->cols + b->cols - 1, padding_pattern);
+	float* pa = (float*)ccmalloc(sizeof(float) * prows * pstep);
+	unsigned char* a_ptr = da->data.u8;
+#define for_block(_, _for_get) \
+	for (i = 0; i < prows; i++) \
+	{ \
+		float* p_ptr = pa + i * pstep; \
+		for (j = 0; j < pstep; j++) \
+			p_ptr[j] = _for_get(a_ptr, j, 0); \
+		a_ptr += da->step; \
+	}
+	ccv_matrix_getter(da->type, for_block);
+#undef for_block
+	ccv_matrix_free(da);
+	ccv_filter_taps_band_t band = {
+		.src = pa,
+		.step = pstep,
+		.ch = ch,
+		.n = n,
+		.dst = 0,
+		.d = d,
+	};
+	if (u && v)
+	{
+		/* along the rows of pa first, then along the columns of that */
+		float* row = (float*)ccmalloc(sizeof(float) * prows * n);
+		band.rows = 1;
+		band.cols = b->cols;
+		band.pattern = _ccv_filter_patterns(b, 0, v, 1, b->cols);
+		band.dst = row;
+		ccv_parallel_for(prows, 1, _ccv_filter_taps, &band);
+		ccfree(band.pattern);
+		band.src = row;
+		band.step = n;
+		band.rows = b->rows;
+		band.cols = 1;
+		band.pattern = _ccv_filter_patterns(b, u, 0, b->rows, 1);
+		band.dst = 0;
+		ccv_parallel_for(d->rows, 1, _ccv_filter_taps, &band);
+		ccfree(band.pattern);
+		ccfree(row);
+	} else {
+		band.rows = b->rows;
+		band.cols = b->cols;
+		band.pattern = _ccv_filter_patterns(b, 0, 0, b->rows, b->cols);
+		ccv_parallel_for(d->rows, 1, _ccv_filter_taps, &band);
+		ccfree(band.pattern);
+	}
+	ccfree(pa);
+}
+
+/* the cost of the ways of ccv_filter, in nanoseconds for a unit of work, measured with kissfft on one thread: a tap of
+ * a pixel (of a channel) for the direct ones, the extra pass of the separable one for a pixel, and a pixel of a tile
+ * (times the log of the tile size for the transforms) for FFT. The taps are about 4 times slower without SSE2. These
+ * only pick a way, thus, don't have to be precise */
+#ifdef HAVE_SSE2
+#define CCV_FILTER_DIRECT_8U_COST (0.15)
+#define CCV_FILTER_DIRECT_COST (0.4)
+#else
+#define CCV_FILTER_DIRECT_8U_COST (0.6)
+#define CCV_FILTER_DIRECT_COST (1.5)
+#endif
+#define CCV_FILTER_SEPARABLE_COST (4)
+#define CCV_FILTER_FFT_COST (2)
+#define CCV_FILTER_FFT_TILE_COST (12)
+/* the cost of the taps grows with the filter while the one of FFT hardly does, and the taps are memory bound on some
+ * machines, thus, the direct ways only take the filters up to these many taps (rows * cols, and rows + cols for the
+ * separable one), beyond that, FFT is as fast or faster even with the slowest taps */
+#define CCV_FILTER_DIRECT_MAX (256)
+#define CCV_FILTER_SEPARABLE_MAX (48)
+
+static double _ccv_filter_fft_cost(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b)
+{
+	/* the tiles of _ccv_filter_fftw / _ccv_filter_kissfft, every channel of a tile takes a forward and an inverse
+	 * transform */
+	int rows = _ccv_filter_fft_tile_size(a->rows, b->rows);
+	int cols = _ccv_filter_fft_tile_size(a->cols, b->cols);
+	int tile_x = (a->cols + cols - b->cols) / (cols - b->cols + 1);
+	int tile_y = (a->rows + rows - b->rows) / (rows - b->rows + 1);
+	double n = (double)rows * cols;
+	return (double)tile_x * tile_y * CCV_GET_CHANNEL(a->type) * n * (log(n) * CCV_FILTER_FFT_COST + CCV_FILTER_FFT_TILE_COST);
+}
+
 void ccv_filter(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_dense_matrix_t** d, int type, int padding_pattern)
 {
 	ccv_declare_derived_signature(sig, a->sig != 0 && b->sig != 0, ccv_sign_with_literal("ccv_filter"), a->sig, b->sig, 0);
@@ -923,24 +1287,43 @@ void ccv_filter(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_dense_matrix_t
 	ccv_dense_matrix_t* dd = *d = ccv_dense_matrix_renew(*d, a->rows, a->cols, CCV_ALL_DATA_TYPE | CCV_GET_CHANNEL(a->type), type, sig);
 	ccv_object_return_if_cached(, dd);
 
-	/* 15 is the constant to indicate the high cost of FFT (even with O(nlog(m)) for
-	 * integer image.
-	 * NOTE: FFT has time complexity of O(nlog(n)), however, for convolution, it
-	 * is not the case. Convolving one image (a) to a kernel (b), can be done by
-	 * dividing image a to several blocks proportional to (b). Thus, one don't need
-	 * to do FFT for the whole image. The image can be divided to n/m part, and
-	 * the FFT itself is O(mlog(m)), so, the convolution process has time complexity
-	 * of O(nlog(m)) */
-	if ((b->rows * b->cols < (log((double)(b->rows * b->cols)) + 1) * 15) && (a->type & CCV_8U))
+	int ch = CCV_GET_CHANNEL(a->type);
+	double size = (double)a->rows * a->cols * ch;
+	/* the direct ways compute in floats, thus, these only take the 8-bit and the 32-bit float results, the 64-bit ones
+	 * are left to FFT for its precision */
+	double direct_8u_cost = DBL_MAX, direct_cost = DBL_MAX, separable_cost = DBL_MAX;
+	if (CCV_GET_DATA_TYPE(a->type) == CCV_8U && CCV_GET_DATA_TYPE(dd->type) == CCV_8U && ch == 1 && b->rows * b->cols <= CCV_FILTER_DIRECT_MAX)
+		direct_8u_cost = size * b->rows * b->cols * CCV_FILTER_DIRECT_8U_COST;
+	float* u = 0;
+	float* v = 0;
+	if (CCV_GET_DATA_TYPE(a->type) != CCV_64F && (CCV_GET_DATA_TYPE(dd->type) == CCV_8U || CCV_GET_DATA_TYPE(dd->type) == CCV_32F))
 	{
+		if (b->rows * b->cols <= CCV_FILTER_DIRECT_MAX)
+			direct_cost = size * b->rows * b->cols * CCV_FILTER_DIRECT_COST;
+		if (b->rows + b->cols <= CCV_FILTER_SEPARABLE_MAX)
+		{
+			u = (float*)ccmalloc(sizeof(float) * (b->rows + b->cols) * ch);
+			v = u + b->rows * ch;
+			if (_ccv_filter_separate(b, u, v))
+				separable_cost = size * ((b->rows + b->cols) * CCV_FILTER_DIRECT_COST + CCV_FILTER_SEPARABLE_COST);
+		}
+	}
+	double fft_cost = _ccv_filter_fft_cost(a, b);
+	if (direct_8u_cost <= ccv_min(ccv_min(direct_cost, separable_cost), fft_cost))
 		_ccv_filter_direct_8u(a, b, dd, padding_pattern);
-	} else {
+	else if (separable_cost <= ccv_min(direct_cost, fft_cost))
+		_ccv_filter_direct_32f(a, b, dd, u, v, padding_pattern);
+	else if (direct_cost <= fft_cost)
+		_ccv_filter_direct_32f(a, b, dd, 0, 0, padding_pattern);
+	else {
 #ifdef HAVE_FFTW3
 		_ccv_filter_fftw(a, b, dd, padding_pattern);
 #else
 		_ccv_filter_kissfft(a, b, dd, padding_pattern);
 #endif
 	}
+	if (u)
+		ccfree(u);
 }
 
 void ccv_filter_kernel(ccv_dense_matrix_t* x, ccv_filter_kernel_f func, void* data)
@@ -965,178 +1348,223 @@ void ccv_filter_kernel(ccv_dense_matrix_t* x, ccv_filter_kernel_f func, void* da
 	ccv_make_matrix_immutable(x);
 }
 
-void ccv_distance_transform(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, ccv_dense_matrix_t** x, int x_type, ccv_dense_matrix_t** y, int y_type, double dx, double dy, double dxx, double dyy, int flag)
-{
-	assert(!(flag & CCV_L2_NORM) && (flag & CCV_GSEDT));
-	ccv_declare_derived_signature(sig, a->sig != 0, ccv_sign_with_format(64, "ccv_distance_transform(%la,%la,%la,%la,%d)", dx, dy, dxx, dyy, flag), a->sig, 0);
-	type = (CCV_GET_DATA_TYPE(type) == CCV_64F || CCV_GET_DATA_TYPE(a->type) == CCV_64F || CCV_GET_DATA_TYPE(a->type) == CCV_64S) ? CCV_GET_CHANNEL(a->type) | CCV_64F : CCV_GET_CHANNEL(a->type) | CCV_32F;
-	ccv_dense_matrix_t* db = *b = ccv_dense_matrix_renew(*b, a->rows, a->cols, CCV_ALL_DATA_TYPE | CCV_GET_CHANNEL(a->type), type, sig);
-	ccv_dense_matrix_t* mx = 0;
-	ccv_dense_matrix_t* my = 0;
-	if (x != 0)
-	{
-		ccv_declare_derived_signature(xsig, a->sig != 0, ccv_sign_with_format(64, "ccv_distance_transform_x(%la,%la,%la,%la,%d)", dx, dy, dxx, dyy, flag), a->sig, 0);
-		mx = *x = ccv_dense_matrix_renew(*x, a->rows, a->cols, CCV_32S | CCV_C1, CCV_32S | CCV_C1, xsig);
-	}
-	if (y != 0)
-	{
-		ccv_declare_derived_signature(ysig, a->sig != 0, ccv_sign_with_format(64, "ccv_distance_transform_y(%la,%la,%la,%la,%d)", dx, dy, dxx, dyy, flag), a->sig, 0);
-		my = *y = ccv_dense_matrix_renew(*y, a->rows, a->cols, CCV_32S | CCV_C1, CCV_32S | CCV_C1, ysig);
-	}
-	ccv_object_return_if_cached(, db, mx, my);
-	ccv_revive_object_if_cached(db, mx, my);
-	int i, j, k;
-	unsigned char* a_ptr = a->data.u8;
-	unsigned char* b_ptr = db->data.u8;
-	int* v = (int*)alloca(sizeof(int) * ccv_max(db->rows, db->cols));
-	unsigned char* c_ptr = (unsigned char*)alloca(CCV_GET_DATA_TYPE_SIZE(db->type) * db->rows);
-	int* x_ptr = mx ? mx->data.i32 : 0;
-	int* y_ptr = my ? my->data.i32 : 0;
-#define for_block(_for_max, _for_type_b, _for_set_b, _for_get_b, _for_get_a) \
-	_for_type_b _dx = dx, _dy = dy, _dxx = dxx, _dyy = dyy; \
-	_for_type_b* z = (_for_type_b*)alloca(sizeof(_for_type_b) * (ccv_max(db->rows, db->cols) + 1)); \
-	if (_dxx > 1e-6) \
+/* the columns of a block of the column pass of ccv_distance_transform, these are gathered into contiguous memory first */
+#define CCV_DISTANCE_TRANSFORM_COLUMNS (16)
+
+typedef struct {
+	ccv_dense_matrix_t* a;
+	ccv_dense_matrix_t* b;
+	ccv_dense_matrix_t* x; // the maps, if these are asked for
+	ccv_dense_matrix_t* y;
+	double dx;
+	double dy;
+	double dxx;
+	double dyy;
+	int negative; // the CCV_NEGATIVE one
+} ccv_distance_transform_band_t;
+
+/* the lower envelope of the parabolas rooted at SGN f[0, n) (Felzenszwalb and Huttenlocher), evaluated at [0, n) into
+ * d, and i - the root of the parabola it takes at i into arg (if it is not 0). f and d must not overlap, g, v and z
+ * are the scratch of n, n and n + 1 values */
+#define ccv_distance_transform_1d(_for_max, _for_type_b, SGN, f, d, arg, n, _d, _dd) \
 	{ \
-		for (i = 0; i < a->rows; i++) \
+		int _i, _k = 0; \
+		for (_i = 0; _i < (n); _i++) \
+			g[_i] = SGN (f)[_i] + _dd * _i * _i - _d * _i; \
+		v[0] = 0; \
+		z[0] = (_for_type_b)-_for_max; \
+		z[1] = (_for_type_b)_for_max; \
+		for (_i = 1; _i < (n); _i++) \
 		{ \
-			k = 0; \
-			v[0] = 0; \
-			z[0] = (_for_type_b)-_for_max; \
-			z[1] = (_for_type_b)_for_max; \
-			for (j = 1; j < a->cols; j++) \
+			_for_type_b s; \
+			for (;;) \
 			{ \
-				_for_type_b s; \
-				for (;;) \
-				{ \
-					assert(k >= 0 && k < ccv_max(db->rows, db->cols) + 1); \
-					s = ((SGN _for_get_a(a_ptr, j, 0) + _dxx * j * j - _dx * j) - (SGN _for_get_a(a_ptr, v[k], 0) + _dxx * v[k] * v[k] - _dx * v[k])) / (2.0 * _dxx * (j - v[k])); \
-					if (s > z[k]) break; \
-					--k; \
-				} \
-				++k; \
-				assert(k >= 0 && k < ccv_max(db->rows, db->cols) + 1); \
-				v[k] = j; \
-				z[k] = s; \
-				z[k + 1] = (_for_type_b)_for_max; \
+				s = (g[_i] - g[v[_k]]) / (2.0 * _dd * (_i - v[_k])); \
+				if (s > z[_k]) break; \
+				--_k; \
 			} \
-			k = 0; \
-			if (mx) \
+			++_k; \
+			v[_k] = _i; \
+			z[_k] = s; \
+			z[_k + 1] = (_for_type_b)_for_max; \
+		} \
+		_k = 0; \
+		if (arg) \
+		{ \
+			for (_i = 0; _i < (n); _i++) \
 			{ \
-				for (j = 0; j < a->cols; j++) \
-				{ \
-					while (z[k + 1] < j) \
-					{ \
-						assert(k >= 0 && k < ccv_max(db->rows, db->cols)); \
-						++k; \
-					} \
-					_for_set_b(b_ptr, j, _dx * (j - v[k]) + _dxx * (j - v[k]) * (j - v[k]) SGN _for_get_a(a_ptr, v[k], 0), 0); \
-					x_ptr[j] = j - v[k]; \
-				} \
-				x_ptr += mx->cols; \
-			} else { \
-				for (j = 0; j < a->cols; j++) \
-				{ \
-					while (z[k + 1] < j) \
-						++k; \
-					_for_set_b(b_ptr, j, _dx * (j - v[k]) + _dxx * (j - v[k]) * (j - v[k]) SGN _for_get_a(a_ptr, v[k], 0), 0); \
-				} \
+				while (z[_k + 1] < _i) \
+					++_k; \
+				(d)[_i] = _d * (_i - v[_k]) + _dd * (_i - v[_k]) * (_i - v[_k]) SGN (f)[v[_k]]; \
+				(arg)[_i] = _i - v[_k]; \
+			} \
+		} else { \
+			for (_i = 0; _i < (n); _i++) \
+			{ \
+				while (z[_k + 1] < _i) \
+					++_k; \
+				(d)[_i] = _d * (_i - v[_k]) + _dd * (_i - v[_k]) * (_i - v[_k]) SGN (f)[v[_k]]; \
 			} \
-			a_ptr += a->step; \
-			b_ptr += db->step; \
 		} \
-	} else { /* above algorithm cannot handle dxx == 0 properly, below is special casing for that */ \
-		assert(mx == 0); \
-		for (i = 0; i < a->rows; i++) \
+	}
+
+/* the pass along the rows [start, end) of ccv_distance_transform, from a to b (and the x map) */
+static void _ccv_distance_transform_rows(void* context, int start, int end)
+{
+	ccv_distance_transform_band_t* band = (ccv_distance_transform_band_t*)context;
+	ccv_dense_matrix_t* a = band->a;
+	ccv_dense_matrix_t* db = band->b;
+	int i, j, n = a->cols;
+	int* v = (int*)ccmalloc(sizeof(int) * n);
+#define for_block(_for_max, _for_type_b, _for_set_b, _for_get_b, _for_get_a) \
+	_for_type_b _dx = band->dx, _dxx = band->dxx; \
+	_for_type_b* f = (_for_type_b*)ccmalloc(sizeof(_for_type_b) * (n * 3 + 1)); \
+	_for_type_b* g = f + n; \
+	_for_type_b* z = g + n; \
+	for (i = start; i < end; i++) \
+	{ \
+		unsigned char* a_ptr = a->data.u8 + i * a->step; \
+		_for_type_b* b_ptr = (_for_type_b*)(db->data.u8 + i * db->step); \
+		for (j = 0; j < n; j++) \
+			f[j] = _for_get_a(a_ptr, j, 0); \
+		if (_dxx > 1e-6) \
 		{ \
-			for (j = 0; j < a->cols; j++) \
-				_for_set_b(b_ptr, j, SGN _for_get_a(a_ptr, j, 0), 0); \
-			for (j = 1; j < a->cols; j++) \
-				_for_set_b(b_ptr, j, ccv_min(_for_get_b(b_ptr, j, 0), _for_get_b(b_ptr, j - 1, 0) + _dx), 0); \
-			for (j = a->cols - 2; j >= 0; j--) \
-				_for_set_b(b_ptr, j, ccv_min(_for_get_b(b_ptr, j, 0), _for_get_b(b_ptr, j + 1, 0) - _dx), 0); \
-			a_ptr += a->step; \
-			b_ptr += db->step; \
+			int* x_ptr = band->x ? band->x->data.i32 + i * band->x->cols : 0; \
+			if (band->negative) \
+				ccv_distance_transform_1d(_for_max, _for_type_b, -, f, b_ptr, x_ptr, n, _dx, _dxx) \
+			else \
+				ccv_distance_transform_1d(_for_max, _for_type_b, +, f, b_ptr, x_ptr, n, _dx, _dxx) \
+		} else { /* the lower envelope cannot handle dxx == 0 properly, below is special casing for that */ \
+			if (band->negative) \
+				for (j = 0; j < n; j++) \
+					b_ptr[j] = -f[j]; \
+			else \
+				for (j = 0; j < n; j++) \
+					b_ptr[j] = f[j]; \
+			for (j = 1; j < n; j++) \
+				b_ptr[j] = ccv_min(b_ptr[j], b_ptr[j - 1] + _dx); \
+			for (j = n - 2; j >= 0; j--) \
+				b_ptr[j] = ccv_min(b_ptr[j], b_ptr[j + 1] - _dx); \
 		} \
 	} \
-	b_ptr = db->data.u8; \
-	if (_dyy > 1e-6) \
+	ccfree(f);
+	if (db->type & CCV_64F)
+	{
+		ccv_matrix_typeof_setter_getter(db->type, ccv_matrix_getter, a->type, for_block, DBL_MAX);
+	} else {
+		ccv_matrix_typeof_setter_getter(db->type, ccv_matrix_getter, a->type, for_block, FLT_MAX);
+	}
+#undef for_block
+	ccfree(v);
+}
+
+/* the pass along the columns of ccv_distance_transform in place (and the y map), for the blocks [start, end) of
+ * CCV_DISTANCE_TRANSFORM_COLUMNS columns. A block is transposed into contiguous memory, transformed, and put back */
+static void _ccv_distance_transform_columns(void* context, int start, int end)
+{
+	ccv_distance_transform_band_t* band = (ccv_distance_transform_band_t*)context;
+	ccv_dense_matrix_t* db = band->b;
+	ccv_dense_matrix_t* my = band->y;
+	int i, j, k, n = db->rows;
+	int* v = (int*)ccmalloc(sizeof(int) * n);
+	int* arg = my ? (int*)ccmalloc(sizeof(int) * n * CCV_DISTANCE_TRANSFORM_COLUMNS) : 0;
+#define for_block(_for_max, _for_type_b) \
+	_for_type_b _dy = band->dy, _dyy = band->dyy; \
+	_for_type_b* f = (_for_type_b*)ccmalloc(sizeof(_for_type_b) * (n * CCV_DISTANCE_TRANSFORM_COLUMNS * 2 + n * 2 + 1)); \
+	_for_type_b* d = f + n * CCV_DISTANCE_TRANSFORM_COLUMNS; \
+	_for_type_b* g = d + n * CCV_DISTANCE_TRANSFORM_COLUMNS; \
+	_for_type_b* z = g + n; \
+	for (k = start; k < end; k++) \
 	{ \
-		for (j = 0; j < db->cols; j++) \
+		int x = k * CCV_DISTANCE_TRANSFORM_COLUMNS; \
+		int cols = ccv_min(CCV_DISTANCE_TRANSFORM_COLUMNS, db->cols - x); \
+		for (i = 0; i < n; i++) \
+		{ \
+			_for_type_b* b_ptr = (_for_type_b*)(db->data.u8 + i * db->step) + x; \
+			for (j = 0; j < cols; j++) \
+				f[j * n + i] = b_ptr[j]; \
+		} \
+		if (_dyy > 1e-6) \
 		{ \
-			for (i = 0; i < db->rows; i++) \
-				_for_set_b(c_ptr, i, _for_get_b(b_ptr + i * db->step, j, 0), 0); \
-			k = 0; \
-			v[0] = 0; \
-			z[0] = (_for_type_b)-_for_max; \
-			z[1] = (_for_type_b)_for_max; \
-			for (i = 1; i < db->rows; i++) \
+			for (j = 0; j < cols; j++) \
 			{ \
-				_for_type_b s; \
-				for (;;) \
-				{ \
-					assert(k >= 0 && k < ccv_max(db->rows, db->cols) + 1); \
-					s = ((_for_get_b(c_ptr, i, 0) + _dyy * i * i - _dy * i) - (_for_get_b(c_ptr, v[k], 0) + _dyy * v[k] * v[k] - _dy * v[k])) / (2.0 * _dyy * (i - v[k])); \
-					if (s > z[k]) break; \
-					--k; \
-				} \
-				++k; \
-				assert(k >= 0 && k < ccv_max(db->rows, db->cols) + 1); \
-				v[k] = i; \
-				z[k] = s; \
-				z[k + 1] = (_for_type_b)_for_max; \
+				int* y_ptr = arg ? arg + j * n : 0; \
+				ccv_distance_transform_1d(_for_max, _for_type_b, +, f + j * n, d + j * n, y_ptr, n, _dy, _dyy); \
 			} \
-			k = 0; \
-			if (my) \
+		} else { \
+			for (j = 0; j < cols; j++) \
 			{ \
-				for (i = 0; i < db->rows; i++) \
-				{ \
-					while (z[k + 1] < i) \
-					{ \
-						assert(k >= 0 && k < ccv_max(db->rows, db->cols)); \
-						++k; \
-					} \
-					_for_set_b(b_ptr + i * db->step, j, _dy * (i - v[k]) + _dyy * (i - v[k]) * (i - v[k]) + _for_get_b(c_ptr, v[k], 0), 0); \
-					y_ptr[i * my->cols] = i - v[k]; \
-				} \
-				++y_ptr; \
-			} else { \
-				for (i = 0; i < db->rows; i++) \
-				{ \
-					while (z[k + 1] < i) \
-						++k; \
-					_for_set_b(b_ptr + i * db->step, j, _dy * (i - v[k]) + _dyy * (i - v[k]) * (i - v[k]) + _for_get_b(c_ptr, v[k], 0), 0); \
-				} \
+				_for_type_b* f_ptr = f + j * n; \
+				_for_type_b* d_ptr = d + j * n; \
+				d_ptr[0] = f_ptr[0]; \
+				for (i = 1; i < n; i++) \
+					d_ptr[i] = ccv_min(f_ptr[i], d_ptr[i - 1] + _dy); \
+				for (i = n - 2; i >= 0; i--) \
+					d_ptr[i] = ccv_min(d_ptr[i], d_ptr[i + 1] - _dy); \
 			} \
 		} \
-	} else { \
-		assert(my == 0); \
-		for (j = 0; j < db->cols; j++) \
+		for (i = 0; i < n; i++) \
 		{ \
-			for (i = 1; i < db->rows; i++) \
-				_for_set_b(b_ptr + i * db->step, j, ccv_min(_for_get_b(b_ptr + i * db->step, j, 0), _for_get_b(b_ptr + (i - 1) * db->step, j, 0) + _dy), 0); \
-			for (i = db->rows - 2; i >= 0; i--) \
-				_for_set_b(b_ptr + i * db->step, j, ccv_min(_for_get_b(b_ptr + i * db->step, j, 0), _for_get_b(b_ptr + (i + 1) * db->step, j, 0) - _dy), 0); \
+			_for_type_b* b_ptr = (_for_type_b*)(db->data.u8 + i * db->step) + x; \
+			for (j = 0; j < cols; j++) \
+				b_ptr[j] = d[j * n + i]; \
+			if (arg) \
+			{ \
+				int* y_ptr = my->data.i32 + i * my->cols + x; \
+				for (j = 0; j < cols; j++) \
+					y_ptr[j] = arg[j * n + i]; \
+			} \
 		} \
-	}
-	if (flag & CCV_NEGATIVE)
+	} \
+	ccfree(f);
+	if (db->type & CCV_64F)
 	{
-#define SGN -
-		if (db->type & CCV_64F)
-		{
-			ccv_matrix_typeof_setter_getter(db->type, ccv_matrix_getter, a->type, for_block, DBL_MAX);
-		} else {
-			ccv_matrix_typeof_setter_getter(db->type, ccv_matrix_getter, a->type, for_block, FLT_MAX);
-		}
-#undef SGN
+		for_block(DBL_MAX, double);
 	} else {
-#define SGN +
-		if (db->type & CCV_64F)
-		{
-			ccv_matrix_typeof_setter_getter(db->type, ccv_matrix_getter, a->type, for_block, DBL_MAX);
-		} else {
-			ccv_matrix_typeof_setter_getter(db->type, ccv_matrix_getter, a->type, for_block, FLT_MAX);
-		}
-#undef SGN
+		for_block(FLT_MAX, float);
 	}
 #undef for_block
+	if (arg)
+		ccfree(arg);
+	ccfree(v);
+}
+
+#undef ccv_distance_transform_1d
+
+void ccv_distance_transform(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, ccv_dense_matrix_t** x, int x_type, ccv_dense_matrix_t** y, int y_type, double dx, double dy, double dxx, double dyy, int flag)
+{
+	assert(!(flag & CCV_L2_NORM) && (flag & CCV_GSEDT));
+	ccv_declare_derived_signature(sig, a->sig != 0, ccv_sign_with_format(64, "ccv_distance_transform(%la,%la,%la,%la,%d)", dx, dy, dxx, dyy, flag), a->sig, 0);
+	type = (CCV_GET_DATA_TYPE(type) == CCV_64F || CCV_GET_DATA_TYPE(a->type) == CCV_64F || CCV_GET_DATA_TYPE(a->type) == CCV_64S) ? CCV_GET_CHANNEL(a->type) | CCV_64F : CCV_GET_CHANNEL(a->type) | CCV_32F;
+	ccv_dense_matrix_t* db = *b = ccv_dense_matrix_renew(*b, a->rows, a->cols, CCV_ALL_DATA_TYPE | CCV_GET_CHANNEL(a->type), type, sig);
+	ccv_dense_matrix_t* mx = 0;
+	ccv_dense_matrix_t* my = 0;
+	if (x != 0)
+	{
+		ccv_declare_derived_signature(xsig, a->sig != 0, ccv_sign_with_format(64, "ccv_distance_transform_x(%la,%la,%la,%la,%d)", dx, dy, dxx, dyy, flag), a->sig, 0);
+		mx = *x = ccv_dense_matrix_renew(*x, a->rows, a->cols, CCV_32S | CCV_C1, CCV_32S | CCV_C1, xsig);
+	}
+	if (y != 0)
+	{
+		ccv_declare_derived_signature(ysig, a->sig != 0, ccv_sign_with_format(64, "ccv_distance_transform_y(%la,%la,%la,%la,%d)", dx, dy, dxx, dyy, flag), a->sig, 0);
+		my = *y = ccv_dense_matrix_renew(*y, a->rows, a->cols, CCV_32S | CCV_C1, CCV_32S | CCV_C1, ysig);
+	}
+	ccv_object_return_if_cached(, db, mx, my);
+	ccv_revive_object_if_cached(db, mx, my);
+	/* the special casing of dxx == 0 (dyy == 0) has no map to write */
+	assert(dxx > 1e-6 || mx == 0);
+	assert(dyy > 1e-6 || my == 0);
+	ccv_distance_transform_band_t band = {
+		.a = a,
+		.b = db,
+		.x = mx,
+		.y = my,
+		.dx = dx,
+		.dy = dy,
+		.dxx = dxx,
+		.dyy = dyy,
+		.negative = !!(flag & CCV_NEGATIVE),
+	};
+	ccv_parallel_for(a->rows, 1, _ccv_distance_transform_rows, &band);
+	ccv_parallel_for((a->cols + CCV_DISTANCE_TRANSFORM_COLUMNS - 1) / CCV_DISTANCE_TRANSFORM_COLUMNS, 1, _ccv_distance_transform_columns, &band);
 }
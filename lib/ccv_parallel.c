@@ -0,0 +1,208 @@
+#include "ccv.h"
+#include "ccv_internal.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/* the pool outlives any arena scope (ccv_arena_begin), thus, it uses the system allocator directly */
+
+#define CCV_PARALLEL_MAX_THREADS (64)
+
+/* the bands a thread owns, [start, end), it takes them one by one from the front, and the others that run out
+ * of theirs steal half of what is left from the back */
+typedef struct {
+	pthread_mutex_t mutex;
+	int start;
+	int end;
+} ccv_parallel_slot_t;
+
+typedef struct {
+	ccv_parallel_f func;
+	void* context;
+	int n;
+	int band;
+	int slot_count;
+	ccv_parallel_slot_t slot[CCV_PARALLEL_MAX_THREADS];
+} ccv_parallel_job_t;
+
+/* written with ccv_parallel_busy held, read with no lock by ccv_parallel_for and ccv_get_num_threads */
+static int ccv_parallel_num_threads = 1;
+/* set while the thread runs the bands of a job, ccv_set_num_threads would wait on ccv_parallel_busy for the job
+ * that waits on this thread */
+static __thread int ccv_parallel_in_pool = 0;
+/* the threads of the pool, the calling thread is the one more that runs with them */
+static pthread_t* ccv_parallel_threads = 0;
+static int ccv_parallel_thread_count = 0;
+/* held by the thread that runs a job on the pool, the others (or nested calls) find it taken and run on their own */
+static pthread_mutex_t ccv_parallel_busy = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ccv_parallel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ccv_parallel_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ccv_parallel_done = PTHREAD_COND_INITIALIZER;
+static int ccv_parallel_generation = 0;
+/* the generation when the threads of the pool started, the jobs after it are theirs */
+static int ccv_parallel_start_generation = 0;
+static int ccv_parallel_running = 0;
+static int ccv_parallel_quit = 0;
+static ccv_parallel_job_t ccv_parallel_job;
+
+static int _ccv_parallel_take(ccv_parallel_job_t* job, int s)
+{
+	ccv_parallel_slot_t* slot = job->slot + s;
+	pthread_mutex_lock(&slot->mutex);
+	int band = (slot->start < slot->end) ? slot->start++ : -1;
+	pthread_mutex_unlock(&slot->mutex);
+	if (band >= 0)
+		return band;
+	int i;
+	for (i = 1; i < job->slot_count; i++)
+	{
+		ccv_parallel_slot_t* victim = job->slot + (s + i) % job->slot_count;
+		pthread_mutex_lock(&victim->mutex);
+		int left = victim->end - victim->start;
+		if (left > 0)
+		{
+			/* the first of the stolen bands runs right away, the rest goes to this slot */
+			int half = (left + 1) / 2;
+			victim->end -= half;
+			band = victim->end;
+			pthread_mutex_unlock(&victim->mutex);
+			pthread_mutex_lock(&slot->mutex);
+			slot->start = band + 1;
+			slot->end = band + half;
+			pthread_mutex_unlock(&slot->mutex);
+			return band;
+		}
+		pthread_mutex_unlock(&victim->mutex);
+	}
+	return -1;
+}
+
+static void _ccv_parallel_run(ccv_parallel_job_t* job, int s)
+{
+	int band;
+	int in_pool = ccv_parallel_in_pool;
+	ccv_parallel_in_pool = 1;
+	while ((band = _ccv_parallel_take(job, s)) >= 0)
+		job->func(job->context, band * job->band, ccv_min((band + 1) * job->band, job->n));
+	ccv_parallel_in_pool = in_pool;
+}
+
+static void* _ccv_parallel_thread(void* arg)
+{
+	int s = (int)(intptr_t)arg;
+	int generation = ccv_parallel_start_generation;
+	for (;;)
+	{
+		pthread_mutex_lock(&ccv_parallel_mutex);
+		while (!ccv_parallel_quit && generation == ccv_parallel_generation)
+			pthread_cond_wait(&ccv_parallel_wake, &ccv_parallel_mutex);
+		if (ccv_parallel_quit)
+		{
+			pthread_mutex_unlock(&ccv_parallel_mutex);
+			break;
+		}
+		generation = ccv_parallel_generation;
+		pthread_mutex_unlock(&ccv_parallel_mutex);
+		_ccv_parallel_run(&ccv_parallel_job, s);
+		pthread_mutex_lock(&ccv_parallel_mutex);
+		if (--ccv_parallel_running == 0)
+			pthread_cond_signal(&ccv_parallel_done);
+		pthread_mutex_unlock(&ccv_parallel_mutex);
+	}
+	return 0;
+}
+
+/* has to be called with ccv_parallel_busy held */
+static void _ccv_parallel_stop(void)
+{
+	if (!ccv_parallel_threads)
+		return;
+	pthread_mutex_lock(&ccv_parallel_mutex);
+	ccv_parallel_quit = 1;
+	pthread_cond_broadcast(&ccv_parallel_wake);
+	pthread_mutex_unlock(&ccv_parallel_mutex);
+	int i;
+	for (i = 0; i < ccv_parallel_thread_count; i++)
+		pthread_join(ccv_parallel_threads[i], 0);
+	free(ccv_parallel_threads);
+	ccv_parallel_threads = 0;
+	ccv_parallel_thread_count = 0;
+	ccv_parallel_quit = 0;
+}
+
+/* has to be called with ccv_parallel_busy held */
+static void _ccv_parallel_start(void)
+{
+	int i, count = ccv_parallel_num_threads - 1;
+	ccv_parallel_start_generation = ccv_parallel_generation;
+	ccv_parallel_threads = (pthread_t*)malloc(sizeof(pthread_t) * count);
+	for (i = 0; i < count; i++)
+		if (pthread_create(ccv_parallel_threads + i, 0, _ccv_parallel_thread, (void*)(intptr_t)(i + 1)) != 0)
+			break;
+	ccv_parallel_thread_count = i;
+}
+
+void ccv_set_num_threads(int n)
+{
+	if (n <= 0)
+		n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	n = ccv_clamp(n, 1, CCV_PARALLEL_MAX_THREADS);
+	assert(!ccv_parallel_in_pool && "ccv_set_num_threads cannot be called from the bands of ccv_parallel_for");
+	if (ccv_parallel_in_pool)
+		return;
+	pthread_mutex_lock(&ccv_parallel_busy);
+	if (n != ccv_parallel_num_threads)
+	{
+		_ccv_parallel_stop();
+		__atomic_store_n(&ccv_parallel_num_threads, n, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&ccv_parallel_busy);
+}
+
+int ccv_get_num_threads(void)
+{
+	return __atomic_load_n(&ccv_parallel_num_threads, __ATOMIC_RELAXED);
+}
+
+void ccv_parallel_for(int n, int grain, ccv_parallel_f func, void* context)
+{
+	if (n <= 0)
+		return;
+	/* read once, the pool that runs the job is the one of the value under ccv_parallel_busy, a stale one here only
+	 * changes the size of the bands */
+	int num_threads = __atomic_load_n(&ccv_parallel_num_threads, __ATOMIC_RELAXED);
+	/* a few bands for every thread, thus, the ones that finish early have something to steal */
+	int band = ccv_max(grain, (n + num_threads * 4 - 1) / (num_threads * 4));
+	if (num_threads <= 1 || band >= n || pthread_mutex_trylock(&ccv_parallel_busy) != 0)
+	{
+		func(context, 0, n);
+		return;
+	}
+	if (!ccv_parallel_threads)
+		_ccv_parallel_start();
+	ccv_parallel_job_t* job = &ccv_parallel_job;
+	int i, count = (n + band - 1) / band;
+	job->func = func;
+	job->context = context;
+	job->n = n;
+	job->band = band;
+	job->slot_count = ccv_parallel_thread_count + 1;
+	for (i = 0; i < job->slot_count; i++)
+	{
+		pthread_mutex_init(&job->slot[i].mutex, 0);
+		job->slot[i].start = count * i / job->slot_count;
+		job->slot[i].end = count * (i + 1) / job->slot_count;
+	}
+	pthread_mutex_lock(&ccv_parallel_mutex);
+	ccv_parallel_running = ccv_parallel_thread_count;
+	++ccv_parallel_generation;
+	pthread_cond_broadcast(&ccv_parallel_wake);
+	pthread_mutex_unlock(&ccv_parallel_mutex);
+	_ccv_parallel_run(job, 0);
+	pthread_mutex_lock(&ccv_parallel_mutex);
+	while (ccv_parallel_running > 0)
+		pthread_cond_wait(&ccv_parallel_done, &ccv_parallel_mutex);
+	pthread_mutex_unlock(&ccv_parallel_mutex);
+	for (i = 0; i < job->slot_count; i++)
+		pthread_mutex_destroy(&job->slot[i].mutex);
+	pthread_mutex_unlock(&ccv_parallel_busy);
+}
@@ -187,6 +187,231 @@ static void _ccv_resample_area(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b)
 #undef for_block
 }
 
+/* linear, cubic and lanczos interpolation are separable, the conventions are the ones of OpenCV resize: the source
+ * position of a destination pixel is (d + 0.5) * scale - 0.5, and the border is replicated. Every source row is
+ * interpolated horizontally only once and kept in a ring of as many rows as the filter has taps. 8u to 8u is done
+ * in fixed-point with 11-bit coefficients in both directions, which fits in 32 bits even with the negative lobes */
+#define CCV_RESAMPLE_COEF_BITS (11)
+#define CCV_RESAMPLE_COEF_SCALE (1 << CCV_RESAMPLE_COEF_BITS)
+
+static int _ccv_resample_taps(int type)
+{
+	switch (type)
+	{
+		case CCV_INTER_CUBIC:
+			return 4;
+		case CCV_INTER_LANCZOS:
+			return 6;
+	}
+	return 2;
+}
+
+/* the coefficients of the taps from floor(s) - taps / 2 + 1 to floor(s) + taps / 2, fx = s - floor(s) */
+static void _ccv_resample_coeffs(int type, double fx, float* w)
+{
+	int k;
+	switch (type)
+	{
+		case CCV_INTER_CUBIC:
+		{
+			const double A = -0.75;
+			w[0] = ((A * (fx + 1) - 5 * A) * (fx + 1) + 8 * A) * (fx + 1) - 4 * A;
+			w[1] = ((A + 2) * fx - (A + 3)) * fx * fx + 1;
+			w[2] = ((A + 2) * (1 - fx) - (A + 3)) * (1 - fx) * (1 - fx) + 1;
+			w[3] = 1 - w[0] - w[1] - w[2];
+			break;
+		}
+		case CCV_INTER_LANCZOS:
+		{
+			double sum = 0;
+			for (k = 0; k < 6; k++)
+			{
+				double t = fx + 2 - k;
+				w[k] = (fabs(t) < 1e-6) ? 1 : 3 * sin(CCV_PI * t) * sin(CCV_PI * t / 3) / (CCV_PI * CCV_PI * t * t);
+				sum += w[k];
+			}
+			for (k = 0; k < 6; k++)
+				w[k] /= sum;
+			break;
+		}
+		default:
+			w[0] = 1 - fx;
+			w[1] = fx;
+	}
+}
+
+static void _ccv_resample_table(int type, int taps, int n, int dn, int mul, int* ofs, float* w, int* iw)
+{
+	double scale = (double)n / dn;
+	int d, k;
+	for (d = 0; d < dn; d++)
+	{
+		double s = (d + 0.5) * scale - 0.5;
+		int si = (int)floor(s);
+		_ccv_resample_coeffs(type, s - si, w + d * taps);
+		for (k = 0; k < taps; k++)
+			ofs[d * taps + k] = ccv_clamp(si - taps / 2 + 1 + k, 0, n - 1) * mul;
+		if (iw)
+		{
+			/* the rounding error goes to the largest one, thus, a flat image stays flat */
+			int sum = 0, max = 0;
+			for (k = 0; k < taps; k++)
+			{
+				iw[d * taps + k] = (int)lrint(w[d * taps + k] * CCV_RESAMPLE_COEF_SCALE);
+				sum += iw[d * taps + k];
+				if (w[d * taps + k] > w[d * taps + max])
+					max = k;
+			}
+			iw[d * taps + max] += CCV_RESAMPLE_COEF_SCALE - sum;
+		}
+	}
+}
+
+static void _ccv_resample_row_8u(const unsigned char* a_ptr, int cols, int ch, int taps, const int* xofs, const int* ialpha, int* row)
+{
+	int dx, c, k;
+	for (dx = 0; dx < cols; dx++, xofs += taps, ialpha += taps)
+		for (c = 0; c < ch; c++)
+		{
+			int sum = 0;
+			for (k = 0; k < taps; k++)
+				sum += a_ptr[xofs[k] + c] * ialpha[k];
+			row[dx * ch + c] = sum;
+		}
+}
+
+#ifdef HAVE_SSE2
+/* SSE2 has no 32-bit multiply that keeps the low half, it is done on the even and the odd lanes */
+static inline __m128i _ccv_mm_mullo_epi32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+static void _ccv_resample_col_8u(int** rows, const int* ibeta, int taps, int n, unsigned char* b_ptr)
+{
+	int i = 0, k;
+#ifdef HAVE_SSE2
+	__m128i half = _mm_set1_epi32(1 << (CCV_RESAMPLE_COEF_BITS * 2 - 1));
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i s0 = half, s1 = half;
+		for (k = 0; k < taps; k++)
+		{
+			__m128i w = _mm_set1_epi32(ibeta[k]);
+			s0 = _mm_add_epi32(s0, _ccv_mm_mullo_epi32(_mm_loadu_si128((const __m128i*)(rows[k] + i)), w));
+			s1 = _mm_add_epi32(s1, _ccv_mm_mullo_epi32(_mm_loadu_si128((const __m128i*)(rows[k] + i + 4)), w));
+		}
+		s0 = _mm_srai_epi32(s0, CCV_RESAMPLE_COEF_BITS * 2);
+		s1 = _mm_srai_epi32(s1, CCV_RESAMPLE_COEF_BITS * 2);
+		__m128i v = _mm_packs_epi32(s0, s1);
+		_mm_storel_epi64((__m128i*)(b_ptr + i), _mm_packus_epi16(v, v));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		int sum = 1 << (CCV_RESAMPLE_COEF_BITS * 2 - 1);
+		for (k = 0; k < taps; k++)
+			sum += rows[k][i] * ibeta[k];
+		b_ptr[i] = ccv_clamp(sum >> (CCV_RESAMPLE_COEF_BITS * 2), 0, 255);
+	}
+}
+
+static void _ccv_resample_col_32f(float** rows, const float* beta, int taps, int n, float* b_ptr)
+{
+	int i = 0, k;
+#ifdef HAVE_SSE2
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 sum = _mm_setzero_ps();
+		for (k = 0; k < taps; k++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(beta[k])));
+		_mm_storeu_ps(b_ptr + i, sum);
+	}
+#endif
+	for (; i < n; i++)
+	{
+		float sum = 0;
+		for (k = 0; k < taps; k++)
+			sum += rows[k][i] * beta[k];
+		b_ptr[i] = sum;
+	}
+}
+
+static void _ccv_resample_interpolate(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, int type)
+{
+	int taps = _ccv_resample_taps(type);
+	int ch = CCV_GET_CHANNEL(a->type);
+	int fixed = (CCV_GET_DATA_TYPE(a->type) == CCV_8U && CCV_GET_DATA_TYPE(b->type) == CCV_8U);
+	int* xofs = (int*)ccmalloc(sizeof(int) * (b->cols + b->rows) * taps * 3);
+	int* yofs = xofs + b->cols * taps;
+	int* ialpha = yofs + b->rows * taps;
+	int* ibeta = ialpha + b->cols * taps;
+	float* alpha = (float*)(ibeta + b->rows * taps);
+	float* beta = alpha + b->cols * taps;
+	_ccv_resample_table(type, taps, a->cols, b->cols, ch, xofs, alpha, fixed ? ialpha : 0);
+	_ccv_resample_table(type, taps, a->rows, b->rows, 1, yofs, beta, fixed ? ibeta : 0);
+	int n = b->cols * ch;
+	/* int and float are of the same size, the ring holds either */
+	unsigned char* buf = (unsigned char*)ccmalloc(sizeof(float) * n * taps);
+	int* ring = (int*)alloca(sizeof(int) * taps);
+	unsigned char* rows[6];
+	int dx, dy, c, k;
+	for (k = 0; k < taps; k++)
+		ring[k] = -1;
+	for (dy = 0; dy < b->rows; dy++)
+	{
+		for (k = 0; k < taps; k++)
+		{
+			/* the taps are consecutive rows (or the same row at the border), they never share a slot */
+			int sy = yofs[dy * taps + k];
+			rows[k] = buf + (sy % taps) * n * sizeof(float);
+			if (ring[sy % taps] == sy)
+				continue;
+			ring[sy % taps] = sy;
+			unsigned char* a_ptr = a->data.u8 + a->step * sy;
+			if (fixed)
+				_ccv_resample_row_8u(a_ptr, b->cols, ch, taps, xofs, ialpha, (int*)rows[k]);
+			else {
+				float* row = (float*)rows[k];
+#define for_block(_, _for_get) \
+				for (dx = 0; dx < b->cols; dx++) \
+					for (c = 0; c < ch; c++) \
+					{ \
+						int i; \
+						float sum = 0; \
+						for (i = 0; i < taps; i++) \
+							sum += _for_get(a_ptr, xofs[dx * taps + i] + c, 0) * alpha[dx * taps + i]; \
+						row[dx * ch + c] = sum; \
+					}
+				ccv_matrix_getter(a->type, for_block);
+#undef for_block
+			}
+		}
+		unsigned char* b_ptr = b->data.u8 + b->step * dy;
+		if (fixed)
+			_ccv_resample_col_8u((int**)rows, ibeta + dy * taps, taps, n, b_ptr);
+		else if (CCV_GET_DATA_TYPE(b->type) == CCV_32F)
+			_ccv_resample_col_32f((float**)rows, beta + dy * taps, taps, n, (float*)b_ptr);
+		else {
+#define for_block(_, _for_set) \
+			for (dx = 0; dx < n; dx++) \
+			{ \
+				float sum = 0; \
+				for (k = 0; k < taps; k++) \
+					sum += ((float*)rows[k])[dx] * beta[dy * taps + k]; \
+				_for_set(b_ptr, dx, sum, 0); \
+			}
+			ccv_matrix_setter(b->type, for_block);
+#undef for_block
+		}
+	}
+	ccfree(buf);
+	ccfree(xofs);
+}
+
 void ccv_resample(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int btype, int rows, int cols, int type)
 {
 	ccv_declare_derived_signature(sig, a->sig != 0, ccv_sign_with_format(64, "ccv_resample(%d,%d,%d)", rows, cols, type), a->sig, 0);
@@ -195,7 +420,7 @@ void ccv_resample(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int btype, int
 	ccv_object_return_if_cached(, db);
 	if (a->rows == db->rows && a->cols == db->cols)
 	{
-		if (CCV_GET_CHANNEL(a->type) == CCV_GET_CHANNEL(db->type) && CCV_GET_DATA_TYPE(db->type) == CCV_GET_DATA_TYPE(a->type))
+		if (CCV_GET_CHANNEL(a->type) == CCV_GET_CHANNEL(db->type) && CCV_GET_DATA_TYPE(db->type) == CCV_GET_DATA_TYPE(a->type) && a->step == db->step)
 			memcpy(db->data.u8, a->data.u8, a->rows * a->step);
 		else {
 			ccv_shift(a, (ccv_matrix_t**)&db, 0, 0, 0);
@@ -214,23 +439,19 @@ void ccv_resample(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int btype, int
 					_ccv_resample_area(a, db);
 				break;
 			}
+			/* area is linear when it is not shrinking in both directions */
+			type = CCV_INTER_LINEAR;
 		case CCV_INTER_LINEAR:
-			break;
 		case CCV_INTER_CUBIC:
-			break;
 		case CCV_INTER_LANCZOS:
+			_ccv_resample_interpolate(a, db, type);
 			break;
 	}
 }
 
 /* the following code is adopted from OpenCV cvPyrDown */
-void ccv_sample_down(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int src_x, int src_y)
+static void _ccv_sample_down(ccv_dense_matrix_t* a, ccv_dense_matrix_t* db, int src_x, int src_y)
 {
-	assert(src_x >= 0 && src_y >= 0);
-	ccv_declare_derived_signature(sig, a->sig != 0, ccv_sign_with_format(64, "ccv_sample_down(%d,%d)", src_x, src_y), a->sig, 0);
-	type = (type == 0) ? CCV_GET_DATA_TYPE(a->type) | CCV_GET_CHANNEL(a->type) : CCV_GET_DATA_TYPE(type) | CCV_GET_CHANNEL(a->type);
-	ccv_dense_matrix_t* db = *b = ccv_dense_matrix_renew(*b, a->rows / 2, a->cols / 2, CCV_ALL_DATA_TYPE | CCV_GET_CHANNEL(a->type), type, sig);
-	ccv_object_return_if_cached(, db);
 	int ch = CCV_GET_CHANNEL(a->type);
 	int cols0 = db->cols - 1 - src_x;
 	int dy, sy = -2 + src_y, sx = src_x * ch, dx, k;
@@ -288,6 +509,230 @@ void ccv_sample_down(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, in
 #undef for_block
 }
 
+/* the same 1 4 6 4 1 filter as _ccv_sample_down for 8u and 32f without type conversion, the horizontal pass of every
+ * source row is done once for both src_x phases and kept in a ring of 8 rows that both src_y phases read from,
+ * thus, all 4 phases take one pass over the source. The horizontal pass of 8u fits in 16 bits (at most 16 * 255),
+ * so does the vertical one (at most 256 * 255) */
+#define ccv_sample_down_reflect(x, n) (((x) < 0) ? -1 - (x) : ((x) >= (n)) ? (n) * 2 - 1 - (x) : (x))
+
+static void _ccv_sample_down_8u_row(const unsigned char* a_ptr, int cols, int ch, int src_x, int dcols, uint16_t* row)
+{
+	int sx = src_x * ch;
+	int cols0 = dcols - 1 - src_x;
+	int dx, k;
+	for (k = 0; k < ch; k++)
+		row[k] = a_ptr[sx + k] * 10 + a_ptr[ch + sx + k] * 5 + a_ptr[2 * ch + sx + k];
+	dx = ch;
+#ifdef HAVE_SSE2
+	if (ch == 1)
+	{
+		__m128i mask = _mm_set1_epi16(0xff);
+		__m128i six = _mm_set1_epi16(6);
+		for (; dx + 8 <= cols0 && dx * 2 + sx + 18 <= cols; dx += 8)
+		{
+			const unsigned char* p = a_ptr + dx * 2 + sx - 2;
+			__m128i v0 = _mm_loadu_si128((const __m128i*)p);
+			__m128i v2 = _mm_loadu_si128((const __m128i*)(p + 2));
+			__m128i v4 = _mm_loadu_si128((const __m128i*)(p + 4));
+			__m128i c = _mm_mullo_epi16(_mm_and_si128(v2, mask), six);
+			__m128i n1 = _mm_slli_epi16(_mm_add_epi16(_mm_srli_epi16(v0, 8), _mm_srli_epi16(v2, 8)), 2);
+			__m128i n2 = _mm_add_epi16(_mm_and_si128(v0, mask), _mm_and_si128(v4, mask));
+			_mm_storeu_si128((__m128i*)(row + dx), _mm_add_epi16(_mm_add_epi16(c, n1), n2));
+		}
+	}
+#endif
+	for (; dx < cols0 * ch; dx += ch)
+		for (k = 0; k < ch; k++)
+			row[dx + k] = a_ptr[dx * 2 + sx + k] * 6 + (a_ptr[dx * 2 + sx + k - ch] + a_ptr[dx * 2 + sx + k + ch]) * 4 + a_ptr[dx * 2 + sx + k - ch * 2] + a_ptr[dx * 2 + sx + k + ch * 2];
+	if (src_x > 0)
+	{
+		for (dx = cols0; dx < dcols; dx++)
+			for (k = 0; k < ch; k++)
+				row[dx * ch + k] = a_ptr[ccv_sample_down_reflect(dx * 2 + src_x, cols) * ch + k] * 6 + (a_ptr[ccv_sample_down_reflect(dx * 2 + src_x - 1, cols) * ch + k] + a_ptr[ccv_sample_down_reflect(dx * 2 + src_x + 1, cols) * ch + k]) * 4 + a_ptr[ccv_sample_down_reflect(dx * 2 + src_x - 2, cols) * ch + k] + a_ptr[ccv_sample_down_reflect(dx * 2 + src_x + 2, cols) * ch + k];
+	} else {
+		for (k = 0; k < ch; k++)
+			row[(dcols - 1) * ch + k] = a_ptr[(cols - 1) * ch + k] * 10 + a_ptr[(cols - 2) * ch + k] * 5 + a_ptr[(cols - 3) * ch + k];
+	}
+}
+
+static void _ccv_sample_down_8u_col(uint16_t** rows, int n, unsigned char* b_ptr)
+{
+	int i = 0;
+#ifdef HAVE_SSE2
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i r0 = _mm_loadu_si128((const __m128i*)(rows[0] + i));
+		__m128i r1 = _mm_loadu_si128((const __m128i*)(rows[1] + i));
+		__m128i r2 = _mm_loadu_si128((const __m128i*)(rows[2] + i));
+		__m128i r3 = _mm_loadu_si128((const __m128i*)(rows[3] + i));
+		__m128i r4 = _mm_loadu_si128((const __m128i*)(rows[4] + i));
+		__m128i v = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r2, _mm_set1_epi16(6)), _mm_slli_epi16(_mm_add_epi16(r1, r3), 2)), _mm_add_epi16(r0, r4));
+		v = _mm_srli_epi16(v, 8);
+		_mm_storel_epi64((__m128i*)(b_ptr + i), _mm_packus_epi16(v, v));
+	}
+#endif
+	for (; i < n; i++)
+		b_ptr[i] = (rows[2][i] * 6 + (rows[1][i] + rows[3][i]) * 4 + rows[0][i] + rows[4][i]) >> 8;
+}
+
+static void _ccv_sample_down_32f_row(const float* a_ptr, int cols, int ch, int src_x, int dcols, float* row)
+{
+	int sx = src_x * ch;
+	int cols0 = dcols - 1 - src_x;
+	int dx, k;
+	for (k = 0; k < ch; k++)
+		row[k] = a_ptr[sx + k] * 10 + a_ptr[ch + sx + k] * 5 + a_ptr[2 * ch + sx + k];
+	dx = ch;
+#ifdef HAVE_SSE2
+	if (ch == 1)
+	{
+		__m128 six = _mm_set1_ps(6);
+		__m128 four = _mm_set1_ps(4);
+		for (; dx + 4 <= cols0 && dx * 2 + sx + 10 <= cols; dx += 4)
+		{
+			const float* p = a_ptr + dx * 2 + sx - 2;
+			__m128 l0 = _mm_loadu_ps(p);
+			__m128 l1 = _mm_loadu_ps(p + 4);
+			__m128 m0 = _mm_loadu_ps(p + 2);
+			__m128 m1 = _mm_loadu_ps(p + 6);
+			__m128 n1 = _mm_loadu_ps(p + 8);
+			__m128 c = _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 r1 = _mm_add_ps(_mm_shuffle_ps(l0, l1, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(3, 1, 3, 1)));
+			__m128 v = _mm_add_ps(_mm_mul_ps(c, six), _mm_mul_ps(r1, four));
+			v = _mm_add_ps(v, _mm_shuffle_ps(l0, l1, _MM_SHUFFLE(2, 0, 2, 0)));
+			v = _mm_add_ps(v, _mm_shuffle_ps(l1, n1, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(row + dx, v);
+		}
+	}
+#endif
+	for (; dx < cols0 * ch; dx += ch)
+		for (k = 0; k < ch; k++)
+			row[dx + k] = a_ptr[dx * 2 + sx + k] * 6 + (a_ptr[dx * 2 + sx + k - ch] + a_ptr[dx * 2 + sx + k + ch]) * 4 + a_ptr[dx * 2 + sx + k - ch * 2] + a_ptr[dx * 2 + sx + k + ch * 2];
+	if (src_x > 0)
+	{
+		for (dx = cols0; dx < dcols; dx++)
+			for (k = 0; k < ch; k++)
+				row[dx * ch + k] = a_ptr[ccv_sample_down_reflect(dx * 2 + src_x, cols) * ch + k] * 6 + (a_ptr[ccv_sample_down_reflect(dx * 2 + src_x - 1, cols) * ch + k] + a_ptr[ccv_sample_down_reflect(dx * 2 + src_x + 1, cols) * ch + k]) * 4 + a_ptr[ccv_sample_down_reflect(dx * 2 + src_x - 2, cols) * ch + k] + a_ptr[ccv_sample_down_reflect(dx * 2 + src_x + 2, cols) * ch + k];
+	} else {
+		for (k = 0; k < ch; k++)
+			row[(dcols - 1) * ch + k] = a_ptr[(cols - 1) * ch + k] * 10 + a_ptr[(cols - 2) * ch + k] * 5 + a_ptr[(cols - 3) * ch + k];
+	}
+}
+
+static void _ccv_sample_down_32f_col(float** rows, int n, float* b_ptr)
+{
+	int i = 0;
+#ifdef HAVE_SSE2
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(rows[2] + i), _mm_set1_ps(6)), _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(rows[1] + i), _mm_loadu_ps(rows[3] + i)), _mm_set1_ps(4)));
+		v = _mm_add_ps(_mm_add_ps(v, _mm_loadu_ps(rows[0] + i)), _mm_loadu_ps(rows[4] + i));
+		_mm_storeu_ps(b_ptr + i, _mm_mul_ps(v, _mm_set1_ps(1.0 / 256)));
+	}
+#endif
+	for (; i < n; i++)
+		b_ptr[i] = (rows[2][i] * 6 + (rows[1][i] + rows[3][i]) * 4 + rows[0][i] + rows[4][i]) / 256;
+}
+
+/* db[src_x + src_y * 2] for the phases in mask */
+static void _ccv_sample_down_phases_8u_32f(ccv_dense_matrix_t* a, ccv_dense_matrix_t** db, int mask)
+{
+	int i, k, dy, sy, x;
+	ccv_dense_matrix_t* d = db[0];
+	for (i = 0; !d; i++)
+		d = db[i];
+	int ch = CCV_GET_CHANNEL(a->type);
+	int xs = ((mask & 5) ? 1 : 0) | ((mask & 10) ? 2 : 0);
+	int rowstep = (d->cols * ch * ((a->type & CCV_8U) ? sizeof(uint16_t) : sizeof(float)) + 15) & -16;
+	unsigned char* buf = (unsigned char*)ccmalloc(rowstep * 16);
+	sy = (mask & 3) ? -2 : -1;
+	int sy_end = (mask & 12) ? 3 : 2;
+	for (dy = 0; dy < d->rows; dy++)
+	{
+		for (; sy <= dy * 2 + sy_end; sy++)
+		{
+			unsigned char* a_ptr = a->data.u8 + a->step * ccv_sample_down_reflect(sy, a->rows);
+			for (x = 0; x < 2; x++)
+				if (xs & (1 << x))
+				{
+					unsigned char* row = buf + (x * 8 + ((sy + 2) & 7)) * rowstep;
+					if (a->type & CCV_8U)
+						_ccv_sample_down_8u_row(a_ptr, a->cols, ch, x, d->cols, (uint16_t*)row);
+					else
+						_ccv_sample_down_32f_row((float*)a_ptr, a->cols, ch, x, d->cols, (float*)row);
+				}
+		}
+		for (i = 0; i < 4; i++)
+			if (mask & (1 << i))
+			{
+				unsigned char* rows[5];
+				for (k = 0; k < 5; k++)
+					rows[k] = buf + ((i & 1) * 8 + ((dy * 2 + (i >> 1) + k) & 7)) * rowstep;
+				unsigned char* b_ptr = db[i]->data.u8 + db[i]->step * dy;
+				if (a->type & CCV_8U)
+					_ccv_sample_down_8u_col((uint16_t**)rows, d->cols * ch, b_ptr);
+				else
+					_ccv_sample_down_32f_col((float**)rows, d->cols * ch, (float*)b_ptr);
+			}
+	}
+	ccfree(buf);
+}
+
+static void _ccv_sample_down_phases(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int mask)
+{
+	type = (type == 0) ? CCV_GET_DATA_TYPE(a->type) | CCV_GET_CHANNEL(a->type) : CCV_GET_DATA_TYPE(type) | CCV_GET_CHANNEL(a->type);
+	int i;
+	for (i = 0; i < 4; i++)
+		if (mask & (1 << i))
+		{
+			ccv_declare_derived_signature(sig, a->sig != 0, ccv_sign_with_format(64, "ccv_sample_down(%d,%d)", i & 1, i >> 1), a->sig, 0);
+			b[i] = ccv_dense_matrix_renew(b[i], a->rows / 2, a->cols / 2, CCV_ALL_DATA_TYPE | CCV_GET_CHANNEL(a->type), type, sig);
+			if (b[i]->type & CCV_GARBAGE)
+			{
+				b[i]->type &= ~CCV_GARBAGE;
+				mask &= ~(1 << i);
+			}
+		}
+	if (!mask)
+		return;
+	if (a->cols >= 8 && a->rows >= 4 && (CCV_GET_DATA_TYPE(a->type) == CCV_8U || CCV_GET_DATA_TYPE(a->type) == CCV_32F) && CCV_GET_DATA_TYPE(type) == CCV_GET_DATA_TYPE(a->type))
+	{
+		ccv_dense_matrix_t* db[4] = { 0 };
+		for (i = 0; i < 4; i++)
+			if (mask & (1 << i))
+				db[i] = b[i];
+		_ccv_sample_down_phases_8u_32f(a, db, mask);
+	} else {
+		for (i = 0; i < 4; i++)
+			if (mask & (1 << i))
+				_ccv_sample_down(a, b[i], i & 1, i >> 1);
+	}
+}
+
+void ccv_sample_down(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int src_x, int src_y)
+{
+	assert(src_x >= 0 && src_y >= 0);
+	if (src_x <= 1 && src_y <= 1)
+	{
+		int q = src_x + src_y * 2;
+		ccv_dense_matrix_t* db[4] = { 0 };
+		db[q] = *b;
+		_ccv_sample_down_phases(a, db, type, 1 << q);
+		*b = db[q];
+		return;
+	}
+	ccv_declare_derived_signature(sig, a->sig != 0, ccv_sign_with_format(64, "ccv_sample_down(%d,%d)", src_x, src_y), a->sig, 0);
+	type = (type == 0) ? CCV_GET_DATA_TYPE(a->type) | CCV_GET_CHANNEL(a->type) : CCV_GET_DATA_TYPE(type) | CCV_GET_CHANNEL(a->type);
+	ccv_dense_matrix_t* db = *b = ccv_dense_matrix_renew(*b, a->rows / 2, a->cols / 2, CCV_ALL_DATA_TYPE | CCV_GET_CHANNEL(a->type), type, sig);
+	ccv_object_return_if_cached(, db);
+	_ccv_sample_down(a, db, src_x, src_y);
+}
+
+void ccv_sample_down_phases(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type)
+{
+	_ccv_sample_down_phases(a, b, type, 0xf);
+}
+
 void ccv_sample_up(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int src_x, int src_y)
 {
 	assert(src_x >= 0 && src_y >= 0);
@@ -423,3 +868,58 @@ void ccv_sample_up(ccv_dense_matrix_t* a, ccv_dense_matrix_t** b, int type, int
 	}
 #undef for_block
 }
+
+ccv_pyramid_t* ccv_pyramid_new(ccv_dense_matrix_t* a, int interval)
+{
+	assert(interval >= 0);
+	int next = interval + 1;
+	/* one octave for each time the shorter side can be halved */
+	int octave = 1, size = ccv_min(a->rows, a->cols);
+	while (size >>= 1)
+		++octave;
+	int count = octave * next;
+	ccv_pyramid_t* pyramid = (ccv_pyramid_t*)ccmalloc(sizeof(ccv_pyramid_t) + count * 4 * sizeof(ccv_dense_matrix_t*));
+	pyramid->interval = interval;
+	pyramid->count = count;
+	pyramid->a = a;
+	pyramid->level = (ccv_dense_matrix_t**)(pyramid + 1);
+	memset(pyramid->level, 0, count * 4 * sizeof(ccv_dense_matrix_t*));
+	pyramid->level[0] = a;
+	return pyramid;
+}
+
+ccv_dense_matrix_t* ccv_pyramid_level(ccv_pyramid_t* pyramid, int i, int src_x, int src_y)
+{
+	assert(i >= 0 && i < pyramid->count);
+	assert(src_x >= 0 && src_x <= 1 && src_y >= 0 && src_y <= 1);
+	int next = pyramid->interval + 1;
+	int q = src_x + src_y * 2;
+	if (pyramid->level[i * 4 + q])
+		return pyramid->level[i * 4 + q];
+	if (i < next)
+	{
+		/* the phase only makes sense for levels that are sampled down */
+		assert(q == 0);
+		double scale = pow(2., 1. / next);
+		ccv_resample(pyramid->a, &pyramid->level[i * 4], 0, (int)(pyramid->a->rows / pow(scale, i)), (int)(pyramid->a->cols / pow(scale, i)), CCV_INTER_AREA);
+	} else if (q > 0) {
+		/* the one who asks for a phase asks for all of them (accurate bbf), they are done in one pass */
+		int mask = 0;
+		for (q = 0; q < 4; q++)
+			if (!pyramid->level[i * 4 + q])
+				mask |= 1 << q;
+		_ccv_sample_down_phases(ccv_pyramid_level(pyramid, i - next, 0, 0), pyramid->level + i * 4, 0, mask);
+		q = src_x + src_y * 2;
+	} else
+		ccv_sample_down(ccv_pyramid_level(pyramid, i - next, 0, 0), &pyramid->level[i * 4], 0, 0, 0);
+	return pyramid->level[i * 4 + q];
+}
+
+void ccv_pyramid_free(ccv_pyramid_t* pyramid)
+{
+	int i;
+	for (i = 1; i < pyramid->count * 4; i++)
+		if (pyramid->level[i])
+			ccv_matrix_free(pyramid->level[i]);
+	ccfree(pyramid);
+}
@@ -65,25 +65,42 @@ void ccv_zero(ccv_matrix_t* mat)
 	memset(dmt->data.u8, 0, dmt->step * dmt->rows);
 }
 
+/* the library is built with -ffast-math, which lets the compiler assume there is no nan and fold isnan away,
+ * thus, the bits are tested instead: all ones in the exponent and a non-zero mantissa */
+static inline int _ccv_isnan_32f(float x)
+{
+	union { float f; uint32_t u; } v = { .f = x };
+	return (v.u & 0x7fffffffu) > 0x7f800000u;
+}
+
+static inline int _ccv_isnan_64f(double x)
+{
+	union { double f; uint64_t u; } v = { .f = x };
+	return (v.u & 0x7fffffffffffffffull) > 0x7ff0000000000000ull;
+}
+
 int ccv_any_nan(ccv_matrix_t *a)
 {
 	ccv_dense_matrix_t* da = ccv_get_dense_matrix(a);
 	assert((da->type & CCV_32F) || (da->type & CCV_64F));
 	int ch = CCV_GET_CHANNEL(da->type);
-	int i;
-	if (da->type & CCV_32F)
+	int i, j;
+	unsigned char* aptr = da->data.u8;
+	for (i = 0; i < da->rows; i++)
 	{
-		for (i = 0; i < da->rows * da->cols * ch; i++)
-#ifdef isnanf
-			if (isnanf(da->data.f32[i]))
-#else
-			if (isnan(da->data.f32[i]))
-#endif
-				return i + 1;
-	} else {
-		for (i = 0; i < da->rows * da->cols * ch; i++)
-			if (isnan(da->data.f64[i]))
-				return i + 1;
+		if (da->type & CCV_32F)
+		{
+			float* fptr = (float*)aptr;
+			for (j = 0; j < da->cols * ch; j++)
+				if (_ccv_isnan_32f(fptr[j]))
+					return i * da->cols * ch + j + 1;
+		} else {
+			double* dptr = (double*)aptr;
+			for (j = 0; j < da->cols * ch; j++)
+				if (_ccv_isnan_64f(dptr[j]))
+					return i * da->cols * ch + j + 1;
+		}
+		aptr += da->step;
 	}
 	return 0;
 }
@@ -587,10 +604,9 @@ typedef struct ccv_ptree_node_t
 	int rank;
 } ccv_ptree_node_t;
 
-/* the code for grouping array is adopted from OpenCV's cvSeqPartition func, it is essentially a find-union algorithm */
-int ccv_array_group(ccv_array_t* array, ccv_array_t** index, ccv_array_group_f gfunc, void* data)
+static ccv_ptree_node_t* _ccv_ptree_new(ccv_array_t* array)
 {
-	int i, j;
+	int i;
 	ccv_ptree_node_t* node = (ccv_ptree_node_t*)ccmalloc(array->rnum * sizeof(ccv_ptree_node_t));
 	for (i = 0; i < array->rnum; i++)
 	{
@@ -598,62 +614,60 @@ int ccv_array_group(ccv_array_t* array, ccv_array_t** index, ccv_array_group_f g
 		node[i].element = ccv_array_get(array, i);
 		node[i].rank = 0;
 	}
-	for (i = 0; i < array->rnum; i++)
-	{
-		if (!node[i].element)
-			continue;
-		ccv_ptree_node_t* root = node + i;
-		while (root->parent)
-			root = root->parent;
-		for (j = 0; j < array->rnum; j++)
-		{
-			if( i != j && node[j].element && gfunc(node[i].element, node[j].element, data))
-			{
-				ccv_ptree_node_t* root2 = node + j;
+	return node;
+}
 
-				while(root2->parent)
-					root2 = root2->parent;
+/* merge the tree of node2 into the one of node (root is the root of node), returns the root of the merged one */
+static ccv_ptree_node_t* _ccv_ptree_union(ccv_ptree_node_t* node, ccv_ptree_node_t* root, ccv_ptree_node_t* node2)
+{
+	ccv_ptree_node_t* root2 = node2;
 
-				if(root2 != root)
-				{
-					if(root->rank > root2->rank)
-						root2->parent = root;
-					else
-					{
-						root->parent = root2;
-						root2->rank += root->rank == root2->rank;
-						root = root2;
-					}
+	while(root2->parent)
+		root2 = root2->parent;
 
-					/* compress path from node2 to the root: */
-					ccv_ptree_node_t* node2 = node + j;
-					while(node2->parent)
-					{
-						ccv_ptree_node_t* temp = node2;
-						node2 = node2->parent;
-						temp->parent = root;
-					}
+	if(root2 != root)
+	{
+		if(root->rank > root2->rank)
+			root2->parent = root;
+		else
+		{
+			root->parent = root2;
+			root2->rank += root->rank == root2->rank;
+			root = root2;
+		}
 
-					/* compress path from node to the root: */
-					node2 = node + i;
-					while(node2->parent)
-					{
-						ccv_ptree_node_t* temp = node2;
-						node2 = node2->parent;
-						temp->parent = root;
-					}
-				}
-			}
+		/* compress path from node2 to the root: */
+		while(node2->parent)
+		{
+			ccv_ptree_node_t* temp = node2;
+			node2 = node2->parent;
+			temp->parent = root;
+		}
+
+		/* compress path from node to the root: */
+		node2 = node;
+		while(node2->parent)
+		{
+			ccv_ptree_node_t* temp = node2;
+			node2 = node2->parent;
+			temp->parent = root;
 		}
 	}
+	return root;
+}
+
+/* the class of every element into index, numbered in the order of their first elements, returns the number of classes */
+static int _ccv_ptree_index(ccv_ptree_node_t* node, int rnum, ccv_array_t** index)
+{
+	int i, j;
 	if (*index == 0)
-		*index = ccv_array_new(sizeof(int), array->rnum, 0);
+		*index = ccv_array_new(sizeof(int), rnum, 0);
 	else
 		ccv_array_clear(*index);
 	ccv_array_t* idx = *index;
 
 	int class_idx = 0;
-	for(i = 0; i < array->rnum; i++)
+	for(i = 0; i < rnum; i++)
 	{
 		j = -1;
 		ccv_ptree_node_t* node1 = node + i;
@@ -667,6 +681,103 @@ int ccv_array_group(ccv_array_t* array, ccv_array_t** index, ccv_array_group_f g
 		}
 		ccv_array_push(idx, &j);
 	}
+	return class_idx;
+}
+
+/* the code for grouping array is adopted from OpenCV's cvSeqPartition func, it is essentially a find-union algorithm */
+int ccv_array_group(ccv_array_t* array, ccv_array_t** index, ccv_array_group_f gfunc, void* data)
+{
+	int i, j;
+	ccv_ptree_node_t* node = _ccv_ptree_new(array);
+	for (i = 0; i < array->rnum; i++)
+	{
+		if (!node[i].element)
+			continue;
+		ccv_ptree_node_t* root = node + i;
+		while (root->parent)
+			root = root->parent;
+		for (j = 0; j < array->rnum; j++)
+			if( i != j && node[j].element && gfunc(node[i].element, node[j].element, data))
+				root = _ccv_ptree_union(node + i, root, node + j);
+	}
+	int class_idx = _ccv_ptree_index(node, array->rnum, index);
+	ccfree(node);
+	return class_idx;
+}
+
+typedef struct {
+	int band; // the band of rows the origin is in
+	int x;
+	int i;
+} ccv_array_group_origin_t;
+
+#define less_than(o1, o2, aux) ((o1).band < (o2).band || ((o1).band == (o2).band && (o1).x < (o2).x))
+static CCV_IMPLEMENT_QSORT(_ccv_array_group_origin_qsort, ccv_array_group_origin_t, less_than)
+#undef less_than
+
+int ccv_array_group_rect(ccv_array_t* array, ccv_array_t** index, ccv_array_group_f gfunc, void* data, double reach)
+{
+	int i, j, k;
+	ccv_ptree_node_t* node = _ccv_ptree_new(array);
+	/* the origins are put into bands of rows as tall as the farthest reach (or more, to have no more bands than
+	 * the elements), and sorted by x in a band, thus, the ones in reach of an origin are in 3 ranges at most */
+	int farthest = 0, miny = 0, maxy = 0;
+	for (i = 0; i < array->rnum; i++)
+	{
+		ccv_rect_t* rect = (ccv_rect_t*)node[i].element;
+		farthest = ccv_max(farthest, (int)(rect->width * reach + 0.5));
+		miny = i ? ccv_min(miny, rect->y) : rect->y;
+		maxy = i ? ccv_max(maxy, rect->y) : rect->y;
+	}
+	int height = ccv_max(farthest, (maxy - miny) / ccv_max(1, array->rnum)) + 1;
+	int bands = (maxy - miny) / height + 1;
+	ccv_array_group_origin_t* origin = (ccv_array_group_origin_t*)ccmalloc(ccv_max(1, array->rnum) * sizeof(ccv_array_group_origin_t) + (bands + 1) * sizeof(int));
+	int* band = (int*)(origin + ccv_max(1, array->rnum));
+	for (i = 0; i < array->rnum; i++)
+	{
+		ccv_rect_t* rect = (ccv_rect_t*)node[i].element;
+		origin[i].band = (rect->y - miny) / height;
+		origin[i].x = rect->x;
+		origin[i].i = i;
+	}
+	_ccv_array_group_origin_qsort(origin, array->rnum, 0);
+	/* the origins of a band b are in [band[b], band[b + 1]) */
+	for (i = 0, j = 0; i <= bands; i++)
+	{
+		while (j < array->rnum && origin[j].band < i)
+			++j;
+		band[i] = j;
+	}
+	for (i = 0; i < array->rnum; i++)
+	{
+		ccv_rect_t* rect = (ccv_rect_t*)node[i].element;
+		int distance = (int)(rect->width * reach + 0.5);
+		ccv_ptree_node_t* root = node + i;
+		while (root->parent)
+			root = root->parent;
+		for (k = ccv_max(0, (rect->y - distance - miny) / height); k <= ccv_min(bands - 1, (rect->y + distance - miny) / height); k++)
+		{
+			/* the first origin at or after rect->x - distance in the band */
+			int lo = band[k], hi = band[k + 1];
+			while (lo < hi)
+			{
+				int mid = (lo + hi) / 2;
+				if (origin[mid].x < rect->x - distance)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			for (j = lo; j < band[k + 1] && origin[j].x <= rect->x + distance; j++)
+			{
+				ccv_ptree_node_t* node2 = node + origin[j].i;
+				ccv_rect_t* rect2 = (ccv_rect_t*)node2->element;
+				if (origin[j].i != i && rect2->y >= rect->y - distance && rect2->y <= rect->y + distance && gfunc(node[i].element, node2->element, data))
+					root = _ccv_ptree_union(node + i, root, node2);
+			}
+		}
+	}
+	ccfree(origin);
+	int class_idx = _ccv_ptree_index(node, array->rnum, index);
 	ccfree(node);
 	return class_idx;
 }
@@ -5,7 +5,15 @@ static void _ccv_write_binary_fd(ccv_dense_matrix_t* mat, FILE* fd, void* conf)
 	fwrite(&ctype, 1, 4, fd);
 	fwrite(&(mat->rows), 1, 4, fd);
 	fwrite(&(mat->cols), 1, 4, fd);
-	fwrite(mat->data.u8, 1, mat->step * mat->rows, fd);
+	/* the rows are written with the step of an unaligned matrix, that is what the reader allocates */
+	int step = ccv_compute_dense_matrix_step(mat->cols, ctype);
+	if (step == mat->step)
+		fwrite(mat->data.u8, 1, mat->step * mat->rows, fd);
+	else {
+		int i;
+		for (i = 0; i < mat->rows; i++)
+			fwrite(mat->data.u8 + i * mat->step, 1, step, fd);
+	}
 	fflush(fd);
 }
 
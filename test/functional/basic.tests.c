@@ -1,6 +1,7 @@
 #include "ccv.h"
 #include "case.h"
 #include "ccv_case.h"
+#include <pthread.h>
 
 TEST_CASE("sobel operation")
 {
@@ -44,6 +45,46 @@ TEST_CASE("resample operation of CCV_INTER_AREA")
 	ccv_matrix_free(x);
 }
 
+TEST_CASE("resample operation of CCV_INTER_LINEAR, CCV_INTER_CUBIC and CCV_INTER_LANCZOS")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/chessbox.png", &image, CCV_IO_ANY_FILE);
+	ccv_dense_matrix_t* f = 0;
+	ccv_shift(image, (ccv_matrix_t**)&f, CCV_32F, 0, 0);
+	ccv_dense_matrix_t* flat = ccv_dense_matrix_new(13, 17, CCV_8U | CCV_C3, 0, 0);
+	memset(flat->data.u8, 77, flat->rows * flat->step);
+	int types[] = { CCV_INTER_LINEAR, CCV_INTER_CUBIC, CCV_INTER_LANCZOS };
+	int t, i, j;
+	for (t = 0; t < 3; t++)
+	{
+		ccv_dense_matrix_t* x = 0;
+		ccv_resample(image, &x, 0, image->rows * 3 / 2, image->cols * 3 / 2 + 1, types[t]);
+		ccv_dense_matrix_t* y = 0;
+		ccv_resample(f, &y, 0, image->rows * 3 / 2, image->cols * 3 / 2 + 1, types[t]);
+		int maxd = 0;
+		for (i = 0; i < x->rows; i++)
+			for (j = 0; j < x->cols * CCV_GET_CHANNEL(x->type); j++)
+			{
+				int v = (int)(ccv_clamp(y->data.f32[i * y->cols * CCV_GET_CHANNEL(y->type) + j], 0, 255) + 0.5);
+				maxd = ccv_max(maxd, abs(x->data.u8[i * x->step + j] - v));
+			}
+		REQUIRE(maxd <= 1, "the fixed-point 8u result should be within 1 of the float one");
+		ccv_dense_matrix_t* z = 0;
+		ccv_resample(flat, &z, 0, 31, 7, types[t]);
+		int same = 1;
+		for (i = 0; i < z->rows; i++)
+			for (j = 0; j < z->cols * 3; j++)
+				same &= (z->data.u8[i * z->step + j] == 77);
+		REQUIRE(same, "a flat image should stay flat");
+		ccv_matrix_free(x);
+		ccv_matrix_free(y);
+		ccv_matrix_free(z);
+	}
+	ccv_matrix_free(flat);
+	ccv_matrix_free(image);
+	ccv_matrix_free(f);
+}
+
 TEST_CASE("sample down operation with source offset (10, 10)")
 {
 	ccv_dense_matrix_t* image = 0;
@@ -55,6 +96,28 @@ TEST_CASE("sample down operation with source offset (10, 10)")
 	ccv_matrix_free(x);
 }
 
+TEST_CASE("sample down all 4 phases in one pass")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/nature.png", &image, CCV_IO_GRAY | CCV_IO_ANY_FILE);
+	ccv_dense_matrix_t* x[4] = { 0 };
+	ccv_sample_down_phases(image, x, 0);
+	int i;
+	for (i = 0; i < 4; i++)
+	{
+		/* the 32s output doesn't take the 8u path, but has the same values */
+		ccv_dense_matrix_t* y = 0;
+		ccv_sample_down(image, &y, CCV_32S, i & 1, i >> 1);
+		ccv_dense_matrix_t* z = 0;
+		ccv_shift(y, (ccv_matrix_t**)&z, CCV_8U, 0, 0);
+		REQUIRE_MATRIX_EQ(x[i], z, "the phase should be the same as the one sampled down alone");
+		ccv_matrix_free(x[i]);
+		ccv_matrix_free(y);
+		ccv_matrix_free(z);
+	}
+	ccv_matrix_free(image);
+}
+
 TEST_CASE("sample up operation with source offset (10, 10)")
 {
 	ccv_dense_matrix_t* image = 0;
@@ -66,6 +129,29 @@ TEST_CASE("sample up operation with source offset (10, 10)")
 	ccv_matrix_free(x);
 }
 
+TEST_CASE("image pyramid levels computed on demand")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/chessbox.png", &image, CCV_IO_ANY_FILE);
+	ccv_pyramid_t* pyramid = ccv_pyramid_new(image, 2);
+	/* level 7 is level 1 sampled down twice, the last time with source offset (1, 1) */
+	ccv_dense_matrix_t* x = ccv_pyramid_level(pyramid, 7, 1, 1);
+	double scale = pow(2., 1. / 3.);
+	ccv_dense_matrix_t* y = 0;
+	ccv_resample(image, &y, 0, (int)(image->rows / scale), (int)(image->cols / scale), CCV_INTER_AREA);
+	ccv_dense_matrix_t* z = 0;
+	ccv_sample_down(y, &z, 0, 0, 0);
+	ccv_matrix_free(y);
+	y = 0;
+	ccv_sample_down(z, &y, 0, 1, 1);
+	REQUIRE_MATRIX_EQ(x, y, "pyramid level 7 should be the same as resample once and sample down twice");
+	REQUIRE(ccv_pyramid_level(pyramid, 4, 0, 0) == pyramid->level[4 * 4], "level 4 is computed on the way to level 7 and should be reused");
+	ccv_pyramid_free(pyramid);
+	ccv_matrix_free(image);
+	ccv_matrix_free(y);
+	ccv_matrix_free(z);
+}
+
 TEST_CASE("blur operation with sigma 10")
 {
 	ccv_dense_matrix_t* image = 0;
@@ -77,6 +163,30 @@ TEST_CASE("blur operation with sigma 10")
 	ccv_matrix_free(x);
 }
 
+TEST_CASE("recursive blur operation approximates the direct one")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/nature.png", &image, CCV_IO_GRAY | CCV_IO_ANY_FILE);
+	ccv_dense_matrix_t* x = 0;
+	ccv_blur(image, &x, CCV_32F, 10);
+	ccv_dense_matrix_t* y = 0;
+	ccv_blur_iir(image, &y, CCV_32F, 10);
+	int i, j;
+	double sum = 0, max = 0;
+	for (i = 0; i < x->rows; i++)
+		for (j = 0; j < x->cols; j++)
+		{
+			double d = fabs(x->data.f32[i * x->cols + j] - y->data.f32[i * y->cols + j]);
+			sum += d;
+			max = ccv_max(max, d);
+		}
+	REQUIRE(sum / (x->rows * x->cols) < 1, "the recursive filter should be within 1 on average to the direct one");
+	REQUIRE(max < 8, "the recursive filter should be within 8 everywhere to the direct one, borders included");
+	ccv_matrix_free(image);
+	ccv_matrix_free(x);
+	ccv_matrix_free(y);
+}
+
 TEST_CASE("flip operation")
 {
 	ccv_dense_matrix_t* image = 0;
@@ -107,6 +217,90 @@ TEST_CASE("canny edge detector")
 	ccv_matrix_free(x);
 }
 
+TEST_CASE("per-pixel kernels split into bands on more threads")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/nature.png", &image, CCV_IO_ANY_FILE);
+	ccv_dense_matrix_t* gray = 0;
+	ccv_read("../../samples/nature.png", &gray, CCV_IO_GRAY | CCV_IO_ANY_FILE);
+	ccv_dense_matrix_t* x[5] = {0};
+	ccv_dense_matrix_t* y[5] = {0};
+	ccv_sobel(image, &x[0], 0, 3, 0);
+	ccv_sobel(image, &x[1], CCV_32F, 0, 5);
+	ccv_blur(image, &x[2], 0, 1.6);
+	ccv_hog(image, &x[3], 0, 9, 8);
+	ccv_canny(gray, &x[4], 0, 3, 36, 36 * 3);
+	ccv_set_num_threads(4);
+	REQUIRE_EQ(ccv_get_num_threads(), 4, "should run on 4 threads");
+	ccv_sobel(image, &y[0], 0, 3, 0);
+	ccv_sobel(image, &y[1], CCV_32F, 0, 5);
+	ccv_blur(image, &y[2], 0, 1.6);
+	ccv_hog(image, &y[3], 0, 9, 8);
+	ccv_canny(gray, &y[4], 0, 3, 36, 36 * 3);
+	ccv_set_num_threads(1);
+	int i;
+	for (i = 0; i < 5; i++)
+	{
+		REQUIRE_MATRIX_EQ(x[i], y[i], "the result of kernel %d should be the same on 4 threads", i);
+		ccv_matrix_free(x[i]);
+		ccv_matrix_free(y[i]);
+	}
+	ccv_matrix_free(image);
+	ccv_matrix_free(gray);
+}
+
+static void* num_threads_switcher(void* arg)
+{
+	int i;
+	for (i = 0; i < 200; i++)
+		ccv_set_num_threads(i % 2 ? 1 : 4);
+	return 0;
+}
+
+TEST_CASE("per-pixel kernels while another thread changes the number of threads")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/nature.png", &image, CCV_IO_ANY_FILE);
+	ccv_dense_matrix_t* x = 0;
+	ccv_blur(image, &x, 0, 1.6);
+	/* every blur is computed, not picked up from the cache */
+	ccv_disable_cache();
+	pthread_t thread;
+	pthread_create(&thread, 0, num_threads_switcher, 0);
+	int i, mismatch = 0;
+	for (i = 0; i < 20; i++)
+	{
+		ccv_dense_matrix_t* y = 0;
+		ccv_blur(image, &y, 0, 1.6);
+		mismatch += !!memcmp(x->data.u8, y->data.u8, x->step * x->rows);
+		ccv_matrix_free(y);
+	}
+	pthread_join(thread, 0);
+	ccv_set_num_threads(1);
+	ccv_enable_default_cache();
+	REQUIRE_EQ(mismatch, 0, "the blur should be the same however many threads it runs on");
+	ccv_matrix_free(x);
+	ccv_matrix_free(image);
+}
+
+TEST_CASE("hog of an 8-bit image against the one of its floating-point copy")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/nature.png", &image, CCV_IO_ANY_FILE);
+	ccv_dense_matrix_t* fimage = 0;
+	ccv_shift(image, (ccv_matrix_t**)&fimage, CCV_32F, 0, 0);
+	ccv_dense_matrix_t* x = 0;
+	ccv_hog(image, &x, 0, 9, 8);
+	ccv_dense_matrix_t* y = 0;
+	ccv_hog(fimage, &y, 0, 9, 8);
+	REQUIRE_EQ(x->rows * x->cols * CCV_GET_CHANNEL(x->type), y->rows * y->cols * CCV_GET_CHANNEL(y->type), "should have the same size");
+	REQUIRE_ARRAY_EQ_WITH_TOLERANCE(float, x->data.f32, y->data.f32, x->rows * x->cols * CCV_GET_CHANNEL(x->type), 1e-5, "the fused 8-bit path should compute the same features");
+	ccv_matrix_free(image);
+	ccv_matrix_free(fimage);
+	ccv_matrix_free(x);
+	ccv_matrix_free(y);
+}
+
 TEST_CASE("otsu threshold")
 {
 	ccv_dense_matrix_t* image = ccv_dense_matrix_new(6, 6, CCV_32S | CCV_C1, 0, 0);
@@ -0,0 +1,96 @@
+#include "ccv.h"
+#include "case.h"
+#include "ccv_case.h"
+
+/* bbf tests are functional tests on the face cascade in samples:
+ * 1. the detection on more threads finds the same windows in the same order as the detection on one thread;
+ * 2. the compiled cascade is kept on the cascade, and the later detections on the same steps reuse it */
+
+static void _bbf_detect_on_threads(ccv_dense_matrix_t* image, ccv_bbf_classifier_cascade_t* cascade, ccv_bbf_param_t params, int threads, ccv_array_t** seq)
+{
+	ccv_set_num_threads(threads);
+	*seq = ccv_bbf_detect_objects(image, &cascade, 1, params);
+	ccv_set_num_threads(1);
+}
+
+TEST_CASE("bbf detection on 4 threads v.s. on 1 thread")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/nature.png", &image, CCV_IO_GRAY | CCV_IO_ANY_FILE);
+	ccv_bbf_classifier_cascade_t* cascade = ccv_load_bbf_classifier_cascade("../../samples/face");
+	ccv_bbf_param_t params = ccv_bbf_default_params;
+	int min_neighbors[] = {0, ccv_bbf_default_params.min_neighbors};
+	int i, k;
+	for (k = 0; k < 2; k++)
+	{
+		/* without the grouping, these are all the windows the scan found, in the order of the scan */
+		params.min_neighbors = min_neighbors[k];
+		ccv_array_t* x = 0;
+		_bbf_detect_on_threads(image, cascade, params, 1, &x);
+		ccv_array_t* y = 0;
+		_bbf_detect_on_threads(image, cascade, params, 4, &y);
+		REQUIRE(x->rnum > 0, "should find windows with min_neighbors %d", min_neighbors[k]);
+		REQUIRE_EQ(x->rnum, y->rnum, "should find the same number of windows with min_neighbors %d", min_neighbors[k]);
+		for (i = 0; i < x->rnum; i++)
+		{
+			ccv_comp_t* cx = (ccv_comp_t*)ccv_array_get(x, i);
+			ccv_comp_t* cy = (ccv_comp_t*)ccv_array_get(y, i);
+			REQUIRE(cx->rect.x == cy->rect.x && cx->rect.y == cy->rect.y && cx->rect.width == cy->rect.width && cx->rect.height == cy->rect.height, "the window %d should be at the same place with min_neighbors %d", i, min_neighbors[k]);
+			REQUIRE_EQ(cx->neighbors, cy->neighbors, "the window %d should have the same neighbors with min_neighbors %d", i, min_neighbors[k]);
+			REQUIRE_EQ_WITH_TOLERANCE(cx->confidence, cy->confidence, 1e-6, "the window %d should have the same confidence with min_neighbors %d", i, min_neighbors[k]);
+		}
+		ccv_array_free(x);
+		ccv_array_free(y);
+	}
+	ccv_bbf_classifier_cascade_free(cascade);
+	ccv_matrix_free(image);
+}
+
+static int _bbf_same_windows(ccv_array_t* x, ccv_array_t* y)
+{
+	if (x->rnum != y->rnum)
+		return 0;
+	int i;
+	for (i = 0; i < x->rnum; i++)
+	{
+		ccv_comp_t* cx = (ccv_comp_t*)ccv_array_get(x, i);
+		ccv_comp_t* cy = (ccv_comp_t*)ccv_array_get(y, i);
+		if (cx->rect.x != cy->rect.x || cx->rect.y != cy->rect.y || cx->rect.width != cy->rect.width || cx->rect.height != cy->rect.height || cx->neighbors != cy->neighbors || cx->confidence != cy->confidence)
+			return 0;
+	}
+	return 1;
+}
+
+TEST_CASE("bbf detection reuses the compiled cascade on the same steps")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/nature.png", &image, CCV_IO_GRAY | CCV_IO_ANY_FILE);
+	ccv_bbf_classifier_cascade_t* cascade = ccv_load_bbf_classifier_cascade("../../samples/face");
+	REQUIRE(cascade->compiled == 0, "should compile the cascade only when it detects");
+	ccv_array_t* x = ccv_bbf_detect_objects(image, &cascade, 1, ccv_bbf_default_params);
+	void* compiled = cascade->compiled;
+	REQUIRE(compiled != 0, "should keep the compiled cascade on the cascade");
+	/* the compiled cascade is not allocated within the arena, thus, it is still there after the scope */
+	ccv_arena_begin();
+	ccv_array_t* y = ccv_bbf_detect_objects(image, &cascade, 1, ccv_bbf_default_params);
+	REQUIRE(_bbf_same_windows(x, y), "should find the same windows with the compiled cascade reused");
+	ccv_arena_end();
+	REQUIRE(cascade->compiled == compiled, "should reuse the compiled cascade on the same steps");
+	/* a narrower image has other steps, and the ones compiled for the wider image are kept along */
+	ccv_dense_matrix_t* narrow = 0;
+	ccv_slice(image, (ccv_matrix_t**)&narrow, 0, 0, 0, image->rows, image->cols / 2);
+	ccv_array_t* z = ccv_bbf_detect_objects(narrow, &cascade, 1, ccv_bbf_default_params);
+	ccv_array_free(z);
+	REQUIRE(cascade->compiled != compiled, "should compile the cascade for the steps of the narrower image");
+	compiled = cascade->compiled;
+	y = ccv_bbf_detect_objects(image, &cascade, 1, ccv_bbf_default_params);
+	REQUIRE(_bbf_same_windows(x, y), "should find the same windows after the cascade is compiled for other steps");
+	REQUIRE(cascade->compiled == compiled, "should not compile the cascade again for the steps of the wider image");
+	ccv_array_free(x);
+	ccv_array_free(y);
+	ccv_matrix_free(narrow);
+	ccv_bbf_classifier_cascade_free(cascade);
+	ccv_matrix_free(image);
+}
+
+#include "case_main.h"
@@ -0,0 +1,199 @@
+#include "ccv.h"
+#include "case.h"
+#include "ccv_case.h"
+#include "ccv_internal.h"
+
+/* dpm tests are functional tests on the model files in samples:
+ * 1. the star-cascade thresholds of a model survive the save and load, in the text and in the binary format,
+ *    and a truncated or corrupted binary model is not loaded;
+ * 2. the detection with the filters correlated in the frequency domain finds the same roots and parts as the one
+ *    with the filters correlated directly;
+ * 3. the detection on more threads finds the same roots and parts in the same order as the detection on one thread */
+
+static void _dpm_set_partial_cascade(ccv_dpm_mixture_model_t* model)
+{
+	int i, j;
+	/* the first root has no cascade, the thresholds of the others are distinct */
+	for (i = 0; i < model->count; i++)
+		for (j = 0; j < CCV_DPM_PART_MAX + 1; j++)
+			model->root[i].cascade[j] = (i > 0 && j <= model->root[i].count) ? i * 10 + j * 0.25 : -FLT_MAX;
+}
+
+static char* _dpm_temp_file(char* filename)
+{
+	strcpy(filename, "/tmp/ccv-dpm-XXXXXX");
+	int fd = mkstemp(filename);
+	if (fd < 0)
+		return 0;
+	close(fd);
+	return filename;
+}
+
+TEST_CASE("star-cascade thresholds of a partial cascade survive the save and load in the text format")
+{
+	ccv_dpm_mixture_model_t* model = ccv_load_dpm_mixture_model("../../samples/car.m");
+	REQUIRE(model->count > 1, "should have more than one root to have a partial cascade");
+	_dpm_set_partial_cascade(model);
+	char filename[32];
+	REQUIRE(_dpm_temp_file(filename) != 0, "should create a temporary file");
+	/* the model file without the thresholds, and then the thresholds as the training writes them, a row of every root */
+	FILE* r = fopen("../../samples/car.m", "r");
+	FILE* w = fopen(filename, "w");
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), r)) > 0)
+		fwrite(buf, 1, len, w);
+	fclose(r);
+	fprintf(w, "\n");
+	int i, j;
+	for (i = 0; i < model->count; i++)
+	{
+		for (j = 0; j <= model->root[i].count; j++)
+			fprintf(w, "%a ", model->root[i].cascade[j]);
+		fprintf(w, "\n");
+	}
+	fclose(w);
+	ccv_dpm_mixture_model_t* loaded = ccv_load_dpm_mixture_model(filename);
+	unlink(filename);
+	REQUIRE_EQ(loaded->count, model->count, "should load the same number of roots");
+	for (i = 0; i < model->count; i++)
+		REQUIRE_ARRAY_EQ(float, loaded->root[i].cascade, model->root[i].cascade, CCV_DPM_PART_MAX + 1, "the thresholds of root %d should be loaded back to the same root", i);
+	ccv_dpm_mixture_model_free(loaded);
+	ccv_dpm_mixture_model_free(model);
+}
+
+TEST_CASE("star-cascade thresholds of a partial cascade survive the save and load in the binary format")
+{
+	ccv_dpm_mixture_model_t* model = ccv_load_dpm_mixture_model("../../samples/car.m");
+	_dpm_set_partial_cascade(model);
+	char filename[32];
+	REQUIRE(_dpm_temp_file(filename) != 0, "should create a temporary file");
+	REQUIRE_EQ(ccv_dpm_mixture_model_write_binary(model, filename), 0, "should write the binary model");
+	ccv_dpm_mixture_model_t* loaded = ccv_load_dpm_mixture_model(filename);
+	unlink(filename);
+	REQUIRE(loaded != 0, "should load the binary model");
+	REQUIRE_EQ(loaded->count, model->count, "should load the same number of roots");
+	int i;
+	for (i = 0; i < model->count; i++)
+		REQUIRE_ARRAY_EQ(float, loaded->root[i].cascade, model->root[i].cascade, CCV_DPM_PART_MAX + 1, "the thresholds of root %d should be loaded back to the same root", i);
+	ccv_dpm_mixture_model_free(loaded);
+	ccv_dpm_mixture_model_free(model);
+}
+
+TEST_CASE("truncated or corrupted binary model is not loaded")
+{
+	ccv_dpm_mixture_model_t* model = ccv_load_dpm_mixture_model("../../samples/car.m");
+	char filename[32];
+	REQUIRE(_dpm_temp_file(filename) != 0, "should create a temporary file");
+	REQUIRE_EQ(ccv_dpm_mixture_model_write_binary(model, filename), 0, "should write the binary model");
+	int model_count = model->count;
+	ccv_dpm_mixture_model_free(model);
+	FILE* r = fopen(filename, "rb");
+	fseek(r, 0, SEEK_END);
+	size_t size = ftell(r);
+	rewind(r);
+	unsigned char* data = (unsigned char*)ccmalloc(size);
+	REQUIRE_EQ(fread(data, 1, size, r), size, "should read the binary model back");
+	fclose(r);
+	/* the header is 32 bytes with the number of roots at 12, the first root follows with its part count after the
+	 * record of its filter (24 bytes) */
+	REQUIRE_EQ(*(uint32_t*)(data + 12), model_count, "should have the roots of the model in the header");
+	int32_t* count = (int32_t*)(data + 32 + 24);
+	int32_t original = *count;
+	/* the part counts of the first root that would overflow the sum, or point the parts backwards */
+	int32_t counts[] = {0x7fffffff, -1, CCV_DPM_PART_MAX + 1};
+	int i;
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+	{
+		*count = counts[i];
+		FILE* w = fopen(filename, "wb");
+		fwrite(data, 1, size, w);
+		fclose(w);
+		REQUIRE(ccv_load_dpm_mixture_model(filename) == 0, "should not load the binary model with %d parts on the first root", counts[i]);
+	}
+	*count = original;
+	/* the file cut in the middle */
+	FILE* w = fopen(filename, "wb");
+	fwrite(data, 1, size / 2, w);
+	fclose(w);
+	REQUIRE(ccv_load_dpm_mixture_model(filename) == 0, "should not load the truncated binary model");
+	unlink(filename);
+	ccfree(data);
+}
+
+/* the first root of x that is not the same as the one of y, -1 if there is none */
+static int _dpm_first_different_root(ccv_array_t* x, ccv_array_t* y, double tolerance)
+{
+	int i, j;
+	for (i = 0; i < ccv_min(x->rnum, y->rnum); i++)
+	{
+		ccv_root_comp_t* cx = (ccv_root_comp_t*)ccv_array_get(x, i);
+		ccv_root_comp_t* cy = (ccv_root_comp_t*)ccv_array_get(y, i);
+		if (cx->rect.x != cy->rect.x || cx->rect.y != cy->rect.y || cx->rect.width != cy->rect.width || cx->rect.height != cy->rect.height ||
+			fabs(cx->confidence - cy->confidence) > tolerance || cx->pnum != cy->pnum)
+			return i;
+		for (j = 0; j < cx->pnum; j++)
+			if (cx->part[j].rect.x != cy->part[j].rect.x || cx->part[j].rect.y != cy->part[j].rect.y)
+				return i;
+	}
+	return x->rnum == y->rnum ? -1 : i;
+}
+
+TEST_CASE("dpm detection with the filters in the frequency domain v.s. without")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/street.png", &image, CCV_IO_ANY_FILE);
+	ccv_dpm_mixture_model_t* model = ccv_load_dpm_mixture_model("../../samples/pedestrian.m");
+	ccv_dpm_param_t params = ccv_dpm_default_params;
+	/* a low threshold and no grouping, thus, many roots to compare, the levels of the pyramid go from the ones of
+	 * many large tiles (with the last ones partial) down to the ones of a small tile */
+	params.threshold = -0.5;
+	params.min_neighbors = 0;
+	int flags[] = {0, CCV_DPM_CASCADE};
+	int k;
+	REQUIRE(model->spectrum == 0, "should not compute the spectra of the filters on load");
+	for (k = 0; k < 2; k++)
+	{
+		params.flags = flags[k];
+		ccv_array_t* x = ccv_dpm_detect_objects(image, &model, 1, params);
+		REQUIRE(model->spectrum != 0, "should compute the spectra of the filters on the first detection");
+		ccv_dpm_set_spectrum(0);
+		ccv_array_t* y = ccv_dpm_detect_objects(image, &model, 1, params);
+		ccv_dpm_set_spectrum(1);
+		REQUIRE(x->rnum > 0, "should find roots with the flags %d", flags[k]);
+		REQUIRE_EQ(_dpm_first_different_root(x, y, 1e-3), -1, "should find the same roots and parts without the frequency domain with the flags %d", flags[k]);
+		ccv_array_free(x);
+		ccv_array_free(y);
+	}
+	ccv_dpm_mixture_model_free(model);
+	ccv_matrix_free(image);
+}
+
+TEST_CASE("dpm detection on 4 threads v.s. on 1 thread")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/street.png", &image, CCV_IO_ANY_FILE);
+	ccv_dpm_mixture_model_t* model = ccv_load_dpm_mixture_model("../../samples/pedestrian.m");
+	ccv_dpm_param_t params = ccv_dpm_default_params;
+	/* a low threshold and no grouping, thus, many roots to compare */
+	params.threshold = -0.5;
+	params.min_neighbors = 0;
+	int flags[] = {0, CCV_DPM_CASCADE};
+	int k;
+	for (k = 0; k < 2; k++)
+	{
+		params.flags = flags[k];
+		ccv_array_t* x = ccv_dpm_detect_objects(image, &model, 1, params);
+		ccv_set_num_threads(4);
+		ccv_array_t* y = ccv_dpm_detect_objects(image, &model, 1, params);
+		ccv_set_num_threads(1);
+		REQUIRE(x->rnum > 0, "should find roots with the flags %d", flags[k]);
+		REQUIRE_EQ(_dpm_first_different_root(x, y, 1e-6), -1, "should find the same roots and parts on 4 threads with the flags %d", flags[k]);
+		ccv_array_free(x);
+		ccv_array_free(y);
+	}
+	ccv_dpm_mixture_model_free(model);
+	ccv_matrix_free(image);
+}
+
+#include "case_main.h"
@@ -1,5 +1,7 @@
 #include "ccv.h"
 #include "case.h"
+#include "ccv_case.h"
+#include <pthread.h>
 
 uint64_t uniqid()
 {
@@ -70,6 +72,36 @@ TEST_CASE("random cache put/delete/get")
 	ccfree(sigs);
 }
 
+TEST_CASE("xxhash signature")
+{
+	ccv_set_signature_hash(CCV_SIGNATURE_XXHASH);
+	REQUIRE_EQ(0xEF46DB3751D8E999ULL, ccv_cache_generate_signature("", 0, 0), "xxHash64 of empty string");
+	REQUIRE_EQ(0x44BC2CF5AD770999ULL, ccv_cache_generate_signature("abc", 3, 0), "xxHash64 of abc");
+	uint64_t sig = ccv_cache_generate_signature("abc", 3, 0);
+	REQUIRE(ccv_cache_generate_signature("abc", 3, sig, 0) != sig, "derived signature should differ from its origin");
+	REQUIRE(ccv_cache_generate_signature("abc", 3, sig, 1, 0) != ccv_cache_generate_signature("abc", 3, 1, sig, 0), "the order of the signatures it derived from matters");
+	ccv_set_signature_hash(CCV_SIGNATURE_SHA1);
+}
+
+TEST_CASE("cache evicts the oldest put first")
+{
+	ccv_cache_t cache;
+	ccv_cache_init(&cache, 4, 1, ccfree);
+	int i;
+	for (i = 0; i < 4; i++)
+		ccv_cache_put(&cache, i + 1, ccmalloc(1), 1, 0);
+	// take out 1 and put it back, and put 2 again, thus, 3 is the oldest and 4 is the next
+	void* x = ccv_cache_out(&cache, 1, 0);
+	ccv_cache_put(&cache, 1, x, 1, 0);
+	ccv_cache_put(&cache, 2, ccmalloc(1), 1, 0);
+	ccv_cache_put(&cache, 5, ccmalloc(1), 1, 0);
+	REQUIRE_EQ(0, (uint64_t)ccv_cache_get(&cache, 3, 0), "3 should be evicted");
+	ccv_cache_put(&cache, 6, ccmalloc(1), 1, 0);
+	REQUIRE_EQ(0, (uint64_t)ccv_cache_get(&cache, 4, 0), "4 should be evicted");
+	REQUIRE(ccv_cache_get(&cache, 1, 0) && ccv_cache_get(&cache, 2, 0) && ccv_cache_get(&cache, 5, 0) && ccv_cache_get(&cache, 6, 0), "1, 2, 5, 6 should stay");
+	ccv_cache_close(&cache);
+}
+
 TEST_CASE("garbage collector 95\% hit rate")
 {
 	int i;
@@ -172,4 +204,258 @@ TEST_CASE("multi-type garbage collector 92\% hit rate")
 	ccv_disable_cache();
 }
 
+static void* shared_cache_producer(void* arg)
+{
+	int i;
+	for (i = 0; i < N / 10; i++)
+	{
+		ccv_dense_matrix_t* dmt = ccv_dense_matrix_new(1, 1, CCV_32S | CCV_C1, 0, 0);
+		dmt->data.i32[0] = i;
+		dmt->sig = ccv_cache_generate_signature((const char*)&i, 4, 0);
+		dmt->type |= CCV_REUSABLE;
+		ccv_matrix_free(dmt);
+	}
+	return 0;
+}
+
+static void* shared_cache_consumer(void* arg)
+{
+	int i, j, *mismatch = (int*)arg;
+	for (j = 0; j < 4; j++)
+		for (i = 0; i < N / 10; i++)
+		{
+			uint64_t sig = ccv_cache_generate_signature((const char*)&i, 4, 0);
+			ccv_dense_matrix_t* dmt = ccv_dense_matrix_new(1, 1, CCV_32S | CCV_C1, 0, sig);
+			if ((dmt->type & CCV_GARBAGE) && dmt->data.i32[0] != i)
+				++*mismatch;
+			dmt->data.i32[0] = i;
+			ccv_matrix_free(dmt);
+		}
+	return 0;
+}
+
+static void* disable_cache_worker(void* arg)
+{
+	ccv_disable_cache();
+	return 0;
+}
+
+TEST_CASE("shared cache across threads")
+{
+	int i;
+	ccv_enable_shared_cache((sizeof(ccv_dense_matrix_t) + 4) * N);
+	pthread_t thread[4];
+	// the matrices freed in one thread are picked up by another
+	pthread_create(thread, 0, shared_cache_producer, 0);
+	pthread_join(thread[0], 0);
+	// a thread that disables its own cache leaves the shared one alone
+	pthread_create(thread, 0, disable_cache_worker, 0);
+	pthread_join(thread[0], 0);
+	int percent = 0, total = 0;
+	for (i = N / 10 - 1; i >= 0; i--)
+	{
+		uint64_t sig = ccv_cache_generate_signature((const char*)&i, 4, 0);
+		ccv_dense_matrix_t* dmt = ccv_dense_matrix_new(1, 1, CCV_32S | CCV_C1, 0, sig);
+		if (i == dmt->data.i32[0])
+			++percent;
+		++total;
+		ccv_matrix_free_immediately(dmt);
+	}
+	REQUIRE((double)percent / (double)total > 0.95, "the cache hit (%lf) should be greater than 95%%", (double)percent / (double)total);
+	// and many threads take out and put back the same signatures at the same time
+	int mismatch[4] = {0};
+	for (i = 0; i < 4; i++)
+		pthread_create(thread + i, 0, shared_cache_consumer, mismatch + i);
+	for (i = 0; i < 4; i++)
+		pthread_join(thread[i], 0);
+	REQUIRE_EQ(0, mismatch[0] + mismatch[1] + mismatch[2] + mismatch[3], "matrices from the shared cache should carry their own data");
+	ccv_disable_shared_cache();
+}
+
+static void* cache_stats_worker(void* arg)
+{
+	int i;
+	ccv_enable_default_cache();
+	for (i = 0; i < 100; i++)
+	{
+		ccv_dense_matrix_t* dmt = ccv_dense_matrix_new(1, 1, CCV_32S | CCV_C1, 0, 0);
+		dmt->sig = ccv_cache_generate_signature((const char*)&i, 4, 0);
+		dmt->type |= CCV_REUSABLE;
+		ccv_matrix_free(dmt);
+	}
+	return 0;
+}
+
+TEST_CASE("cache statistics per thread and in aggregate")
+{
+	int i;
+	ccv_cache_stats_t before;
+	ccv_cache_stats(&before, 1);
+	// room for 10 matrices only
+	ccv_enable_cache((sizeof(ccv_dense_matrix_t) + 4) * 10);
+	for (i = 0; i < 20; i++)
+	{
+		ccv_dense_matrix_t* dmt = ccv_dense_matrix_new(1, 1, CCV_32S | CCV_C1, 0, 0);
+		dmt->sig = ccv_cache_generate_signature((const char*)&i, 4, 0);
+		dmt->type |= CCV_REUSABLE;
+		ccv_matrix_free(dmt);
+	}
+	for (i = 0; i < 20; i++)
+	{
+		uint64_t sig = ccv_cache_generate_signature((const char*)&i, 4, 0);
+		ccv_dense_matrix_t* dmt = ccv_dense_matrix_new(1, 1, CCV_32S | CCV_C1, 0, sig);
+		ccv_matrix_free_immediately(dmt);
+	}
+	ccv_cache_stats_t stats;
+	ccv_cache_stats(&stats, 0);
+	REQUIRE_EQ(20, stats.puts, "should put 20 matrices");
+	REQUIRE_EQ(10, stats.evictions, "should evict the 10 older matrices");
+	REQUIRE_EQ(10 * (sizeof(ccv_dense_matrix_t) + 4), stats.evicted_bytes, "should evict the bytes of 10 matrices");
+	REQUIRE_EQ(20, stats.lookups, "should look up 20 matrices");
+	REQUIRE_EQ(10, stats.hits, "should find the 10 newer matrices");
+	uint64_t total = 0;
+	for (i = 0; i < CCV_CACHE_STATS_BINS; i++)
+		total += stats.size[i];
+	REQUIRE_EQ(20, total, "size histogram should count every put");
+	pthread_t thread;
+	pthread_create(&thread, 0, cache_stats_worker, 0);
+	pthread_join(thread, 0);
+	ccv_cache_stats_t after;
+	ccv_cache_stats(&after, 1);
+	REQUIRE_EQ(before.puts + 120, after.puts, "aggregate should count the puts of this and the exited thread");
+	ccv_disable_cache();
+}
+
+TEST_CASE("arena reuses freed blocks and releases the rest at the end")
+{
+	ccv_enable_default_cache();
+	ccv_cache_stats_t before;
+	ccv_cache_stats(&before, 0);
+	ccv_arena_begin();
+	ccv_dense_matrix_t* a = ccv_dense_matrix_new(10, 10, CCV_32S | CCV_C1, 0, 0);
+	a->sig = ccv_cache_generate_signature("arena", 5, 0);
+	a->type |= CCV_REUSABLE;
+	ccv_matrix_free(a);
+	ccv_dense_matrix_t* b = ccv_dense_matrix_new(10, 10, CCV_32S | CCV_C1, 0, 0);
+	REQUIRE(a == b, "the block freed within the arena should be reused");
+	ccv_matrix_free(b);
+	int i;
+	int* x = (int*)ccmalloc(sizeof(int) * 4);
+	for (i = 0; i < 4; i++)
+		x[i] = i;
+	x = (int*)ccrealloc(x, sizeof(int) * 1000000); // grows into a region of its own
+	for (i = 4; i < 1000000; i++)
+		x[i] = i;
+	int match = 1;
+	for (i = 0; i < 1000000; i++)
+		match &= (x[i] == i);
+	REQUIRE(match, "realloc within the arena should keep the data");
+	ccv_array_t* seq = ccv_array_new(sizeof(int), 2, 0);
+	for (i = 0; i < 1000; i++)
+		ccv_array_push(seq, &i);
+	REQUIRE_EQ(999, *(int*)ccv_array_get(seq, 999), "array should grow within the arena");
+	ccv_arena_end();
+	ccv_cache_stats_t stats;
+	ccv_cache_stats(&stats, 0);
+	REQUIRE_EQ(before.puts, stats.puts, "nothing allocated within the arena should be put in the cache");
+	ccv_dense_matrix_t* c = ccv_dense_matrix_new(10, 10, CCV_32S | CCV_C1, 0, 0);
+	ccv_matrix_free(c);
+	ccv_disable_cache();
+}
+
+static void* arena_free_worker(void* arg)
+{
+	int i;
+	// the memory of the system allocator is freed, the block of the other thread's arena is left alone
+	for (i = 0; i < 1000; i++)
+	{
+		void* x = ccmalloc(i * 64 + 1);
+		ccfree(x);
+	}
+	ccfree(arg);
+	return 0;
+}
+
+TEST_CASE("ccfree on other threads while a thread is within an arena")
+{
+	ccv_arena_begin();
+	int i;
+	int* x = (int*)ccmalloc(sizeof(int) * 1000);
+	for (i = 0; i < 1000; i++)
+		x[i] = i;
+	pthread_t thread[4];
+	for (i = 0; i < 4; i++)
+		pthread_create(thread + i, 0, arena_free_worker, x);
+	for (i = 0; i < 4; i++)
+		pthread_join(thread[i], 0);
+	int* y = (int*)ccmalloc(sizeof(int) * 1000);
+	REQUIRE(x != y, "the block freed by the other threads should still belong to this arena");
+	int match = 1;
+	for (i = 0; i < 1000; i++)
+		match &= (x[i] == i);
+	REQUIRE(match, "the block freed by the other threads should keep the data");
+	ccv_arena_end();
+}
+
+TEST_CASE("aligned matrix data and rows")
+{
+	int i, j;
+	for (i = 1; i < 40; i += 3)
+	{
+		ccv_dense_matrix_t* dmt = ccv_dense_matrix_new(5, i, CCV_8U | CCV_C3 | CCV_ALIGNED, 0, 0);
+		REQUIRE(dmt->type & CCV_ALIGNED, "the matrix should advertise the alignment");
+		REQUIRE_EQ(0, (uintptr_t)dmt->data.u8 % CCV_ALIGNMENT, "the data should be aligned");
+		REQUIRE_EQ(0, dmt->step % CCV_ALIGNMENT, "the rows should be aligned");
+		REQUIRE(dmt->data.u8 + dmt->step * dmt->rows <= (unsigned char*)dmt + ccv_compute_dense_matrix_size(5, i, dmt->type), "the data should fit in the allocation");
+		ccv_matrix_free(dmt);
+	}
+	ccv_dense_matrix_t* a = ccv_dense_matrix_new(7, 9, CCV_32F | CCV_C1, 0, 0);
+	for (i = 0; i < 7 * 9; i++)
+		a->data.f32[i] = i;
+	ccv_dense_matrix_t* b = ccv_dense_matrix_new(7, 9, CCV_32F | CCV_C1 | CCV_ALIGNED, 0, 0);
+	ccv_flip(a, &b, 0, 0);
+	REQUIRE(b->type & CCV_ALIGNED, "the output should keep the alignment");
+	int match = 1;
+	for (i = 0; i < 7; i++)
+		for (j = 0; j < 9; j++)
+			match &= (b->data.f32[i * b->step / sizeof(float) + j] == i * 9 + j);
+	REQUIRE(match, "the copy should go row by row into the aligned matrix");
+	ccv_matrix_free(a);
+	ccv_matrix_free(b);
+}
+
+TEST_CASE("whole matrix operations on aligned matrix skip the padding of the rows")
+{
+	ccv_dense_matrix_t* a = ccv_dense_matrix_new(7, 9, CCV_32F | CCV_C1, 0, 0);
+	ccv_dense_matrix_t* b = ccv_dense_matrix_new(7, 9, CCV_32F | CCV_C1 | CCV_ALIGNED, 0, 0);
+	REQUIRE(b->step > 9 * sizeof(float), "the aligned rows should be padded");
+	int i, j;
+	for (i = 0; i < 7; i++)
+		for (j = 0; j < 9; j++)
+			*(float*)ccv_get_dense_matrix_cell(a, i, j, 0) = *(float*)ccv_get_dense_matrix_cell(b, i, j, 0) = i * 9 + j;
+	/* the padding is whatever, a nan in there is not a nan of the matrix */
+	for (i = 0; i < 7; i++)
+		for (j = 9; j < b->step / sizeof(float); j++)
+			((float*)(b->data.u8 + i * b->step))[j] = NAN;
+	REQUIRE_EQ(0, ccv_any_nan(b), "the nan in the padding should not be found");
+	*(float*)ccv_get_dense_matrix_cell(b, 6, 8, 0) = NAN;
+	REQUIRE_EQ(7 * 9, ccv_any_nan(b), "the nan of the last cell should be found at its index");
+	*(float*)ccv_get_dense_matrix_cell(b, 6, 8, 0) = 6 * 9 + 8;
+	ccv_make_matrix_immutable(a);
+	ccv_make_matrix_immutable(b);
+	REQUIRE(a->sig == b->sig, "the same content should have the same signature");
+	char filename[] = "/tmp/ccv-aligned-XXXXXX";
+	int fd = mkstemp(filename);
+	REQUIRE(fd >= 0, "should create a temporary file");
+	close(fd);
+	ccv_write(b, filename, 0, CCV_IO_BINARY_FILE, 0);
+	ccv_dense_matrix_t* c = 0;
+	ccv_read(filename, &c, CCV_IO_BINARY_FILE);
+	unlink(filename);
+	REQUIRE_MATRIX_EQ(a, c, "the aligned matrix should be written as its rows");
+	ccv_matrix_free(a);
+	ccv_matrix_free(b);
+	ccv_matrix_free(c);
+}
+
 #include "case_main.h"
@@ -112,6 +112,154 @@ TEST_CASE("ccv_filter centre point for odd number window size, hint: (size - 1)
 	ccv_matrix_free(x);
 }
 
+TEST_CASE("ccv_filter with a cached plan and the tiles on more threads")
+{
+	ccv_dense_matrix_t* image = 0;
+	ccv_read("../../samples/street.png", &image, CCV_IO_ANY_FILE);
+	/* random taps are not separable, and 41x41 is too large for the direct ways, thus, it takes the fft tiles */
+	ccv_dense_matrix_t* kernel = ccv_dense_matrix_new(41, 41, CCV_32F | CCV_GET_CHANNEL(image->type), 0, 0);
+	int i;
+	for (i = 0; i < 41 * 41 * CCV_GET_CHANNEL(image->type); i++)
+		kernel->data.f32[i] = (i * 104729 % 200 - 100) / 10000.0;
+	ccv_dense_matrix_t* x = 0;
+	ccv_filter(image, kernel, &x, CCV_32F, 0);
+	ccv_dense_matrix_t* y = 0;
+	ccv_filter(image, kernel, &y, CCV_32F, 0);
+	REQUIRE_MATRIX_EQ(x, y, "the second filter with the cached plan should be the same");
+	ccv_matrix_free(y);
+	y = 0;
+	ccv_set_num_threads(4);
+	ccv_filter(image, kernel, &y, CCV_32F, 0);
+	ccv_set_num_threads(1);
+	REQUIRE_MATRIX_EQ(x, y, "the filter on 4 threads should be the same");
+	ccv_matrix_free(y);
+	y = 0;
+	ccv_drain_cache();
+	ccv_filter(image, kernel, &y, CCV_32F, 0);
+	REQUIRE_MATRIX_EQ(x, y, "the filter after the plans are drained should be the same");
+	ccv_matrix_free(y);
+	ccv_matrix_free(x);
+	ccv_matrix_free(kernel);
+	ccv_matrix_free(image);
+}
+
+static int naive_border(int i, int n, int padding_pattern)
+{
+	if (i >= 0 && i < n)
+		return i;
+	if (padding_pattern == CCV_PADDING_EXTEND)
+		return i < 0 ? 0 : n - 1;
+	if (padding_pattern == CCV_PADDING_MIRROR)
+		return i < 0 ? -i - 1 : n * 2 - 1 - i;
+	return -1;
+}
+
+static void naive_filter(ccv_dense_matrix_t* a, ccv_dense_matrix_t* b, ccv_dense_matrix_t* d, int padding_pattern)
+{
+	int i, j, k, x, y, ch = CCV_GET_CHANNEL(a->type);
+	for (i = 0; i < a->rows; i++)
+		for (j = 0; j < a->cols; j++)
+			for (k = 0; k < ch; k++)
+			{
+				double sum = 0;
+				for (y = 0; y < b->rows; y++)
+					for (x = 0; x < b->cols; x++)
+					{
+						int iy = naive_border(i + y - (b->rows - 1) / 2, a->rows, padding_pattern);
+						int ix = naive_border(j + x - (b->cols - 1) / 2, a->cols, padding_pattern);
+						if (iy >= 0 && ix >= 0)
+							sum += ccv_get_dense_matrix_cell_value(a, iy, ix, k) * b->data.f32[(y * b->cols + x) * ch + k];
+					}
+				d->data.f32[(i * a->cols + j) * ch + k] = sum;
+			}
+}
+
+TEST_CASE("ccv_filter with small filters (direct and separable) v.s. naive filter")
+{
+	ccv_dense_matrix_t* a = ccv_dense_matrix_new(37, 45, CCV_32F | CCV_C3, 0, 0);
+	int i;
+	for (i = 0; i < 37 * 45 * 3; i++)
+		a->data.f32[i] = (i * 7919 % 1000) / 100.0;
+	ccv_dense_matrix_t* b = ccv_dense_matrix_new(5, 4, CCV_32F | CCV_C3, 0, 0);
+	for (i = 0; i < 5 * 4 * 3; i++)
+		b->data.f32[i] = (i * 104729 % 200 - 100) / 1000.0;
+	ccv_dense_matrix_t* x = 0;
+	ccv_filter(a, b, &x, 0, 0);
+	ccv_dense_matrix_t* y = ccv_dense_matrix_new(37, 45, CCV_32F | CCV_C3, 0, 0);
+	naive_filter(a, b, y, CCV_PADDING_ZERO);
+	REQUIRE_MATRIX_EQ(x, y, "the direct filter should be the same as the naive one");
+	/* the top 2 rows and the bottom 2 rows are within the reach of the filter, these take zeros out of a */
+	REQUIRE_ARRAY_EQ_WITH_TOLERANCE(float, x->data.f32, y->data.f32, 45 * 3 * 2, 1e-4, "the direct filter should take zeros above a");
+	REQUIRE_ARRAY_EQ_WITH_TOLERANCE(float, x->data.f32 + 35 * 45 * 3, y->data.f32 + 35 * 45 * 3, 45 * 3 * 2, 1e-4, "the direct filter should take zeros below a");
+	ccv_matrix_free(b);
+	ccv_matrix_free(x);
+	b = ccv_dense_matrix_new(7, 7, CCV_32F | CCV_C3, 0, 0);
+	ccv_filter_kernel(b, gaussian, 0);
+	x = 0;
+	ccv_filter(a, b, &x, 0, 0);
+	naive_filter(a, b, y, CCV_PADDING_ZERO);
+	REQUIRE_MATRIX_EQ(x, y, "the separable filter should be the same as the naive one");
+	REQUIRE_ARRAY_EQ_WITH_TOLERANCE(float, x->data.f32, y->data.f32, 45 * 3 * 3, 1e-4, "the separable filter should take zeros above a");
+	REQUIRE_ARRAY_EQ_WITH_TOLERANCE(float, x->data.f32 + 34 * 45 * 3, y->data.f32 + 34 * 45 * 3, 45 * 3 * 3, 1e-4, "the separable filter should take zeros below a");
+	ccv_matrix_free(b);
+	ccv_matrix_free(x);
+	ccv_matrix_free(y);
+	ccv_matrix_free(a);
+}
+
+TEST_CASE("ccv_filter pads the border of a the same way whichever way it takes")
+{
+	ccv_dense_matrix_t* a = ccv_dense_matrix_new(37, 45, CCV_32F | CCV_C1, 0, 0);
+	ccv_dense_matrix_t* a8 = ccv_dense_matrix_new(37, 45, CCV_8U | CCV_C1, 0, 0);
+	int i, j;
+	for (i = 0; i < 37; i++)
+		for (j = 0; j < 45; j++)
+		{
+			a8->data.u8[i * a8->step + j] = ((i * 45 + j) * 7919 % 256);
+			a->data.f32[i * 45 + j] = a8->data.u8[i * a8->step + j] / 25.5;
+		}
+	/* direct, separable, and FFT (it is too large for the direct ways) */
+	ccv_dense_matrix_t* b[3];
+	b[0] = ccv_dense_matrix_new(5, 4, CCV_32F | CCV_C1, 0, 0);
+	for (i = 0; i < 5 * 4; i++)
+		b[0]->data.f32[i] = (i * 104729 % 200 - 100) / 1000.0;
+	b[1] = ccv_dense_matrix_new(7, 7, CCV_32F | CCV_C1, 0, 0);
+	ccv_filter_kernel(b[1], gaussian, 0);
+	ccv_normalize(b[1], (ccv_matrix_t**)&b[1], 0, CCV_L1_NORM);
+	b[2] = ccv_dense_matrix_new(41, 41, CCV_32F | CCV_C1, 0, 0);
+	for (i = 0; i < 41 * 41; i++)
+		b[2]->data.f32[i] = (i * 104729 % 200 - 100) / 10000.0;
+	int padding_pattern[] = {CCV_PADDING_ZERO, CCV_PADDING_EXTEND, CCV_PADDING_MIRROR};
+	ccv_dense_matrix_t* y = ccv_dense_matrix_new(37, 45, CCV_32F | CCV_C1, 0, 0);
+	int k;
+	for (k = 0; k < 3; k++)
+	{
+		for (i = 0; i < 3; i++)
+		{
+			ccv_dense_matrix_t* x = 0;
+			ccv_filter(a, b[i], &x, 0, padding_pattern[k]);
+			naive_filter(a, b[i], y, padding_pattern[k]);
+			REQUIRE_ARRAY_EQ_WITH_TOLERANCE(float, x->data.f32, y->data.f32, 37 * 45, 1e-3, "the filter %d with the padding %d should be the same as the naive one", i, padding_pattern[k]);
+			ccv_matrix_free(x);
+		}
+		/* the 8-bit direct one, it rounds the weights to 1 / (1 << 14), and truncates the sums */
+		ccv_dense_matrix_t* x8 = 0;
+		ccv_filter(a8, b[1], &x8, 0, padding_pattern[k]);
+		ccv_dense_matrix_t* y8 = ccv_dense_matrix_new(37, 45, CCV_32F | CCV_C1, 0, 0);
+		naive_filter(a8, b[1], y8, padding_pattern[k]);
+		for (i = 0; i < 37; i++)
+			for (j = 0; j < 45; j++)
+				REQUIRE_EQ_WITH_TOLERANCE(x8->data.u8[i * x8->step + j], y8->data.f32[i * 45 + j], 2, "the 8-bit filter with the padding %d should be the same as the naive one at (%d, %d)", padding_pattern[k], i, j);
+		ccv_matrix_free(y8);
+		ccv_matrix_free(x8);
+	}
+	ccv_matrix_free(y);
+	for (i = 0; i < 3; i++)
+		ccv_matrix_free(b[i]);
+	ccv_matrix_free(a8);
+	ccv_matrix_free(a);
+}
+
 #include "ccv_internal.h"
 
 static void naive_ssd(ccv_dense_matrix_t* image, ccv_dense_matrix_t* template, ccv_dense_matrix_t* out)
@@ -363,4 +511,34 @@ TEST_CASE("ccv_distance_transform to compute max distance")
 	ccv_matrix_free(distance);
 }
 
+TEST_CASE("ccv_distance_transform with the displacement maps and on more threads")
+{
+	ccv_dense_matrix_t* geometry = 0;
+	ccv_read("../../samples/geometry.png", &geometry, CCV_IO_GRAY | CCV_IO_ANY_FILE);
+	ccv_dense_matrix_t* distance = 0;
+	ccv_distance_transform(geometry, &distance, 0, 0, 0, 0, 0, 1, 1, 0.4, 0.4, CCV_NEGATIVE | CCV_GSEDT);
+	ccv_dense_matrix_t* x = 0;
+	ccv_dense_matrix_t* y = 0;
+	ccv_dense_matrix_t* b = 0;
+	ccv_distance_transform(geometry, &b, 0, &x, 0, &y, 0, 1, 1, 0.4, 0.4, CCV_NEGATIVE | CCV_GSEDT);
+	REQUIRE_MATRIX_EQ(distance, b, "distance transform with the displacement maps should be the same");
+	ccv_matrix_free(b);
+	b = 0;
+	ccv_dense_matrix_t* tx = 0;
+	ccv_dense_matrix_t* ty = 0;
+	ccv_set_num_threads(4);
+	ccv_distance_transform(geometry, &b, 0, &tx, 0, &ty, 0, 1, 1, 0.4, 0.4, CCV_NEGATIVE | CCV_GSEDT);
+	ccv_set_num_threads(1);
+	REQUIRE_MATRIX_EQ(distance, b, "distance transform on 4 threads should be the same");
+	REQUIRE_MATRIX_EQ(x, tx, "the x displacement map on 4 threads should be the same");
+	REQUIRE_MATRIX_EQ(y, ty, "the y displacement map on 4 threads should be the same");
+	ccv_matrix_free(tx);
+	ccv_matrix_free(ty);
+	ccv_matrix_free(b);
+	ccv_matrix_free(x);
+	ccv_matrix_free(y);
+	ccv_matrix_free(distance);
+	ccv_matrix_free(geometry);
+}
+
 #include "case_main.h"
@@ -87,6 +87,46 @@ TEST_CASE("group array with is_equal function")
 	ccv_array_free(idx);
 }
 
+int is_near(const void* _r1, const void* _r2, void* data)
+{
+	const ccv_comp_t* r1 = (const ccv_comp_t*)_r1;
+	const ccv_comp_t* r2 = (const ccv_comp_t*)_r2;
+	int distance = (int)(r1->rect.width * 0.25 + 0.5);
+	return r2->rect.x <= r1->rect.x + distance &&
+		r2->rect.x >= r1->rect.x - distance &&
+		r2->rect.y <= r1->rect.y + distance &&
+		r2->rect.y >= r1->rect.y - distance &&
+		r2->rect.width <= (int)(r1->rect.width * 1.5 + 0.5) &&
+		(int)(r2->rect.width * 1.5 + 0.5) >= r1->rect.width;
+}
+
+TEST_CASE("group rectangles by the rect v.s. group array")
+{
+	ccv_array_t* array = ccv_array_new(sizeof(ccv_comp_t), 2000, 0);
+	int i;
+	srand(1);
+	for (i = 0; i < 2000; i++)
+	{
+		ccv_comp_t comp;
+		comp.rect.width = comp.rect.height = 10 + rand() % 40;
+		comp.rect.x = rand() % 600;
+		comp.rect.y = rand() % 400;
+		comp.neighbors = 1;
+		comp.id = 0;
+		comp.confidence = 0;
+		ccv_array_push(array, &comp);
+	}
+	ccv_array_t* idx = 0;
+	int ncomp = ccv_array_group(array, &idx, is_near, 0);
+	ccv_array_t* idx_rect = 0;
+	int ncomp_rect = ccv_array_group_rect(array, &idx_rect, is_near, 0, 0.25);
+	REQUIRE_EQ(ncomp, ncomp_rect, "should have the same number of groups");
+	REQUIRE_ARRAY_EQ(int, idx->data, idx_rect->data, array->rnum, "every rectangle should be in the same group");
+	ccv_array_free(idx_rect);
+	ccv_array_free(idx);
+	ccv_array_free(array);
+}
+
 TEST_CASE("sparse matrix basic insertion")
 {
 	ccv_sparse_matrix_t* mat = ccv_sparse_matrix_new(1000, 1000, CCV_32S | CCV_C1, CCV_SPARSE_ROW_MAJOR, 0);
@@ -0,0 +1,81 @@
+#include "ccv.h"
+#include <sys/time.h>
+
+unsigned int get_current_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static int uint64_cmp(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+#define N (1000000)
+
+/* compares the cost and the collisions of the signature hashes */
+static void benchmark(int hash, const char* name, ccv_dense_matrix_t* image)
+{
+	ccv_set_signature_hash(hash);
+	int i, j;
+	uint64_t* sigs = (uint64_t*)ccmalloc(sizeof(uint64_t) * N);
+	/* derived signatures, like the ones of the operations on a pyramid: a short parameter string and the signature
+	 * of the input, which is derived as well */
+	unsigned int elapsed_time = get_current_time();
+	uint64_t sig = ccv_cache_generate_signature("image", 5, 0);
+	for (i = 0; i < N; i++)
+	{
+		char identifier[64];
+		int len = snprintf(identifier, 64, "ccv_sample_down(%d,%d)", i & 1, (i >> 1) & 1);
+		sigs[i] = sig = ccv_cache_generate_signature(identifier, len, sig, CCV_8U | CCV_C1, 0);
+	}
+	unsigned int derived_time = get_current_time() - elapsed_time;
+	qsort(sigs, N, sizeof(uint64_t), uint64_cmp);
+	int collisions = 0;
+	for (i = 1; i < N; i++)
+		collisions += (sigs[i] == sigs[i - 1]);
+	/* low entropy input: consecutive integers, and the shard (top 4 bits) they fall into */
+	int shards[16] = {0};
+	for (i = 0; i < N; i++)
+	{
+		sigs[i] = ccv_cache_generate_signature((const char*)&i, 4, 0);
+		++shards[sigs[i] >> 60];
+	}
+	qsort(sigs, N, sizeof(uint64_t), uint64_cmp);
+	for (i = 1; i < N; i++)
+		collisions += (sigs[i] == sigs[i - 1]);
+	int min_shard = N, max_shard = 0;
+	for (i = 0; i < 16; i++)
+		min_shard = ccv_min(min_shard, shards[i]), max_shard = ccv_max(max_shard, shards[i]);
+	/* the initial signature on the whole image */
+	elapsed_time = get_current_time();
+	for (j = 0; j < 100; j++)
+		sig = ccv_cache_generate_signature((const char*)image->data.u8, image->rows * image->step, image->type, 0);
+	unsigned int content_time = get_current_time() - elapsed_time;
+	printf("%-8s derived: %4ums / %d, content: %4ums / 100 x %dx%d, collisions: %d, shards: %d ~ %d\n", name, derived_time, N, content_time, image->cols, image->rows, collisions, min_shard, max_shard);
+	ccfree(sigs);
+}
+
+int main(int argc, char** argv)
+{
+	ccv_dense_matrix_t* image = 0;
+	if (argc > 1)
+		ccv_read(argv[1], &image, CCV_IO_ANY_FILE);
+	else {
+		image = ccv_dense_matrix_new(480, 640, CCV_8U | CCV_C3, 0, 0);
+		int i;
+		for (i = 0; i < image->rows * image->step; i++)
+			image->data.u8[i] = i * 2654435761u >> 24;
+	}
+	/* known answers of xxHash64 with seed 0 */
+	ccv_set_signature_hash(CCV_SIGNATURE_XXHASH);
+	assert(ccv_cache_generate_signature("", 0, 0) == 0xEF46DB3751D8E999ULL);
+	assert(ccv_cache_generate_signature("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+	benchmark(CCV_SIGNATURE_SHA1, "sha1", image);
+	benchmark(CCV_SIGNATURE_XXHASH, "xxhash", image);
+	ccv_matrix_free(image);
+	return 0;
+}